@@ -18,6 +18,9 @@ import org.junit.Test;
 import org.junit.runner.RunWith;
 
 import java.io.File;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 import static org.junit.Assert.*;
 
@@ -114,4 +117,81 @@ public class UncompressFlacFileTest {
         updateFileSystem(appContext,audioAsset+".raw");
 
     }
+
+    @Test
+    public void nativeBackend() {
+        Context appContext = InstrumentationRegistry.getTargetContext();
+
+        askPerm();
+
+        Flac2Raw flac2Raw = new Flac2Raw();
+        Flac2Raw.Options options = new Flac2Raw.Options();
+        options.backend = Flac2Raw.BACKEND_NATIVE;
+        options.verifyMd5 = true;
+
+        final String audioAsset="audioasset";
+        AssetManager assetManager = appContext.getAssets();
+        int r = flac2Raw.uncompressAsset2File(
+                assetManager,
+                audioAsset+".flac",
+                getFullPath(audioAsset+"_native.raw"),
+                options);
+        assertEquals(0, r);
+        updateFileSystem(appContext,audioAsset+"_native.raw");
+    }
+
+    @Test
+    public void chunkedReader() throws Exception {
+        Context appContext = InstrumentationRegistry.getTargetContext();
+        AssetManager assetManager = appContext.getAssets();
+        File dir = appContext.getCacheDir();
+        String rawFile = new File(dir, "chunked.raw").getPath();
+        String chunkedFile = new File(dir, "chunked.f2rc").getPath();
+
+        Flac2Raw flac2Raw = new Flac2Raw();
+        Flac2Raw.Options options = new Flac2Raw.Options();
+        options.backend = Flac2Raw.BACKEND_NATIVE;
+        assertEquals(0, flac2Raw.uncompressAsset2File(assetManager, "audioasset.flac", rawFile, options));
+        options.container = Flac2Raw.CONTAINER_CHUNKED;
+        options.chunkBytes = 4096;
+        assertEquals(0, flac2Raw.uncompressAsset2File(assetManager, "audioasset.flac", chunkedFile, options));
+        flac2Raw.close();
+
+        byte[] raw = new byte[(int) new File(rawFile).length()];
+        RandomAccessFile f = new RandomAccessFile(rawFile, "r");
+        f.readFully(raw);
+        f.close();
+
+        Flac2Raw.ChunkedReader reader = new Flac2Raw.ChunkedReader();
+        assertEquals(0, reader.open(chunkedFile));
+        assertTrue(reader.isComplete());
+        assertEquals(Flac2Raw.FORMAT_PCM16, reader.sampleFormat());
+        int bpf = reader.bytesPerFrame();
+        assertEquals(raw.length / bpf, reader.frames());
+        for (int i = 0; i < reader.chunks(); i++) {
+            assertEquals(0, reader.verify(i));
+        }
+
+        // a range across chunk boundaries, as shorts and into a ByteBuffer
+        long first = 3000;
+        int n = 5000;
+        short[] samples = new short[n * reader.channels()];
+        assertEquals(n, reader.read(first, samples, 0, n));
+        ByteBuffer pcm = ByteBuffer.wrap(raw).order(ByteOrder.LITTLE_ENDIAN);
+        for (int i = 0; i < samples.length; i++) {
+            assertEquals(pcm.getShort((int) (first * bpf) + 2 * i), samples[i]);
+        }
+        ByteBuffer buffer = ByteBuffer.allocateDirect(n * bpf);
+        assertEquals(n, reader.read(first, buffer));
+        assertEquals(n * bpf, buffer.position());
+        for (int i = 0; i < n * bpf; i++) {
+            assertEquals(raw[(int) (first * bpf) + i], buffer.get(i));
+        }
+        assertEquals(0, reader.read(reader.frames(), samples, 0, n));
+        reader.close();
+
+        assertEquals(22, reader.open(rawFile));
+        new File(rawFile).delete();
+        new File(chunkedFile).delete();
+    }
 }
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Command line front end of the native decoder for build servers:
+ *
+ *     flac2raw [--md5] [-j threads] [-f format] [--mono] [--planar] [-r rate]
+ *              [--start ms] [--end ms] [--index dir] [--cache dir]
+ *              [--output stdio|mmap|pwrite] [--stats] [--chunked bytes [--resume]]
+ *              input.flac|- output.raw
+ *     flac2raw --probe [-j threads] file.flac|directory ...
+ *
+ * The output is the same headerless little endian format as produced on
+ * the phone so both can be compared byte for byte. --planar writes every
+ * channel to its own file output.raw.0, output.raw.1, ...
+ * An input of - reads the flac data from stdin into memory and decodes it
+ * from there. --start and --end only decode that time range, --index keeps the seek
+ * indexes of files without a SEEKTABLE in dir. --cache copies the output
+ * from a cache of earlier conversions if it's there. --output selects how the output
+ * files are written (FLAC2RAW_OUTPUT_*). --stats prints the timing of the conversion
+ * to stderr. --chunked writes a chunked container (chunked-pcm.h) with chunks of that
+ * many bytes, --resume carries on an interrupted one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder-backend.h"
+#include "format-pcm-sink.h"
+#include "resample-pcm-sink.h"
+#include "probe.h"
+#include "pcm-cache.h"
+
+static void usage() {
+    fprintf(stderr, "usage: flac2raw [--md5] [-j threads] [-f pcm16|float32|int24|int32] [--mono]\n"
+                    "                [--planar] [-r rate] [--start ms] [--end ms] [--index dir]\n"
+                    "                [--cache dir] [--output stdio|mmap|pwrite] [--stats]\n"
+                    "                [--chunked bytes [--resume]]\n"
+                    "                input.flac|- output.raw\n"
+                    "       flac2raw --probe [-j threads] file.flac|directory ...\n");
+}
+
+static int parseFormat(const char *name) {
+    static const char *const names[] = {"pcm16", "float32", "int24", "int32"};
+    for (int i = 0; i < 4; i++) {
+        if (!strcmp(name, names[i])) return i;
+    }
+    return -1;
+}
+
+static int parseOutputMode(const char *name) {
+    static const char *const names[] = {"stdio", "mmap", "pwrite"};
+    for (int i = 0; i < 3; i++) {
+        if (!strcmp(name, names[i])) return i;
+    }
+    return -1;
+}
+
+/* Decodes src into sink, timed if opts ask for it */
+static int decodeTimed(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+    NativeFlacBackend native;
+    if (NULL == opts.stats) return native.decode(src, sink, opts);
+    StatsPcmSink stats(sink, *opts.stats);
+    int r = native.decode(src, stats, opts);
+    stats.finish();
+    return r;
+}
+
+/* Decodes src into sink, resampled if opts ask for it */
+static int decodeResampled(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+    if (opts.resampleToHz <= 0) return decodeTimed(src, sink, opts);
+    ResamplePcmSink resample(sink, (unsigned) opts.resampleToHz);
+    return decodeTimed(src, resample, opts);
+}
+
+/* Decodes src into one file per channel of the output */
+static int decodePlanar(const DecodeSource &src, const char *dst, const ConvOptions &opts) {
+    FlacStreamInfo info;
+    int r = NativeFlacBackend::probe(src, info);
+    if (r) return r;
+    const unsigned channels = opts.downmix ? 1 : info.channels;
+    std::vector<std::unique_ptr<FilePcmSink> > files;
+    std::vector<PcmSink *> sinks;
+    for (unsigned ch = 0; ch < channels; ch++) {
+        files.push_back(std::unique_ptr<FilePcmSink>(new FilePcmSink()));
+        r = files.back()->open((std::string(dst) + "." + std::to_string(ch)).c_str(),
+                               opts.outputMode);
+        if (r) return r;
+        sinks.push_back(files.back().get());
+    }
+    FormatPcmSink format(sinks, opts.sampleFormat, opts.downmix);
+    return decodeResampled(src, format, opts);
+}
+
+static void printStats(const ConvStats &s) {
+    fprintf(stderr, "first buffer %.1f ms, %.1f ms in total, %.0f times real time\n"
+                    "%llu buffers, %.0f us apart (jitter %.0f us, max %lld us), "
+                    "%.1f ms waiting for the output\n",
+            s.firstBufferUs / 1e3, s.wallUs / 1e3, realtimeFactor(s),
+            (unsigned long long) s.callbacks, meanIntervalUs(s), intervalJitterUs(s),
+            (long long) s.maxIntervalUs, s.writeBlockedUs / 1e3);
+}
+
+static void printProbe(const ProbeResult &result) {
+    if (result.error) {
+        printf("%s: %s\n", result.path.c_str(), strerror(result.error));
+        return;
+    }
+    printf("%s: %u Hz, %u channels, %u bits, %llu samples, %llu ms, %zu seek points\n",
+           result.path.c_str(), result.info.sampleRate, result.info.channels,
+           result.info.bitsPerSample, (unsigned long long) result.info.totalSamples,
+           (unsigned long long) result.durationMs, result.seekPoints);
+}
+
+/* Prints the format of files and of all flac files in directories */
+static int probe(char **paths, int n, unsigned numThreads) {
+    int status = 0;
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            std::vector<ProbeResult> results;
+            int r = probeDirectory(paths[i], numThreads, results);
+            if (r) {
+                fprintf(stderr, "flac2raw: %s: %s\n", paths[i], strerror(r));
+                status = 1;
+            }
+            for (size_t j = 0; j < results.size(); j++) {
+                printProbe(results[j]);
+                if (results[j].error) status = 1;
+            }
+        } else {
+            ProbeResult result;
+            result.path = paths[i];
+            DecodeSource src;
+            src.type = DecodeSource::URI;
+            src.path = paths[i];
+            probeSource(src, result);
+            printProbe(result);
+            if (result.error) status = 1;
+        }
+    }
+    return status;
+}
+
+int main(int argc, char **argv) {
+    ConvOptions opts;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    bool probeOnly = false;
+    bool planar = false;
+    ConvStats stats;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+        if (!strcmp(argv[arg], "--md5")) {
+            opts.verifyMd5 = true;
+        } else if (!strcmp(argv[arg], "--probe")) {
+            probeOnly = true;
+        } else if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+            opts.numThreads = atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "-f") && arg + 1 < argc &&
+                   parseFormat(argv[arg + 1]) >= 0) {
+            opts.sampleFormat = parseFormat(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--mono")) {
+            opts.downmix = true;
+        } else if (!strcmp(argv[arg], "--planar")) {
+            planar = true;
+        } else if (!strcmp(argv[arg], "-r") && arg + 1 < argc) {
+            opts.resampleToHz = atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--start") && arg + 1 < argc) {
+            opts.startMs = atoll(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--end") && arg + 1 < argc) {
+            opts.endMs = atoll(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--index") && arg + 1 < argc) {
+            opts.seekIndexDir = argv[++arg];
+        } else if (!strcmp(argv[arg], "--cache") && arg + 1 < argc) {
+            opts.cacheDir = argv[++arg];
+        } else if (!strcmp(argv[arg], "--output") && arg + 1 < argc &&
+                   parseOutputMode(argv[arg + 1]) >= 0) {
+            opts.outputMode = parseOutputMode(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--stats")) {
+            opts.stats = &stats;
+        } else if (!strcmp(argv[arg], "--chunked") && arg + 1 < argc) {
+            opts.container = FLAC2RAW_CONTAINER_CHUNKED;
+            opts.chunkBytes = atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--resume")) {
+            opts.resume = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (probeOnly && arg < argc) {
+        /* by default -j is 1 for decoding but all cores for probing */
+        return probe(argv + arg, argc - arg, opts.numThreads > 1 ? opts.numThreads : 0);
+    }
+    if (argc - arg != 2) {
+        usage();
+        return 2;
+    }
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = argv[arg];
+    std::vector<uint8_t> input;
+    if (!strcmp(argv[arg], "-")) {
+        uint8_t buf[64 * 1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) input.insert(input.end(), buf, buf + n);
+        src.type = DecodeSource::MEMORY;
+        src.data = input.empty() ? NULL : &input[0];
+        src.size = input.size();
+    }
+    const int64_t startUs = statsNowUs();
+    int r;
+    if (planar) {
+        r = decodePlanar(src, argv[arg + 1], opts);
+    } else {
+        const char *dst = argv[arg + 1];
+        r = cachedConvert(src, dst, opts, [&]() {
+            if (opts.container == FLAC2RAW_CONTAINER_CHUNKED) {
+                ChunkedPcmSink chunked(opts.sampleFormat, (size_t) std::max(opts.chunkBytes, 1));
+                int e = chunked.open(dst, opts.resume);
+                if (e) return e;
+                FormatPcmSink format(chunked, opts.sampleFormat, opts.downmix);
+                e = decodeResampled(src, format, opts);
+                return e ? e : chunked.finish();
+            }
+            FilePcmSink sink;
+            int e = sink.open(dst, opts.outputMode);
+            if (e) return e;
+            FormatPcmSink format(sink, opts.sampleFormat, opts.downmix);
+            return decodeResampled(src, format, opts);
+        });
+    }
+    if (opts.stats) {
+        stats.wallUs = statsNowUs() - startUs;
+        printStats(stats);
+    }
+    if (r) {
+        fprintf(stderr, "flac2raw: %s: %s\n", argv[arg], strerror(r));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the OpenSL ES backend on the host, against the stub of OpenSL
+ * ES which replays the audio through the buffer queue callbacks:
+ *
+ *     opensl-bench [--speed x] [--jitter us] [--runs n] [--lengths s,s,...]
+ *
+ * Generates a corpus of flac files of the lengths in seconds (1,10,60 by
+ * default), mono and stereo, with blocks of 1152 and 4096 samples, and decodes
+ * every file with every buffer queue configuration. --speed paces the stub
+ * like a decoder of that many times real time (0, the default, is as fast as
+ * possible) and --jitter delays every callback by a random time of up to us.
+ *
+ * Prints one JSON object per file and configuration, for regression tracking:
+ * the best realtime factor of the runs, the latencies and callback intervals
+ * of that run and its heap allocations (operator new, including those of the
+ * stub) once the backend has been warmed up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "decoder-backend.h"
+#include "opensl-backend.h"
+#include "opensl-stub.h"
+#include "flac-test-encoder.h"
+
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> allocatedBytes(0);
+
+void *operator new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(n, std::memory_order_relaxed);
+    void *p = malloc(n ? n : 1);
+    if (NULL == p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/* Throws the audio away, only the decoding is measured */
+class NullPcmSink : public PcmSink {
+public:
+    int write(const void *, size_t) { return 0; }
+};
+
+typedef struct BenchFile_ {
+    std::string name;
+    std::string path;
+    unsigned seconds;
+    TestStreamParams params;
+} BenchFile;
+
+typedef struct BenchResult_ {
+    int error = 0;
+    ConvStats best;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+} BenchResult;
+
+static BenchResult run(OpenSLBackend &backend, const BenchFile &file, const ConvOptions &config,
+                       int runs) {
+    BenchResult result;
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = file.path.c_str();
+    /* the first conversion sets up the engine and the slot of the backend */
+    NullPcmSink warmup;
+    result.error = backend.decode(src, warmup, config);
+    for (int i = 0; i < runs && !result.error; i++) {
+        ConvStats stats;
+        ConvOptions opts = config;
+        opts.stats = &stats;
+        NullPcmSink sink;
+        const uint64_t a = allocations.load();
+        const uint64_t b = allocatedBytes.load();
+        const int64_t start = statsNowUs();
+        {
+            StatsPcmSink timed(sink, stats);
+            result.error = backend.decode(src, timed, opts);
+            timed.finish();
+        }
+        stats.wallUs = statsNowUs() - start;
+        stats.conversions = 1;
+        const uint64_t runAllocations = allocations.load() - a;
+        const uint64_t runAllocatedBytes = allocatedBytes.load() - b;
+        /* the allocations belong to the run whose stats are reported */
+        if (0 == i || stats.wallUs < result.best.wallUs) {
+            result.best = stats;
+            result.allocations = runAllocations;
+            result.allocatedBytes = runAllocatedBytes;
+        }
+    }
+    return result;
+}
+
+static void printResult(const BenchFile &file, const ConvOptions &config, double speed,
+                        unsigned jitterUs, int runs, const BenchResult &r) {
+    const ConvStats &s = r.best;
+    printf("{\"file\":\"%s\",\"seconds\":%u,\"channels\":%u,\"blockSize\":%u,"
+           "\"numBuffers\":%d,\"bufferSamples\":%d,\"speed\":%g,\"jitterUs\":%u,\"runs\":%d,"
+           "\"error\":%d",
+           file.name.c_str(), file.seconds, file.params.channels, file.params.blockSize,
+           config.numBuffers, config.bufferSizeSamples, speed, jitterUs, runs, r.error);
+    if (0 == r.error) {
+        printf(",\"realtimeFactor\":%.1f,\"mbPerSecond\":%.1f,\"wallUs\":%lld,"
+               "\"prefetchUs\":%lld,\"firstBufferUs\":%lld,\"callbacks\":%llu,"
+               "\"meanIntervalUs\":%.1f,\"intervalJitterUs\":%.1f,\"maxIntervalUs\":%lld,"
+               "\"writeBlockedUs\":%lld,\"allocations\":%llu,\"allocatedBytes\":%llu,"
+               "\"allocationsPerBuffer\":%.2f",
+               realtimeFactor(s), s.wallUs > 0 ? s.bytesWritten / (double) s.wallUs : 0,
+               (long long) s.wallUs, (long long) s.prefetchUs, (long long) s.firstBufferUs,
+               (unsigned long long) s.callbacks, meanIntervalUs(s), intervalJitterUs(s),
+               (long long) s.maxIntervalUs, (long long) s.writeBlockedUs,
+               (unsigned long long) r.allocations, (unsigned long long) r.allocatedBytes,
+               s.callbacks ? r.allocations / (double) s.callbacks : 0);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: opensl-bench [--speed x] [--jitter us] [--runs n] [--lengths s,s,...]\n");
+}
+
+int main(int argc, char **argv) {
+    double speed = 0;
+    unsigned jitterUs = 0;
+    int runs = 3;
+    std::vector<unsigned> lengths = {1, 10, 60};
+    for (int arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "--speed") && arg + 1 < argc) {
+            speed = atof(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--jitter") && arg + 1 < argc) {
+            jitterUs = (unsigned) atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--runs") && arg + 1 < argc) {
+            runs = std::max(1, atoi(argv[++arg]));
+        } else if (!strcmp(argv[arg], "--lengths") && arg + 1 < argc) {
+            lengths.clear();
+            for (char *p = argv[++arg]; *p;) {
+                char *end;
+                const unsigned long s = strtoul(p, &end, 10);
+                if (end == p || s == 0) break;
+                lengths.push_back((unsigned) s);
+                p = *end == ',' ? end + 1 : end;
+            }
+            if (lengths.empty()) {
+                usage();
+                return 2;
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    char dir[] = "/tmp/opensl-bench-XXXXXX";
+    if (NULL == mkdtemp(dir)) {
+        perror("opensl-bench");
+        return 1;
+    }
+    std::vector<BenchFile> corpus;
+    const unsigned blockSizes[] = {1152, 4096};
+    for (size_t l = 0; l < lengths.size(); l++) {
+        for (unsigned channels = 1; channels <= 2; channels++) {
+            for (size_t b = 0; b < 2; b++) {
+                BenchFile file;
+                file.seconds = lengths[l];
+                file.params.channels = channels;
+                file.params.blockSize = blockSizes[b];
+                file.name = std::to_string(lengths[l]) + "s-" + std::to_string(channels) +
+                            "ch-b" + std::to_string(blockSizes[b]);
+                file.path = std::string(dir) + "/" + file.name + ".flac";
+                const std::vector<int32_t> signal =
+                        makeTestSignal((uint64_t) lengths[l] * file.params.sampleRate, file.params);
+                if (writeTestFile(file.path.c_str(), encodeTestFlac(signal, file.params))) {
+                    fprintf(stderr, "opensl-bench: can't write %s\n", file.path.c_str());
+                    return 1;
+                }
+                corpus.push_back(file);
+            }
+        }
+    }
+
+    /* the default queue, fewer and more buffers and larger and adaptive ones */
+    const int configs[][2] = {
+            {DEFAULT_BUFFERS_IN_QUEUE, DEFAULT_BUFFER_SIZE_IN_SAMPLES},
+            {2, DEFAULT_BUFFER_SIZE_IN_SAMPLES},
+            {8, DEFAULT_BUFFER_SIZE_IN_SAMPLES},
+            {DEFAULT_BUFFERS_IN_QUEUE, 8192},
+            {DEFAULT_BUFFERS_IN_QUEUE, BUFFER_SIZE_ADAPTIVE},
+    };
+    slStubSetPacing(speed, jitterUs);
+    OpenSLBackend backend(1);
+    int status = 0;
+    for (size_t f = 0; f < corpus.size(); f++) {
+        for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+            ConvOptions config;
+            config.numBuffers = configs[c][0];
+            config.bufferSizeSamples = configs[c][1];
+            const BenchResult r = run(backend, corpus[f], config, runs);
+            printResult(corpus[f], config, speed, jitterUs, runs, r);
+            if (r.error) status = 1;
+        }
+        unlink(corpus[f].path.c_str());
+    }
+    rmdir(dir);
+    return status;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Write throughput and fragmentation of the output modes of FilePcmSink:
+ *
+ *     output-bench [directory] [megabytes]
+ *
+ * Writes megabytes of audio in the chunks OpenSL ES hands out (a stereo MP3
+ * frame) to a file in directory with every mode, including the fsync, and
+ * prints the best MB/s of several runs and the number of extents of the
+ * result (- if the filesystem can't tell). Run it on the filesystem the phone
+ * writes to, the numbers of tmpfs say little.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pcm-sink.h"
+
+#define BENCH_RUNS 3
+/* 1152 stereo 16 bit frames */
+#define CHUNK_BYTES 4608
+
+/* number of extents of the file or -1 if unknown */
+static long extents(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct fiemap fm;
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_length = FIEMAP_MAX_OFFSET;
+    fm.fm_flags = FIEMAP_FLAG_SYNC;
+    long n = ioctl(fd, FS_IOC_FIEMAP, &fm) == 0 ? (long) fm.fm_mapped_extents : -1;
+    close(fd);
+    return n;
+}
+
+/* writes the file with mode and returns the seconds it took or a negative error */
+static double writeFile(const char *path, int mode, const std::vector<uint8_t> &chunk, size_t bytes) {
+    const auto start = std::chrono::steady_clock::now();
+    FilePcmSink sink;
+    int r = sink.open(path, mode);
+    PcmFormat fmt;
+    fmt.sampleRate = 48000;
+    fmt.channels = 2;
+    fmt.totalFrames = bytes / 4;
+    if (!r) r = sink.begin(fmt);
+    for (size_t done = 0; !r && done < bytes; done += chunk.size()) {
+        r = sink.write(&chunk[0], std::min(chunk.size(), bytes - done));
+    }
+    if (!r) r = sink.end();
+    if (!r) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0 || fsync(fd)) r = errno;
+        if (fd >= 0) close(fd);
+    }
+    if (r) return -r;
+    const std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    return t.count();
+}
+
+int main(int argc, char **argv) {
+    const std::string dir = argc > 1 ? argv[1] : ".";
+    const size_t megabytes = (size_t) std::max(argc > 2 ? atoi(argv[2]) : 256, 1);
+    const size_t bytes = megabytes * 1024 * 1024;
+    const std::string path = dir + "/output-bench.raw";
+    std::vector<uint8_t> chunk(CHUNK_BYTES);
+    uint32_t x = 1;
+    for (size_t i = 0; i < chunk.size(); i++) {
+        x = x * 1103515245 + 12345;
+        chunk[i] = (uint8_t) (x >> 16);
+    }
+
+    static const char *const names[] = {"stdio", "mmap", "pwrite"};
+    printf("%-8s %10s %8s   (%zu MB in chunks of %d bytes)\n", "mode", "MB/s", "extents",
+           megabytes, CHUNK_BYTES);
+    int status = 0;
+    for (int mode = FLAC2RAW_OUTPUT_STDIO; mode <= FLAC2RAW_OUTPUT_PWRITE; mode++) {
+        double best = 1e9;
+        for (int run = 0; run < BENCH_RUNS && best > 0; run++) {
+            unlink(path.c_str());
+            const double t = writeFile(path.c_str(), mode, chunk, bytes);
+            if (t < 0) {
+                fprintf(stderr, "output-bench: %s: %s\n", names[mode], strerror((int) -t));
+                best = t;
+                status = 1;
+            } else if (t < best) {
+                best = t;
+            }
+        }
+        if (best < 0) continue;
+        const long n = extents(path.c_str());
+        if (n < 0) {
+            printf("%-8s %10.0f %8s\n", names[mode], megabytes / best, "-");
+        } else {
+            printf("%-8s %10.0f %8ld\n", names[mode], megabytes / best, n);
+        }
+    }
+    unlink(path.c_str());
+    return status;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of the sample format kernels this CPU supports:
+ *
+ *     sample-format-bench [seconds of stereo audio at 48kHz]
+ *
+ * Prints the million samples converted per second, best of several runs, and
+ * how much faster than real time the resampler is with the fastest kernels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "sample-format.h"
+#include "resample-pcm-sink.h"
+
+#define BENCH_RUNS 20
+
+/* best time of the runs in seconds */
+static double bestOf(const std::function<void()> &f) {
+    double best = 1e9;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        if (t.count() < best) best = t.count();
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    const int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    const size_t frames = (size_t) std::max(seconds, 1) * 48000;
+    const size_t n = 2 * frames;
+    std::vector<int16_t> in(n);
+    uint32_t x = 1;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        in[i] = (int16_t) (x >> 16);
+    }
+    std::vector<float> f(n);
+    std::vector<uint8_t> b(3 * n);
+    std::vector<int32_t> i32(n);
+    std::vector<int16_t> mono(frames);
+    std::vector<int16_t> planes(n);
+    int16_t *const planePtrs[2] = {&planes[0], &planes[frames]};
+
+    printf("%-8s %10s %10s %10s %10s %12s   (Msamples/s, %zu stereo frames)\n",
+           "kernels", "float32", "int24", "int32", "downmix", "deinterleave", frames);
+    const std::vector<const SampleKernels *> all = supportedSampleKernels();
+    for (size_t k = 0; k < all.size(); k++) {
+        const SampleKernels &kern = *all[k];
+        const double tf = bestOf([&] { kern.toFloat(&in[0], &f[0], n); });
+        const double t24 = bestOf([&] { kern.toInt24(&in[0], &b[0], n); });
+        const double t32 = bestOf([&] { kern.toInt32(&in[0], &i32[0], n); });
+        const double tm = bestOf([&] { kern.downmix(&in[0], &mono[0], frames, 2); });
+        const double td = bestOf([&] { kern.deinterleave(&in[0], planePtrs, frames, 2); });
+        printf("%-8s %10.0f %10.0f %10.0f %10.0f %12.0f\n", kern.name,
+               n / tf / 1e6, n / t24 / 1e6, n / t32 / 1e6, n / tm / 1e6, n / td / 1e6);
+    }
+
+    const unsigned rates[][2] = {{48000, 16000}, {44100, 16000}, {48000, 22050}, {44100, 48000}};
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        Resampler resampler;
+        std::vector<int16_t> out;
+        const double t = bestOf([&] {
+            resampler.init(rates[r][0], rates[r][1], 2);
+            out.clear();
+            resampler.process(&in[0], frames, out);
+            resampler.flush(out);
+        });
+        printf("resampling stereo %u -> %u Hz (%u taps): %.0f times real time\n",
+               rates[r][0], rates[r][1], resampler.filterTaps(),
+               (double) frames / rates[r][0] / t);
+    }
+    return 0;
+}
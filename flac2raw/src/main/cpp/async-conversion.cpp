@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "async-conversion.h"
+#include "flac2raw-log.h"
+
+AsyncConversion::~AsyncConversion() {
+    cancel();
+    if (thread.joinable()) thread.join();
+}
+
+void AsyncConversion::start(const std::function<int(const ConvOptions &)> &convert,
+                            const ConvOptions &opts, const std::string &dst) {
+    ConvOptions o = opts;
+    o.monitor = this;
+    thread = std::thread([this, convert, o, dst]() {
+        int r = convert(o);
+        /* a conversion which has finished anyway is kept */
+        if (cancelFlag && r) {
+            r = ECANCELED;
+            /* the output is closed by now, don't leave half of it behind. A chunked
+             * container keeps its complete chunks without an index for a resume. */
+            if (!dst.empty() && o.container != FLAC2RAW_CONTAINER_CHUNKED &&
+                truncate(dst.c_str(), 0)) {
+                LOGE("Could not truncate %s", dst.c_str());
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            result = r;
+            done = true;
+        }
+        finishedChanged.notify_all();
+    });
+}
+
+void AsyncConversion::cancel() {
+    cancelFlag = true;
+}
+
+int AsyncConversion::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    finishedChanged.wait(guard, [this] { return done.load(); });
+    return result;
+}
+
+void AsyncConversion::position(int64_t &position, int64_t &duration) const {
+    position = positionMs.load(std::memory_order_relaxed);
+    duration = durationMs.load(std::memory_order_relaxed);
+}
+
+void AsyncConversion::progress(int64_t position, int64_t duration) {
+    positionMs.store(position, std::memory_order_relaxed);
+    durationMs.store(duration, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------
+int AsyncConversions::start(const std::function<int(const ConvOptions &)> &convert,
+                            const ConvOptions &opts, const std::string &dst,
+                            std::shared_ptr<AsyncConversion> &conversion) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (closed) return EBADF;
+    /* forgets the conversions which have finished */
+    running.erase(std::remove_if(running.begin(), running.end(),
+                                 [](const std::weak_ptr<AsyncConversion> &w) {
+                                     std::shared_ptr<AsyncConversion> r = w.lock();
+                                     return !r || r->finished();
+                                 }), running.end());
+    conversion.reset(new AsyncConversion());
+    running.push_back(conversion);
+    conversion->start(convert, opts, dst);
+    return 0;
+}
+
+void AsyncConversions::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    for (size_t i = 0; i < running.size(); i++) {
+        std::shared_ptr<AsyncConversion> c = running[i].lock();
+        if (c) c->cancel();
+    }
+    for (size_t i = 0; i < running.size(); i++) {
+        std::shared_ptr<AsyncConversion> c = running[i].lock();
+        if (c) c->wait();
+    }
+    running.clear();
+}
+
+//-----------------------------------------------------------------
+int MonitorPcmSink::begin(const PcmFormat &format) {
+    frameBytes = (uint64_t) format.channels * (format.bitsPerSample / 8);
+    sampleRate = format.sampleRate;
+    if (format.totalFrames && sampleRate) {
+        durationMs = (int64_t) (format.totalFrames * 1000 / sampleRate);
+    }
+    return destination.begin(format);
+}
+
+void MonitorPcmSink::advance(size_t nbytes) {
+    const uint64_t w = written.fetch_add(nbytes, std::memory_order_relaxed) + nbytes;
+    if (reportProgress && frameBytes && sampleRate) {
+        monitor.progress((int64_t) (w / frameBytes * 1000 / sampleRate), durationMs);
+    }
+}
+
+int MonitorPcmSink::write(const void *data, size_t nbytes) {
+    if (monitor.cancelled()) return ECANCELED;
+    int r = destination.write(data, nbytes);
+    if (!r) advance(nbytes);
+    return r;
+}
+
+int MonitorPcmSink::writeAt(uint64_t offset, const void *data, size_t nbytes) {
+    if (monitor.cancelled()) return ECANCELED;
+    int r = destination.writeAt(offset, data, nbytes);
+    if (!r) advance(nbytes);
+    return r;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_ASYNC_CONVERSION_H
+#define FLAC2RAW_ASYNC_CONVERSION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decoder-backend.h"
+
+//-----------------------------------------------------------------
+/* A conversion running on a thread of its own. It is the ConvMonitor of the
+ * conversion: the backends poll cancelled() and report their position through
+ * progress(), which only stores it, so that any thread can read it at its own
+ * pace. A cancelled conversion stops the decoder and truncates its output
+ * unless it is a chunked container. */
+class AsyncConversion : public ConvMonitor {
+public:
+    AsyncConversion() : cancelFlag(false), done(false), result(0), positionMs(0),
+                        durationMs(-1) {}
+
+    /* cancels the conversion and waits for it */
+    ~AsyncConversion();
+
+    /* Runs convert on a new thread with the monitor of opts set to this
+     * conversion. dst is the output file which is truncated if the conversion
+     * is cancelled before it has finished, unless it's a chunked container. */
+    void start(const std::function<int(const ConvOptions &)> &convert, const ConvOptions &opts,
+               const std::string &dst);
+
+    /* Stops the conversion, doesn't wait for it */
+    void cancel();
+
+    /* Waits for the conversion and returns zero, its error number or ECANCELED */
+    int wait();
+
+    bool finished() const { return done; }
+
+    /* last position and duration in ms reported by the decoder, -1 if unknown */
+    void position(int64_t &position, int64_t &duration) const;
+
+    /* ConvMonitor */
+    bool cancelled() const { return cancelFlag; }
+
+    void progress(int64_t position, int64_t duration);
+
+private:
+    std::atomic<bool> cancelFlag;
+    std::atomic<bool> done;
+    int result;
+    std::atomic<int64_t> positionMs;
+    std::atomic<int64_t> durationMs;
+    std::mutex lock;
+    std::condition_variable finishedChanged;
+    std::thread thread;
+};
+
+//-----------------------------------------------------------------
+/* The asynchronous conversions of a converter. close() cancels them and waits
+ * for them; conversions started while or after it runs, for example by a
+ * listener of one which has just finished, fail with EBADF instead. */
+class AsyncConversions {
+public:
+    AsyncConversions() : closed(false) {}
+
+    ~AsyncConversions() { close(); }
+
+    /* Starts convert as a new AsyncConversion, returns EBADF without starting
+     * it once close() has been called */
+    int start(const std::function<int(const ConvOptions &)> &convert, const ConvOptions &opts,
+              const std::string &dst, std::shared_ptr<AsyncConversion> &conversion);
+
+    void close();
+
+private:
+    std::mutex lock;
+    bool closed;
+    std::vector<std::weak_ptr<AsyncConversion> > running;
+};
+
+//-----------------------------------------------------------------
+/* Stops the decoder of a cancelled conversion at its next write and reports
+ * the position of the audio written, for backends which can't report it
+ * themselves */
+class MonitorPcmSink : public PcmSink {
+public:
+    MonitorPcmSink(PcmSink &destination, ConvMonitor &monitor, bool reportProgress) :
+            destination(destination), monitor(monitor), reportProgress(reportProgress),
+            frameBytes(0), sampleRate(0), durationMs(-1), written(0) {}
+
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    bool randomAccess() const { return destination.randomAccess(); }
+
+    int writeAt(uint64_t offset, const void *data, size_t nbytes);
+
+    uint8_t *directBuffer(size_t &capacity) { return destination.directBuffer(capacity); }
+
+    int end() { return destination.end(); }
+
+private:
+    void advance(size_t nbytes);
+
+    PcmSink &destination;
+    ConvMonitor &monitor;
+    bool reportProgress;
+    uint64_t frameBytes;
+    unsigned sampleRate;
+    int64_t durationMs;
+    std::atomic<uint64_t> written;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "batch-runner.h"
+#include "flac2raw-log.h"
+
+static off_t fileSize(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) return 0;
+    return st.st_size;
+}
+
+void runBatch(std::vector<BatchJob> &jobs, unsigned maxWorkers,
+              const std::function<int(BatchJob &)> &convert) {
+    if (jobs.empty()) return;
+    if (0 == maxWorkers) maxWorkers = std::thread::hardware_concurrency();
+    if (0 == maxWorkers) maxWorkers = 1;
+    if (maxWorkers > jobs.size()) maxWorkers = (unsigned) jobs.size();
+
+    /* longest processing time first keeps the tail of the batch short */
+    std::vector<std::pair<off_t, size_t> > order;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        order.push_back(std::make_pair(fileSize(jobs[i].src), i));
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<off_t, size_t> &a, const std::pair<off_t, size_t> &b) {
+                         return a.first > b.first;
+                     });
+
+    LOGV("Converting %zu files with %u workers", jobs.size(), maxWorkers);
+    std::atomic<size_t> nextJob(0);
+    auto worker = [&]() {
+        if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), BATCH_WORKER_NICE)) {
+            LOGV("Could not lower the priority of the batch worker: %s", strerror(errno));
+        }
+        for (;;) {
+            const size_t n = nextJob++;
+            if (n >= order.size()) return;
+            BatchJob &job = jobs[order[n].second];
+            job.result = convert(job);
+            if (job.result) {
+                LOGE("Converting %s failed: %s", job.src.c_str(), strerror(job.result));
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < maxWorkers; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_BATCH_RUNNER_H
+#define FLAC2RAW_BATCH_RUNNER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "decoder-backend.h"
+
+/* Nice value of the batch workers, same as THREAD_PRIORITY_BACKGROUND on Android */
+#define BATCH_WORKER_NICE 10
+
+//-----------------------------------------------------------------
+/* One conversion of a batch */
+typedef struct BatchJob_ {
+    std::string src;
+    std::string dst;
+    /* zero or the error number once the batch has run */
+    int result = 0;
+} BatchJob;
+
+/* Converts every job with convert() on at most maxWorkers threads (0 for all cores).
+ * The workers run at a lower priority so that they don't starve audio in the
+ * foreground. The jobs are taken from a shared queue, largest file first, so that
+ * a long file doesn't end up alone at the end of the batch. */
+void runBatch(std::vector<BatchJob> &jobs, unsigned maxWorkers,
+              const std::function<int(BatchJob &)> &convert);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "chunked-pcm.h"
+#include "flac2raw-log.h"
+
+/* all supported ABIs are little endian, the structs are written as they are */
+static_assert(sizeof(ChunkedPcmHeader) == 64, "ChunkedPcmHeader isn't packed");
+static_assert(sizeof(ChunkedPcmRecord) == 16, "ChunkedPcmRecord isn't packed");
+static_assert(sizeof(ChunkedPcmIndexEntry) == 16, "ChunkedPcmIndexEntry isn't packed");
+static_assert(sizeof(ChunkedPcmFooter) == 32, "ChunkedPcmFooter isn't packed");
+
+uint32_t chunkedPcmCrc(const void *data, size_t nbytes, uint32_t crc) {
+    static const struct Table_ {
+        uint32_t t[256];
+
+        Table_() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c >> 1) ^ (c & 1 ? 0xedb88320u : 0);
+                t[i] = c;
+            }
+        }
+    } table;
+    const uint8_t *p = (const uint8_t *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < nbytes; i++) crc = table.t[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static int pwriteAll(int fd, uint64_t offset, const void *data, size_t nbytes) {
+    const uint8_t *p = (const uint8_t *) data;
+    while (nbytes > 0) {
+        ssize_t n = pwrite(fd, p, nbytes, (off_t) offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Could not write to the phone memory");
+            return errno;
+        }
+        p += n;
+        offset += (uint64_t) n;
+        nbytes -= (size_t) n;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------
+ChunkedPcmSink::ChunkedPcmSink(int sampleFormat, size_t chunkBytes) :
+        fd(-1), resume(false), sampleFormat(sampleFormat), requestedChunkBytes(chunkBytes),
+        filled(0), offset(0), frames(0), resumed(0), skip(0) {
+    memset(&header, 0, sizeof(header));
+}
+
+ChunkedPcmSink::~ChunkedPcmSink() {
+    if (fd >= 0) close(fd);
+}
+
+int ChunkedPcmSink::open(const char *dst, bool resume) {
+    path = dst;
+    this->resume = resume;
+    fd = ::open(dst, O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0666);
+    if (fd < 0) {
+        LOGE("Could not write to the phone memory");
+        return errno;
+    }
+    return 0;
+}
+
+int ChunkedPcmSink::begin(const PcmFormat &fmt) {
+    if (fd < 0) return EBADF;
+    const uint32_t frameBytes = fmt.channels * (fmt.bitsPerSample / 8);
+    if (0 == frameBytes || requestedChunkBytes > UINT32_MAX) return EINVAL;
+    const uint32_t chunkBytes = (uint32_t) std::max(requestedChunkBytes / frameBytes,
+                                                    (size_t) 1) * frameBytes;
+    memcpy(header.magic, CHUNKED_PCM_MAGIC, sizeof(header.magic));
+    header.version = CHUNKED_PCM_VERSION;
+    header.headerBytes = sizeof(header);
+    header.sampleRate = fmt.sampleRate;
+    header.channels = fmt.channels;
+    header.bitsPerSample = fmt.bitsPerSample;
+    header.sampleFormat = (uint32_t) sampleFormat;
+    header.chunkBytes = chunkBytes;
+    header.frameBytes = frameBytes;
+    header.expectedFrames = fmt.totalFrames;
+    header.crc = chunkedPcmCrc(&header, offsetof(ChunkedPcmHeader, crc));
+    chunk.resize(sizeof(ChunkedPcmRecord) + chunkBytes);
+    offset = sizeof(header);
+
+    /* keeps the full chunks with a valid CRC of an earlier conversion of the same format */
+    if (resume) {
+        ChunkedPcmReader earlier;
+        if (earlier.open(path.c_str()) == 0 &&
+            memcmp(&earlier.format(), &header, sizeof(header)) == 0) {
+            for (size_t i = 0; i < earlier.chunks(); i++) {
+                if (earlier.chunk(i).bytes != chunkBytes || earlier.verify(i)) break;
+                index.push_back(earlier.chunk(i));
+            }
+        }
+        resumed = index.size() * (uint64_t) (chunkBytes / frameBytes);
+        skip = resumed * frameBytes;
+        offset += index.size() * (uint64_t) chunk.size();
+        if (resumed) LOGV("Resuming after %llu frames", (unsigned long long) resumed);
+    }
+    frames = resumed;
+    if (ftruncate(fd, (off_t) offset)) return errno;
+    return pwriteAll(fd, 0, &header, sizeof(header));
+}
+
+int ChunkedPcmSink::write(const void *data, size_t nbytes) {
+    if (chunk.empty()) return EINVAL;
+    const uint8_t *p = (const uint8_t *) data;
+    if (skip) {
+        const size_t n = (size_t) std::min(skip, (uint64_t) nbytes);
+        skip -= n;
+        p += n;
+        nbytes -= n;
+    }
+    while (nbytes > 0) {
+        const size_t n = std::min(nbytes, (size_t) header.chunkBytes - filled);
+        memcpy(&chunk[sizeof(ChunkedPcmRecord) + filled], p, n);
+        filled += n;
+        p += n;
+        nbytes -= n;
+        if (filled == header.chunkBytes) {
+            int r = writeChunk();
+            if (r) return r;
+        }
+    }
+    return 0;
+}
+
+int ChunkedPcmSink::writeChunk() {
+    ChunkedPcmRecord record;
+    record.magic = CHUNKED_PCM_RECORD_MAGIC;
+    record.index = (uint32_t) index.size();
+    record.bytes = (uint32_t) filled;
+    record.crc = chunkedPcmCrc(&chunk[sizeof(record)], filled);
+    memcpy(&chunk[0], &record, sizeof(record));
+    int r = pwriteAll(fd, offset, &chunk[0], sizeof(record) + filled);
+    if (r) return r;
+    ChunkedPcmIndexEntry entry;
+    entry.firstFrame = frames;
+    entry.bytes = record.bytes;
+    entry.crc = record.crc;
+    index.push_back(entry);
+    frames += filled / header.frameBytes;
+    offset += sizeof(record) + filled;
+    filled = 0;
+    return 0;
+}
+
+int ChunkedPcmSink::finish() {
+    if (chunk.empty()) return EINVAL;
+    if (filled) {
+        int r = writeChunk();
+        if (r) return r;
+    }
+    ChunkedPcmFooter footer;
+    memcpy(footer.magic, CHUNKED_PCM_INDEX_MAGIC, sizeof(footer.magic));
+    footer.totalFrames = frames;
+    footer.indexOffset = offset;
+    footer.chunks = (uint32_t) index.size();
+    const size_t indexBytes = index.size() * sizeof(ChunkedPcmIndexEntry);
+    footer.indexCrc = chunkedPcmCrc(index.data(), indexBytes);
+    int r = pwriteAll(fd, offset, index.data(), indexBytes);
+    if (!r) r = pwriteAll(fd, offset + indexBytes, &footer, sizeof(footer));
+    if (r) return r;
+    /* a resumed file may have been longer */
+    if (ftruncate(fd, (off_t) (offset + indexBytes + sizeof(footer)))) return errno;
+    return 0;
+}
+
+//-----------------------------------------------------------------
+int ChunkedPcmReader::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int e = errno;
+        ::close(fd);
+        return e;
+    }
+    if ((uint64_t) st.st_size < sizeof(header)) {
+        ::close(fd);
+        return EINVAL;
+    }
+    void *m = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return errno;
+    map = (uint8_t *) m;
+    mapSize = (size_t) st.st_size;
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, CHUNKED_PCM_MAGIC, sizeof(header.magic)) ||
+        header.version != CHUNKED_PCM_VERSION ||
+        header.crc != chunkedPcmCrc(&header, offsetof(ChunkedPcmHeader, crc)) ||
+        header.headerBytes < sizeof(header) || header.headerBytes > mapSize ||
+        0 == header.frameBytes || header.frameBytes != header.channels * (header.bitsPerSample / 8) ||
+        0 == header.chunkBytes || header.chunkBytes % header.frameBytes) {
+        close();
+        return EINVAL;
+    }
+    framesPerChunk = header.chunkBytes / header.frameBytes;
+    const uint64_t stride = sizeof(ChunkedPcmRecord) + header.chunkBytes;
+
+    /* a finished file: the footer points to the index */
+    ChunkedPcmFooter footer;
+    if (mapSize >= header.headerBytes + sizeof(footer)) {
+        memcpy(&footer, map + mapSize - sizeof(footer), sizeof(footer));
+        const uint64_t indexBytes = (uint64_t) footer.chunks * sizeof(ChunkedPcmIndexEntry);
+        /* compared without sums which a damaged footer could overflow */
+        if (!memcmp(footer.magic, CHUNKED_PCM_INDEX_MAGIC, sizeof(footer.magic)) &&
+            footer.indexOffset >= header.headerBytes &&
+            footer.indexOffset <= mapSize - sizeof(footer) &&
+            indexBytes == mapSize - sizeof(footer) - footer.indexOffset &&
+            footer.indexCrc == chunkedPcmCrc(map + footer.indexOffset, (size_t) indexBytes)) {
+            index.resize(footer.chunks);
+            if (footer.chunks) memcpy(&index[0], map + footer.indexOffset, (size_t) indexBytes);
+            uint64_t end = header.headerBytes;
+            uint64_t n = 0;
+            bool valid = true;
+            for (size_t i = 0; i < index.size() && valid; i++) {
+                valid = index[i].firstFrame == i * framesPerChunk &&
+                        index[i].bytes % header.frameBytes == 0 &&
+                        (i + 1 == index.size() ? index[i].bytes <= header.chunkBytes :
+                         index[i].bytes == header.chunkBytes);
+                end = header.headerBytes + i * stride + sizeof(ChunkedPcmRecord) + index[i].bytes;
+                n += index[i].bytes / header.frameBytes;
+            }
+            if (valid && end == footer.indexOffset && n == footer.totalFrames) {
+                total = n;
+                sealed = true;
+                return 0;
+            }
+            index.clear();
+        }
+    }
+
+    /* an interrupted file: the chunks up to the first damaged one */
+    uint64_t pos = header.headerBytes;
+    while (pos + sizeof(ChunkedPcmRecord) <= mapSize) {
+        ChunkedPcmRecord record;
+        memcpy(&record, map + pos, sizeof(record));
+        if (record.magic != CHUNKED_PCM_RECORD_MAGIC || record.index != index.size() ||
+            record.bytes > header.chunkBytes || record.bytes % header.frameBytes ||
+            pos + sizeof(record) + record.bytes > mapSize ||
+            record.crc != chunkedPcmCrc(map + pos + sizeof(record), record.bytes)) {
+            break;
+        }
+        ChunkedPcmIndexEntry entry;
+        entry.firstFrame = total;
+        entry.bytes = record.bytes;
+        entry.crc = record.crc;
+        index.push_back(entry);
+        total += record.bytes / header.frameBytes;
+        /* only the last chunk is short */
+        if (record.bytes < header.chunkBytes) break;
+        pos += stride;
+    }
+    return 0;
+}
+
+void ChunkedPcmReader::close() {
+    if (map) munmap(map, mapSize);
+    map = NULL;
+    mapSize = 0;
+    index.clear();
+    framesPerChunk = 0;
+    total = 0;
+    sealed = false;
+}
+
+const uint8_t *ChunkedPcmReader::chunkData(size_t i) const {
+    return map + header.headerBytes + i * (sizeof(ChunkedPcmRecord) + header.chunkBytes) +
+           sizeof(ChunkedPcmRecord);
+}
+
+const uint8_t *ChunkedPcmReader::framesAt(uint64_t frame, uint64_t &count) const {
+    if (frame >= total) {
+        count = 0;
+        return NULL;
+    }
+    const size_t i = (size_t) (frame / framesPerChunk);
+    const uint64_t first = frame - index[i].firstFrame;
+    count = index[i].bytes / header.frameBytes - first;
+    return chunkData(i) + first * header.frameBytes;
+}
+
+uint64_t ChunkedPcmReader::read(uint64_t frame, void *dst, uint64_t count) const {
+    uint8_t *out = (uint8_t *) dst;
+    uint64_t copied = 0;
+    while (copied < count) {
+        uint64_t n;
+        const uint8_t *p = framesAt(frame + copied, n);
+        if (NULL == p) break;
+        n = std::min(n, count - copied);
+        memcpy(out + copied * header.frameBytes, p, (size_t) (n * header.frameBytes));
+        copied += n;
+    }
+    return copied;
+}
+
+int ChunkedPcmReader::verify(size_t i) const {
+    if (i >= index.size()) return EINVAL;
+    return chunkedPcmCrc(chunkData(i), index[i].bytes) == index[i].crc ? 0 : EILSEQ;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_CHUNKED_PCM_H
+#define FLAC2RAW_CHUNKED_PCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "pcm-sink.h"
+
+/* Container of output files, same values as Flac2Raw.CONTAINER_* in Java */
+#define FLAC2RAW_CONTAINER_RAW 0
+#define FLAC2RAW_CONTAINER_CHUNKED 1
+
+/*
+ * Chunked raw container, all fields little endian:
+ *
+ *     ChunkedPcmHeader
+ *     ChunkedPcmRecord + chunkBytes of audio      chunk 0
+ *     ChunkedPcmRecord + chunkBytes of audio      chunk 1
+ *     ...
+ *     ChunkedPcmRecord + up to chunkBytes         last chunk
+ *     ChunkedPcmIndexEntry[chunks]
+ *     ChunkedPcmFooter
+ *
+ * Every chunk but the last holds the same number of whole sample frames, so
+ * chunk i starts at headerBytes + i * (sizeof(ChunkedPcmRecord) + chunkBytes)
+ * and the chunk of a frame is frame / framesPerChunk. The index and the
+ * footer are only written once the conversion has finished. A file without
+ * them has been interrupted: its chunks with a valid CRC can still be read
+ * and a resumed conversion carries on after them.
+ */
+
+#define CHUNKED_PCM_MAGIC "F2RCHUNK"
+#define CHUNKED_PCM_INDEX_MAGIC "F2RINDEX"
+#define CHUNKED_PCM_RECORD_MAGIC 0x4b4e4843u /* "CHNK" */
+#define CHUNKED_PCM_VERSION 1
+
+typedef struct ChunkedPcmHeader_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    /* format descriptor of the audio */
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t bitsPerSample;
+    /* one of FLAC2RAW_FORMAT_* */
+    uint32_t sampleFormat;
+    /* bytes of audio in every chunk but the last, a multiple of frameBytes */
+    uint32_t chunkBytes;
+    uint32_t frameBytes;
+    /* frames the decoder announced, 0 if unknown */
+    uint64_t expectedFrames;
+    uint32_t reserved[3];
+    /* CRC-32 of the bytes in front of it */
+    uint32_t crc;
+} ChunkedPcmHeader;
+
+typedef struct ChunkedPcmRecord_ {
+    uint32_t magic;
+    uint32_t index;
+    /* bytes of audio following the record */
+    uint32_t bytes;
+    /* CRC-32 of the audio */
+    uint32_t crc;
+} ChunkedPcmRecord;
+
+typedef struct ChunkedPcmIndexEntry_ {
+    uint64_t firstFrame;
+    uint32_t bytes;
+    uint32_t crc;
+} ChunkedPcmIndexEntry;
+
+typedef struct ChunkedPcmFooter_ {
+    char magic[8];
+    uint64_t totalFrames;
+    /* file offset of the index */
+    uint64_t indexOffset;
+    uint32_t chunks;
+    /* CRC-32 of the index entries */
+    uint32_t indexCrc;
+} ChunkedPcmFooter;
+
+/* CRC-32 (IEEE 802.3) of data, continuing from crc */
+uint32_t chunkedPcmCrc(const void *data, size_t nbytes, uint32_t crc = 0);
+
+//-----------------------------------------------------------------
+/* Writes the decoded audio as a chunked raw container. A chunk is written
+ * with a single pwrite as soon as it's full, from the thread of the decoder.
+ * finish() writes the last chunk and the index; a failed conversion doesn't
+ * call it and leaves its complete chunks for a resume. */
+class ChunkedPcmSink : public PcmSink {
+public:
+    /* sampleFormat is recorded in the header, chunkBytes is rounded down to
+     * whole frames */
+    ChunkedPcmSink(int sampleFormat, size_t chunkBytes);
+
+    ~ChunkedPcmSink();
+
+    /* With resume an existing container of dst is kept up to its last valid
+     * chunk if begin() gets the same format, the audio in front of that point
+     * is then dropped instead of written again. */
+    int open(const char *dst, bool resume = false);
+
+    int begin(const PcmFormat &fmt);
+
+    int write(const void *data, size_t nbytes);
+
+    /* writes the last chunk, the index and the footer */
+    int finish();
+
+    /* frames kept from an earlier conversion */
+    uint64_t resumedFrames() const { return resumed; }
+
+private:
+    int writeChunk();
+
+    int fd;
+    std::string path;
+    bool resume;
+    int sampleFormat;
+    size_t requestedChunkBytes;
+    ChunkedPcmHeader header;
+    /* record and audio of the chunk being filled */
+    std::vector<uint8_t> chunk;
+    size_t filled;
+    uint64_t offset;
+    std::vector<ChunkedPcmIndexEntry> index;
+    uint64_t frames;
+    uint64_t resumed;
+    /* bytes still to drop of a resumed conversion */
+    uint64_t skip;
+};
+
+//-----------------------------------------------------------------
+/* Maps a chunked raw container for random access. A finished file is opened
+ * from its index without reading the audio, an interrupted one is scanned up
+ * to its first damaged chunk. All methods returning int return zero or the
+ * error number. */
+class ChunkedPcmReader {
+public:
+    ChunkedPcmReader() : map(NULL), mapSize(0), framesPerChunk(0), total(0), sealed(false) {}
+
+    ~ChunkedPcmReader() { close(); }
+
+    /* EINVAL if path isn't a chunked container */
+    int open(const char *path);
+
+    void close();
+
+    const ChunkedPcmHeader &format() const { return header; }
+
+    /* true if the conversion had finished, false if it was interrupted */
+    bool complete() const { return sealed; }
+
+    /* frames which can be read */
+    uint64_t frames() const { return total; }
+
+    size_t chunks() const { return index.size(); }
+
+    const ChunkedPcmIndexEntry &chunk(size_t i) const { return index[i]; }
+
+    /* Audio from frame on, in place in the mapping. count is set to the
+     * number of frames up to the end of its chunk, NULL past the end. */
+    const uint8_t *framesAt(uint64_t frame, uint64_t &count) const;
+
+    /* copies up to count frames from frame on into dst, returns the frames copied */
+    uint64_t read(uint64_t frame, void *dst, uint64_t count) const;
+
+    /* checks the CRC of chunk i, EILSEQ if it's damaged */
+    int verify(size_t i) const;
+
+private:
+    const uint8_t *chunkData(size_t i) const;
+
+    uint8_t *map;
+    size_t mapSize;
+    ChunkedPcmHeader header;
+    std::vector<ChunkedPcmIndexEntry> index;
+    uint64_t framesPerChunk;
+    uint64_t total;
+    bool sealed;
+};
+
+#endif
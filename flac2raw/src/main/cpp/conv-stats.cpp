@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#include "conv-stats.h"
+
+int64_t statsNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* adds a time which is -1 if it's unknown */
+static void mergeTime(int64_t &into, int64_t t) {
+    if (t < 0) return;
+    into = into < 0 ? t : into + t;
+}
+
+void mergeStats(ConvStats &into, const ConvStats &s) {
+    into.conversions += s.conversions;
+    mergeTime(into.prefetchUs, s.prefetchUs);
+    mergeTime(into.firstBufferUs, s.firstBufferUs);
+    into.wallUs += s.wallUs;
+    into.callbacks += s.callbacks;
+    for (int i = 0; i < CONV_STATS_BUCKETS; i++) {
+        into.intervalHistogram[i] += s.intervalHistogram[i];
+    }
+    into.maxIntervalUs = std::max(into.maxIntervalUs, s.maxIntervalUs);
+    into.intervalSumUs += s.intervalSumUs;
+    into.intervalSumSqUs += s.intervalSumSqUs;
+    into.writeBlockedUs += s.writeBlockedUs;
+    into.bytesWritten += s.bytesWritten;
+    into.audioSeconds += s.audioSeconds;
+}
+
+double realtimeFactor(const ConvStats &s) {
+    return s.wallUs > 0 ? s.audioSeconds * 1e6 / (double) s.wallUs : 0;
+}
+
+static uint64_t intervals(const ConvStats &s) {
+    uint64_t n = 0;
+    for (int i = 0; i < CONV_STATS_BUCKETS; i++) n += s.intervalHistogram[i];
+    return n;
+}
+
+double meanIntervalUs(const ConvStats &s) {
+    const uint64_t n = intervals(s);
+    return n ? s.intervalSumUs / (double) n : 0;
+}
+
+double intervalJitterUs(const ConvStats &s) {
+    const uint64_t n = intervals(s);
+    if (n < 2) return 0;
+    const double mean = s.intervalSumUs / (double) n;
+    return sqrt(std::max(0.0, s.intervalSumSqUs / (double) n - mean * mean));
+}
+
+//-----------------------------------------------------------------
+StatsPcmSink::StatsPcmSink(PcmSink &destination, ConvStats &stats) :
+        destination(destination), total(stats), startUs(statsNowUs()), lastUs(-1),
+        frameBytes(0), sampleRate(0), firstUs(-1), atCalls(0), atBytes(0), atBlockedUs(0) {}
+
+int StatsPcmSink::begin(const PcmFormat &format) {
+    frameBytes = (uint64_t) format.channels * (format.bitsPerSample / 8);
+    sampleRate = format.sampleRate;
+    return destination.begin(format);
+}
+
+void StatsPcmSink::firstBuffer(int64_t t) {
+    int64_t unset = -1;
+    firstUs.compare_exchange_strong(unset, t - startUs, std::memory_order_relaxed);
+}
+
+int StatsPcmSink::write(const void *data, size_t nbytes) {
+    const int64_t t0 = statsNowUs();
+    if (lastUs < 0) {
+        firstBuffer(t0);
+    } else {
+        const int64_t interval = t0 - lastUs;
+        const uint64_t v = (uint64_t) interval >> 6;
+        const int bucket = v ? std::min(CONV_STATS_BUCKETS - 1, 64 - __builtin_clzll(v)) : 0;
+        stats.intervalHistogram[bucket]++;
+        stats.maxIntervalUs = std::max(stats.maxIntervalUs, interval);
+        stats.intervalSumUs += (double) interval;
+        stats.intervalSumSqUs += (double) interval * (double) interval;
+    }
+    lastUs = t0;
+    int r = destination.write(data, nbytes);
+    stats.writeBlockedUs += statsNowUs() - t0;
+    stats.callbacks++;
+    stats.bytesWritten += nbytes;
+    return r;
+}
+
+int StatsPcmSink::writeAt(uint64_t offset, const void *data, size_t nbytes) {
+    const int64_t t0 = statsNowUs();
+    firstBuffer(t0);
+    int r = destination.writeAt(offset, data, nbytes);
+    atBlockedUs.fetch_add(statsNowUs() - t0, std::memory_order_relaxed);
+    atCalls.fetch_add(1, std::memory_order_relaxed);
+    atBytes.fetch_add(nbytes, std::memory_order_relaxed);
+    return r;
+}
+
+void StatsPcmSink::finish() {
+    stats.firstBufferUs = firstUs.load();
+    stats.callbacks += atCalls.load();
+    stats.bytesWritten += atBytes.load();
+    stats.writeBlockedUs += atBlockedUs.load();
+    if (frameBytes && sampleRate) {
+        stats.audioSeconds = (double) (stats.bytesWritten / frameBytes) / sampleRate;
+    }
+    /* the conversion and its wall time are counted by the caller, the
+     * prefetch by the backend */
+    mergeStats(total, stats);
+}
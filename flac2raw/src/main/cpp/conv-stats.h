@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_CONV_STATS_H
+#define FLAC2RAW_CONV_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "pcm-sink.h"
+
+/* Buckets of the callback interval histogram: bucket 0 counts intervals below
+ * 64us, bucket i those from 32 << i to 64 << i us and the last one the rest */
+#define CONV_STATS_BUCKETS 16
+
+//-----------------------------------------------------------------
+/* Timing of conversions, mirrors Flac2Raw.Stats in Java. Times are in
+ * microseconds, everything adds up over the conversions merged into it. */
+typedef struct ConvStats_ {
+    uint64_t conversions = 0;
+    /* until the platform decoder had prefetched the source, -1 if there was no
+     * prefetch (native backend, cached output) */
+    int64_t prefetchUs = -1;
+    /* from the start of the decoder until the first decoded buffer, -1 if there was none */
+    int64_t firstBufferUs = -1;
+    /* whole conversion */
+    int64_t wallUs = 0;
+    /* buffers handed to the sink, for the OpenSL ES backend the DecPlayCallback calls */
+    uint64_t callbacks = 0;
+    /* time between successive buffers */
+    uint64_t intervalHistogram[CONV_STATS_BUCKETS] = {};
+    int64_t maxIntervalUs = 0;
+    double intervalSumUs = 0;
+    double intervalSumSqUs = 0;
+    /* time the decoder waited for the sink, and the 16 bit PCM it received */
+    int64_t writeBlockedUs = 0;
+    uint64_t bytesWritten = 0;
+    double audioSeconds = 0;
+} ConvStats;
+
+/* steady clock in microseconds */
+int64_t statsNowUs();
+
+/* adds s to into */
+void mergeStats(ConvStats &into, const ConvStats &s);
+
+/* seconds of audio decoded per second of conversion, 0 if unknown */
+double realtimeFactor(const ConvStats &s);
+
+/* mean and standard deviation of the time between buffers */
+double meanIntervalUs(const ConvStats &s);
+
+double intervalJitterUs(const ConvStats &s);
+
+//-----------------------------------------------------------------
+/* Passes the decoded audio on to destination and times the writes into
+ * stats. write() is only called by the thread of the decoder so it just adds
+ * two clock reads and a few increments to the callback. writeAt() of parallel
+ * decoders collects into atomics. finish() adds everything to stats. */
+class StatsPcmSink : public PcmSink {
+public:
+    StatsPcmSink(PcmSink &destination, ConvStats &stats);
+
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    bool randomAccess() const { return destination.randomAccess(); }
+
+    int writeAt(uint64_t offset, const void *data, size_t nbytes);
+
+    uint8_t *directBuffer(size_t &capacity) { return destination.directBuffer(capacity); }
+
+    int end() { return destination.end(); }
+
+    /* to be called once the decoder has returned */
+    void finish();
+
+private:
+    void firstBuffer(int64_t t);
+
+    PcmSink &destination;
+    ConvStats &total;
+    ConvStats stats;
+    int64_t startUs;
+    int64_t lastUs;
+    uint64_t frameBytes;
+    unsigned sampleRate;
+    std::atomic<int64_t> firstUs;
+    std::atomic<uint64_t> atCalls;
+    std::atomic<uint64_t> atBytes;
+    std::atomic<int64_t> atBlockedUs;
+};
+
+#endif
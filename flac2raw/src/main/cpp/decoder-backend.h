@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_DECODER_BACKEND_H
+#define FLAC2RAW_DECODER_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "pcm-sink.h"
+#include "chunked-pcm.h"
+#include "flac-decoder.h"
+#include "sample-format.h"
+#include "conv-stats.h"
+
+/* Default buffer queue of the OpenSL ES backend: 4 buffers of an MP3 frame */
+#define DEFAULT_BUFFERS_IN_QUEUE 4
+#define DEFAULT_BUFFER_SIZE_IN_SAMPLES 1152
+/* buffer size derived from the FLAC block size, same as Flac2Raw.BUFFER_SIZE_ADAPTIVE */
+#define BUFFER_SIZE_ADAPTIVE 0
+
+/* Backends, same values as Flac2Raw.BACKEND_* in Java */
+#define FLAC2RAW_BACKEND_OPENSL 0
+#define FLAC2RAW_BACKEND_NATIVE 1
+
+//-----------------------------------------------------------------
+/* Where the compressed audio comes from */
+typedef struct DecodeSource_ {
+    enum Type {
+        URI,
+        FD,
+        MEMORY
+    };
+    Type type = URI;
+    /* filesystem path for URI */
+    const char *path = NULL;
+    /* file descriptor and byte range for FD, for example an Android asset */
+    int fd = -1;
+    off_t start = 0;
+    off_t length = 0;
+    /* compressed audio already in memory for MEMORY, for example received over IPC.
+     * It has to stay valid until the decoding has finished. */
+    const uint8_t *data = NULL;
+    size_t size = 0;
+} DecodeSource;
+
+/* Observer of a running conversion, see AsyncConversion. The backends ask it
+ * whether to stop and report how far they are every progressIntervalMs. */
+class ConvMonitor {
+public:
+    virtual ~ConvMonitor() {}
+
+    /* true once the conversion should stop, the backend then returns ECANCELED */
+    virtual bool cancelled() const = 0;
+
+    /* position and duration of the decoder in ms, durationMs is -1 if it's unknown */
+    virtual void progress(int64_t positionMs, int64_t durationMs) = 0;
+};
+
+/* Options of a conversion, mirrors Flac2Raw.Options in Java */
+typedef struct ConvOptions_ {
+    int backend = FLAC2RAW_BACKEND_OPENSL;
+    int samplingRateHz = 48000;
+    /* check the decoded audio against the MD5 in STREAMINFO (native backend only) */
+    bool verifyMd5 = false;
+    /* number of decoding threads for a single file, 0 for all cores (native backend only) */
+    int numThreads = 1;
+    /* how long the platform decoder may take to open the source (OpenSL ES backend only) */
+    int prefetchTimeoutMs = 5000;
+    /* buffer queue between the platform decoder and the sink (OpenSL ES backend only),
+     * the size is in 16 bit samples or BUFFER_SIZE_ADAPTIVE */
+    int numBuffers = DEFAULT_BUFFERS_IN_QUEUE;
+    int bufferSizeSamples = DEFAULT_BUFFER_SIZE_IN_SAMPLES;
+    /* size of the ring between the decoder and a writer thread, 0 writes directly */
+    int ringBufferBytes = 0;
+    /* size of the writes of the writer thread */
+    int writeChunkBytes = 64 * 1024;
+    /* decoded audio a stream buffers ahead of its reader */
+    int streamBufferBytes = 256 * 1024;
+    /* format of the output, one of FLAC2RAW_FORMAT_*, and averaging all channels into one.
+     * The backends always decode to 16 bit, a FormatPcmSink in front of the sink converts. */
+    int sampleFormat = FLAC2RAW_FORMAT_PCM16;
+    bool downmix = false;
+    /* rate of the output, 0 keeps the rate of the source (ResamplePcmSink) */
+    int resampleToHz = 0;
+    /* time range to decode, endMs < 0 decodes to the end */
+    int64_t startMs = 0;
+    int64_t endMs = -1;
+    /* directory for the seek indexes of flac files without a SEEKTABLE, empty for none
+     * (native backend only) */
+    std::string seekIndexDir;
+    /* directory of the cache of converted files, empty for none (PcmCache) */
+    std::string cacheDir;
+    /* size of the cache above which the least recently used files are evicted */
+    int64_t cacheMaxBytes = 256 * 1024 * 1024;
+    /* how output files are written, one of FLAC2RAW_OUTPUT_* (FilePcmSink) */
+    int outputMode = FLAC2RAW_OUTPUT_STDIO;
+    /* container of output files, one of FLAC2RAW_CONTAINER_* (ChunkedPcmSink), the
+     * bytes of audio per chunk and whether an interrupted container is carried on */
+    int container = FLAC2RAW_CONTAINER_RAW;
+    int chunkBytes = 256 * 1024;
+    bool resume = false;
+    /* timing of the conversion is added here if it isn't NULL, see StatsPcmSink */
+    ConvStats *stats = NULL;
+    /* cancellation and progress of an asynchronous conversion, NULL for none */
+    ConvMonitor *monitor = NULL;
+    int progressIntervalMs = 250;
+} ConvOptions;
+
+/* First frame and number of frames of the time range of opts in a stream of
+ * rate Hz and totalFrames (0 if unknown, count is then UINT64_MAX for an open
+ * end). Returns EINVAL if the range is empty. */
+int rangeFrames(const ConvOptions &opts, unsigned rate, uint64_t totalFrames,
+                uint64_t &first, uint64_t &count);
+
+/* true if opts ask for less than the whole stream */
+static inline bool isRanged(const ConvOptions &opts) {
+    return opts.startMs != 0 || opts.endMs >= 0;
+}
+
+//-----------------------------------------------------------------
+/* A decoder which turns a compressed source into 16 bit PCM for a sink */
+class DecoderBackend {
+public:
+    virtual ~DecoderBackend() {}
+
+    /* returns zero on success or the error number */
+    virtual int decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) = 0;
+};
+
+//-----------------------------------------------------------------
+/* Read only memory mapping of a source, or just the memory of a MEMORY source */
+class MappedSource {
+public:
+    MappedSource() : base(NULL), mapLen(0), data(NULL), size(0) {}
+
+    ~MappedSource();
+
+    int map(const DecodeSource &src);
+
+    void unmap();
+
+private:
+    void *base;
+    size_t mapLen;
+
+public:
+    const uint8_t *data;
+    size_t size;
+};
+
+//-----------------------------------------------------------------
+/* In-process FLAC decoder which doesn't need OpenSL ES */
+class NativeFlacBackend : public DecoderBackend {
+public:
+    int decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts);
+
+    /* reads only the STREAMINFO and, if seekTable isn't NULL, the SEEKTABLE of a flac source */
+    static int probe(const DecodeSource &src, FlacStreamInfo &info,
+                     std::vector<FlacSeekPoint> *seekTable = NULL);
+
+private:
+    /* splits the stream at frame boundaries and decodes the chunks concurrently,
+     * each writing straight to its position in the output */
+    int decodeParallel(const FlacDecoder &dec, PcmSink &sink, unsigned numThreads);
+
+    /* seeks to frame first and decodes count frames, see ConvOptions::startMs */
+    int decodeRange(FlacDecoder &dec, PcmSink &sink, const ConvOptions &opts,
+                    uint64_t first, uint64_t count);
+};
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include "flac-decoder.h"
+#include "flac2raw-log.h"
+
+/* Metadata block types we're interested in */
+#define FLAC_METADATA_STREAMINFO 0
+#define FLAC_METADATA_SEEKTABLE 3
+
+/* Channel assignments of the frame header */
+#define FLAC_CHANNEL_LEFT_SIDE 8
+#define FLAC_CHANNEL_RIGHT_SIDE 9
+#define FLAC_CHANNEL_MID_SIDE 10
+
+//-----------------------------------------------------------------
+/* CRC tables, filled in by a static initializer */
+static uint8_t crc8Table[256];
+static uint16_t crc16Table[256];
+
+static struct CrcTableInit_ {
+    CrcTableInit_() {
+        for (unsigned i = 0; i < 256; i++) {
+            unsigned c8 = i;
+            unsigned c16 = i << 8;
+            for (int b = 0; b < 8; b++) {
+                c8 = (c8 & 0x80) ? ((c8 << 1) ^ 0x07) : (c8 << 1);
+                c16 = (c16 & 0x8000) ? ((c16 << 1) ^ 0x8005) : (c16 << 1);
+            }
+            crc8Table[i] = (uint8_t) c8;
+            crc16Table[i] = (uint16_t) c16;
+        }
+    }
+} crcTableInit;
+
+uint8_t flacCrc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        crc = crc8Table[crc ^ *data++];
+    }
+    return crc;
+}
+
+uint16_t flacCrc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    while (len--) {
+        crc = (uint16_t) ((crc << 8) ^ crc16Table[(crc >> 8) ^ *data++]);
+    }
+    return crc;
+}
+
+//-----------------------------------------------------------------
+/* MSB first bit reader over a memory region. Reading past the end
+ * returns zeros and sets the overrun flag. */
+class FlacBitReader {
+public:
+    FlacBitReader(const uint8_t *data, size_t size) :
+            overrun(false), buf(data), size(size), pos(0), cache(0), cbits(0) {}
+
+    inline void refill() {
+        if (pos + 8 <= size) {
+            uint64_t v;
+            memcpy(&v, buf + pos, 8);
+            v = __builtin_bswap64(v);
+            // OR in as many whole bytes as fit; the partial byte at the bottom is
+            // identical to what the next refill loads at the same position
+            cache |= v >> cbits;
+            unsigned advance = (63 - cbits) >> 3;
+            pos += advance;
+            cbits += advance << 3;
+        } else {
+            while (cbits <= 56 && pos < size) {
+                cache |= (uint64_t) buf[pos++] << (56 - cbits);
+                cbits += 8;
+            }
+        }
+    }
+
+    /* reads up to 32 bits */
+    inline uint32_t read(unsigned n) {
+        if (n == 0) return 0;
+        if (cbits < n) {
+            refill();
+            if (cbits < n) {
+                overrun = true;
+                cache = 0;
+                cbits = 0;
+                return 0;
+            }
+        }
+        uint32_t v = (uint32_t) (cache >> (64 - n));
+        cache <<= n;
+        cbits -= n;
+        return v;
+    }
+
+    inline int32_t readSigned(unsigned n) {
+        if (n == 0) return 0;
+        uint32_t v = read(n);
+        return (int32_t) (v << (32 - n)) >> (32 - n);
+    }
+
+    inline uint32_t readUnary() {
+        uint32_t q = 0;
+        for (;;) {
+            if (cbits < 64) refill();
+            if (cbits == 0) {
+                overrun = true;
+                return q;
+            }
+            uint64_t valid = cache & (~0ULL << (64 - cbits));
+            if (valid) {
+                unsigned lz = (unsigned) __builtin_clzll(valid);
+                cache <<= lz;
+                cache <<= 1;
+                cbits -= lz + 1;
+                return q + lz;
+            }
+            q += cbits;
+            cache = 0;
+            cbits = 0;
+        }
+    }
+
+    inline void alignToByte() {
+        unsigned drop = cbits & 7;
+        cache <<= drop;
+        cbits -= drop;
+    }
+
+    /* byte position of the next unread bit, only meaningful when aligned */
+    size_t bytePos() const { return pos - (cbits >> 3); }
+
+    bool overrun;
+
+private:
+    const uint8_t *buf;
+    size_t size;
+    size_t pos;
+    uint64_t cache;
+    unsigned cbits;
+};
+
+//-----------------------------------------------------------------
+static inline uint32_t be24(const uint8_t *p) {
+    return ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+}
+
+static inline uint64_t be64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+int flacParseFrameHeader(const uint8_t *data, size_t size,
+                         const FlacStreamInfo &streamInfo,
+                         FlacFrameHeader &header) {
+    if (size < 6) return EILSEQ;
+    /* sync code 0b11111111111110 and reserved bit */
+    if (data[0] != 0xFF || (data[1] & 0xFE) != 0xF8) return EILSEQ;
+    header.variableBlockSize = (data[1] & 1) != 0;
+    const unsigned bsCode = data[2] >> 4;
+    const unsigned srCode = data[2] & 0x0F;
+    const unsigned chCode = data[3] >> 4;
+    const unsigned ssCode = (data[3] >> 1) & 0x07;
+    if (bsCode == 0 || srCode == 15 || chCode > FLAC_CHANNEL_MID_SIDE || ssCode == 3 ||
+        (data[3] & 1)) {
+        return EILSEQ;
+    }
+    /* UTF-8 like coded frame or sample number */
+    size_t p = 4;
+    uint64_t number = data[p++];
+    unsigned extra = 0;
+    if (number < 0x80) {
+        extra = 0;
+    } else if ((number & 0xE0) == 0xC0) {
+        number &= 0x1F;
+        extra = 1;
+    } else if ((number & 0xF0) == 0xE0) {
+        number &= 0x0F;
+        extra = 2;
+    } else if ((number & 0xF8) == 0xF0) {
+        number &= 0x07;
+        extra = 3;
+    } else if ((number & 0xFC) == 0xF8) {
+        number &= 0x03;
+        extra = 4;
+    } else if ((number & 0xFE) == 0xFC) {
+        number &= 0x01;
+        extra = 5;
+    } else if (number == 0xFE) {
+        number = 0;
+        extra = 6;
+    } else {
+        return EILSEQ;
+    }
+    if (p + extra + 5 > size) return EILSEQ;
+    for (unsigned i = 0; i < extra; i++) {
+        const uint8_t c = data[p++];
+        if ((c & 0xC0) != 0x80) return EILSEQ;
+        number = (number << 6) | (c & 0x3F);
+    }
+    /* block size */
+    if (bsCode == 1) {
+        header.blockSize = 192;
+    } else if (bsCode <= 5) {
+        header.blockSize = 576u << (bsCode - 2);
+    } else if (bsCode == 6) {
+        header.blockSize = data[p++] + 1u;
+    } else if (bsCode == 7) {
+        header.blockSize = ((unsigned) data[p] << 8 | data[p + 1]) + 1u;
+        p += 2;
+    } else {
+        header.blockSize = 256u << (bsCode - 8);
+    }
+    /* sample rate */
+    static const unsigned rates[12] = {0, 88200, 176400, 192000, 8000, 16000, 22050,
+                                       24000, 32000, 44100, 48000, 96000};
+    if (srCode < 12) {
+        header.sampleRate = srCode ? rates[srCode] : streamInfo.sampleRate;
+    } else if (srCode == 12) {
+        header.sampleRate = data[p++] * 1000u;
+    } else {
+        header.sampleRate = (unsigned) data[p] << 8 | data[p + 1];
+        if (srCode == 14) header.sampleRate *= 10;
+        p += 2;
+    }
+    /* channels */
+    header.channelAssignment = chCode;
+    header.channels = chCode < FLAC_CHANNEL_LEFT_SIDE ? chCode + 1 : 2;
+    /* sample size */
+    static const unsigned sizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    header.bitsPerSample = ssCode ? sizes[ssCode] : streamInfo.bitsPerSample;
+    /* CRC-8 of everything up to here */
+    if (p >= size) return EILSEQ;
+    if (flacCrc8(data, p) != data[p]) return EILSEQ;
+    p++;
+    header.headerBytes = (unsigned) p;
+    if (header.variableBlockSize) {
+        header.firstSample = number;
+    } else {
+        header.firstSample = number * (streamInfo.maxBlockSize ?
+                                       streamInfo.maxBlockSize : header.blockSize);
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------
+FlacDecoder::FlacDecoder() : stream(NULL), streamSize(0), firstFrame(0), quiet(false) {}
+
+int flacParseMetadata(const uint8_t *data, size_t size, FlacStreamInfo &info,
+                      std::vector<FlacSeekPoint> *seekTable, size_t &audioOffset) {
+    if (seekTable) seekTable->clear();
+    size_t p = 0;
+    /* skip an ID3v2 tag which some tools put in front of the stream */
+    if (size >= 10 && !memcmp(data, "ID3", 3)) {
+        p = 10 + (((size_t) data[6] & 0x7F) << 21 | ((size_t) data[7] & 0x7F) << 14 |
+                  ((size_t) data[8] & 0x7F) << 7 | ((size_t) data[9] & 0x7F));
+    }
+    if (p + 4 > size || memcmp(data + p, "fLaC", 4)) {
+        LOGE("Not a flac stream");
+        return EILSEQ;
+    }
+    p += 4;
+    bool haveStreamInfo = false;
+    bool last = false;
+    while (!last) {
+        if (p + 4 > size) return EILSEQ;
+        last = (data[p] & 0x80) != 0;
+        const unsigned type = data[p] & 0x7F;
+        const size_t len = be24(data + p + 1);
+        p += 4;
+        if (p + len > size) return EILSEQ;
+        const uint8_t *b = data + p;
+        if (type == FLAC_METADATA_STREAMINFO) {
+            if (len < 34) return EILSEQ;
+            info.minBlockSize = (unsigned) b[0] << 8 | b[1];
+            info.maxBlockSize = (unsigned) b[2] << 8 | b[3];
+            info.minFrameSize = be24(b + 4);
+            info.maxFrameSize = be24(b + 7);
+            info.sampleRate = (unsigned) b[10] << 12 | (unsigned) b[11] << 4 | b[12] >> 4;
+            info.channels = ((b[12] >> 1) & 0x07) + 1u;
+            info.bitsPerSample = (((b[12] & 1) << 4) | (b[13] >> 4)) + 1u;
+            info.totalSamples = ((uint64_t) (b[13] & 0x0F) << 32) |
+                                ((uint64_t) b[14] << 24) | ((uint64_t) b[15] << 16) |
+                                ((uint64_t) b[16] << 8) | b[17];
+            memcpy(info.md5, b + 18, 16);
+            haveStreamInfo = true;
+        } else if (type == FLAC_METADATA_SEEKTABLE && seekTable) {
+            for (size_t i = 0; i + 18 <= len; i += 18) {
+                FlacSeekPoint sp;
+                sp.sampleNumber = be64(b + i);
+                sp.streamOffset = be64(b + i + 8);
+                sp.frameSamples = (unsigned) b[i + 16] << 8 | b[i + 17];
+                if (sp.sampleNumber != FLAC_SEEKPOINT_PLACEHOLDER) {
+                    seekTable->push_back(sp);
+                }
+            }
+        }
+        p += len;
+    }
+    if (!haveStreamInfo) {
+        LOGE("STREAMINFO missing");
+        return EILSEQ;
+    }
+    audioOffset = p;
+    return 0;
+}
+
+//-----------------------------------------------------------------
+int FlacDecoder::open(const uint8_t *data, size_t size) {
+    stream = data;
+    streamSize = size;
+    int r = flacParseMetadata(data, size, info, &seekPoints, firstFrame);
+    if (r) return r;
+    if (info.bitsPerSample < 4 || info.bitsPerSample > 24) {
+        LOGE("Unsupported sample size of %u bits", info.bitsPerSample);
+        return EINVAL;
+    }
+    const unsigned maxBlock = info.maxBlockSize >= 16 ? info.maxBlockSize : FLAC_MAX_BLOCK_SIZE;
+    for (unsigned ch = 0; ch < FLAC_MAX_CHANNELS; ch++) {
+        samples[ch].assign(ch < info.channels ? maxBlock : 0, 0);
+    }
+    LOGV("flac stream: %u Hz, %u channels, %u bits, %llu samples",
+         info.sampleRate, info.channels, info.bitsPerSample,
+         (unsigned long long) info.totalSamples);
+    return 0;
+}
+
+//-----------------------------------------------------------------
+int FlacDecoder::decodeFrame(size_t &pos, FlacFrameHeader &header) {
+    if (pos >= streamSize) return EILSEQ;
+    const uint8_t *frame = stream + pos;
+    const size_t avail = streamSize - pos;
+    int r = flacParseFrameHeader(frame, avail, info, header);
+    if (r) {
+        if (!quiet) LOGE("Invalid frame header at offset %zu", pos);
+        return r;
+    }
+    if (header.blockSize > samples[0].size()) {
+        /* the STREAMINFO lied about the maximum block size */
+        for (unsigned ch = 0; ch < info.channels; ch++) {
+            samples[ch].resize(header.blockSize);
+        }
+    }
+    if (header.channels != info.channels || header.bitsPerSample > 24 ||
+        header.bitsPerSample == 0) {
+        if (!quiet) LOGE("Frame at offset %zu does not match STREAMINFO", pos);
+        return EILSEQ;
+    }
+    FlacBitReader br(frame + header.headerBytes, avail - header.headerBytes);
+    for (unsigned ch = 0; ch < header.channels; ch++) {
+        unsigned bps = header.bitsPerSample;
+        /* the side channel needs one extra bit */
+        if ((header.channelAssignment == FLAC_CHANNEL_LEFT_SIDE && ch == 1) ||
+            (header.channelAssignment == FLAC_CHANNEL_RIGHT_SIDE && ch == 0) ||
+            (header.channelAssignment == FLAC_CHANNEL_MID_SIDE && ch == 1)) {
+            bps++;
+        }
+        r = decodeSubframe(br, header, bps, &samples[ch][0]);
+        if (r) {
+            if (!quiet) LOGE("Corrupt subframe %u in frame at offset %zu", ch, pos);
+            return r;
+        }
+    }
+    br.alignToByte();
+    const size_t crcPos = header.headerBytes + br.bytePos();
+    if (br.overrun || crcPos + 2 > avail) {
+        if (!quiet) LOGE("Truncated frame at offset %zu", pos);
+        return EILSEQ;
+    }
+    const uint16_t crc = (uint16_t) (frame[crcPos] << 8 | frame[crcPos + 1]);
+    if (flacCrc16(frame, crcPos) != crc) {
+        if (!quiet) LOGE("CRC error in frame at offset %zu", pos);
+        return EILSEQ;
+    }
+    /* undo the inter channel decorrelation */
+    const unsigned n = header.blockSize;
+    int32_t *a = &samples[0][0];
+    int32_t *b = header.channels > 1 ? &samples[1][0] : NULL;
+    switch (header.channelAssignment) {
+        case FLAC_CHANNEL_LEFT_SIDE:
+            for (unsigned i = 0; i < n; i++) b[i] = a[i] - b[i];
+            break;
+        case FLAC_CHANNEL_RIGHT_SIDE:
+            for (unsigned i = 0; i < n; i++) a[i] += b[i];
+            break;
+        case FLAC_CHANNEL_MID_SIDE:
+            for (unsigned i = 0; i < n; i++) {
+                const int32_t side = b[i];
+                const int32_t mid = (int32_t) ((uint32_t) a[i] << 1) | (side & 1);
+                a[i] = (mid + side) >> 1;
+                b[i] = (mid - side) >> 1;
+            }
+            break;
+        default:
+            break;
+    }
+    pos += crcPos + 2;
+    return 0;
+}
+
+/* true if v is a signed sample of bps bits */
+static inline bool fitsBits(int64_t v, unsigned bps) {
+    const int64_t half = (int64_t) 1 << (bps - 1);
+    return v >= -half && v < half;
+}
+
+int FlacDecoder::decodeSubframe(FlacBitReader &br, const FlacFrameHeader &header,
+                                unsigned bps, int32_t *out) {
+    const unsigned n = header.blockSize;
+    if (br.read(1)) return EILSEQ;
+    const unsigned type = br.read(6);
+    unsigned wasted = 0;
+    if (br.read(1)) {
+        wasted = br.readUnary() + 1;
+        if (wasted >= bps) return EILSEQ;
+        bps -= wasted;
+    }
+    if (type == 0) {
+        /* constant */
+        const int32_t v = br.readSigned(bps);
+        for (unsigned i = 0; i < n; i++) out[i] = v;
+    } else if (type == 1) {
+        /* verbatim */
+        for (unsigned i = 0; i < n; i++) out[i] = br.readSigned(bps);
+    } else if (type >= 8 && type <= 12) {
+        /* fixed predictor */
+        const unsigned order = type - 8;
+        if (order > n) return EILSEQ;
+        for (unsigned i = 0; i < order; i++) out[i] = br.readSigned(bps);
+        int r = decodeResidual(br, n, order, out);
+        if (r) return r;
+        /* the history is within bps bits, so the prediction fits into 64 bits */
+        for (unsigned i = order; i < n; i++) {
+            int64_t v = out[i];
+            switch (order) {
+                case 1:
+                    v += out[i - 1];
+                    break;
+                case 2:
+                    v += 2 * (int64_t) out[i - 1] - out[i - 2];
+                    break;
+                case 3:
+                    v += 3 * ((int64_t) out[i - 1] - out[i - 2]) + out[i - 3];
+                    break;
+                case 4:
+                    v += 4 * ((int64_t) out[i - 1] + out[i - 3]) - 6 * (int64_t) out[i - 2] -
+                         out[i - 4];
+                    break;
+                default:
+                    break;
+            }
+            if (!fitsBits(v, bps)) return EILSEQ;
+            out[i] = (int32_t) v;
+        }
+    } else if (type >= 32) {
+        /* linear prediction */
+        const unsigned order = type - 31;
+        if (order > n) return EILSEQ;
+        for (unsigned i = 0; i < order; i++) out[i] = br.readSigned(bps);
+        const unsigned precision = br.read(4) + 1;
+        if (precision == 16) return EILSEQ;
+        const int shift = br.readSigned(5);
+        if (shift < 0) return EILSEQ;
+        int32_t coefs[32];
+        for (unsigned i = 0; i < order; i++) coefs[i] = br.readSigned(precision);
+        int r = decodeResidual(br, n, order, out);
+        if (r) return r;
+        /* the history is within bps bits, checked sample by sample, so the
+         * prediction fits into 32 bits if bps + precision + 5 <= 32 */
+        if (bps + precision + 5 <= 32) {
+            for (unsigned i = order; i < n; i++) {
+                int32_t sum = 0;
+                const int32_t *hist = out + i;
+                for (unsigned j = 0; j < order; j++) sum += coefs[j] * hist[-1 - (int) j];
+                const int64_t v = (int64_t) out[i] + (sum >> shift);
+                if (!fitsBits(v, bps)) return EILSEQ;
+                out[i] = (int32_t) v;
+            }
+        } else {
+            for (unsigned i = order; i < n; i++) {
+                int64_t sum = 0;
+                const int32_t *hist = out + i;
+                for (unsigned j = 0; j < order; j++)
+                    sum += (int64_t) coefs[j] * hist[-1 - (int) j];
+                const int64_t v = (int64_t) out[i] + (sum >> shift);
+                if (!fitsBits(v, bps)) return EILSEQ;
+                out[i] = (int32_t) v;
+            }
+        }
+    } else {
+        return EILSEQ;
+    }
+    if (br.overrun) return EILSEQ;
+    if (wasted) {
+        for (unsigned i = 0; i < n; i++) out[i] = (int32_t) ((uint32_t) out[i] << wasted);
+    }
+    return 0;
+}
+
+int FlacDecoder::decodeResidual(FlacBitReader &br, unsigned blockSize, unsigned order,
+                                int32_t *out) {
+    const unsigned method = br.read(2);
+    if (method > 1) return EILSEQ;
+    const unsigned paramBits = method ? 5 : 4;
+    const unsigned escape = method ? 31 : 15;
+    const unsigned partitionOrder = br.read(4);
+    const unsigned partitions = 1u << partitionOrder;
+    const unsigned partitionSize = blockSize >> partitionOrder;
+    if ((partitionSize << partitionOrder) != blockSize || partitionSize < order) {
+        return EILSEQ;
+    }
+    unsigned i = order;
+    for (unsigned p = 0; p < partitions; p++) {
+        const unsigned end = (p + 1) * partitionSize;
+        const unsigned param = br.read(paramBits);
+        if (param == escape) {
+            const unsigned bits = br.read(5);
+            for (; i < end; i++) out[i] = br.readSigned(bits);
+        } else {
+            for (; i < end; i++) {
+                const uint32_t v = (br.readUnary() << param) | br.read(param);
+                out[i] = (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+            }
+        }
+        if (br.overrun) return EILSEQ;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------
+void FlacDecoder::toInt16Interleaved(const FlacFrameHeader &header, int16_t *dst) const {
+    const unsigned n = header.blockSize;
+    const unsigned nch = header.channels;
+    const int bps = (int) header.bitsPerSample;
+    for (unsigned ch = 0; ch < nch; ch++) {
+        const int32_t *src = &samples[ch][0];
+        int16_t *d = dst + ch;
+        if (bps == 16) {
+            for (unsigned i = 0; i < n; i++, d += nch) *d = (int16_t) src[i];
+        } else if (bps > 16) {
+            const int s = bps - 16;
+            for (unsigned i = 0; i < n; i++, d += nch) *d = (int16_t) (src[i] >> s);
+        } else {
+            const int s = 16 - bps;
+            for (unsigned i = 0; i < n; i++, d += nch) {
+                *d = (int16_t) (int32_t) ((uint32_t) src[i] << s);
+            }
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_FLAC_DECODER_H
+#define FLAC2RAW_FLAC_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* Maximum number of channels a FLAC stream can have */
+#define FLAC_MAX_CHANNELS 8
+/* Maximum block size of a FLAC frame in samples */
+#define FLAC_MAX_BLOCK_SIZE 65535
+/* Sample number of a placeholder point in the SEEKTABLE */
+#define FLAC_SEEKPOINT_PLACEHOLDER 0xFFFFFFFFFFFFFFFFULL
+
+//-----------------------------------------------------------------
+/* Contents of the mandatory STREAMINFO metadata block */
+typedef struct FlacStreamInfo_ {
+    unsigned minBlockSize = 0;
+    unsigned maxBlockSize = 0;
+    unsigned minFrameSize = 0;
+    unsigned maxFrameSize = 0;
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    unsigned bitsPerSample = 0;
+    /* zero if unknown */
+    uint64_t totalSamples = 0;
+    /* MD5 of the unencoded audio, all zero if unknown */
+    uint8_t md5[16] = {0};
+} FlacStreamInfo;
+
+/* One entry of the SEEKTABLE metadata block */
+typedef struct FlacSeekPoint_ {
+    uint64_t sampleNumber;
+    /* offset in bytes relative to the first frame header */
+    uint64_t streamOffset;
+    unsigned frameSamples;
+} FlacSeekPoint;
+
+/* Decoded header of an audio frame */
+typedef struct FlacFrameHeader_ {
+    unsigned blockSize = 0;
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    unsigned channelAssignment = 0;
+    unsigned bitsPerSample = 0;
+    bool variableBlockSize = false;
+    /* number of the first sample in this frame */
+    uint64_t firstSample = 0;
+    /* length of the header including its CRC-8 */
+    unsigned headerBytes = 0;
+} FlacFrameHeader;
+
+//-----------------------------------------------------------------
+/* CRC-8 (polynomial 0x07) as used by the frame header */
+uint8_t flacCrc8(const uint8_t *data, size_t len);
+
+/* CRC-16 (polynomial 0x8005) as used by the frame footer */
+uint16_t flacCrc16(const uint8_t *data, size_t len);
+
+/* Parses the metadata blocks in front of the audio without decoding anything.
+ * seekTable may be NULL. audioOffset is set to the offset of the first frame. */
+int flacParseMetadata(const uint8_t *data, size_t size, FlacStreamInfo &info,
+                      std::vector<FlacSeekPoint> *seekTable, size_t &audioOffset);
+
+/* Parses the frame header at data and validates its CRC-8. Returns zero on success,
+ * EILSEQ if there is no valid frame header at data. */
+int flacParseFrameHeader(const uint8_t *data, size_t size,
+                         const FlacStreamInfo &streamInfo,
+                         FlacFrameHeader &header);
+
+//-----------------------------------------------------------------
+/* Decodes a FLAC stream which is fully mapped into memory.
+ * All methods return zero on success or an error number. */
+class FlacDecoder {
+public:
+    FlacDecoder();
+
+    /* Parses the metadata blocks of the stream in data */
+    int open(const uint8_t *data, size_t size);
+
+    const FlacStreamInfo &streamInfo() const { return info; }
+
+    const std::vector<FlacSeekPoint> &seekTable() const { return seekPoints; }
+
+    /* Offset of the first audio frame from the start of the stream */
+    size_t audioOffset() const { return firstFrame; }
+
+    /* Decodes the frame starting at byte offset pos and advances pos to the next frame.
+     * The decoded samples are available through channel() afterwards. */
+    int decodeFrame(size_t &pos, FlacFrameHeader &header);
+
+    /* Decoded samples of channel ch of the last frame */
+    const int32_t *channel(unsigned ch) const { return &samples[ch][0]; }
+
+    /* Converts the last decoded frame into interleaved 16 bit samples */
+    void toInt16Interleaved(const FlacFrameHeader &header, int16_t *dst) const;
+
+    const uint8_t *data() const { return stream; }
+
+    /* suppresses error logging, for example when probing for frame boundaries */
+    void setQuiet(bool q) { quiet = q; }
+
+    size_t size() const { return streamSize; }
+
+private:
+    int decodeSubframe(class FlacBitReader &br, const FlacFrameHeader &header,
+                       unsigned bps, int32_t *out);
+
+    int decodeResidual(class FlacBitReader &br, unsigned blockSize, unsigned order,
+                       int32_t *out);
+
+    const uint8_t *stream;
+    size_t streamSize;
+    size_t firstFrame;
+    bool quiet;
+    FlacStreamInfo info;
+    std::vector<FlacSeekPoint> seekPoints;
+    std::vector<int32_t> samples[FLAC_MAX_CHANNELS];
+};
+
+#endif
@@ -19,505 +19,1473 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/time.h>
-#include <fcntl.h>
-#include <SLES/OpenSLES.h>
-#include <SLES/OpenSLES_Android.h>
 #include <sys/types.h>
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
 #include <assert.h>
 #include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder-backend.h"
+#include "opensl-backend.h"
+#include "batch-runner.h"
+#include "ring-pcm-sink.h"
+#include "format-pcm-sink.h"
+#include "resample-pcm-sink.h"
+#include "stream-session.h"
+#include "pcm-cache.h"
+#include "probe.h"
+#include "async-conversion.h"
+#include "flac2raw-log.h"
 
 
 extern "C" {
 
-#define  LOG_TAG    "flac2raw"
+#define CONVERSION_CLASS "uk/me/berndporr/flac2raw/Flac2Raw$Conversion"
 
-// logging
-#include <android/log.h>
+//-----------------------------------------------------------------
+/* Delivers the progress and the end of the asynchronous conversions of a
+ * Flac2Raw instance to their Flac2Raw.ProgressListener. However many
+ * conversions run, there's a single thread attached to the VM. It's started
+ * with the first conversion and polls the positions the conversions store, at
+ * most every progressIntervalMs of each. */
+class ProgressDispatcher {
+public:
+    explicit ProgressDispatcher(JavaVM *vm) : vm(vm), stopping(false), failed(false) {}
 
-// convenience wrappers for debugging
-#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define  LOGV(...)  __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
+    ~ProgressDispatcher() { stop(NULL); }
 
-#define NUM_EXPLICIT_INTERFACES_FOR_PLAYER 3
-/* Size of the decode buffer queue */
-#define NB_BUFFERS_IN_QUEUE 4
-/* Size of each buffer in the queue */
-#define BUFFER_SIZE_IN_SAMPLES 1152 // number of samples per MP3 frame
-#define BUFFER_SIZE_IN_BYTES   (2*BUFFER_SIZE_IN_SAMPLES)
-/* size of the struct to retrieve the PCM format metadata values: the values we're interested in
- * are SLuint32, but it is saved in the data field of a SLMetadataInfo, hence the larger size.
- * Nate that this size is queried and displayed at l.452 for demonstration/test purposes.
- *  */
-#define PCM_METADATA_VALUE_SIZE 32
+    /* conversion and listener (may be NULL) are global references which the
+     * dispatcher deletes after onFinished */
+    void add(JNIEnv *env, const std::shared_ptr<AsyncConversion> &c, jobject conversion,
+             jobject listener, int intervalMs) {
+        Entry e;
+        e.async = c;
+        e.conversion = conversion;
+        e.listener = listener;
+        e.interval = std::chrono::milliseconds(std::max(intervalMs, 1));
+        e.next = std::chrono::steady_clock::now() + e.interval;
+        std::vector<Entry> orphans;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entries.push_back(e);
+            if (failed) {
+                /* without a thread nobody can call the listeners */
+                orphans.swap(entries);
+            } else if (!thread.joinable()) {
+                thread = std::thread(&ProgressDispatcher::run, this);
+            }
+        }
+        changed.notify_all();
+        if (!orphans.empty()) LOGE("No progress thread, the listeners aren't called");
+        for (size_t i = 0; i < orphans.size(); i++) release(env, orphans[i]);
+    }
 
+    /* Delivers the end of the conversions which have finished and ends the
+     * thread, the listeners of the others aren't called anymore. env deletes
+     * what a thread which couldn't attach has left behind. */
+    void stop(JNIEnv *env) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (thread.joinable()) thread.join();
+        if (env) {
+            for (size_t i = 0; i < entries.size(); i++) release(env, entries[i]);
+            entries.clear();
+        }
+    }
+
+private:
+    typedef struct Entry_ {
+        std::shared_ptr<AsyncConversion> async;
+        jobject conversion = NULL;
+        jobject listener = NULL;
+        std::chrono::milliseconds interval;
+        std::chrono::steady_clock::time_point next;
+        int64_t lastPosition = -1;
+        int64_t lastDuration = -1;
+        bool finished = false;
+    } Entry;
+
+    void run() {
+        JNIEnv *env = NULL;
+        JavaVMAttachArgs args;
+        args.version = JNI_VERSION_1_6;
+        args.name = "flac2raw-progress";
+        args.group = NULL;
+        if (vm->AttachCurrentThread(&env, &args) != JNI_OK) {
+            LOGE("Could not attach the progress thread");
+            /* the entries are deleted by the next add() or by stop() */
+            std::lock_guard<std::mutex> guard(lock);
+            failed = true;
+            return;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        for (bool last = false; !last;) {
+            if (!stopping) {
+                auto wakeup = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                for (size_t i = 0; i < entries.size(); i++) {
+                    wakeup = std::min(wakeup, entries[i].next);
+                }
+                changed.wait_until(guard, wakeup);
+            }
+            /* a last round delivers the conversions which have finished */
+            last = stopping;
+            /* the listeners run without the lock so that they can start and close
+             * conversions, starting fails with EBADF once the converter is closing */
+            const auto now = std::chrono::steady_clock::now();
+            std::vector<Entry> due;
+            for (size_t i = 0; i < entries.size();) {
+                Entry &e = entries[i];
+                if (e.async->finished()) {
+                    e.finished = true;
+                    due.push_back(e);
+                    entries.erase(entries.begin() + i);
+                    continue;
+                }
+                if (!last && e.next <= now) {
+                    e.next = now + e.interval;
+                    int64_t position, duration;
+                    e.async->position(position, duration);
+                    if (position != e.lastPosition || duration != e.lastDuration) {
+                        e.lastPosition = position;
+                        e.lastDuration = duration;
+                        due.push_back(e);
+                    }
+                }
+                i++;
+            }
+            guard.unlock();
+            for (size_t i = 0; i < due.size(); i++) deliver(env, due[i]);
+            guard.lock();
+        }
+        for (size_t i = 0; i < entries.size(); i++) release(env, entries[i]);
+        entries.clear();
+        guard.unlock();
+        vm->DetachCurrentThread();
+    }
+
+    void deliver(JNIEnv *env, Entry &e) {
+        if (e.listener) {
+            jclass cls = env->GetObjectClass(e.listener);
+            if (e.finished) {
+                env->CallVoidMethod(e.listener, env->GetMethodID(
+                        cls, "onFinished", "(L" CONVERSION_CLASS ";I)V"),
+                                    e.conversion, (jint) e.async->wait());
+            } else {
+                env->CallVoidMethod(e.listener, env->GetMethodID(
+                        cls, "onProgress", "(L" CONVERSION_CLASS ";JJ)V"),
+                                    e.conversion, (jlong) e.lastPosition, (jlong) e.lastDuration);
+            }
+            if (env->ExceptionCheck()) {
+                LOGE("Exception in a ProgressListener");
+                env->ExceptionClear();
+            }
+            env->DeleteLocalRef(cls);
+        }
+        if (e.finished) release(env, e);
+    }
+
+    static void release(JNIEnv *env, Entry &e) {
+        if (e.listener) env->DeleteGlobalRef(e.listener);
+        env->DeleteGlobalRef(e.conversion);
+        e.listener = NULL;
+        e.conversion = NULL;
+    }
+
+    JavaVM *vm;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<Entry> entries;
+    bool stopping;
+    /* the thread couldn't attach to the VM */
+    bool failed;
+    std::thread thread;
+};
 
 //-----------------------------------------------------------------
-/* Structure keeping all info for a run */
-typedef struct CallbackCntxt_ {
-    SLPlayItf playItf;
-    SLMetadataExtractionItf metaItf;
-    SLuint32 size;
-    SLint8 *pDataBase = NULL;    // Base address of local audio data storage
-    SLint8 *pData = NULL;        // Current address of local audio data storage
-    /* Local storage for decoded audio data */
-    int8_t pcmData[NB_BUFFERS_IN_QUEUE * BUFFER_SIZE_IN_BYTES];
-    /* destination for decoded data */
-    FILE *gFdestination = NULL;
-    /* metadata key index for the PCM format information we want to retrieve */
-    int channelCountKeyIndex = -1;
-    int sampleRateKeyIndex = -1;
-    /* used to query metadata values */
-    SLMetadataInfo *pcmMetaData = NULL;
-    /* we only want to query / display the PCM format once */
-    bool formatQueried = false;
-    /* to signal to the test app the end of the stream to decode has been reached */
-    bool eos = false;
-    /* Used to signal prefetching failures */
-    bool prefetchError = false;
-    /* error number */
-    int error_number = 0;
-} CallbackCntxt;
-
-
-/* used to detect errors likely to have occured when the OpenSL ES framework fails to open
- * a resource, for instance because a file URI is invalid, or an HTTP server doesn't respond.
- */
-#define PREFETCHEVENT_ERROR_CANDIDATE \
-        (SL_PREFETCHEVENT_STATUSCHANGE | SL_PREFETCHEVENT_FILLLEVELCHANGE)
-//-----------------------------------------------------------------
-/* Brute force: Exits the application if an error is encountered */
-#define ExitOnError(x) ExitOnErrorFunc(x,__LINE__)
+/* Native state of a Flac2Raw instance, kept in Flac2Raw.nativeHandle */
+class Flac2RawContext {
+public:
+    Flac2RawContext(JavaVM *vm, unsigned maxPlayers) : dispatcher(vm), openSL(maxPlayers) {}
+
+    ~Flac2RawContext() { shutdown(NULL); }
+
+    /* Cancels the asynchronous conversions and waits for them, they use the
+     * backends. Their listeners get onFinished before the dispatcher stops. */
+    void shutdown(JNIEnv *env) {
+        conversions.close();
+        dispatcher.stop(env);
+    }
+
+    /* Starts convert on a thread of its own, see AsyncConversion. The handle
+     * is stored in the Java Conversion before its listener can be called. Once
+     * shutdown() has begun the handle stays 0 and Java reports EBADF. */
+    void startAsync(JNIEnv *env, const std::function<int(const ConvOptions &)> &convert,
+                    const ConvOptions &opts, const std::string &dst, jobject conversion,
+                    jobject listener) {
+        std::shared_ptr<AsyncConversion> c;
+        if (conversions.start(convert, opts, dst, c)) {
+            LOGE("Flac2Raw is being closed");
+            return;
+        }
+        jclass cls = env->GetObjectClass(conversion);
+        env->SetLongField(conversion, env->GetFieldID(cls, "handle", "J"),
+                          (jlong) (intptr_t) new std::shared_ptr<AsyncConversion>(c));
+        env->DeleteLocalRef(cls);
+        dispatcher.add(env, c, env->NewGlobalRef(conversion),
+                       listener ? env->NewGlobalRef(listener) : NULL, opts.progressIntervalMs);
+    }
+
+    /* Decodes src into sink with the backend and in the format selected in opts */
+    int decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        if (opts.sampleFormat == FLAC2RAW_FORMAT_PCM16 && !opts.downmix) {
+            return decodeResampled(src, sink, opts);
+        }
+        FormatPcmSink format(sink, opts.sampleFormat, opts.downmix);
+        return decodeResampled(src, format, opts);
+    }
+
+    /* Decodes every channel of src into its own sink */
+    int decodePlanar(const DecodeSource &src, const std::vector<PcmSink *> &sinks,
+                     const ConvOptions &opts) {
+        FormatPcmSink format(sinks, opts.sampleFormat, opts.downmix);
+        return decodeResampled(src, format, opts);
+    }
+
+    /* Decodes src into sink at the rate selected in opts */
+    int decodeResampled(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        if (opts.resampleToHz <= 0) return decodePcm16(src, sink, opts);
+        ResamplePcmSink resample(sink, (unsigned) opts.resampleToHz);
+        return decodePcm16(src, resample, opts);
+    }
+
+    /* Decodes src into sink with the backend selected in opts, timed if opts ask
+     * for it and stopped if an asynchronous conversion is cancelled */
+    int decodePcm16(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        if (opts.monitor) {
+            /* the platform decoder reports its position itself */
+            MonitorPcmSink monitored(sink, *opts.monitor, opts.backend != FLAC2RAW_BACKEND_OPENSL);
+            return decodeTimed(src, monitored, opts);
+        }
+        return decodeTimed(src, sink, opts);
+    }
 
-void ExitOnErrorFunc(SLresult result, int line) {
-    if (SL_RESULT_SUCCESS != result) {
-        LOGE("Error code %u encountered at line %d, exiting", result, line);
-        exit(EXIT_FAILURE);
+    int decodeTimed(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        if (NULL == opts.stats) return decodeWith(src, sink, opts);
+        StatsPcmSink stats(sink, *opts.stats);
+        int r = decodeWith(src, stats, opts);
+        stats.finish();
+        return r;
     }
+
+    int decodeWith(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        switch (opts.backend) {
+            case FLAC2RAW_BACKEND_OPENSL:
+                return openSL.decode(src, sink, opts);
+            case FLAC2RAW_BACKEND_NATIVE:
+                return native.decode(src, sink, opts);
+            default:
+                LOGE("Unknown backend %d", opts.backend);
+                return EINVAL;
+        }
+    }
+
+    /* Starts a streaming session on src, src.fd is then owned by the session */
+    StreamSession *openStream(const DecodeSource &src, const ConvOptions &opts) {
+        StreamSession *session = new StreamSession((size_t) std::max(opts.streamBufferBytes, 2));
+        switch (opts.backend) {
+            case FLAC2RAW_BACKEND_OPENSL:
+                session->start(openSL, src, opts, true);
+                break;
+            case FLAC2RAW_BACKEND_NATIVE:
+                session->start(native, src, opts, true);
+                break;
+            default:
+                LOGE("Unknown backend %d", opts.backend);
+                if (src.type == DecodeSource::FD) close(src.fd);
+                session->fail(EINVAL);
+        }
+        return session;
+    }
+
+    /* Runs a conversion from src to the raw file dst, or copies it from the cache */
+    int convert(const DecodeSource &src, const char *dst, const ConvOptions &opts) {
+        return cachedConvert(src, dst, opts, [&]() { return convertUncached(src, dst, opts); });
+    }
+
+    int convertUncached(const DecodeSource &src, const char *dst, const ConvOptions &opts) {
+        if (opts.container == FLAC2RAW_CONTAINER_CHUNKED) {
+            ChunkedPcmSink chunked(opts.sampleFormat, (size_t) std::max(opts.chunkBytes, 1));
+            int r = chunked.open(dst, opts.resume);
+            if (!r) r = decodeToFile(src, chunked, opts);
+            /* a failed conversion keeps its chunks without an index for a resume */
+            if (!r) r = chunked.finish();
+            return r;
+        }
+        FilePcmSink sink;
+        int r = sink.open(dst, opts.outputMode);
+        if (r) return r;
+        return decodeToFile(src, sink, opts);
+    }
+
+    /* Decodes src into a file sink, through a writer thread if opts ask for it */
+    int decodeToFile(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+        if (opts.ringBufferBytes <= 0) return decode(src, sink, opts);
+        RingPcmSink ring(sink, (size_t) opts.ringBufferBytes, (size_t) opts.writeChunkBytes);
+        int r = decode(src, ring, opts);
+        /* drains what is left if the backend has given up before end() */
+        ring.end();
+        addWriterStats(ring.stats());
+        return r;
+    }
+
+    /* accumulated over all conversions through the ring */
+    RingStats writerStats() {
+        std::lock_guard<std::mutex> guard(statsLock);
+        return ringStats;
+    }
+
+    uint64_t writerConversions() {
+        std::lock_guard<std::mutex> guard(statsLock);
+        return ringConversions;
+    }
+
+private:
+    void addWriterStats(const RingStats &s) {
+        std::lock_guard<std::mutex> guard(statsLock);
+        ringConversions++;
+        ringStats.capacityBytes = std::max(ringStats.capacityBytes, s.capacityBytes);
+        ringStats.highWaterBytes = std::max(ringStats.highWaterBytes, s.highWaterBytes);
+        ringStats.producerStalls += s.producerStalls;
+        ringStats.writes += s.writes;
+        ringStats.bytesWritten += s.bytesWritten;
+    }
+
+    std::mutex statsLock;
+    RingStats ringStats;
+    uint64_t ringConversions = 0;
+
+    ProgressDispatcher dispatcher;
+    AsyncConversions conversions;
+
+    OpenSLBackend openSL;
+    NativeFlacBackend native;
+};
+
+static Flac2RawContext *getContext(JNIEnv *env, jobject thiz) {
+    jclass cls = env->GetObjectClass(thiz);
+    jlong handle = env->GetLongField(thiz, env->GetFieldID(cls, "nativeHandle", "J"));
+    env->DeleteLocalRef(cls);
+    return (Flac2RawContext *) (intptr_t) handle;
 }
 
-//-----------------------------------------------------------------
-/* Callback for "prefetch" events, here used to detect audio resource opening errors */
-void PrefetchEventCallback(SLPrefetchStatusItf caller, void *pContext, SLuint32 event) {
-    SLpermille level = 0;
-    SLresult result;
-    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
-    result = (*caller)->GetFillLevel(caller, &level);
-    ExitOnError(result);
-    SLuint32 status;
-    LOGV("PrefetchEventCallback: received event %u", event);
-    result = (*caller)->GetPrefetchStatus(caller, &status);
-    ExitOnError(result);
-    if ((PREFETCHEVENT_ERROR_CANDIDATE == (event & PREFETCHEVENT_ERROR_CANDIDATE))
-        && (level == 0) && (status == SL_PREFETCHSTATUS_UNDERFLOW)) {
-        LOGE("PrefetchEventCallback: Error while prefetching data, exiting");
-        pCntxt->prefetchError = true;
-        pCntxt->eos = true;
-        pCntxt->error_number = -1;
-    }
-}
-
-/* Callback for "playback" events, i.e. event happening during decoding */
-void DecProgressCallback(
-        SLPlayItf caller,
-        void *pContext,
-        SLuint32 event) {
-    SLresult result;
-    SLmillisecond msec;
-    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
-    result = (*caller)->GetPosition(caller, &msec);
-    ExitOnError(result);
-    if (SL_PLAYEVENT_HEADATEND & event) {
-        LOGV("SL_PLAYEVENT_HEADATEND current position=%u ms", msec);
-        pCntxt->eos = true;
-        pCntxt->error_number = 0;
+/* Reads a String field, null leaves s unchanged */
+static void readStringField(JNIEnv *env, jobject obj, jclass cls, const char *name,
+                            std::string &s) {
+    jstring str = (jstring) env->GetObjectField(obj, env->GetFieldID(cls, name,
+                                                                      "Ljava/lang/String;"));
+    if (NULL == str) return;
+    const char *utf = env->GetStringUTFChars(str, NULL);
+    s = utf;
+    env->ReleaseStringUTFChars(str, utf);
+    env->DeleteLocalRef(str);
+}
+
+/* Copies the fields of a Flac2Raw.Options object into opts */
+static void readOptions(JNIEnv *env, jobject options, ConvOptions &opts) {
+    if (NULL == options) return;
+    jclass cls = env->GetObjectClass(options);
+    opts.backend = env->GetIntField(options, env->GetFieldID(cls, "backend", "I"));
+    opts.samplingRateHz = env->GetIntField(options,
+                                           env->GetFieldID(cls, "samplingRateHz", "I"));
+    opts.verifyMd5 = env->GetBooleanField(options,
+                                          env->GetFieldID(cls, "verifyMd5", "Z")) != 0;
+    opts.numThreads = env->GetIntField(options, env->GetFieldID(cls, "numThreads", "I"));
+    opts.prefetchTimeoutMs = env->GetIntField(options,
+                                              env->GetFieldID(cls, "prefetchTimeoutMs", "I"));
+    opts.numBuffers = env->GetIntField(options, env->GetFieldID(cls, "numBuffers", "I"));
+    opts.bufferSizeSamples = env->GetIntField(options,
+                                              env->GetFieldID(cls, "bufferSizeSamples", "I"));
+    opts.streamBufferBytes = env->GetIntField(options,
+                                              env->GetFieldID(cls, "streamBufferBytes", "I"));
+    opts.ringBufferBytes = env->GetIntField(options,
+                                            env->GetFieldID(cls, "ringBufferBytes", "I"));
+    opts.writeChunkBytes = env->GetIntField(options,
+                                            env->GetFieldID(cls, "writeChunkBytes", "I"));
+    opts.sampleFormat = env->GetIntField(options, env->GetFieldID(cls, "sampleFormat", "I"));
+    opts.downmix = env->GetBooleanField(options,
+                                        env->GetFieldID(cls, "downmixToMono", "Z")) != 0;
+    opts.resampleToHz = env->GetIntField(options, env->GetFieldID(cls, "resampleToHz", "I"));
+    opts.startMs = env->GetLongField(options, env->GetFieldID(cls, "startMs", "J"));
+    opts.endMs = env->GetLongField(options, env->GetFieldID(cls, "endMs", "J"));
+    readStringField(env, options, cls, "seekIndexDir", opts.seekIndexDir);
+    readStringField(env, options, cls, "cacheDir", opts.cacheDir);
+    opts.cacheMaxBytes = env->GetLongField(options, env->GetFieldID(cls, "cacheMaxBytes", "J"));
+    opts.outputMode = env->GetIntField(options, env->GetFieldID(cls, "outputMode", "I"));
+    opts.container = env->GetIntField(options, env->GetFieldID(cls, "container", "I"));
+    opts.chunkBytes = env->GetIntField(options, env->GetFieldID(cls, "chunkBytes", "I"));
+    opts.resume = env->GetBooleanField(options, env->GetFieldID(cls, "resume", "Z")) == JNI_TRUE;
+    opts.progressIntervalMs = env->GetIntField(options,
+                                               env->GetFieldID(cls, "progressIntervalMs", "I"));
+    env->DeleteLocalRef(cls);
+}
+
+/* The platform decoder gives up the whole process if it can't open the source
+ * so check it before */
+static int checkReadable(const char *path) {
+    FILE *fsrc = fopen(path, "r");
+    if (fsrc == NULL) {
+        LOGE("Could not read from the phone memory: >>%s<<", path);
+        return errno;
     }
+    fclose(fsrc);
+    return 0;
 }
-//-----------------------------------------------------------------
-/* Callback for decoding buffer queue events */
-void DecPlayCallback(
-        SLAndroidSimpleBufferQueueItf queueItf,
-        void *pContext) {
-    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
-    /* Save the decoded data  */
-    if (pCntxt == NULL) return;
-    if (fwrite(pCntxt->pDataBase, 1, BUFFER_SIZE_IN_BYTES, pCntxt->gFdestination) <
-        BUFFER_SIZE_IN_BYTES) {
-        LOGE("Error writing to output file, signaling EOS");
-        pCntxt->eos = true;
-        pCntxt->error_number = errno;
-        return;
+
+static int file2File(JNIEnv *env, jobject thiz, jstring fFlac, jstring fRaw,
+                     const ConvOptions &opts) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return EBADF;
     }
-    /* Increase data pointer by buffer size */
-    pCntxt->pData += BUFFER_SIZE_IN_BYTES;
-    if (pCntxt->pData >= pCntxt->pDataBase + (NB_BUFFERS_IN_QUEUE * BUFFER_SIZE_IN_BYTES)) {
-        pCntxt->pData = pCntxt->pDataBase;
-    }
-    ExitOnError((*queueItf)->Enqueue(queueItf, pCntxt->pDataBase, BUFFER_SIZE_IN_BYTES));
-    // Note: adding a sleep here or any sync point is a way to slow down the decoding, or
-    //  synchronize it with some other event, as the OpenSL ES framework will block until the
-    //  buffer queue callback return to proceed with the decoding.
-    /* Example: query of the decoded PCM format */
-    if (pCntxt->formatQueried) {
-        return;
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+
+    int r = checkReadable(fFlacUTF);
+    if (r) {
+        env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+        env->ReleaseStringUTFChars(fRaw, fRawUTF);
+        return r;
+    }
+
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = fFlacUTF;
+    r = context->convert(src, fRawUTF, opts);
+
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    env->ReleaseStringUTFChars(fRaw, fRawUTF);
+
+    return r;
+}
+
+/* Opens an asset as a file descriptor with its byte range, returns the fd or -1
+ * if the asset doesn't exist */
+static int openAsset(JNIEnv *env, jobject assetManager, const char *name, DecodeSource &src) {
+    // use asset manager to open asset by filename
+    AAssetManager *mgr = AAssetManager_fromJava(env, assetManager);
+    assert(NULL != mgr);
+    AAsset *asset = AAssetManager_open(mgr, name, AASSET_MODE_UNKNOWN);
+
+    // the asset might not be found
+    if (NULL == asset) return -1;
+
+    // open asset as file descriptor
+    off_t start, length;
+    int fd = AAsset_openFileDescriptor(asset, &start, &length);
+    assert(0 <= fd);
+    AAsset_close(asset);
+
+    src.type = DecodeSource::FD;
+    src.fd = fd;
+    src.start = start;
+    src.length = length;
+    return fd;
+}
+
+static int asset2File(JNIEnv *env, jobject thiz, jobject assetManager, jstring fFlac,
+                      jstring fRaw, const ConvOptions &opts) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return EBADF;
+    }
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+
+    DecodeSource src;
+    int fd = openAsset(env, assetManager, fFlacUTF, src);
+    if (fd < 0) {
+        env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+        env->ReleaseStringUTFChars(fRaw, fRawUTF);
+        return -1;
     }
-    SLresult res = (*pCntxt->metaItf)->GetValue(pCntxt->metaItf, pCntxt->sampleRateKeyIndex,
-                                                PCM_METADATA_VALUE_SIZE, pCntxt->pcmMetaData);
-    ExitOnError(res);
-    // Note: here we could verify the following:
-    //         pcmMetaData->encoding == SL_CHARACTERENCODING_BINARY
-    //         pcmMetaData->size == sizeof(SLuint32)
-    //       but the call was successful for the PCM format keys, so those conditions are implied
-    LOGV("sample rate = %dHz, ", *((SLuint32 *) pCntxt->pcmMetaData->data));
-    res = (*pCntxt->metaItf)->GetValue(pCntxt->metaItf, pCntxt->channelCountKeyIndex,
-                                       PCM_METADATA_VALUE_SIZE, pCntxt->pcmMetaData);
-    ExitOnError(res);
-    LOGV("channel count = %d", *((SLuint32 *) pCntxt->pcmMetaData->data));
-    pCntxt->formatQueried = true;
+    int r = context->convert(src, fRawUTF, opts);
+    close(fd);
+
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    env->ReleaseStringUTFChars(fRaw, fRawUTF);
+
+    return r;
 }
-//-----------------------------------------------------------------
-/* Decode an audio path by opening a file descriptor on that path  */
-int decToBuffQueue(SLObjectItf sl, SLDataSource *decSource, const char *dst, int samplingRateHz) {
-    CallbackCntxt cntxt;
-    cntxt.gFdestination = fopen(dst, "w");
-    if (NULL == cntxt.gFdestination) {
-        LOGE("Could not write to the phone memory");
-        return errno;
+
+/* Bytes of a frame in the output format of opts */
+static size_t outputFrameBytes(unsigned channels, const ConvOptions &opts) {
+    return sampleFormatBytes(opts.sampleFormat) * (opts.downmix ? 1 : channels);
+}
+
+/* Frames of the output of the time range and at the rate of opts */
+static uint64_t outputFrames(const FlacStreamInfo &info, const ConvOptions &opts) {
+    uint64_t frames = info.totalSamples;
+    uint64_t first;
+    if (isRanged(opts) && rangeFrames(opts, info.sampleRate, info.totalSamples, first, frames)) {
+        return 0;
     }
-    SLresult result;
-    SLEngineItf EngineItf;
-    /* Objects this application uses: one audio player */
-    SLObjectItf player;
-    /* Interfaces for the audio player */
-    SLAndroidSimpleBufferQueueItf decBuffQueueItf;
-    SLPrefetchStatusItf prefetchItf;
-    SLPlayItf playItf;
-    SLMetadataExtractionItf mdExtrItf;
-    /* Data sink for decoded audio */
-    SLDataSink decDest;
-    SLDataLocator_AndroidSimpleBufferQueue decBuffQueue;
-    SLDataFormat_PCM pcm;
-    SLboolean required[NUM_EXPLICIT_INTERFACES_FOR_PLAYER];
-    SLInterfaceID iidArray[NUM_EXPLICIT_INTERFACES_FOR_PLAYER];
-    /* Get the SL Engine Interface which is implicit */
-    result = (*sl)->GetInterface(sl, SL_IID_ENGINE, (void *) &EngineItf);
-    ExitOnError(result);
-    /* Initialize arrays required[] and iidArray[] */
-    for (int i = 0; i < NUM_EXPLICIT_INTERFACES_FOR_PLAYER; i++) {
-        required[i] = SL_BOOLEAN_FALSE;
-        iidArray[i] = SL_IID_NULL;
-    }
-    /* allocate memory to receive the PCM format metadata */
-    if (!(cntxt.pcmMetaData)) {
-        cntxt.pcmMetaData = (SLMetadataInfo *) malloc(PCM_METADATA_VALUE_SIZE);
-    }
-    cntxt.formatQueried = false;
-    /* ------------------------------------------------------ */
-    /* Configuration of the player  */
-    /* Request the AndroidSimpleBufferQueue interface */
-    required[0] = SL_BOOLEAN_TRUE;
-    iidArray[0] = SL_IID_ANDROIDSIMPLEBUFFERQUEUE;
-    /* Request the PrefetchStatus interface */
-    required[1] = SL_BOOLEAN_TRUE;
-    iidArray[1] = SL_IID_PREFETCHSTATUS;
-    /* Request the PrefetchStatus interface */
-    required[2] = SL_BOOLEAN_TRUE;
-    iidArray[2] = SL_IID_METADATAEXTRACTION;
-    /* Setup the data sink */
-    decBuffQueue.locatorType = SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE;
-    decBuffQueue.numBuffers = NB_BUFFERS_IN_QUEUE;
-    /*    set up the format of the data in the buffer queue */
-    pcm.formatType = SL_DATAFORMAT_PCM;
-    // FIXME valid value required but currently ignored
-    pcm.numChannels = 1;
-    switch (samplingRateHz) {
-        case 48000:
-            pcm.samplesPerSec = SL_SAMPLINGRATE_48;
-            break;
-        case 44100:
-            pcm.samplesPerSec = SL_SAMPLINGRATE_44_1;
-            break;
-        case 8000:
-            pcm.samplesPerSec = SL_SAMPLINGRATE_8;
-            break;
-        default:
-            pcm.samplesPerSec = SL_SAMPLINGRATE_48;
-            break;
-    }
-    pcm.bitsPerSample = SL_PCMSAMPLEFORMAT_FIXED_16;
-    pcm.containerSize = 16;
-    pcm.channelMask = SL_SPEAKER_FRONT_CENTER;
-    pcm.endianness = SL_BYTEORDER_LITTLEENDIAN;
-    decDest.pLocator = (void *) &decBuffQueue;
-    decDest.pFormat = (void *) &pcm;
-    /* Create the audio player */
-    result = (*EngineItf)->CreateAudioPlayer(EngineItf, &player, decSource, &decDest,
-                                             NUM_EXPLICIT_INTERFACES_FOR_PLAYER, iidArray,
-                                             required);
-    ExitOnError(result);
-    LOGV("Player created");
-    /* Realize the player in synchronous mode. */
-    result = (*player)->Realize(player, SL_BOOLEAN_FALSE);
-    ExitOnError(result);
-    LOGV("Player realized");
-    /* Get the play interface which is implicit */
-    result = (*player)->GetInterface(player, SL_IID_PLAY, (void *) &playItf);
-    ExitOnError(result);
-    result = (*playItf)->SetCallbackEventsMask(playItf, SL_PLAYEVENT_HEADATEND);
-    ExitOnError(result);
-    result = (*playItf)->RegisterCallback(playItf,
-                                          DecProgressCallback,
-                                          &cntxt);
-    ExitOnError(result);
-    LOGV("Play callback registered");
-    /* Get the buffer queue interface which was explicitly requested */
-    result = (*player)->GetInterface(player, SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
-                                     (void *) &decBuffQueueItf);
-    ExitOnError(result);
-    /* Get the prefetch status interface which was explicitly requested */
-    result = (*player)->GetInterface(player, SL_IID_PREFETCHSTATUS, (void *) &prefetchItf);
-    ExitOnError(result);
-    /* Get the metadata extraction interface which was explicitly requested */
-    result = (*player)->GetInterface(player, SL_IID_METADATAEXTRACTION, (void *) &mdExtrItf);
-    ExitOnError(result);
-    /* ------------------------------------------------------ */
-    /* Initialize the callback and its context for the decoding buffer queue */
-    cntxt.playItf = playItf;
-    cntxt.metaItf = mdExtrItf;
-    cntxt.pDataBase = (int8_t *) &cntxt.pcmData;
-    cntxt.pData = cntxt.pDataBase;
-    cntxt.size = sizeof(cntxt.pcmData);
-    cntxt.error_number = 0;
-    result = (*decBuffQueueItf)->RegisterCallback(decBuffQueueItf,
-                                                  DecPlayCallback,
-                                                  &cntxt);
-    ExitOnError(result);
-    /* Enqueue buffers to map the region of memory allocated to store the decoded data */
-    LOGV("Enqueueing buffer ");
-    for (int i = 0; i < NB_BUFFERS_IN_QUEUE; i++) {
-        result = (*decBuffQueueItf)->Enqueue(decBuffQueueItf, cntxt.pData, BUFFER_SIZE_IN_BYTES);
-        ExitOnError(result);
-        cntxt.pData += BUFFER_SIZE_IN_BYTES;
-    }
-    cntxt.pData = cntxt.pDataBase;
-    /* ------------------------------------------------------ */
-    /* Initialize the callback for prefetch errors, if we can't open the resource to decode */
-    result = (*prefetchItf)->RegisterCallback(prefetchItf, PrefetchEventCallback, &cntxt);
-    ExitOnError(result);
-    result = (*prefetchItf)->SetCallbackEventsMask(prefetchItf, PREFETCHEVENT_ERROR_CANDIDATE);
-    ExitOnError(result);
-    /* ------------------------------------------------------ */
-    /* Prefetch the data so we can get information about the format before starting to decode */
-    /*     1/ cause the player to prefetch the data */
-    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_PAUSED);
-    ExitOnError(result);
-    /*     2/ block until data has been prefetched */
-    SLuint32 prefetchStatus = SL_PREFETCHSTATUS_UNDERFLOW;
-    SLuint32 timeOutIndex = 50; // time out prefetching after 5s
-    while ((prefetchStatus != SL_PREFETCHSTATUS_SUFFICIENTDATA) && (timeOutIndex > 0) &&
-           !(cntxt.prefetchError)) {
-        usleep(10 * 1000);
-        (*prefetchItf)->GetPrefetchStatus(prefetchItf, &prefetchStatus);
-        timeOutIndex--;
-    }
-    if (timeOutIndex == 0 || cntxt.prefetchError) {
-        LOGE("Failure to prefetch data in time, exiting");
-        ExitOnError(SL_RESULT_CONTENT_NOT_FOUND);
-    }
-    /* ------------------------------------------------------ */
-    /* Display duration */
-    SLmillisecond durationInMsec = SL_TIME_UNKNOWN;
-    result = (*playItf)->GetDuration(playItf, &durationInMsec);
-    ExitOnError(result);
-    if (durationInMsec == SL_TIME_UNKNOWN) {
-        LOGV("Content duration is unknown");
-    } else {
-        LOGV("Content duration is %ums", durationInMsec);
-    }
-    /* ------------------------------------------------------ */
-    /* Display the metadata obtained from the decoder */
-    //   This is for test / demonstration purposes only where we discover the key and value sizes
-    //   of a PCM decoder. An application that would want to directly get access to those values
-    //   can make assumptions about the size of the keys and their matching values (all SLuint32)
-    SLuint32 itemCount;
-    (*mdExtrItf)->GetItemCount(mdExtrItf, &itemCount);
-    SLuint32 i, keySize, valueSize;
-    SLMetadataInfo *keyInfo;
-    for (i = 0; i < itemCount; i++) {
-        keySize = 0;
-        valueSize = 0;
-        result = (*mdExtrItf)->GetKeySize(mdExtrItf, i, &keySize);
-        ExitOnError(result);
-        result = (*mdExtrItf)->GetValueSize(mdExtrItf, i, &valueSize);
-        ExitOnError(result);
-        keyInfo = (SLMetadataInfo *) malloc(keySize);
-        if (NULL != keyInfo) {
-            result = (*mdExtrItf)->GetKey(mdExtrItf, i, keySize, keyInfo);
-            ExitOnError(result);
-            LOGV("key[%d] size=%d, name=%s \tvalue size=%d",
-                 i, keyInfo->size, keyInfo->data, valueSize);
-            /* find out the key index of the metadata we're interested in */
-            if (!strcmp((char *) keyInfo->data, ANDROID_KEY_PCMFORMAT_NUMCHANNELS)) {
-                cntxt.channelCountKeyIndex = i;
-            } else if (!strcmp((char *) keyInfo->data, ANDROID_KEY_PCMFORMAT_SAMPLERATE)) {
-                cntxt.sampleRateKeyIndex = i;
-            }
-            free(keyInfo);
+    if (opts.resampleToHz <= 0 || (unsigned) opts.resampleToHz == info.sampleRate) {
+        return frames;
+    }
+    return Resampler::outputFrames(frames, info.sampleRate, (unsigned) opts.resampleToHz);
+}
+
+/* Decodes into a direct buffer of elementSize byte elements. Returns the number
+ * of bytes decoded or the negative error number. */
+static jlong decode2Buffer(JNIEnv *env, jobject thiz, const DecodeSource &src, jobject buffer,
+                           jint elementSize, const ConvOptions &opts) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return -EBADF;
+    }
+    void *addr = env->GetDirectBufferAddress(buffer);
+    const jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (NULL == addr || capacity < 0) {
+        LOGE("Not a direct buffer");
+        return -EINVAL;
+    }
+    BufferPcmSink sink(addr, (size_t) capacity * (size_t) elementSize);
+    int r = context->decode(src, sink, opts);
+    if (r) return -r;
+    size_t bytes = sink.size();
+    /* the platform decoder hands out whole buffers, cut off what's beyond the end */
+    FlacStreamInfo info;
+    if (NativeFlacBackend::probe(src, info) == 0 && info.totalSamples) {
+        bytes = std::min(bytes, (size_t) (outputFrames(info, opts) *
+                                          outputFrameBytes(info.channels, opts)));
+    }
+    return (jlong) bytes;
+}
+
+/* Size of the decoded audio of a flac source in bytes, -1 if it's unknown */
+static jlong decodedSize(const DecodeSource &src) {
+    FlacStreamInfo info;
+    if (NativeFlacBackend::probe(src, info) || 0 == info.totalSamples) return -1;
+    return (jlong) (info.totalSamples * info.channels * sizeof(int16_t));
+}
+
+/* Compressed audio in a byte[] or a direct ByteBuffer as a MEMORY source. The
+ * elements of the array are held until it goes out of scope. */
+class JavaMemory {
+public:
+    JavaMemory(JNIEnv *env, jbyteArray array, jobject buffer, jint offset, jint length) :
+            error(0), env(env), array(array), elements(NULL) {
+        const uint8_t *base = NULL;
+        jlong capacity = 0;
+        if (NULL != array) {
+            elements = env->GetByteArrayElements(array, NULL);
+            base = (const uint8_t *) elements;
+            capacity = env->GetArrayLength(array);
+        } else if (NULL != buffer) {
+            base = (const uint8_t *) env->GetDirectBufferAddress(buffer);
+            capacity = env->GetDirectBufferCapacity(buffer);
+        }
+        if (NULL == base || offset < 0 || length <= 0 || (jlong) offset + length > capacity) {
+            LOGE("Not a byte array or direct buffer with the compressed audio");
+            error = EINVAL;
+            return;
         }
+        src.type = DecodeSource::MEMORY;
+        src.data = base + offset;
+        src.size = (size_t) length;
     }
-    if (cntxt.channelCountKeyIndex != -1) {
-        LOGV("Key %s is at index %d",
-             ANDROID_KEY_PCMFORMAT_NUMCHANNELS, cntxt.channelCountKeyIndex);
-    } else {
-        LOGD("Unable to find key %s", ANDROID_KEY_PCMFORMAT_NUMCHANNELS);
+
+    ~JavaMemory() {
+        /* only read, nothing to copy back */
+        if (elements) env->ReleaseByteArrayElements(array, elements, JNI_ABORT);
     }
-    if (cntxt.sampleRateKeyIndex != -1) {
-        LOGV("Key %s is at index %d",
-             ANDROID_KEY_PCMFORMAT_SAMPLERATE, cntxt.sampleRateKeyIndex);
-    } else {
-        LOGD("Unable to find key %s", ANDROID_KEY_PCMFORMAT_SAMPLERATE);
-    }
-    /* ------------------------------------------------------ */
-    /* Start decoding */
-    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_PLAYING);
-    ExitOnError(result);
-    LOGV("Starting to decode");
-    /* Decode until the end of the stream is reached */
-    {
-        while (!(cntxt.eos)) {
-            usleep(10 * 1000);
+
+    DecodeSource src;
+    int error;
+
+private:
+    JNIEnv *env;
+    jbyteArray array;
+    jbyte *elements;
+};
+
+/* Creates a Flac2Raw.Info from a probe result */
+static jobject newInfo(JNIEnv *env, jclass cls, const ProbeResult &result) {
+    jobject obj = env->NewObject(cls, env->GetMethodID(cls, "<init>", "()V"));
+    if (NULL == obj) return NULL;
+    jstring path = env->NewStringUTF(result.path.c_str());
+    env->SetObjectField(obj, env->GetFieldID(cls, "path", "Ljava/lang/String;"), path);
+    env->DeleteLocalRef(path);
+    env->SetIntField(obj, env->GetFieldID(cls, "error", "I"), result.error);
+    env->SetIntField(obj, env->GetFieldID(cls, "sampleRate", "I"), (jint) result.info.sampleRate);
+    env->SetIntField(obj, env->GetFieldID(cls, "channels", "I"), (jint) result.info.channels);
+    env->SetIntField(obj, env->GetFieldID(cls, "bitsPerSample", "I"),
+                     (jint) result.info.bitsPerSample);
+    env->SetLongField(obj, env->GetFieldID(cls, "totalSamples", "J"),
+                      (jlong) result.info.totalSamples);
+    env->SetLongField(obj, env->GetFieldID(cls, "durationMs", "J"), (jlong) result.durationMs);
+    env->SetIntField(obj, env->GetFieldID(cls, "seekPoints", "I"), (jint) result.seekPoints);
+    env->SetIntField(obj, env->GetFieldID(cls, "minBlockSize", "I"),
+                     (jint) result.info.minBlockSize);
+    env->SetIntField(obj, env->GetFieldID(cls, "maxBlockSize", "I"),
+                     (jint) result.info.maxBlockSize);
+    return obj;
+}
+
+#define INFO_CLASS "uk/me/berndporr/flac2raw/Flac2Raw$Info"
+#define STATS_CLASS "uk/me/berndporr/flac2raw/Flac2Raw$Stats"
+
+/* Times the conversions of a call into the Flac2Raw.Stats of options, if it has
+ * one. The Java object is filled in when this goes out of scope. */
+class JavaStats {
+public:
+    JavaStats(JNIEnv *env, jobject options, ConvOptions &opts) :
+            env(env), object(NULL), startUs(statsNowUs()) {
+        if (NULL == options) return;
+        jclass cls = env->GetObjectClass(options);
+        object = env->GetObjectField(options, env->GetFieldID(cls, "stats", "L" STATS_CLASS ";"));
+        env->DeleteLocalRef(cls);
+        if (NULL != object) opts.stats = &stats;
+    }
+
+    ~JavaStats() {
+        if (NULL == object) return;
+        stats.wallUs = statsNowUs() - startUs;
+        if (0 == stats.conversions) stats.conversions = 1;
+        jclass cls = env->GetObjectClass(object);
+        env->SetLongField(object, env->GetFieldID(cls, "conversions", "J"),
+                          (jlong) stats.conversions);
+        env->SetLongField(object, env->GetFieldID(cls, "prefetchUs", "J"), stats.prefetchUs);
+        env->SetLongField(object, env->GetFieldID(cls, "firstBufferUs", "J"),
+                          stats.firstBufferUs);
+        env->SetLongField(object, env->GetFieldID(cls, "wallUs", "J"), stats.wallUs);
+        env->SetLongField(object, env->GetFieldID(cls, "callbacks", "J"), (jlong) stats.callbacks);
+        jlongArray histogram = env->NewLongArray(CONV_STATS_BUCKETS);
+        if (NULL != histogram) {
+            jlong h[CONV_STATS_BUCKETS];
+            for (int i = 0; i < CONV_STATS_BUCKETS; i++) h[i] = (jlong) stats.intervalHistogram[i];
+            env->SetLongArrayRegion(histogram, 0, CONV_STATS_BUCKETS, h);
+            env->SetObjectField(object, env->GetFieldID(cls, "intervalHistogram", "[J"), histogram);
+            env->DeleteLocalRef(histogram);
         }
+        env->SetLongField(object, env->GetFieldID(cls, "maxIntervalUs", "J"), stats.maxIntervalUs);
+        env->SetDoubleField(object, env->GetFieldID(cls, "meanIntervalUs", "D"),
+                            meanIntervalUs(stats));
+        env->SetDoubleField(object, env->GetFieldID(cls, "intervalJitterUs", "D"),
+                            intervalJitterUs(stats));
+        env->SetLongField(object, env->GetFieldID(cls, "writeBlockedUs", "J"),
+                          stats.writeBlockedUs);
+        env->SetLongField(object, env->GetFieldID(cls, "bytesWritten", "J"),
+                          (jlong) stats.bytesWritten);
+        env->SetDoubleField(object, env->GetFieldID(cls, "audioSeconds", "D"), stats.audioSeconds);
+        env->SetDoubleField(object, env->GetFieldID(cls, "realtimeFactor", "D"),
+                            realtimeFactor(stats));
+        env->DeleteLocalRef(cls);
+        env->DeleteLocalRef(object);
+    }
+
+private:
+    JNIEnv *env;
+    jobject object;
+    int64_t startUs;
+    ConvStats stats;
+};
+
+static jintArray files2Files(JNIEnv *env, jobject thiz, jobjectArray fFlacs,
+                             jobjectArray fRaws, const ConvOptions &opts,
+                             unsigned maxConcurrency) {
+    const jsize n = env->GetArrayLength(fFlacs);
+    std::vector<BatchJob> jobs(n);
+    for (jsize i = 0; i < n; i++) {
+        jstring fFlac = (jstring) env->GetObjectArrayElement(fFlacs, i);
+        jstring fRaw = (jstring) env->GetObjectArrayElement(fRaws, i);
+        const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+        const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+        jobs[i].src = fFlacUTF;
+        jobs[i].dst = fRawUTF;
+        env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+        env->ReleaseStringUTFChars(fRaw, fRawUTF);
+        env->DeleteLocalRef(fFlac);
+        env->DeleteLocalRef(fRaw);
     }
-    LOGV("EOS signaled");
-    /* ------------------------------------------------------ */
-    /* End of decoding */
-    /* Stop decoding */
-    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_STOPPED);
-    ExitOnError(result);
-    LOGV("Stopped decoding");
-    /* Destroy the AudioPlayer object */
-    (*player)->Destroy(player);
 
-    fclose(cntxt.gFdestination);
-    free(cntxt.pcmMetaData);
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        for (jsize i = 0; i < n; i++) jobs[i].result = EBADF;
+    } else {
+        /* the conversions run concurrently, each is timed on its own */
+        std::vector<ConvStats> jobStats(opts.stats ? jobs.size() : 0);
+        runBatch(jobs, maxConcurrency, [context, &opts, &jobs, &jobStats](BatchJob &job) {
+            int r = checkReadable(job.src.c_str());
+            if (r) return r;
+            DecodeSource src;
+            src.type = DecodeSource::URI;
+            src.path = job.src.c_str();
+            if (jobStats.empty()) return context->convert(src, job.dst.c_str(), opts);
+            ConvOptions jobOpts = opts;
+            jobOpts.stats = &jobStats[&job - &jobs[0]];
+            jobOpts.stats->conversions = 1;
+            return context->convert(src, job.dst.c_str(), jobOpts);
+        });
+        for (size_t i = 0; i < jobStats.size(); i++) mergeStats(*opts.stats, jobStats[i]);
+    }
+
+    jintArray results = env->NewIntArray(n);
+    if (NULL == results) return NULL;
+    std::vector<jint> r(n);
+    for (jsize i = 0; i < n; i++) r[i] = jobs[i].result;
+    if (n) env->SetIntArrayRegion(results, 0, n, &r[0]);
+    return results;
+}
+
+//-----------------------------------------------------------------
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_nativeCreate(JNIEnv *env,
+                                                    jclass,
+                                                    jint maxPlayers) {
+    JavaVM *vm = NULL;
+    env->GetJavaVM(&vm);
+    return (jlong) (intptr_t) new Flac2RawContext(vm, (unsigned) maxPlayers);
+}
 
-    return cntxt.error_number;
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_nativeRelease(JNIEnv *env,
+                                                     jclass,
+                                                     jlong handle) {
+    Flac2RawContext *context = (Flac2RawContext *) (intptr_t) handle;
+    context->shutdown(env);
+    delete context;
 }
 
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_fillWriterStats(JNIEnv *env,
+                                                       jobject thiz,
+                                                       jobject stats) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) return;
+    const RingStats s = context->writerStats();
+    jclass cls = env->GetObjectClass(stats);
+    env->SetLongField(stats, env->GetFieldID(cls, "conversions", "J"),
+                      (jlong) context->writerConversions());
+    env->SetIntField(stats, env->GetFieldID(cls, "capacityBytes", "I"), (jint) s.capacityBytes);
+    env->SetIntField(stats, env->GetFieldID(cls, "highWaterBytes", "I"), (jint) s.highWaterBytes);
+    env->SetLongField(stats, env->GetFieldID(cls, "producerStalls", "J"),
+                      (jlong) s.producerStalls);
+    env->SetLongField(stats, env->GetFieldID(cls, "writes", "J"), (jlong) s.writes);
+    env->SetLongField(stats, env->GetFieldID(cls, "bytesWritten", "J"), (jlong) s.bytesWritten);
+    env->DeleteLocalRef(cls);
+}
 
 //-----------------------------------------------------------------
 jint
 Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFile2File(JNIEnv *env,
-                                                           jclass,
+                                                           jobject thiz,
                                                            jstring fFlac,
                                                            jstring fRaw,
                                                            jint samplingRateHz) {
-    SLresult result;
-    SLObjectItf sl;
-    SLEngineOption EngineOption[] = {
-            {(SLuint32) SL_ENGINEOPTION_THREADSAFE, (SLuint32) SL_BOOLEAN_TRUE}
-    };
+    ConvOptions opts;
+    opts.samplingRateHz = samplingRateHz;
+    return file2File(env, thiz, fFlac, fRaw, opts);
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFile2FileWithOptions(JNIEnv *env,
+                                                                      jobject thiz,
+                                                                      jstring fFlac,
+                                                                      jstring fRaw,
+                                                                      jobject options) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    return file2File(env, thiz, fFlac, fRaw, opts);
+}
+
+//-----------------------------------------------------------------
+jintArray
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFiles2FilesWithOptions(JNIEnv *env,
+                                                                        jobject thiz,
+                                                                        jobjectArray fFlacs,
+                                                                        jobjectArray fRaws,
+                                                                        jobject options,
+                                                                        jint maxConcurrency) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    return files2Files(env, thiz, fFlacs, fRaws, opts,
+                       maxConcurrency > 0 ? (unsigned) maxConcurrency : 0);
+}
+
+//-----------------------------------------------------------------
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFile2BufferWithOptions(JNIEnv *env,
+                                                                        jobject thiz,
+                                                                        jstring fFlac,
+                                                                        jobject buffer,
+                                                                        jint elementSize,
+                                                                        jobject options) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
     const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
-    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+    jlong r = -checkReadable(fFlacUTF);
+    if (0 == r) {
+        DecodeSource src;
+        src.type = DecodeSource::URI;
+        src.path = fFlacUTF;
+        r = decode2Buffer(env, thiz, src, buffer, elementSize, opts);
+    }
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    return r;
+}
 
-    FILE *fsrc = fopen(fFlacUTF, "r");
-    if (fsrc == NULL) {
-        LOGE("Could not read from the phone memory: >>%s<<", fFlacUTF);
-        env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressAsset2BufferWithOptions(JNIEnv *env,
+                                                                         jobject thiz,
+                                                                         jobject assetManager,
+                                                                         jstring fFlac,
+                                                                         jobject buffer,
+                                                                         jint elementSize,
+                                                                         jobject options) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    DecodeSource src;
+    int fd = openAsset(env, assetManager, fFlacUTF, src);
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    if (fd < 0) return -ENOENT;
+    jlong r = decode2Buffer(env, thiz, src, buffer, elementSize, opts);
+    close(fd);
+    return r;
+}
+
+//-----------------------------------------------------------------
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFile2PlanarFilesWithOptions(JNIEnv *env,
+                                                                             jobject thiz,
+                                                                             jstring fFlac,
+                                                                             jobjectArray fRaws,
+                                                                             jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return EBADF;
+    }
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    int r = checkReadable(fFlacUTF);
+    std::vector<std::unique_ptr<FilePcmSink> > files;
+    std::vector<PcmSink *> sinks;
+    const jsize n = env->GetArrayLength(fRaws);
+    for (jsize i = 0; i < n && !r; i++) {
+        jstring fRaw = (jstring) env->GetObjectArrayElement(fRaws, i);
+        const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+        files.push_back(std::unique_ptr<FilePcmSink>(new FilePcmSink()));
+        r = files.back()->open(fRawUTF, opts.outputMode);
+        sinks.push_back(files.back().get());
         env->ReleaseStringUTFChars(fRaw, fRawUTF);
-        return errno;
+        env->DeleteLocalRef(fRaw);
     }
-    fclose(fsrc);
+    if (0 == r) {
+        DecodeSource src;
+        src.type = DecodeSource::URI;
+        src.path = fFlacUTF;
+        r = context->decodePlanar(src, sinks, opts);
+    }
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    return r;
+}
+
+/* Returns the number of bytes decoded into each buffer or the negative error number */
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressFile2PlanarBuffersWithOptions(JNIEnv *env,
+                                                                               jobject thiz,
+                                                                               jstring fFlac,
+                                                                               jobjectArray buffers,
+                                                                               jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return -EBADF;
+    }
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    std::vector<std::unique_ptr<BufferPcmSink> > planes;
+    std::vector<PcmSink *> sinks;
+    const jsize n = env->GetArrayLength(buffers);
+    for (jsize i = 0; i < n; i++) {
+        jobject buffer = env->GetObjectArrayElement(buffers, i);
+        void *addr = env->GetDirectBufferAddress(buffer);
+        const jlong capacity = env->GetDirectBufferCapacity(buffer);
+        env->DeleteLocalRef(buffer);
+        if (NULL == addr || capacity < 0) {
+            LOGE("Not a direct buffer");
+            return -EINVAL;
+        }
+        planes.push_back(std::unique_ptr<BufferPcmSink>(
+                new BufferPcmSink(addr, (size_t) capacity)));
+        sinks.push_back(planes.back().get());
+    }
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    jlong r = -checkReadable(fFlacUTF);
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = fFlacUTF;
+    if (0 == r) r = -context->decodePlanar(src, sinks, opts);
+    if (0 == r) {
+        size_t bytes = planes.empty() ? 0 : planes[0]->size();
+        for (size_t i = 1; i < planes.size(); i++) bytes = std::min(bytes, planes[i]->size());
+        /* the platform decoder hands out whole buffers, cut off what's beyond the end */
+        FlacStreamInfo info;
+        if (NativeFlacBackend::probe(src, info) == 0 && info.totalSamples) {
+            bytes = std::min(bytes, (size_t) outputFrames(info, opts) *
+                                    sampleFormatBytes(opts.sampleFormat));
+        }
+        r = (jlong) bytes;
+    }
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    return r;
+}
+
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_decodedSizeOfFile(JNIEnv *env,
+                                                         jclass,
+                                                         jstring fFlac) {
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = fFlacUTF;
+    jlong r = decodedSize(src);
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    return r;
+}
+
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_decodedSizeOfAsset(JNIEnv *env,
+                                                          jclass,
+                                                          jobject assetManager,
+                                                          jstring fFlac) {
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    DecodeSource src;
+    int fd = openAsset(env, assetManager, fFlacUTF, src);
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    if (fd < 0) return -1;
+    jlong r = decodedSize(src);
+    close(fd);
+    return r;
+}
 
-    /* Source of audio data for the decoding */
-    SLDataSource decSource;
-    SLDataLocator_URI decUri;
-    SLDataFormat_MIME decMime;
+//-----------------------------------------------------------------
+/* A session which has failed before it could start */
+static jlong failedStream(int error) {
+    StreamSession *session = new StreamSession(2);
+    session->fail(error);
+    return (jlong) (intptr_t) session;
+}
 
-    /* Setup the data source */
-    decUri.locatorType = SL_DATALOCATOR_URI;
-    decUri.URI = (SLchar *) fFlacUTF;
-    decMime.formatType = SL_DATAFORMAT_MIME;
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_openStreamFile(JNIEnv *env,
+                                                      jobject thiz,
+                                                      jstring fFlac,
+                                                      jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) return failedStream(EBADF);
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    jlong handle;
+    int r = checkReadable(fFlacUTF);
+    if (r) {
+        handle = failedStream(r);
+    } else {
+        DecodeSource src;
+        src.type = DecodeSource::URI;
+        src.path = fFlacUTF;
+        handle = (jlong) (intptr_t) context->openStream(src, opts);
+    }
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    return handle;
+}
 
-    /*     this is how ignored mime information is specified, according to OpenSL ES spec
-     *     in 9.1.6 SLDataFormat_MIME and 8.23 SLMetadataTraversalItf GetChildInfo */
-    decMime.mimeType = (SLchar *) NULL;
-    decMime.containerType = SL_CONTAINERTYPE_UNSPECIFIED;
-    decSource.pLocator = (void *) &decUri;
-    decSource.pFormat = (void *) &decMime;
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_openStreamAsset(JNIEnv *env,
+                                                       jobject thiz,
+                                                       jobject assetManager,
+                                                       jstring fFlac,
+                                                       jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) return failedStream(EBADF);
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    DecodeSource src;
+    int fd = openAsset(env, assetManager, fFlacUTF, src);
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    if (fd < 0) return failedStream(ENOENT);
+    return (jlong) (intptr_t) context->openStream(src, opts);
+}
 
-    result = slCreateEngine(&sl, 1, EngineOption, 0, NULL, NULL);
-    ExitOnError(result);
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_openStreamFd(JNIEnv *env,
+                                                    jobject thiz,
+                                                    jint fd,
+                                                    jlong offset,
+                                                    jlong length,
+                                                    jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) return failedStream(EBADF);
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    DecodeSource src;
+    src.type = DecodeSource::FD;
+    /* the session closes its own copy, the caller keeps theirs */
+    src.fd = dup(fd);
+    if (src.fd < 0) return failedStream(errno);
+    src.start = (off_t) offset;
+    src.length = (off_t) length;
+    return (jlong) (intptr_t) context->openStream(src, opts);
+}
 
-    /* Realizing the SL Engine in synchronous mode. */
-    result = (*sl)->Realize(sl, SL_BOOLEAN_FALSE);
-    ExitOnError(result);
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeReadShorts(JNIEnv *env,
+                                                                    jclass,
+                                                                    jlong handle,
+                                                                    jshortArray samples,
+                                                                    jint offset,
+                                                                    jint n) {
+    StreamSession *session = (StreamSession *) (intptr_t) handle;
+    /* blocking isn't allowed while holding the array so read into a copy,
+     * Stream.read() serializes the reads which share it */
+    const size_t nBytes = (size_t) std::max(n, 0) * sizeof(jshort);
+    jshort *buf = (jshort *) session->scratch(nBytes);
+    long r = session->read(buf, nBytes);
+    /* the end of the stream and errors, Stream.error() tells them apart */
+    if (r <= 0) return -1;
+    const jint read = (jint) (r / sizeof(jshort));
+    env->SetShortArrayRegion(samples, offset, read, buf);
+    return read;
+}
 
-    int r = decToBuffQueue(sl, &decSource, fRawUTF, samplingRateHz);
-    /* Shutdown OpenSL ES */
-    (*sl)->Destroy(sl);
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeReadBuffer(JNIEnv *env,
+                                                                    jclass,
+                                                                    jlong handle,
+                                                                    jobject buffer,
+                                                                    jint offset,
+                                                                    jint nBytes) {
+    StreamSession *session = (StreamSession *) (intptr_t) handle;
+    uint8_t *addr = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    if (NULL == addr) {
+        LOGE("Not a direct buffer");
+        return -1;
+    }
+    long r = session->read(addr + offset, (size_t) nBytes);
+    return r <= 0 ? -1 : (jint) r;
+}
 
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeError(JNIEnv *,
+                                                               jclass,
+                                                               jlong handle) {
+    return ((StreamSession *) (intptr_t) handle)->error();
+}
+
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeStartupLatencyUs(JNIEnv *,
+                                                                          jclass,
+                                                                          jlong handle) {
+    return ((StreamSession *) (intptr_t) handle)->startupLatencyUs();
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeFormat(JNIEnv *env,
+                                                                jclass,
+                                                                jlong handle,
+                                                                jintArray format) {
+    PcmFormat fmt;
+    int r = ((StreamSession *) (intptr_t) handle)->format(fmt);
+    if (r) return r;
+    const jint values[2] = {(jint) fmt.sampleRate, (jint) fmt.channels};
+    env->SetIntArrayRegion(format, 0, 2, values);
+    return 0;
+}
+
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeCancel(JNIEnv *,
+                                                                jclass,
+                                                                jlong handle) {
+    ((StreamSession *) (intptr_t) handle)->cancel();
+}
+
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Stream_nativeClose(JNIEnv *,
+                                                               jclass,
+                                                               jlong handle) {
+    delete (StreamSession *) (intptr_t) handle;
+}
+
+//-----------------------------------------------------------------
+jobject
+Java_uk_me_berndporr_flac2raw_Flac2Raw_probeFile(JNIEnv *env,
+                                                 jclass,
+                                                 jstring fFlac) {
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    ProbeResult result;
+    result.path = fFlacUTF;
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = fFlacUTF;
+    probeSource(src, result);
     env->ReleaseStringUTFChars(fFlac, fFlacUTF);
-    env->ReleaseStringUTFChars(fRaw, fRawUTF);
+    jclass cls = env->FindClass(INFO_CLASS);
+    jobject info = newInfo(env, cls, result);
+    env->DeleteLocalRef(cls);
+    return info;
+}
 
-    return r;
+jobject
+Java_uk_me_berndporr_flac2raw_Flac2Raw_probeAsset(JNIEnv *env,
+                                                  jclass,
+                                                  jobject assetManager,
+                                                  jstring fFlac) {
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    ProbeResult result;
+    result.path = fFlacUTF;
+    DecodeSource src;
+    int fd = openAsset(env, assetManager, fFlacUTF, src);
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    if (fd < 0) {
+        result.error = ENOENT;
+    } else {
+        probeSource(src, result);
+        close(fd);
+    }
+    jclass cls = env->FindClass(INFO_CLASS);
+    jobject info = newInfo(env, cls, result);
+    env->DeleteLocalRef(cls);
+    return info;
 }
 
+jobjectArray
+Java_uk_me_berndporr_flac2raw_Flac2Raw_probeDirectory(JNIEnv *env,
+                                                      jclass,
+                                                      jstring dir,
+                                                      jint maxConcurrency) {
+    const char *dirUTF = env->GetStringUTFChars(dir, NULL);
+    std::vector<ProbeResult> results;
+    int r = probeDirectory(dirUTF, maxConcurrency > 0 ? (unsigned) maxConcurrency : 0, results);
+    env->ReleaseStringUTFChars(dir, dirUTF);
+    if (r) return NULL;
+    jclass cls = env->FindClass(INFO_CLASS);
+    jobjectArray infos = env->NewObjectArray((jsize) results.size(), cls, NULL);
+    for (size_t i = 0; infos != NULL && i < results.size(); i++) {
+        jobject info = newInfo(env, cls, results[i]);
+        env->SetObjectArrayElement(infos, (jsize) i, info);
+        env->DeleteLocalRef(info);
+    }
+    env->DeleteLocalRef(cls);
+    return infos;
+}
 
 //-----------------------------------------------------------------
 jint
 Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressAsset2File(JNIEnv *env,
-                                                            jclass,
+                                                            jobject thiz,
                                                             jobject assetManager,
                                                             jstring fFlac,
                                                             jstring fRaw,
                                                             jint samplingRateHz) {
-    SLresult result;
-    SLObjectItf sl;
-    SLEngineOption EngineOption[] = {
-            {(SLuint32) SL_ENGINEOPTION_THREADSAFE, (SLuint32) SL_BOOLEAN_TRUE}
-    };
-    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
-    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+    ConvOptions opts;
+    opts.samplingRateHz = samplingRateHz;
+    return asset2File(env, thiz, assetManager, fFlac, fRaw, opts);
+}
 
-    // use asset manager to open asset by filename
-    AAssetManager *mgr = AAssetManager_fromJava(env, assetManager);
-    assert(NULL != mgr);
-    AAsset *asset = AAssetManager_open(mgr, fFlacUTF, AASSET_MODE_UNKNOWN);
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressAsset2FileWithOptions(JNIEnv *env,
+                                                                       jobject thiz,
+                                                                       jobject assetManager,
+                                                                       jstring fFlac,
+                                                                       jstring fRaw,
+                                                                       jobject options) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    return asset2File(env, thiz, assetManager, fFlac, fRaw, opts);
+}
 
-    // the asset might not be found
-    if (NULL == asset) {
-        return -1;
+//-----------------------------------------------------------------
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressMemory2FileWithOptions(JNIEnv *env,
+                                                                        jobject thiz,
+                                                                        jbyteArray array,
+                                                                        jobject flac,
+                                                                        jint offset,
+                                                                        jint length,
+                                                                        jstring fRaw,
+                                                                        jobject options) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return EBADF;
     }
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    JavaMemory memory(env, array, flac, offset, length);
+    if (memory.error) return memory.error;
+    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+    int r = context->convert(memory.src, fRawUTF, opts);
+    env->ReleaseStringUTFChars(fRaw, fRawUTF);
+    return r;
+}
 
-    // open asset as file descriptor
-    off_t start, length;
-    int fd = AAsset_openFileDescriptor(asset, &start, &length);
-    assert(0 <= fd);
-    AAsset_close(asset);
-    // configure audio source
-    SLDataLocator_AndroidFD loc_fd = {SL_DATALOCATOR_ANDROIDFD, fd, start, length};
-    SLDataFormat_MIME format_mime = {SL_DATAFORMAT_MIME, NULL, SL_CONTAINERTYPE_UNSPECIFIED};
-    SLDataSource audioSrc = {&loc_fd, &format_mime};
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_uncompressMemory2BufferWithOptions(JNIEnv *env,
+                                                                          jobject thiz,
+                                                                          jbyteArray array,
+                                                                          jobject flac,
+                                                                          jint offset,
+                                                                          jint length,
+                                                                          jobject buffer,
+                                                                          jint elementSize,
+                                                                          jobject options) {
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    JavaStats stats(env, options, opts);
+    JavaMemory memory(env, array, flac, offset, length);
+    if (memory.error) return -memory.error;
+    return decode2Buffer(env, thiz, memory.src, buffer, elementSize, opts);
+}
 
-    result = slCreateEngine(&sl, 1, EngineOption, 0, NULL, NULL);
-    ExitOnError(result);
+jobject
+Java_uk_me_berndporr_flac2raw_Flac2Raw_probeMemoryWithOffset(JNIEnv *env,
+                                                             jclass,
+                                                             jbyteArray array,
+                                                             jobject flac,
+                                                             jint offset,
+                                                             jint length) {
+    ProbeResult result;
+    JavaMemory memory(env, array, flac, offset, length);
+    result.error = memory.error;
+    if (!result.error) probeSource(memory.src, result);
+    jclass cls = env->FindClass(INFO_CLASS);
+    jobject info = newInfo(env, cls, result);
+    env->DeleteLocalRef(cls);
+    return info;
+}
 
-    /* Realizing the SL Engine in synchronous mode. */
-    result = (*sl)->Realize(sl, SL_BOOLEAN_FALSE);
-    ExitOnError(result);
 
-    int r = decToBuffQueue(sl, &audioSrc, fRawUTF, samplingRateHz);
-    /* Shutdown OpenSL ES */
-    (*sl)->Destroy(sl);
+//-----------------------------------------------------------------
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_startFile2FileAsync(JNIEnv *env,
+                                                           jobject thiz,
+                                                           jstring fFlac,
+                                                           jstring fRaw,
+                                                           jobject options,
+                                                           jobject conversion,
+                                                           jobject listener) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return;
+    }
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+    const std::string src = fFlacUTF;
+    const std::string dst = fRawUTF;
+    env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    env->ReleaseStringUTFChars(fRaw, fRawUTF);
+    context->startAsync(env, [context, src, dst](const ConvOptions &o) {
+        int r = checkReadable(src.c_str());
+        if (r) return r;
+        DecodeSource s;
+        s.type = DecodeSource::URI;
+        s.path = src.c_str();
+        return context->convert(s, dst.c_str(), o);
+    }, opts, dst, conversion, listener);
+}
 
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_startAsset2FileAsync(JNIEnv *env,
+                                                            jobject thiz,
+                                                            jobject assetManager,
+                                                            jstring fFlac,
+                                                            jstring fRaw,
+                                                            jobject options,
+                                                            jobject conversion,
+                                                            jobject listener) {
+    Flac2RawContext *context = getContext(env, thiz);
+    if (NULL == context) {
+        LOGE("Flac2Raw has been closed");
+        return;
+    }
+    ConvOptions opts;
+    readOptions(env, options, opts);
+    const char *fFlacUTF = env->GetStringUTFChars(fFlac, NULL);
+    DecodeSource src;
+    const int fd = openAsset(env, assetManager, fFlacUTF, src);
     env->ReleaseStringUTFChars(fFlac, fFlacUTF);
+    const char *fRawUTF = env->GetStringUTFChars(fRaw, NULL);
+    const std::string dst = fRawUTF;
     env->ReleaseStringUTFChars(fRaw, fRawUTF);
+    /* the conversion owns the file descriptor of the asset */
+    context->startAsync(env, [context, src, fd, dst](const ConvOptions &o) {
+        if (fd < 0) return ENOENT;
+        int r = context->convert(src, dst.c_str(), o);
+        close(fd);
+        return r;
+    }, opts, dst, conversion, listener);
+}
 
-    return r;
+//-----------------------------------------------------------------
+static AsyncConversion *asyncConversion(jlong handle) {
+    return ((std::shared_ptr<AsyncConversion> *) (intptr_t) handle)->get();
+}
+
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Conversion_nativeCancel(JNIEnv *,
+                                                                    jclass,
+                                                                    jlong handle) {
+    asyncConversion(handle)->cancel();
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Conversion_nativeAwait(JNIEnv *,
+                                                                   jclass,
+                                                                   jlong handle) {
+    return asyncConversion(handle)->wait();
+}
+
+jboolean
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Conversion_nativeIsDone(JNIEnv *,
+                                                                    jclass,
+                                                                    jlong handle) {
+    return asyncConversion(handle)->finished() ? JNI_TRUE : JNI_FALSE;
+}
+
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024Conversion_nativeRelease(JNIEnv *,
+                                                                     jclass,
+                                                                     jlong handle) {
+    delete (std::shared_ptr<AsyncConversion> *) (intptr_t) handle;
+}
+
+
+//-----------------------------------------------------------------
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeOpen(JNIEnv *env,
+                                                                     jclass,
+                                                                     jstring path,
+                                                                     jintArray format) {
+    const char *pathUTF = env->GetStringUTFChars(path, NULL);
+    ChunkedPcmReader *reader = new ChunkedPcmReader();
+    int r = reader->open(pathUTF);
+    env->ReleaseStringUTFChars(path, pathUTF);
+    if (r) {
+        delete reader;
+        return -r;
+    }
+    const ChunkedPcmHeader &h = reader->format();
+    const jint f[] = {(jint) h.sampleRate, (jint) h.channels, (jint) h.bitsPerSample,
+                      (jint) h.sampleFormat, (jint) h.chunkBytes};
+    env->SetIntArrayRegion(format, 0, 5, f);
+    return (jlong) (intptr_t) reader;
+}
+
+jboolean
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeIsComplete(JNIEnv *,
+                                                                           jclass,
+                                                                           jlong handle) {
+    return ((ChunkedPcmReader *) (intptr_t) handle)->complete() ? JNI_TRUE : JNI_FALSE;
 }
 
-}
\ No newline at end of file
+jlong
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeFrames(JNIEnv *,
+                                                                       jclass,
+                                                                       jlong handle) {
+    return (jlong) ((ChunkedPcmReader *) (intptr_t) handle)->frames();
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeChunks(JNIEnv *,
+                                                                       jclass,
+                                                                       jlong handle) {
+    return (jint) ((ChunkedPcmReader *) (intptr_t) handle)->chunks();
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeReadShorts(JNIEnv *env,
+                                                                           jclass,
+                                                                           jlong handle,
+                                                                           jlong frame,
+                                                                           jshortArray samples,
+                                                                           jint offset,
+                                                                           jint frames) {
+    const ChunkedPcmReader *reader = (const ChunkedPcmReader *) (intptr_t) handle;
+    const unsigned channels = reader->format().channels;
+    /* copies straight from the mapping, chunk by chunk */
+    jint done = 0;
+    while (done < frames) {
+        uint64_t n;
+        const uint8_t *p = reader->framesAt((uint64_t) frame + done, n);
+        if (NULL == p) break;
+        n = std::min(n, (uint64_t) (frames - done));
+        env->SetShortArrayRegion(samples, offset + done * (jint) channels,
+                                 (jsize) (n * channels), (const jshort *) p);
+        done += (jint) n;
+    }
+    return done;
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeReadBuffer(JNIEnv *env,
+                                                                           jclass,
+                                                                           jlong handle,
+                                                                           jlong frame,
+                                                                           jobject buffer,
+                                                                           jint offset,
+                                                                           jint frames) {
+    const ChunkedPcmReader *reader = (const ChunkedPcmReader *) (intptr_t) handle;
+    uint8_t *addr = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    if (NULL == addr) {
+        LOGE("Not a direct buffer");
+        return -1;
+    }
+    return (jint) reader->read((uint64_t) frame, addr + offset, (uint64_t) frames);
+}
+
+jint
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeVerify(JNIEnv *,
+                                                                       jclass,
+                                                                       jlong handle,
+                                                                       jint chunk) {
+    return ((ChunkedPcmReader *) (intptr_t) handle)->verify((size_t) chunk);
+}
+
+void
+Java_uk_me_berndporr_flac2raw_Flac2Raw_00024ChunkedReader_nativeClose(JNIEnv *,
+                                                                      jclass,
+                                                                      jlong handle) {
+    delete (ChunkedPcmReader *) (intptr_t) handle;
+}
+
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_LOG_H
+#define FLAC2RAW_LOG_H
+
+#define  LOG_TAG    "flac2raw"
+
+#ifdef __ANDROID__
+
+// logging
+#include <android/log.h>
+
+// convenience wrappers for debugging
+#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define  LOGV(...)  __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
+
+#else
+
+// host builds log to stderr, verbose output only if FLAC2RAW_VERBOSE is defined
+#include <stdio.h>
+
+#define  LOGD(...)  do { fprintf(stderr, LOG_TAG ": " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define  LOGE(...)  do { fprintf(stderr, LOG_TAG ": " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#ifdef FLAC2RAW_VERBOSE
+#define  LOGV(...)  LOGD(__VA_ARGS__)
+#else
+#define  LOGV(...)  do { } while (0)
+#endif
+
+#endif
+
+#endif
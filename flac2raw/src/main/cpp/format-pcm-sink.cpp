@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "format-pcm-sink.h"
+#include "flac2raw-log.h"
+
+FormatPcmSink::FormatPcmSink(PcmSink &destination, int sampleFormat, bool downmix) :
+        destinations(1, &destination), kernels(sampleKernels()), sampleFormat(sampleFormat),
+        sampleBytes(sampleFormatBytes(sampleFormat)), downmix(downmix), inChannels(0),
+        outChannels(0), planar(false) {}
+
+FormatPcmSink::FormatPcmSink(const std::vector<PcmSink *> &destinations, int sampleFormat,
+                             bool downmix) :
+        destinations(destinations), kernels(sampleKernels()), sampleFormat(sampleFormat),
+        sampleBytes(sampleFormatBytes(sampleFormat)), downmix(downmix), inChannels(0),
+        outChannels(0), planar(destinations.size() > 1) {}
+
+int FormatPcmSink::setup(unsigned channels) {
+    if (!sampleBytes) {
+        LOGE("Unknown sample format %d", sampleFormat);
+        return EINVAL;
+    }
+    if (!channels) {
+        if (downmix || planar) {
+            LOGE("The number of channels is unknown, can't downmix or split them");
+            return EINVAL;
+        }
+        /* converting sample by sample works for any number of channels */
+        channels = 1;
+    }
+    inChannels = channels;
+    outChannels = downmix ? 1 : channels;
+    if (planar && destinations.size() != outChannels) {
+        LOGE("%zu outputs for %u channels", destinations.size(), outChannels);
+        return EINVAL;
+    }
+    LOGV("Converting %u channels with the %s kernels", inChannels, kernels.name);
+    return 0;
+}
+
+int FormatPcmSink::begin(const PcmFormat &format) {
+    int r = setup(format.channels);
+    if (r) return r;
+    PcmFormat out = format;
+    out.channels = planar ? 1 : outChannels;
+    out.bitsPerSample = (unsigned) sampleBytes * 8;
+    for (size_t d = 0; d < destinations.size(); d++) {
+        r = destinations[d]->begin(out);
+        if (r) return r;
+    }
+    return 0;
+}
+
+int FormatPcmSink::convertBlock(const int16_t *in, size_t frames, int64_t offset, Scratch &s) {
+    unsigned channels = inChannels;
+    if (downmix && channels > 1) {
+        s.mixed.resize(frames);
+        kernels.downmix(in, &s.mixed[0], frames, channels);
+        in = &s.mixed[0];
+        channels = 1;
+    }
+    if (planar && channels > 1) {
+        s.planes.resize(frames * channels);
+        s.planePtrs.resize(channels);
+        for (unsigned ch = 0; ch < channels; ch++) s.planePtrs[ch] = &s.planes[ch * frames];
+        kernels.deinterleave(in, &s.planePtrs[0], frames, channels);
+    }
+    const size_t n = planar ? frames : frames * channels;
+    for (size_t d = 0; d < destinations.size(); d++) {
+        const int16_t *p = planar && channels > 1 ? s.planePtrs[d] : in;
+        const void *out = p;
+        if (sampleFormat != FLAC2RAW_FORMAT_PCM16) {
+            s.out.resize(n * sampleBytes);
+            switch (sampleFormat) {
+                case FLAC2RAW_FORMAT_FLOAT32:
+                    kernels.toFloat(p, (float *) &s.out[0], n);
+                    break;
+                case FLAC2RAW_FORMAT_INT24:
+                    kernels.toInt24(p, &s.out[0], n);
+                    break;
+                case FLAC2RAW_FORMAT_INT32:
+                    kernels.toInt32(p, (int32_t *) &s.out[0], n);
+                    break;
+            }
+            out = &s.out[0];
+        }
+        int r;
+        if (offset < 0) {
+            r = destinations[d]->write(out, n * sampleBytes);
+        } else {
+            const uint64_t first = (uint64_t) offset * (planar ? 1 : channels);
+            r = destinations[d]->writeAt(first * sampleBytes, out, n * sampleBytes);
+        }
+        if (r) return r;
+    }
+    return 0;
+}
+
+int FormatPcmSink::convert(const uint8_t *in, size_t frames, int64_t offset, Scratch &s) {
+    const size_t frameBytes = inChannels * sizeof(int16_t);
+    while (frames > 0) {
+        const size_t n = std::min(frames, (size_t) FORMAT_BLOCK_FRAMES);
+        const int16_t *p = (const int16_t *) in;
+        if ((uintptr_t) in % sizeof(int16_t)) {
+            s.aligned.resize(n * inChannels);
+            memcpy(&s.aligned[0], in, n * frameBytes);
+            p = &s.aligned[0];
+        }
+        int r = convertBlock(p, n, offset, s);
+        if (r) return r;
+        in += n * frameBytes;
+        frames -= n;
+        if (offset >= 0) offset += (int64_t) n;
+    }
+    return 0;
+}
+
+int FormatPcmSink::write(const void *data, size_t nbytes) {
+    if (!inChannels) {
+        int r = setup(0);
+        if (r) return r;
+    }
+    const size_t frameBytes = inChannels * sizeof(int16_t);
+    const uint8_t *p = (const uint8_t *) data;
+    if (!partialFrame.empty()) {
+        const size_t n = std::min(frameBytes - partialFrame.size(), nbytes);
+        partialFrame.insert(partialFrame.end(), p, p + n);
+        p += n;
+        nbytes -= n;
+        if (partialFrame.size() < frameBytes) return 0;
+        int r = convert(&partialFrame[0], 1, -1, scratch);
+        partialFrame.clear();
+        if (r) return r;
+    }
+    const size_t frames = nbytes / frameBytes;
+    int r = convert(p, frames, -1, scratch);
+    if (r) return r;
+    partialFrame.assign(p + frames * frameBytes, p + nbytes);
+    return 0;
+}
+
+bool FormatPcmSink::randomAccess() const {
+    for (size_t d = 0; d < destinations.size(); d++) {
+        if (!destinations[d]->randomAccess()) return false;
+    }
+    return true;
+}
+
+int FormatPcmSink::writeAt(uint64_t offset, const void *data, size_t nbytes) {
+    if (!inChannels) return EINVAL;
+    const size_t frameBytes = inChannels * sizeof(int16_t);
+    if (offset % frameBytes || nbytes % frameBytes) {
+        LOGE("Random access writes have to be whole frames");
+        return EINVAL;
+    }
+    Scratch s;
+    return convert((const uint8_t *) data, nbytes / frameBytes,
+                   (int64_t) (offset / frameBytes), s);
+}
+
+int FormatPcmSink::end() {
+    if (!partialFrame.empty()) {
+        LOGD("Dropping %zu bytes of an incomplete frame", partialFrame.size());
+        partialFrame.clear();
+    }
+    int r = 0;
+    for (size_t d = 0; d < destinations.size(); d++) {
+        const int e = destinations[d]->end();
+        if (!r) r = e;
+    }
+    return r;
+}
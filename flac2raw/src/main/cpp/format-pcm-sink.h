@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_FORMAT_PCM_SINK_H
+#define FLAC2RAW_FORMAT_PCM_SINK_H
+
+#include <vector>
+
+#include "pcm-sink.h"
+#include "sample-format.h"
+
+/* Number of frames converted at a time */
+#define FORMAT_BLOCK_FRAMES 4096
+
+//-----------------------------------------------------------------
+/* Converts the 16 bit interleaved audio of a backend into another sample
+ * format, optionally downmixed to mono. With a single destination the output
+ * stays interleaved, with more each gets one channel and their number has to
+ * match the channels of the output. The destinations get begin() and end()
+ * through this sink. Returns EINVAL if the channel layout doesn't fit. */
+class FormatPcmSink : public PcmSink {
+public:
+    FormatPcmSink(PcmSink &destination, int sampleFormat, bool downmix);
+
+    FormatPcmSink(const std::vector<PcmSink *> &destinations, int sampleFormat, bool downmix);
+
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    bool randomAccess() const;
+
+    /* offset and size have to be whole frames */
+    int writeAt(uint64_t offset, const void *data, size_t nbytes);
+
+    int end();
+
+private:
+    /* conversion buffers, one set per thread for writeAt() */
+    typedef struct Scratch_ {
+        std::vector<int16_t> aligned;
+        std::vector<int16_t> mixed;
+        std::vector<int16_t> planes;
+        std::vector<int16_t *> planePtrs;
+        std::vector<uint8_t> out;
+    } Scratch;
+
+    int setup(unsigned channels);
+
+    /* converts frames and writes them at frame offset, sequentially if it's negative */
+    int convert(const uint8_t *in, size_t frames, int64_t offset, Scratch &s);
+
+    int convertBlock(const int16_t *in, size_t frames, int64_t offset, Scratch &s);
+
+    std::vector<PcmSink *> destinations;
+    const SampleKernels &kernels;
+    int sampleFormat;
+    size_t sampleBytes;
+    bool downmix;
+    /* zero until begin() or the first write */
+    unsigned inChannels;
+    unsigned outChannels;
+    bool planar;
+    /* start of a frame split between two writes */
+    std::vector<uint8_t> partialFrame;
+    Scratch scratch;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_MD5_H
+#define FLAC2RAW_MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Plain RFC 1321 MD5, used to verify the decoded audio against STREAMINFO */
+class Md5 {
+public:
+    Md5();
+
+    void update(const void *data, size_t len);
+
+    void final(uint8_t digest[16]);
+
+private:
+    void transform(const uint8_t block[64]);
+
+    uint32_t state[4];
+    uint64_t count;
+    uint8_t buffer[64];
+};
+
+#endif
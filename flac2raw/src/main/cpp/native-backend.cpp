@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#include "decoder-backend.h"
+#include "flac-decoder.h"
+#include "md5.h"
+#include "seek-index.h"
+#include "flac2raw-log.h"
+
+//-----------------------------------------------------------------
+int rangeFrames(const ConvOptions &opts, unsigned rate, uint64_t totalFrames,
+                uint64_t &first, uint64_t &count) {
+    if (opts.startMs < 0 || !rate) return EINVAL;
+    first = (uint64_t) opts.startMs * rate / 1000;
+    uint64_t end = opts.endMs < 0 ? UINT64_MAX : (uint64_t) opts.endMs * rate / 1000;
+    if (totalFrames) end = std::min(end, totalFrames);
+    if (end <= first) {
+        LOGE("Empty range from %lld ms to %lld ms",
+             (long long) opts.startMs, (long long) opts.endMs);
+        return EINVAL;
+    }
+    count = end == UINT64_MAX ? UINT64_MAX : end - first;
+    return 0;
+}
+
+//-----------------------------------------------------------------
+MappedSource::~MappedSource() {
+    unmap();
+}
+
+void MappedSource::unmap() {
+    if (base) munmap(base, mapLen);
+    base = NULL;
+    mapLen = 0;
+    data = NULL;
+    size = 0;
+}
+
+int MappedSource::map(const DecodeSource &src) {
+    if (src.type == DecodeSource::MEMORY) {
+        /* nothing to map, the memory belongs to the caller */
+        if (NULL == src.data || 0 == src.size) return EILSEQ;
+        data = src.data;
+        size = src.size;
+        return 0;
+    }
+    int fd = src.fd;
+    off_t start = src.start;
+    off_t length = src.length;
+    if (src.type == DecodeSource::URI) {
+        fd = open(src.path, O_RDONLY);
+        if (fd < 0) {
+            LOGE("Could not read from the phone memory: >>%s<<", src.path);
+            return errno;
+        }
+        struct stat st;
+        if (fstat(fd, &st)) {
+            int e = errno;
+            close(fd);
+            return e;
+        }
+        start = 0;
+        length = st.st_size;
+    }
+    if (length <= 0) {
+        if (src.type == DecodeSource::URI) close(fd);
+        return EILSEQ;
+    }
+    /* mmap offsets have to be page aligned, assets usually aren't */
+    const off_t page = (off_t) sysconf(_SC_PAGESIZE);
+    const off_t alignedStart = start - (start % page);
+    const size_t delta = (size_t) (start - alignedStart);
+    mapLen = (size_t) length + delta;
+    base = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, alignedStart);
+    const int e = errno;
+    if (src.type == DecodeSource::URI) close(fd);
+    if (base == MAP_FAILED) {
+        base = NULL;
+        mapLen = 0;
+        LOGE("Could not map the source");
+        return e;
+    }
+    madvise(base, mapLen, MADV_SEQUENTIAL);
+    data = (const uint8_t *) base + delta;
+    size = (size_t) length;
+    return 0;
+}
+
+//-----------------------------------------------------------------
+/* The metadata is usually at the start, a single read of this is cheaper than a mapping */
+#define PROBE_READ_BYTES (64 * 1024)
+
+/* Feeds the samples of a frame in the STREAMINFO MD5 layout, i.e. little endian
+ * at the original bit depth rounded up to whole bytes */
+static void md5Frame(Md5 &md5, const FlacDecoder &dec, const FlacFrameHeader &header,
+                     std::vector<uint8_t> &scratch) {
+    const unsigned bytes = (header.bitsPerSample + 7) / 8;
+    scratch.resize((size_t) header.blockSize * header.channels * bytes);
+    uint8_t *p = &scratch[0];
+    for (unsigned i = 0; i < header.blockSize; i++) {
+        for (unsigned ch = 0; ch < header.channels; ch++) {
+            const int32_t v = dec.channel(ch)[i];
+            for (unsigned b = 0; b < bytes; b++) *p++ = (uint8_t) (v >> (8 * b));
+        }
+    }
+    md5.update(&scratch[0], scratch.size());
+}
+
+int NativeFlacBackend::probe(const DecodeSource &src, FlacStreamInfo &info,
+                             std::vector<FlacSeekPoint> *seekTable) {
+    size_t audioOffset;
+    if (src.type == DecodeSource::MEMORY) {
+        if (NULL == src.data) return EILSEQ;
+        return flacParseMetadata(src.data, src.size, info, seekTable, audioOffset);
+    }
+    int fd = src.fd;
+    off_t start = src.start;
+    off_t length = src.length;
+    if (src.type == DecodeSource::URI) {
+        fd = open(src.path, O_RDONLY);
+        if (fd < 0) return errno;
+        struct stat st;
+        if (fstat(fd, &st)) {
+            int e = errno;
+            close(fd);
+            return e;
+        }
+        start = 0;
+        length = st.st_size;
+    }
+    std::vector<uint8_t> head((size_t) std::max(std::min(length, (off_t) PROBE_READ_BYTES),
+                                                (off_t) 0));
+    ssize_t n = head.empty() ? 0 : pread(fd, &head[0], head.size(), start);
+    if (src.type == DecodeSource::URI) close(fd);
+    if (n < 0) return errno;
+    if (n > 0 && (size_t) n == head.size() &&
+        flacParseMetadata(&head[0], head.size(), info, seekTable, audioOffset) == 0) {
+        return 0;
+    }
+    if ((off_t) n >= length) return EILSEQ;
+    /* the metadata is larger than the first read, for example because of cover art */
+    MappedSource in;
+    int r = in.map(src);
+    if (r) return r;
+    return flacParseMetadata(in.data, in.size, info, seekTable, audioOffset);
+}
+
+int NativeFlacBackend::decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+    MappedSource in;
+    int r = in.map(src);
+    if (r) return r;
+    FlacDecoder dec;
+    r = dec.open(in.data, in.size);
+    if (r) return r;
+    const FlacStreamInfo &info = dec.streamInfo();
+    if ((int) info.sampleRate != opts.samplingRateHz) {
+        LOGD("Source has %u Hz and not %d Hz, writing it unchanged",
+             info.sampleRate, opts.samplingRateHz);
+    }
+    PcmFormat fmt;
+    fmt.sampleRate = info.sampleRate;
+    fmt.channels = info.channels;
+    fmt.totalFrames = info.totalSamples;
+    uint64_t first = 0;
+    uint64_t count = 0;
+    if (isRanged(opts)) {
+        r = rangeFrames(opts, info.sampleRate, info.totalSamples, first, count);
+        if (r) return r;
+        if (info.totalSamples) fmt.totalFrames = count;
+    }
+    r = sink.begin(fmt);
+    if (r) return r;
+    if (isRanged(opts)) {
+        r = decodeRange(dec, sink, opts, first, count);
+        if (r) return r;
+        return sink.end();
+    }
+
+    unsigned numThreads = opts.numThreads > 0 ? (unsigned) opts.numThreads :
+                          std::thread::hardware_concurrency();
+    if (numThreads > 1) {
+        if (opts.verifyMd5) {
+            LOGD("MD5 verification needs sequential decoding, ignoring numThreads");
+        } else if (!info.totalSamples || !sink.randomAccess()) {
+            LOGD("Unknown length or sequential output, ignoring numThreads");
+        } else {
+            r = decodeParallel(dec, sink, numThreads);
+            if (r) return r;
+            return sink.end();
+        }
+    }
+
+    static const uint8_t noMd5[16] = {0};
+    const bool checkMd5 = opts.verifyMd5 && memcmp(info.md5, noMd5, 16) != 0;
+    Md5 md5;
+    std::vector<uint8_t> md5Scratch;
+    std::vector<int16_t> pcm;
+    /* decodes straight into the output if the sink has memory for it */
+    size_t directCapacity;
+    uint8_t *direct = sink.directBuffer(directCapacity);
+    size_t written = 0;
+    uint64_t decoded = 0;
+    size_t pos = dec.audioOffset();
+    while (pos < in.size) {
+        FlacFrameHeader header;
+        r = dec.decodeFrame(pos, header);
+        if (r) return r;
+        const size_t n = (size_t) header.blockSize * header.channels;
+        int16_t *out;
+        if (direct && written + n * sizeof(int16_t) <= directCapacity) {
+            out = (int16_t *) (direct + written);
+        } else {
+            if (pcm.size() < n) pcm.resize(n);
+            out = &pcm[0];
+        }
+        dec.toInt16Interleaved(header, out);
+        r = sink.write(out, n * sizeof(int16_t));
+        if (r) return r;
+        written += n * sizeof(int16_t);
+        if (checkMd5) md5Frame(md5, dec, header, md5Scratch);
+        decoded += header.blockSize;
+        if (info.totalSamples && decoded >= info.totalSamples) break;
+    }
+    if (info.totalSamples && decoded != info.totalSamples) {
+        LOGE("Decoded %llu samples but STREAMINFO says %llu",
+             (unsigned long long) decoded, (unsigned long long) info.totalSamples);
+        return EILSEQ;
+    }
+    if (checkMd5) {
+        uint8_t digest[16];
+        md5.final(digest);
+        if (memcmp(digest, info.md5, 16)) {
+            LOGE("MD5 mismatch of the decoded audio");
+            return EILSEQ;
+        }
+    }
+    LOGV("Decoded %llu samples", (unsigned long long) decoded);
+    return sink.end();
+}
+
+//-----------------------------------------------------------------
+/* Size of the per thread output buffer of the parallel decoder */
+#define PARALLEL_WRITE_BUFFER_BYTES (256 * 1024)
+/* Number of chunks per thread so that threads finishing early can pick up more work */
+#define PARALLEL_CHUNKS_PER_THREAD 4
+
+/* Returns the offset of the first frame at or after from which decodes with valid CRCs */
+static size_t findFrame(FlacDecoder &probe, size_t from, size_t end) {
+    const uint8_t *d = probe.data();
+    for (size_t p = from; p + 1 < end; p++) {
+        if (d[p] != 0xFF || (d[p + 1] & 0xFE) != 0xF8) continue;
+        FlacFrameHeader header;
+        if (flacParseFrameHeader(d + p, end - p, probe.streamInfo(), header)) continue;
+        size_t q = p;
+        if (!probe.decodeFrame(q, header)) return p;
+    }
+    return end;
+}
+
+/* Frame aligned byte ranges of the stream, either from the SEEKTABLE or by
+ * searching for frame sync codes near evenly spaced byte positions */
+static std::vector<size_t> chunkBoundaries(const FlacDecoder &dec, unsigned nChunks) {
+    const FlacStreamInfo &info = dec.streamInfo();
+    const size_t begin = dec.audioOffset();
+    const size_t end = dec.size();
+    std::vector<size_t> bounds;
+    bounds.push_back(begin);
+    const std::vector<FlacSeekPoint> &seekTable = dec.seekTable();
+    if (seekTable.size() >= nChunks) {
+        for (unsigned k = 1; k < nChunks; k++) {
+            const uint64_t target = info.totalSamples * k / nChunks;
+            size_t best = 0;
+            for (size_t i = 0; i < seekTable.size(); i++) {
+                if (seekTable[i].sampleNumber <= target) best = i;
+            }
+            const size_t off = begin + (size_t) seekTable[best].streamOffset;
+            FlacFrameHeader header;
+            if (off < end &&
+                !flacParseFrameHeader(dec.data() + off, end - off, info, header)) {
+                bounds.push_back(off);
+            }
+        }
+    } else {
+        FlacDecoder probe;
+        probe.open(dec.data(), dec.size());
+        probe.setQuiet(true);
+        for (unsigned k = 1; k < nChunks; k++) {
+            const size_t target = begin + (end - begin) * k / nChunks;
+            bounds.push_back(findFrame(probe, std::max(target, bounds.back()), end));
+        }
+    }
+    bounds.push_back(end);
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    return bounds;
+}
+
+int NativeFlacBackend::decodeParallel(const FlacDecoder &dec, PcmSink &sink,
+                                      unsigned numThreads) {
+    const FlacStreamInfo &info = dec.streamInfo();
+    const std::vector<size_t> bounds = chunkBoundaries(dec, numThreads *
+                                                            PARALLEL_CHUNKS_PER_THREAD);
+    const size_t nChunks = bounds.size() - 1;
+    if (numThreads > nChunks) numThreads = (unsigned) nChunks;
+    LOGV("Decoding %zu chunks with %u threads", nChunks, numThreads);
+    const size_t frameBytes = info.channels * sizeof(int16_t);
+    std::atomic<size_t> nextChunk(0);
+    std::atomic<uint64_t> decodedSamples(0);
+    std::atomic<int> error(0);
+
+    auto worker = [&]() {
+        FlacDecoder d;
+        int r = d.open(dec.data(), dec.size());
+        if (r) {
+            error = r;
+            return;
+        }
+        std::vector<int16_t> buf(std::max(PARALLEL_WRITE_BUFFER_BYTES / sizeof(int16_t),
+                                          (size_t) FLAC_MAX_BLOCK_SIZE * info.channels));
+        for (;;) {
+            const size_t c = nextChunk++;
+            if (c >= nChunks || error) return;
+            size_t pos = bounds[c];
+            /* samples in buf start at this sample number */
+            uint64_t bufSample = 0;
+            size_t bufFrames = 0;
+            uint64_t chunkSamples = 0;
+            while (pos < bounds[c + 1] && !error) {
+                FlacFrameHeader header;
+                r = d.decodeFrame(pos, header);
+                if (!r && header.firstSample + header.blockSize > info.totalSamples) {
+                    LOGE("Frame beyond the end of the stream");
+                    r = EILSEQ;
+                }
+                if (r) {
+                    error = r;
+                    return;
+                }
+                const bool contiguous = bufSample + bufFrames == header.firstSample;
+                if (bufFrames && (!contiguous ||
+                                  (bufFrames + header.blockSize) * info.channels > buf.size())) {
+                    r = sink.writeAt(bufSample * frameBytes, &buf[0], bufFrames * frameBytes);
+                    if (r) {
+                        error = r;
+                        return;
+                    }
+                    bufFrames = 0;
+                }
+                if (!bufFrames) bufSample = header.firstSample;
+                d.toInt16Interleaved(header, &buf[bufFrames * info.channels]);
+                bufFrames += header.blockSize;
+                chunkSamples += header.blockSize;
+                if (header.firstSample + header.blockSize == info.totalSamples) break;
+            }
+            if (bufFrames) {
+                r = sink.writeAt(bufSample * frameBytes, &buf[0], bufFrames * frameBytes);
+                if (r) {
+                    error = r;
+                    return;
+                }
+            }
+            decodedSamples += chunkSamples;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads; t++) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    if (error) return error;
+    if (decodedSamples != info.totalSamples) {
+        LOGE("Decoded %llu samples but STREAMINFO says %llu",
+             (unsigned long long) decodedSamples.load(),
+             (unsigned long long) info.totalSamples);
+        return EILSEQ;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------
+/* The bisection stops when the frame is within twice the maximum frame size
+ * or this many bytes, from there it's cheaper to decode forward */
+#define SEEK_MIN_WINDOW_BYTES (16 * 1024)
+
+/* Returns true if there is a frame starting with sample sampleNumber at off */
+static bool isFrameAt(const FlacDecoder &dec, size_t off, uint64_t sampleNumber) {
+    FlacFrameHeader header;
+    return off < dec.size() &&
+           !flacParseFrameHeader(dec.data() + off, dec.size() - off, dec.streamInfo(), header) &&
+           header.firstSample == sampleNumber;
+}
+
+/* Offset of a frame starting at or before sample target, close enough to decode
+ * forward from. The seek points around target narrow the stream down, a
+ * bisection over frame sync codes does the rest. */
+static size_t seekFrame(const FlacDecoder &dec, const std::vector<FlacSeekPoint> &points,
+                        uint64_t target) {
+    const FlacStreamInfo &info = dec.streamInfo();
+    const size_t begin = dec.audioOffset();
+    size_t lo = begin;
+    size_t hi = dec.size();
+    /* placeholders have the largest sample number and sort last */
+    const size_t k = std::upper_bound(points.begin(), points.end(), target,
+                                      [](uint64_t t, const FlacSeekPoint &p) {
+                                          return t < p.sampleNumber;
+                                      }) - points.begin();
+    if (k > 0 && isFrameAt(dec, begin + (size_t) points[k - 1].streamOffset,
+                           points[k - 1].sampleNumber)) {
+        lo = begin + (size_t) points[k - 1].streamOffset;
+    }
+    if (k < points.size() && points[k].sampleNumber != FLAC_SEEKPOINT_PLACEHOLDER &&
+        begin + (size_t) points[k].streamOffset > lo &&
+        isFrameAt(dec, begin + (size_t) points[k].streamOffset, points[k].sampleNumber)) {
+        hi = begin + (size_t) points[k].streamOffset;
+    }
+    const size_t window = 2 * std::max((size_t) info.maxFrameSize,
+                                       (size_t) SEEK_MIN_WINDOW_BYTES);
+    FlacDecoder probe;
+    probe.open(dec.data(), dec.size());
+    probe.setQuiet(true);
+    unsigned steps = 0;
+    /* the frame at lo starts at or before target, the one containing target before hi */
+    while (hi - lo > window) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const size_t p = findFrame(probe, mid, hi);
+        FlacFrameHeader header;
+        if (p < hi && !flacParseFrameHeader(dec.data() + p, dec.size() - p, info, header) &&
+            header.firstSample <= target) {
+            lo = p;
+        } else {
+            hi = mid;
+        }
+        steps++;
+    }
+    LOGV("Seeked to sample %llu with %zu seek points and %u bisection steps",
+         (unsigned long long) target, points.size(), steps);
+    return lo;
+}
+
+int NativeFlacBackend::decodeRange(FlacDecoder &dec, PcmSink &sink, const ConvOptions &opts,
+                                   uint64_t first, uint64_t count) {
+    if (opts.verifyMd5 || opts.numThreads > 1) {
+        LOGD("A range is decoded sequentially and without MD5 verification");
+    }
+    const FlacStreamInfo &info = dec.streamInfo();
+    std::vector<FlacSeekPoint> points = dec.seekTable();
+    if (points.empty() && first > 0 && !opts.seekIndexDir.empty()) {
+        int r = openSeekIndex(opts.seekIndexDir, dec, points);
+        if (r) LOGD("No seek index, bisecting the stream: %s", strerror(r));
+    }
+    size_t pos = first > 0 ? seekFrame(dec, points, first) : dec.audioOffset();
+    const uint64_t last = count == UINT64_MAX ? UINT64_MAX : first + count;
+    std::vector<int16_t> pcm;
+    uint64_t written = 0;
+    while (pos < dec.size() && written < count) {
+        FlacFrameHeader header;
+        int r = dec.decodeFrame(pos, header);
+        if (r) return r;
+        const uint64_t frameEnd = header.firstSample + header.blockSize;
+        /* the part of the frame inside of the range */
+        const uint64_t from = std::max(first, header.firstSample);
+        const uint64_t to = std::min(last, frameEnd);
+        if (from < to) {
+            const size_t n = (size_t) header.blockSize * header.channels;
+            if (pcm.size() < n) pcm.resize(n);
+            dec.toInt16Interleaved(header, &pcm[0]);
+            r = sink.write(&pcm[(size_t) (from - header.firstSample) * header.channels],
+                           (size_t) (to - from) * header.channels * sizeof(int16_t));
+            if (r) return r;
+            written += to - from;
+        }
+        if (info.totalSamples && frameEnd >= info.totalSamples) break;
+    }
+    if (info.totalSamples && written != count) {
+        LOGE("Decoded %llu samples of the range but expected %llu",
+             (unsigned long long) written, (unsigned long long) count);
+        return EILSEQ;
+    }
+    LOGV("Decoded %llu samples from sample %llu",
+         (unsigned long long) written, (unsigned long long) first);
+    return 0;
+}
@@ -0,0 +1,843 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <assert.h>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+
+#include "opensl-backend.h"
+#include "flac2raw-log.h"
+
+#define NUM_EXPLICIT_INTERFACES_FOR_PLAYER 4
+/* Limits of the runtime buffer queue configuration, see ConvOptions */
+#define MAX_BUFFERS_IN_QUEUE 64
+#define MAX_BUFFER_SIZE_IN_SAMPLES (1024 * 1024)
+/* The adaptive buffer size is a multiple of the FLAC block size of at least this */
+#define ADAPTIVE_MIN_BUFFER_BYTES (16 * 1024)
+/* size of the struct to retrieve the PCM format metadata values: the values we're interested in
+ * are SLuint32, but it is saved in the data field of a SLMetadataInfo, hence the larger size.
+ * Nate that this size is queried and displayed at l.452 for demonstration/test purposes.
+ *  */
+#define PCM_METADATA_VALUE_SIZE 32
+
+
+//-----------------------------------------------------------------
+/* Structure keeping all info for a run */
+typedef struct CallbackCntxt_ {
+    SLPlayItf playItf;
+    SLMetadataExtractionItf metaItf;
+    SLuint32 size;
+    SLint8 *pDataBase = NULL;    // Base address of local audio data storage
+    SLint8 *pData = NULL;        // Current address of local audio data storage
+    /* Local storage for decoded audio data, numBuffers of bufferBytes each */
+    std::vector<int8_t> pcmData;
+    unsigned numBuffers = 0;
+    size_t bufferBytes = 0;
+    /* destination for decoded data */
+    PcmSink *sink = NULL;
+    /* memory of the sink which is decoded into in place, see PcmSink::directBuffer() */
+    uint8_t *direct = NULL;
+    size_t directCapacity = 0;
+    /* bytes of the direct memory enqueued and returned by the decoder */
+    size_t directQueued = 0;
+    size_t directDone = 0;
+    /* pcmData has been enqueued to catch audio which doesn't fit into the direct memory */
+    bool overflowQueued = false;
+    /* time range: decoded bytes to drop in front of it when the player can't
+     * seek and bytes left until its end, UINT64_MAX for the whole stream */
+    uint64_t skipBytes = 0;
+    uint64_t remainingBytes = UINT64_MAX;
+    /* metadata key index for the PCM format information we want to retrieve */
+    int channelCountKeyIndex = -1;
+    int sampleRateKeyIndex = -1;
+    /* used to query metadata values */
+    SLMetadataInfo *pcmMetaData = NULL;
+    /* we only want to query / display the PCM format once */
+    bool formatQueried = false;
+    /* the callbacks run on OpenSL ES threads, they report progress through
+     * these flags and wake up the decoding thread with stateChanged */
+    std::mutex lock;
+    std::condition_variable stateChanged;
+    /* to signal to the test app the end of the stream to decode has been reached */
+    std::atomic<bool> eos{false};
+    /* enough data has been prefetched to start decoding */
+    std::atomic<bool> prefetched{false};
+    /* Used to signal prefetching failures */
+    std::atomic<bool> prefetchError{false};
+    /* error number */
+    std::atomic<int> error_number{0};
+} CallbackCntxt;
+
+/* Sets a flag of the context and wakes up the thread waiting for it. Taking
+ * the lock makes sure that the waiting thread doesn't miss the notification. */
+static void signalState(CallbackCntxt *pCntxt, std::atomic<bool> &flag) {
+    {
+        std::lock_guard<std::mutex> guard(pCntxt->lock);
+        flag = true;
+    }
+    pCntxt->stateChanged.notify_all();
+}
+
+
+/* used to detect errors likely to have occured when the OpenSL ES framework fails to open
+ * a resource, for instance because a file URI is invalid, or an HTTP server doesn't respond.
+ */
+#define PREFETCHEVENT_ERROR_CANDIDATE \
+        (SL_PREFETCHEVENT_STATUSCHANGE | SL_PREFETCHEVENT_FILLLEVELCHANGE)
+//-----------------------------------------------------------------
+/* Error number of an OpenSL ES result, zero on success. Errors are logged with
+ * the line they happened at and returned to the caller instead of exiting. */
+#define SlErrno(x) SlErrnoFunc(x,__LINE__)
+
+static int SlErrnoFunc(SLresult result, int line) {
+    if (SL_RESULT_SUCCESS == result) return 0;
+    LOGE("Error code %u encountered at line %d", result, line);
+    switch (result) {
+        case SL_RESULT_PARAMETER_INVALID:
+            return EINVAL;
+        case SL_RESULT_MEMORY_FAILURE:
+            return ENOMEM;
+        case SL_RESULT_RESOURCE_ERROR:
+            return EBUSY;
+        case SL_RESULT_CONTENT_CORRUPTED:
+        case SL_RESULT_CONTENT_UNSUPPORTED:
+            return EILSEQ;
+        case SL_RESULT_CONTENT_NOT_FOUND:
+            return ENOENT;
+        case SL_RESULT_PERMISSION_DENIED:
+            return EACCES;
+        case SL_RESULT_FEATURE_UNSUPPORTED:
+            return ENOTSUP;
+        case SL_RESULT_OPERATION_ABORTED:
+            return ECANCELED;
+        default:
+            return EIO;
+    }
+}
+
+/* Returns the error number from the calling function if the result is an error */
+#define ReturnOnError(x) do { int e_ = SlErrno(x); if (e_) return e_; } while (0)
+
+/* Ends the decoding with an error from a callback */
+static void failDecoding(CallbackCntxt *pCntxt, int error) {
+    pCntxt->error_number = error;
+    signalState(pCntxt, pCntxt->eos);
+}
+
+//-----------------------------------------------------------------
+/* Callback for "prefetch" events, here used to detect audio resource opening errors */
+void PrefetchEventCallback(SLPrefetchStatusItf caller, void *pContext, SLuint32 event) {
+    SLpermille level = 0;
+    SLresult result;
+    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
+    result = (*caller)->GetFillLevel(caller, &level);
+    SLuint32 status = SL_PREFETCHSTATUS_UNDERFLOW;
+    if (SL_RESULT_SUCCESS == result) result = (*caller)->GetPrefetchStatus(caller, &status);
+    if (SL_RESULT_SUCCESS != result) {
+        pCntxt->error_number = SlErrno(result);
+        pCntxt->eos = true;
+        signalState(pCntxt, pCntxt->prefetchError);
+        return;
+    }
+    LOGV("PrefetchEventCallback: received event %u", event);
+    if ((PREFETCHEVENT_ERROR_CANDIDATE == (event & PREFETCHEVENT_ERROR_CANDIDATE))
+        && (level == 0) && (status == SL_PREFETCHSTATUS_UNDERFLOW)) {
+        LOGE("PrefetchEventCallback: Error while prefetching data, exiting");
+        pCntxt->error_number = -1;
+        pCntxt->eos = true;
+        signalState(pCntxt, pCntxt->prefetchError);
+    } else if (status == SL_PREFETCHSTATUS_SUFFICIENTDATA) {
+        signalState(pCntxt, pCntxt->prefetched);
+    }
+}
+
+/* Callback for "playback" events, i.e. event happening during decoding */
+void DecProgressCallback(
+        SLPlayItf caller,
+        void *pContext,
+        SLuint32 event) {
+    SLresult result;
+    SLmillisecond msec;
+    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
+    result = (*caller)->GetPosition(caller, &msec);
+    if (SL_RESULT_SUCCESS != result) msec = 0;
+    if (SL_PLAYEVENT_HEADATEND & event) {
+        LOGV("SL_PLAYEVENT_HEADATEND current position=%u ms", msec);
+        pCntxt->error_number = 0;
+        signalState(pCntxt, pCntxt->eos);
+    }
+}
+//-----------------------------------------------------------------
+/* Enqueues the next slice of the direct memory. Once it's used up pcmData is
+ * enqueued, audio arriving there means that the direct memory is too small. */
+static SLresult EnqueueDirect(SLAndroidSimpleBufferQueueItf queueItf, CallbackCntxt *pCntxt) {
+    if (pCntxt->directQueued < pCntxt->directCapacity) {
+        const size_t n = std::min(pCntxt->bufferBytes,
+                                  pCntxt->directCapacity - pCntxt->directQueued);
+        SLresult result = (*queueItf)->Enqueue(queueItf, pCntxt->direct + pCntxt->directQueued,
+                                               (SLuint32) n);
+        pCntxt->directQueued += n;
+        return result;
+    }
+    if (pCntxt->overflowQueued) return SL_RESULT_SUCCESS;
+    pCntxt->overflowQueued = true;
+    return (*queueItf)->Enqueue(queueItf, pCntxt->pDataBase, (SLuint32) pCntxt->bufferBytes);
+}
+
+/* Buffers complete in the order they were enqueued */
+static int DirectBufferDone(SLAndroidSimpleBufferQueueItf queueItf, CallbackCntxt *pCntxt) {
+    if (pCntxt->directDone >= pCntxt->directCapacity) {
+        LOGE("The buffer is too small for the decoded audio");
+        return ENOBUFS;
+    }
+    const size_t n = std::min(pCntxt->bufferBytes, pCntxt->directQueued - pCntxt->directDone);
+    /* the audio is already in place, the sink doesn't copy it */
+    int r = pCntxt->sink->write(pCntxt->direct + pCntxt->directDone, n);
+    if (r) return r;
+    pCntxt->directDone += n;
+    return SlErrno(EnqueueDirect(queueItf, pCntxt));
+}
+
+//-----------------------------------------------------------------
+/* Callback for decoding buffer queue events */
+void DecPlayCallback(
+        SLAndroidSimpleBufferQueueItf queueItf,
+        void *pContext) {
+    CallbackCntxt *pCntxt = (CallbackCntxt *) pContext;
+    /* Save the decoded data  */
+    if (pCntxt == NULL) return;
+    if (pCntxt->direct) {
+        int r = DirectBufferDone(queueItf, pCntxt);
+        if (r) {
+            failDecoding(pCntxt, r);
+            return;
+        }
+    } else {
+        /* Buffers complete in the order they were enqueued, so pData is the one just filled */
+        const size_t skip = (size_t) std::min(pCntxt->skipBytes, (uint64_t) pCntxt->bufferBytes);
+        const size_t n = (size_t) std::min(pCntxt->remainingBytes,
+                                           (uint64_t) (pCntxt->bufferBytes - skip));
+        pCntxt->skipBytes -= skip;
+        int r = n ? pCntxt->sink->write(pCntxt->pData + skip, n) : 0;
+        if (r) {
+            if (r != ECANCELED) LOGE("Error writing to output file, signaling EOS");
+            failDecoding(pCntxt, r);
+            return;
+        }
+        if (pCntxt->remainingBytes != UINT64_MAX) {
+            pCntxt->remainingBytes -= n;
+            if (!pCntxt->remainingBytes) {
+                /* the end of the range, nothing more is enqueued */
+                signalState(pCntxt, pCntxt->eos);
+                return;
+            }
+        }
+        r = SlErrno((*queueItf)->Enqueue(queueItf, pCntxt->pData,
+                                         (SLuint32) pCntxt->bufferBytes));
+        if (r) {
+            failDecoding(pCntxt, r);
+            return;
+        }
+        /* Increase data pointer by buffer size */
+        pCntxt->pData += pCntxt->bufferBytes;
+        if (pCntxt->pData >= pCntxt->pDataBase + (pCntxt->numBuffers * pCntxt->bufferBytes)) {
+            pCntxt->pData = pCntxt->pDataBase;
+        }
+    }
+    // Note: adding a sleep here or any sync point is a way to slow down the decoding, or
+    //  synchronize it with some other event, as the OpenSL ES framework will block until the
+    //  buffer queue callback return to proceed with the decoding.
+    /* Example: query of the decoded PCM format */
+    if (pCntxt->formatQueried) {
+        return;
+    }
+    /* the format is only logged, failing to query it doesn't stop the decoding */
+    pCntxt->formatQueried = true;
+    SLresult res = (*pCntxt->metaItf)->GetValue(pCntxt->metaItf, pCntxt->sampleRateKeyIndex,
+                                                PCM_METADATA_VALUE_SIZE, pCntxt->pcmMetaData);
+    if (SlErrno(res)) return;
+    // Note: here we could verify the following:
+    //         pcmMetaData->encoding == SL_CHARACTERENCODING_BINARY
+    //         pcmMetaData->size == sizeof(SLuint32)
+    //       but the call was successful for the PCM format keys, so those conditions are implied
+    LOGV("sample rate = %dHz, ", *((SLuint32 *) pCntxt->pcmMetaData->data));
+    res = (*pCntxt->metaItf)->GetValue(pCntxt->metaItf, pCntxt->channelCountKeyIndex,
+                                       PCM_METADATA_VALUE_SIZE, pCntxt->pcmMetaData);
+    if (SlErrno(res)) return;
+    LOGV("channel count = %d", *((SLuint32 *) pCntxt->pcmMetaData->data));
+}
+//-----------------------------------------------------------------
+/* Reads a PCM format value from the metadata of the decoder, zero if it's unknown */
+static SLuint32 metadataValue(CallbackCntxt &cntxt, int keyIndex) {
+    if (keyIndex < 0) return 0;
+    SLresult res = (*cntxt.metaItf)->GetValue(cntxt.metaItf, (SLuint32) keyIndex,
+                                              PCM_METADATA_VALUE_SIZE, cntxt.pcmMetaData);
+    if (SL_RESULT_SUCCESS != res) return 0;
+    return *((SLuint32 *) cntxt.pcmMetaData->data);
+}
+
+/* Format of the decoded audio from the metadata of the decoder or, if it
+ * doesn't have it, from the STREAMINFO of a flac source (NULL otherwise) */
+static void decodedFormat(CallbackCntxt &cntxt, const FlacStreamInfo *flacInfo,
+                          const ConvOptions &opts, PcmFormat &fmt) {
+    fmt.sampleRate = metadataValue(cntxt, cntxt.sampleRateKeyIndex);
+    fmt.channels = metadataValue(cntxt, cntxt.channelCountKeyIndex);
+    if (flacInfo) {
+        if (!fmt.channels) fmt.channels = flacInfo->channels;
+        if (!fmt.sampleRate) fmt.sampleRate = flacInfo->sampleRate;
+        fmt.totalFrames = flacInfo->totalSamples;
+    }
+    if (!fmt.sampleRate) fmt.sampleRate = (unsigned) opts.samplingRateHz;
+}
+
+//-----------------------------------------------------------------
+/* Buffer size in 16 bit samples for the source: the configured one or for
+ * BUFFER_SIZE_ADAPTIVE a multiple of the block size of a FLAC source so that
+ * every buffer takes whole blocks */
+static size_t bufferSamples(const FlacStreamInfo *flacInfo, const ConvOptions &opts) {
+    if (opts.bufferSizeSamples > 0) {
+        return std::min((size_t) opts.bufferSizeSamples, (size_t) MAX_BUFFER_SIZE_IN_SAMPLES);
+    }
+    size_t samples = DEFAULT_BUFFER_SIZE_IN_SAMPLES;
+    if (flacInfo && flacInfo->maxBlockSize > 0) {
+        const size_t block = (size_t) flacInfo->maxBlockSize * flacInfo->channels;
+        samples = block * std::max((size_t) 1, (ADAPTIVE_MIN_BUFFER_BYTES / 2 + block - 1) / block);
+        samples = std::min(samples, (size_t) MAX_BUFFER_SIZE_IN_SAMPLES);
+        LOGV("Adaptive buffer size: %zu samples for FLAC blocks of %u",
+             samples, flacInfo->maxBlockSize);
+    }
+    return samples;
+}
+
+//-----------------------------------------------------------------
+/* Destroys an audio player when it goes out of scope, so that every error
+ * return stops the player and its callbacks */
+class PlayerGuard {
+public:
+    PlayerGuard() : player(NULL) {}
+
+    ~PlayerGuard() { destroy(); }
+
+    void destroy() {
+        if (player) (*player)->Destroy(player);
+        player = NULL;
+    }
+
+    SLObjectItf player;
+};
+
+/* Waits until the callbacks signal done or the wait is given up after
+ * timeoutMs (< 0 for none). With a monitor it wakes up every
+ * progressIntervalMs to report the position and to check whether the
+ * conversion has been cancelled. Returns zero, ETIMEDOUT or ECANCELED. */
+template<class Done>
+static int waitForCallbacks(CallbackCntxt &cntxt, SLPlayItf playItf, const ConvOptions &opts,
+                            int64_t timeoutMs, Done done) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(
+            timeoutMs < 0 ? 0 : timeoutMs);
+    std::unique_lock<std::mutex> guard(cntxt.lock);
+    for (;;) {
+        if (done()) return 0;
+        if (NULL == opts.monitor) {
+            if (timeoutMs < 0) {
+                cntxt.stateChanged.wait(guard, done);
+                return 0;
+            }
+            return cntxt.stateChanged.wait_until(guard, deadline, done) ? 0 : ETIMEDOUT;
+        }
+        auto wakeup = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(std::max(opts.progressIntervalMs, 1));
+        if (timeoutMs >= 0) wakeup = std::min(wakeup, deadline);
+        if (cntxt.stateChanged.wait_until(guard, wakeup, done)) return 0;
+        if (opts.monitor->cancelled()) return ECANCELED;
+        if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline) return ETIMEDOUT;
+        guard.unlock();
+        SLmillisecond position = 0;
+        SLmillisecond duration = SL_TIME_UNKNOWN;
+        if (SL_RESULT_SUCCESS == (*playItf)->GetPosition(playItf, &position)) {
+            (*playItf)->GetDuration(playItf, &duration);
+            opts.monitor->progress((int64_t) position,
+                                   duration == SL_TIME_UNKNOWN ? -1 : (int64_t) duration);
+        }
+        guard.lock();
+    }
+}
+
+//-----------------------------------------------------------------
+/* Decode an audio path by opening a file descriptor on that path  */
+static int decToBuffQueue(SLEngineItf EngineItf, SLDataSource *decSource, PcmSink &sink,
+                          const ConvOptions &opts, const FlacStreamInfo *flacInfo,
+                          size_t bufferSamples, CallbackCntxt &cntxt) {
+    cntxt.sink = &sink;
+    cntxt.numBuffers = (unsigned) std::max(1, std::min(opts.numBuffers, MAX_BUFFERS_IN_QUEUE));
+    cntxt.bufferBytes = 2 * bufferSamples;
+    /* a range is trimmed from the buffers, the sink's memory only gets the range */
+    cntxt.direct = isRanged(opts) ? NULL : sink.directBuffer(cntxt.directCapacity);
+    cntxt.skipBytes = 0;
+    cntxt.remainingBytes = UINT64_MAX;
+    cntxt.directQueued = 0;
+    cntxt.directDone = 0;
+    cntxt.overflowQueued = false;
+    /* the slot keeps the largest buffers it has had, decoding in place
+     * only needs one for the overflow */
+    cntxt.pcmData.resize((cntxt.direct ? 1 : cntxt.numBuffers) * cntxt.bufferBytes);
+    cntxt.channelCountKeyIndex = -1;
+    cntxt.sampleRateKeyIndex = -1;
+    cntxt.eos = false;
+    cntxt.prefetched = false;
+    cntxt.prefetchError = false;
+    SLresult result;
+    /* Objects this application uses: one audio player */
+    PlayerGuard playerGuard;
+    SLObjectItf &player = playerGuard.player;
+    /* Interfaces for the audio player */
+    SLAndroidSimpleBufferQueueItf decBuffQueueItf;
+    SLPrefetchStatusItf prefetchItf;
+    SLPlayItf playItf;
+    SLMetadataExtractionItf mdExtrItf;
+    SLSeekItf seekItf;
+    /* Data sink for decoded audio */
+    SLDataSink decDest;
+    SLDataLocator_AndroidSimpleBufferQueue decBuffQueue;
+    SLDataFormat_PCM pcm;
+    SLboolean required[NUM_EXPLICIT_INTERFACES_FOR_PLAYER];
+    SLInterfaceID iidArray[NUM_EXPLICIT_INTERFACES_FOR_PLAYER];
+    /* Initialize arrays required[] and iidArray[] */
+    for (int i = 0; i < NUM_EXPLICIT_INTERFACES_FOR_PLAYER; i++) {
+        required[i] = SL_BOOLEAN_FALSE;
+        iidArray[i] = SL_IID_NULL;
+    }
+    /* allocate memory to receive the PCM format metadata */
+    if (!(cntxt.pcmMetaData)) {
+        cntxt.pcmMetaData = (SLMetadataInfo *) malloc(PCM_METADATA_VALUE_SIZE);
+    }
+    cntxt.formatQueried = false;
+    /* ------------------------------------------------------ */
+    /* Configuration of the player  */
+    /* Request the AndroidSimpleBufferQueue interface */
+    required[0] = SL_BOOLEAN_TRUE;
+    iidArray[0] = SL_IID_ANDROIDSIMPLEBUFFERQUEUE;
+    /* Request the PrefetchStatus interface */
+    required[1] = SL_BOOLEAN_TRUE;
+    iidArray[1] = SL_IID_PREFETCHSTATUS;
+    /* Request the PrefetchStatus interface */
+    required[2] = SL_BOOLEAN_TRUE;
+    iidArray[2] = SL_IID_METADATAEXTRACTION;
+    /* Request the Seek interface for a time range, without it the audio in
+     * front of the range is decoded and dropped */
+    if (isRanged(opts)) iidArray[3] = SL_IID_SEEK;
+    /* Setup the data sink */
+    decBuffQueue.locatorType = SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE;
+    decBuffQueue.numBuffers = cntxt.numBuffers;
+    /*    set up the format of the data in the buffer queue */
+    pcm.formatType = SL_DATAFORMAT_PCM;
+    // FIXME valid value required but currently ignored
+    pcm.numChannels = 1;
+    switch (opts.samplingRateHz) {
+        case 48000:
+            pcm.samplesPerSec = SL_SAMPLINGRATE_48;
+            break;
+        case 44100:
+            pcm.samplesPerSec = SL_SAMPLINGRATE_44_1;
+            break;
+        case 8000:
+            pcm.samplesPerSec = SL_SAMPLINGRATE_8;
+            break;
+        default:
+            pcm.samplesPerSec = SL_SAMPLINGRATE_48;
+            break;
+    }
+    pcm.bitsPerSample = SL_PCMSAMPLEFORMAT_FIXED_16;
+    pcm.containerSize = 16;
+    pcm.channelMask = SL_SPEAKER_FRONT_CENTER;
+    pcm.endianness = SL_BYTEORDER_LITTLEENDIAN;
+    decDest.pLocator = (void *) &decBuffQueue;
+    decDest.pFormat = (void *) &pcm;
+    /* Create the audio player */
+    result = (*EngineItf)->CreateAudioPlayer(EngineItf, &player, decSource, &decDest,
+                                             NUM_EXPLICIT_INTERFACES_FOR_PLAYER, iidArray,
+                                             required);
+    if (SL_RESULT_SUCCESS != result) player = NULL;
+    ReturnOnError(result);
+    LOGV("Player created");
+    /* Realize the player in synchronous mode. */
+    result = (*player)->Realize(player, SL_BOOLEAN_FALSE);
+    ReturnOnError(result);
+    LOGV("Player realized");
+    /* Get the play interface which is implicit */
+    result = (*player)->GetInterface(player, SL_IID_PLAY, (void *) &playItf);
+    ReturnOnError(result);
+    result = (*playItf)->SetCallbackEventsMask(playItf, SL_PLAYEVENT_HEADATEND);
+    ReturnOnError(result);
+    result = (*playItf)->RegisterCallback(playItf,
+                                          DecProgressCallback,
+                                          &cntxt);
+    ReturnOnError(result);
+    LOGV("Play callback registered");
+    /* Get the buffer queue interface which was explicitly requested */
+    result = (*player)->GetInterface(player, SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
+                                     (void *) &decBuffQueueItf);
+    ReturnOnError(result);
+    /* Get the prefetch status interface which was explicitly requested */
+    result = (*player)->GetInterface(player, SL_IID_PREFETCHSTATUS, (void *) &prefetchItf);
+    ReturnOnError(result);
+    /* Get the metadata extraction interface which was explicitly requested */
+    result = (*player)->GetInterface(player, SL_IID_METADATAEXTRACTION, (void *) &mdExtrItf);
+    ReturnOnError(result);
+    /* ------------------------------------------------------ */
+    /* Initialize the callback and its context for the decoding buffer queue */
+    cntxt.playItf = playItf;
+    cntxt.metaItf = mdExtrItf;
+    cntxt.pDataBase = &cntxt.pcmData[0];
+    cntxt.pData = cntxt.pDataBase;
+    cntxt.size = (SLuint32) cntxt.pcmData.size();
+    cntxt.error_number = 0;
+    result = (*decBuffQueueItf)->RegisterCallback(decBuffQueueItf,
+                                                  DecPlayCallback,
+                                                  &cntxt);
+    ReturnOnError(result);
+    /* Enqueue buffers to map the region of memory allocated to store the decoded data */
+    LOGV("Enqueueing buffer ");
+    for (unsigned i = 0; i < cntxt.numBuffers; i++) {
+        if (cntxt.direct) {
+            result = EnqueueDirect(decBuffQueueItf, &cntxt);
+        } else {
+            result = (*decBuffQueueItf)->Enqueue(decBuffQueueItf, cntxt.pData,
+                                                 (SLuint32) cntxt.bufferBytes);
+            cntxt.pData += cntxt.bufferBytes;
+        }
+        ReturnOnError(result);
+    }
+    cntxt.pData = cntxt.pDataBase;
+    /* ------------------------------------------------------ */
+    /* Initialize the callback for prefetch errors, if we can't open the resource to decode */
+    result = (*prefetchItf)->RegisterCallback(prefetchItf, PrefetchEventCallback, &cntxt);
+    ReturnOnError(result);
+    result = (*prefetchItf)->SetCallbackEventsMask(prefetchItf, PREFETCHEVENT_ERROR_CANDIDATE);
+    ReturnOnError(result);
+    /* ------------------------------------------------------ */
+    /* Prefetch the data so we can get information about the format before starting to decode */
+    /*     1/ cause the player to prefetch the data */
+    const int64_t prefetchStartUs = statsNowUs();
+    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_PAUSED);
+    ReturnOnError(result);
+    /*     2/ block until the prefetch callback reports data or an error. The status
+     *        is also queried directly in case it was reached before the callback. */
+    SLuint32 prefetchStatus = SL_PREFETCHSTATUS_UNDERFLOW;
+    (*prefetchItf)->GetPrefetchStatus(prefetchItf, &prefetchStatus);
+    if (prefetchStatus == SL_PREFETCHSTATUS_SUFFICIENTDATA) cntxt.prefetched = true;
+    int r = waitForCallbacks(cntxt, playItf, opts, opts.prefetchTimeoutMs, [&cntxt] {
+        return cntxt.prefetched || cntxt.prefetchError;
+    });
+    if (r == ECANCELED) return r;
+    if (!cntxt.prefetched || cntxt.prefetchError) {
+        LOGE("Failure to prefetch data in time");
+        if (cntxt.error_number > 0) return cntxt.error_number;
+        return cntxt.prefetchError ? ENOENT : ETIMEDOUT;
+    }
+    if (opts.stats) opts.stats->prefetchUs = statsNowUs() - prefetchStartUs;
+    /* ------------------------------------------------------ */
+    /* Display duration */
+    SLmillisecond durationInMsec = SL_TIME_UNKNOWN;
+    result = (*playItf)->GetDuration(playItf, &durationInMsec);
+    ReturnOnError(result);
+    if (durationInMsec == SL_TIME_UNKNOWN) {
+        LOGV("Content duration is unknown");
+    } else {
+        LOGV("Content duration is %ums", durationInMsec);
+    }
+    /* ------------------------------------------------------ */
+    /* Display the metadata obtained from the decoder */
+    //   This is for test / demonstration purposes only where we discover the key and value sizes
+    //   of a PCM decoder. An application that would want to directly get access to those values
+    //   can make assumptions about the size of the keys and their matching values (all SLuint32)
+    SLuint32 itemCount;
+    (*mdExtrItf)->GetItemCount(mdExtrItf, &itemCount);
+    SLuint32 i, keySize, valueSize;
+    SLMetadataInfo *keyInfo;
+    for (i = 0; i < itemCount; i++) {
+        keySize = 0;
+        valueSize = 0;
+        result = (*mdExtrItf)->GetKeySize(mdExtrItf, i, &keySize);
+        ReturnOnError(result);
+        result = (*mdExtrItf)->GetValueSize(mdExtrItf, i, &valueSize);
+        ReturnOnError(result);
+        keyInfo = (SLMetadataInfo *) malloc(keySize);
+        if (NULL != keyInfo) {
+            result = (*mdExtrItf)->GetKey(mdExtrItf, i, keySize, keyInfo);
+            if (SL_RESULT_SUCCESS != result) free(keyInfo);
+            ReturnOnError(result);
+            LOGV("key[%d] size=%d, name=%s \tvalue size=%d",
+                 i, keyInfo->size, keyInfo->data, valueSize);
+            /* find out the key index of the metadata we're interested in */
+            if (!strcmp((char *) keyInfo->data, ANDROID_KEY_PCMFORMAT_NUMCHANNELS)) {
+                cntxt.channelCountKeyIndex = i;
+            } else if (!strcmp((char *) keyInfo->data, ANDROID_KEY_PCMFORMAT_SAMPLERATE)) {
+                cntxt.sampleRateKeyIndex = i;
+            }
+            free(keyInfo);
+        }
+    }
+    if (cntxt.channelCountKeyIndex != -1) {
+        LOGV("Key %s is at index %d",
+             ANDROID_KEY_PCMFORMAT_NUMCHANNELS, cntxt.channelCountKeyIndex);
+    } else {
+        LOGD("Unable to find key %s", ANDROID_KEY_PCMFORMAT_NUMCHANNELS);
+    }
+    if (cntxt.sampleRateKeyIndex != -1) {
+        LOGV("Key %s is at index %d",
+             ANDROID_KEY_PCMFORMAT_SAMPLERATE, cntxt.sampleRateKeyIndex);
+    } else {
+        LOGD("Unable to find key %s", ANDROID_KEY_PCMFORMAT_SAMPLERATE);
+    }
+    /* ------------------------------------------------------ */
+    /* Tell the sink the format of the decoded audio */
+    PcmFormat fmt;
+    decodedFormat(cntxt, flacInfo, opts, fmt);
+    uint64_t first = 0;
+    uint64_t count = 0;
+    if (isRanged(opts)) {
+        r = rangeFrames(opts, fmt.sampleRate, fmt.totalFrames, first, count);
+        if (!r && fmt.totalFrames) fmt.totalFrames = count;
+    }
+    if (!r) r = sink.begin(fmt);
+    if (r) return r;
+    /* ------------------------------------------------------ */
+    /* Go to the start of the time range */
+    if (isRanged(opts)) {
+        const uint64_t frameBytes = (uint64_t) std::max(fmt.channels, 1u) * sizeof(int16_t);
+        if (count != UINT64_MAX) cntxt.remainingBytes = count * frameBytes;
+        if (first > 0) {
+            result = (*player)->GetInterface(player, SL_IID_SEEK, (void *) &seekItf);
+            if (SL_RESULT_SUCCESS == result) {
+                result = (*seekItf)->SetPosition(seekItf, (SLmillisecond) opts.startMs,
+                                                 SL_SEEKMODE_ACCURATE);
+            }
+            if (SL_RESULT_SUCCESS != result) {
+                LOGD("The decoder can't seek, dropping the audio in front of the range");
+                cntxt.skipBytes = first * frameBytes;
+            }
+        }
+    }
+    /* ------------------------------------------------------ */
+    /* Start decoding */
+    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_PLAYING);
+    ReturnOnError(result);
+    LOGV("Starting to decode");
+    /* Decode until the end of the stream is reached or the conversion is cancelled */
+    r = waitForCallbacks(cntxt, playItf, opts, -1, [&cntxt] { return cntxt.eos.load(); });
+    LOGV(r ? "Cancelled" : "EOS signaled");
+    /* ------------------------------------------------------ */
+    /* End of decoding */
+    /* Stop decoding */
+    result = (*playItf)->SetPlayState(playItf, SL_PLAYSTATE_STOPPED);
+    if (!r) r = SlErrno(result);
+    LOGV("Stopped decoding");
+    /* Destroy the AudioPlayer object, after that no callback runs anymore */
+    playerGuard.destroy();
+
+    if (r) return r;
+    if (cntxt.error_number) return cntxt.error_number;
+    return sink.end();
+}
+
+
+//-----------------------------------------------------------------
+OpenSLBackend::OpenSLBackend(unsigned maxPlayers) :
+        sl(NULL), engineItf(NULL), maxPlayers(maxPlayers ? maxPlayers : 1), slotsInUse(0) {}
+
+OpenSLBackend::~OpenSLBackend() {
+    std::unique_lock<std::mutex> guard(lock);
+    /* conversions still running own a slot, wait for them */
+    slotReturned.wait(guard, [this] { return slotsInUse == 0; });
+    for (size_t i = 0; i < freeSlots.size(); i++) {
+        free(freeSlots[i]->pcmMetaData);
+        delete freeSlots[i];
+    }
+    freeSlots.clear();
+    if (sl) {
+        /* Shutdown OpenSL ES */
+        (*sl)->Destroy(sl);
+        LOGV("Engine destroyed");
+    }
+}
+
+SLEngineItf OpenSLBackend::engine() {
+    if (sl) return engineItf;
+    SLresult result;
+    SLEngineOption EngineOption[] = {
+            {(SLuint32) SL_ENGINEOPTION_THREADSAFE, (SLuint32) SL_BOOLEAN_TRUE}
+    };
+    result = slCreateEngine(&sl, 1, EngineOption, 0, NULL, NULL);
+    if (SlErrno(result)) {
+        sl = NULL;
+        return NULL;
+    }
+
+    /* Realizing the SL Engine in synchronous mode. */
+    result = (*sl)->Realize(sl, SL_BOOLEAN_FALSE);
+
+    /* Get the SL Engine Interface which is implicit */
+    if (SL_RESULT_SUCCESS == result) {
+        result = (*sl)->GetInterface(sl, SL_IID_ENGINE, (void *) &engineItf);
+    }
+    if (SlErrno(result)) {
+        /* the next conversion tries again */
+        (*sl)->Destroy(sl);
+        sl = NULL;
+        engineItf = NULL;
+        return NULL;
+    }
+    LOGV("Engine realized");
+    return engineItf;
+}
+
+CallbackCntxt *OpenSLBackend::acquire(SLEngineItf &itf, const ConvOptions &opts, int &error) {
+    std::unique_lock<std::mutex> guard(lock);
+    auto slotFree = [this] {
+        return !freeSlots.empty() || slotsInUse + freeSlots.size() < maxPlayers;
+    };
+    if (NULL == opts.monitor) {
+        slotReturned.wait(guard, slotFree);
+    } else {
+        /* an asynchronous conversion can be cancelled while it waits */
+        const auto interval = std::chrono::milliseconds(std::max(opts.progressIntervalMs, 1));
+        while (!slotReturned.wait_for(guard, interval, slotFree)) {
+            if (opts.monitor->cancelled()) {
+                error = ECANCELED;
+                return NULL;
+            }
+        }
+    }
+    itf = engine();
+    if (NULL == itf) {
+        LOGE("Could not create the OpenSL ES engine");
+        error = EIO;
+        return NULL;
+    }
+    CallbackCntxt *cntxt;
+    if (freeSlots.empty()) {
+        cntxt = new CallbackCntxt;
+    } else {
+        cntxt = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    slotsInUse++;
+    return cntxt;
+}
+
+void OpenSLBackend::release(CallbackCntxt *cntxt) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        freeSlots.push_back(cntxt);
+        slotsInUse--;
+    }
+    slotReturned.notify_all();
+}
+
+/* The platform decoder only reads URIs and file descriptors, and its buffer
+ * queue source only takes MPEG-2 TS. Compressed audio in memory is handed to
+ * it as an anonymous file in RAM, which doesn't touch the flash. */
+static int memoryFd(const DecodeSource &src) {
+#ifdef __NR_memfd_create
+    int fd = (int) syscall(__NR_memfd_create, "flac2raw", 0);
+    if (fd < 0) return -errno;
+    size_t done = 0;
+    while (done < src.size) {
+        ssize_t w = write(fd, src.data + done, src.size - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            int e = w < 0 ? errno : EIO;
+            close(fd);
+            return -e;
+        }
+        done += (size_t) w;
+    }
+    return fd;
+#else
+    (void) src;
+    return -ENOSYS;
+#endif
+}
+
+int OpenSLBackend::decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts) {
+    if (src.type == DecodeSource::MEMORY) {
+        if (NULL == src.data || 0 == src.size) return EILSEQ;
+        int fd = memoryFd(src);
+        if (fd < 0) {
+            LOGE("Could not create an in-memory file, the native backend can decode from memory");
+            return -fd;
+        }
+        DecodeSource fdSrc;
+        fdSrc.type = DecodeSource::FD;
+        fdSrc.fd = fd;
+        fdSrc.start = 0;
+        fdSrc.length = (off_t) src.size;
+        int r = decode(fdSrc, sink, opts);
+        close(fd);
+        return r;
+    }
+    /* Source of audio data for the decoding */
+    SLDataSource decSource;
+    SLDataLocator_URI decUri;
+    SLDataLocator_AndroidFD decFd;
+    SLDataFormat_MIME decMime;
+
+    /* Setup the data source */
+    if (src.type == DecodeSource::URI) {
+        decUri.locatorType = SL_DATALOCATOR_URI;
+        decUri.URI = (SLchar *) src.path;
+        decSource.pLocator = (void *) &decUri;
+    } else {
+        decFd.locatorType = SL_DATALOCATOR_ANDROIDFD;
+        decFd.fd = src.fd;
+        decFd.offset = src.start;
+        decFd.length = src.length;
+        decSource.pLocator = (void *) &decFd;
+    }
+    decMime.formatType = SL_DATAFORMAT_MIME;
+
+    /*     this is how ignored mime information is specified, according to OpenSL ES spec
+     *     in 9.1.6 SLDataFormat_MIME and 8.23 SLMetadataTraversalItf GetChildInfo */
+    decMime.mimeType = (SLchar *) NULL;
+    decMime.containerType = SL_CONTAINERTYPE_UNSPECIFIED;
+    decSource.pFormat = (void *) &decMime;
+
+    /* the metadata of a flac source helps to size the buffers and fills in the format */
+    FlacStreamInfo info;
+    const FlacStreamInfo *flacInfo = NativeFlacBackend::probe(src, info) == 0 ? &info : NULL;
+    const size_t samples = bufferSamples(flacInfo, opts);
+    SLEngineItf itf;
+    int r = 0;
+    CallbackCntxt *cntxt = acquire(itf, opts, r);
+    if (NULL == cntxt) return r;
+    r = decToBuffQueue(itf, &decSource, sink, opts, flacInfo, samples, *cntxt);
+    release(cntxt);
+    return r;
+}
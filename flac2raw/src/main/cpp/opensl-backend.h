@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_OPENSL_BACKEND_H
+#define FLAC2RAW_OPENSL_BACKEND_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+#include "decoder-backend.h"
+
+/* Default number of audio players decoding at the same time */
+#define OPENSL_DEFAULT_MAX_PLAYERS 4
+
+struct CallbackCntxt_;
+
+//-----------------------------------------------------------------
+/* Decodes through the platform decoder of OpenSL ES. Errors of OpenSL ES are
+ * returned as error numbers. The engine is created
+ * on first use and kept until the backend is destroyed. An audio player is
+ * bound to its data source so it's created per conversion but its callback
+ * context with the PCM buffers is recycled, and at most maxPlayers players
+ * exist at any time; further conversions wait for a free slot. */
+class OpenSLBackend : public DecoderBackend {
+public:
+    explicit OpenSLBackend(unsigned maxPlayers = OPENSL_DEFAULT_MAX_PLAYERS);
+
+    /* waits for running conversions and then shuts down OpenSL ES */
+    ~OpenSLBackend();
+
+    int decode(const DecodeSource &src, PcmSink &sink, const ConvOptions &opts);
+
+private:
+    SLEngineItf engine();
+
+    /* waits for a free slot, NULL with the error number if the engine can't be
+     * created or opts.monitor cancels the conversion while it waits */
+    struct CallbackCntxt_ *acquire(SLEngineItf &itf, const ConvOptions &opts, int &error);
+
+    void release(struct CallbackCntxt_ *cntxt);
+
+    std::mutex lock;
+    std::condition_variable slotReturned;
+    SLObjectItf sl;
+    SLEngineItf engineItf;
+    std::vector<struct CallbackCntxt_ *> freeSlots;
+    unsigned maxPlayers;
+    unsigned slotsInUse;
+};
+
+#endif
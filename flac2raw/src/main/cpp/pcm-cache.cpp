@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <time.h>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+#include "pcm-cache.h"
+#include "md5.h"
+#include "flac2raw-log.h"
+
+/* Temporary files of entries older than this are left over from a crash */
+#define PCM_CACHE_STALE_TMP_SECONDS 3600
+/* Buffer for copying if the kernel can't copy between the files itself */
+#define PCM_CACHE_COPY_BUFFER_BYTES (64 * 1024)
+
+//-----------------------------------------------------------------
+/* Copies the file open as in to a new file at path, on disk if sync is set */
+static int copyTo(int in, const char *path, bool sync) {
+    struct stat st;
+    if (fstat(in, &st)) return errno;
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) return errno;
+    int r = 0;
+    off_t off = 0;
+    bool kernelCopy = true;
+    std::vector<uint8_t> buf;
+    while (off < st.st_size && !r) {
+        const size_t len = (size_t) (st.st_size - off);
+        if (kernelCopy) {
+            ssize_t n = sendfile(out, in, &off, len);
+            if (n > 0) continue;
+            if (n == 0) break;
+            if (errno == EINTR) continue;
+            if (errno != EINVAL && errno != ENOSYS) {
+                r = errno;
+                break;
+            }
+            kernelCopy = false;
+            buf.resize(PCM_CACHE_COPY_BUFFER_BYTES);
+        }
+        ssize_t n = pread(in, &buf[0], std::min(len, buf.size()), off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            r = n < 0 ? errno : EIO;
+            break;
+        }
+        for (ssize_t done = 0; done < n && !r;) {
+            ssize_t w = write(out, &buf[(size_t) done], (size_t) (n - done));
+            if (w < 0 && errno != EINTR) r = errno;
+            if (w > 0) done += w;
+        }
+        off += n;
+    }
+    if (!r && sync && fsync(out)) r = errno;
+    if (close(out) && !r) r = errno;
+    return r;
+}
+
+int PcmCache::key(const DecodeSource &src, const ConvOptions &opts, std::string &key) {
+    MappedSource in;
+    int r = in.map(src);
+    if (r) return r;
+    uint8_t digest[16];
+    Md5 content;
+    content.update(in.data, in.size);
+    content.final(digest);
+    /* everything which changes the bytes of the output */
+    char params[160];
+    snprintf(params, sizeof(params), "backend=%d format=%d mono=%d rate=%d start=%lld end=%lld",
+             opts.backend, opts.sampleFormat, opts.downmix ? 1 : 0, opts.resampleToHz,
+             (long long) opts.startMs, (long long) opts.endMs);
+    if (opts.container == FLAC2RAW_CONTAINER_CHUNKED) {
+        const size_t n = strlen(params);
+        snprintf(params + n, sizeof(params) - n, " chunked=%d", opts.chunkBytes);
+    }
+    Md5 md5;
+    md5.update(digest, sizeof(digest));
+    md5.update(params, strlen(params));
+    md5.final(digest);
+    char hex[33];
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    key = hex;
+    return 0;
+}
+
+/* Copies the file open as in to path through a temporary file next to it,
+ * so that path is either complete or not there */
+static int copyAtomically(int in, const std::string &path) {
+    static std::atomic<unsigned> counter(0);
+    const std::string tmp = path + "." + std::to_string(getpid()) + "." +
+                            std::to_string(counter++) + ".tmp";
+    int r = copyTo(in, tmp.c_str(), true);
+    if (!r && rename(tmp.c_str(), path.c_str())) r = errno;
+    if (r) unlink(tmp.c_str());
+    return r;
+}
+
+std::string PcmCache::entryPath(const std::string &key) const {
+    return dir + "/" + key + ".pcm";
+}
+
+int PcmCache::fetch(const std::string &key, const char *dst) {
+    int in = open(entryPath(key).c_str(), O_RDONLY);
+    if (in < 0) return errno;
+    int r = copyAtomically(in, dst);
+    /* the modification time orders the entries for the eviction */
+    if (!r) futimens(in, NULL);
+    close(in);
+    return r;
+}
+
+int PcmCache::store(const std::string &key, const char *src) {
+    int in = open(src, O_RDONLY);
+    if (in < 0) return errno;
+    struct stat st;
+    if (fstat(in, &st)) {
+        int e = errno;
+        close(in);
+        return e;
+    }
+    if ((uint64_t) st.st_size > maxBytes) {
+        LOGD("%s is larger than the cache", src);
+        close(in);
+        return 0;
+    }
+    if (mkdir(dir.c_str(), 0700) && errno != EEXIST) {
+        int e = errno;
+        close(in);
+        return e;
+    }
+    int r = copyAtomically(in, entryPath(key));
+    close(in);
+    if (r) return r;
+    evict();
+    return 0;
+}
+
+void PcmCache::evict() {
+    DIR *d = opendir(dir.c_str());
+    if (NULL == d) return;
+    typedef struct Entry_ {
+        std::string path;
+        uint64_t size;
+        struct timespec mtime;
+    } Entry;
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    const time_t now = time(NULL);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        const size_t len = strlen(e->d_name);
+        const bool isEntry = len > 4 && !strcmp(e->d_name + len - 4, ".pcm");
+        const bool isTmp = len > 4 && !strcmp(e->d_name + len - 4, ".tmp");
+        if (!isEntry && !isTmp) continue;
+        Entry entry;
+        entry.path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(entry.path.c_str(), &st)) continue;
+        if (isTmp) {
+            if (now - st.st_mtime > PCM_CACHE_STALE_TMP_SECONDS) unlink(entry.path.c_str());
+            continue;
+        }
+        entry.size = (uint64_t) st.st_size;
+        entry.mtime = st.st_mtim;
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    closedir(d);
+    if (total <= maxBytes) return;
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec :
+               a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > maxBytes; i++) {
+        /* a conversion still copying the entry keeps its data */
+        if (unlink(entries[i].path.c_str()) == 0) {
+            total -= entries[i].size;
+            LOGV("Evicted %s from the cache", entries[i].path.c_str());
+        }
+    }
+}
+
+//-----------------------------------------------------------------
+int cachedConvert(const DecodeSource &src, const char *dst, const ConvOptions &opts,
+                  const std::function<int()> &convert) {
+    if (opts.cacheDir.empty()) return convert();
+    PcmCache cache(opts.cacheDir, (uint64_t) std::max(opts.cacheMaxBytes, (int64_t) 0));
+    std::string key;
+    int r = PcmCache::key(src, opts, key);
+    if (r) {
+        LOGD("Not caching the output of an unreadable source: %s", strerror(r));
+        return convert();
+    }
+    r = cache.fetch(key, dst);
+    if (!r) {
+        LOGV("%s from the cache", dst);
+        return 0;
+    }
+    if (r != ENOENT) LOGE("Could not copy from the cache: %s", strerror(r));
+    r = convert();
+    if (r) return r;
+    r = cache.store(key, dst);
+    if (r) LOGE("Could not add %s to the cache: %s", dst, strerror(r));
+    return 0;
+}
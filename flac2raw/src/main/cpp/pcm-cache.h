@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_PCM_CACHE_H
+#define FLAC2RAW_PCM_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <functional>
+
+#include "decoder-backend.h"
+
+//-----------------------------------------------------------------
+/* On disk cache of converted raw files. An entry is named after the MD5 of the
+ * compressed source and of everything in ConvOptions which changes the output,
+ * so a renamed or copied file still hits and a changed one doesn't. Entries
+ * are written to a temporary file, synced and renamed, so a crash never leaves
+ * a partial entry behind. The least recently used entries are evicted when the
+ * cache grows beyond its budget. All methods return zero or the error number. */
+class PcmCache {
+public:
+    PcmCache(const std::string &dir, uint64_t maxBytes) : dir(dir), maxBytes(maxBytes) {}
+
+    /* Key of the output of src converted with opts */
+    static int key(const DecodeSource &src, const ConvOptions &opts, std::string &key);
+
+    /* Copies the entry of key to dst, ENOENT if there is none. The copy goes to a
+     * temporary file which is renamed to dst, so dst is never left half written. */
+    int fetch(const std::string &key, const char *dst);
+
+    /* Adds a copy of the converted file src as the entry of key and evicts
+     * older entries until the cache fits into its budget */
+    int store(const std::string &key, const char *src);
+
+    /* Path of the entry of key */
+    std::string entryPath(const std::string &key) const;
+
+private:
+    void evict();
+
+    const std::string dir;
+    const uint64_t maxBytes;
+};
+
+/* Converts src to dst with convert() unless opts.cacheDir has the output
+ * already, the new output is then added to the cache. Cache errors are only
+ * logged, the conversion is what counts. */
+int cachedConvert(const DecodeSource &src, const char *dst, const ConvOptions &opts,
+                  const std::function<int()> &convert);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+#include "pcm-sink.h"
+#include "flac2raw-log.h"
+
+/* size of the blocks written in FLAC2RAW_OUTPUT_PWRITE mode */
+#define OUTPUT_BLOCK_BYTES (1024 * 1024)
+
+FilePcmSink::~FilePcmSink() {
+    if (f) fclose(f);
+    if (map) munmap(map, mapSize);
+    if (fd >= 0) close(fd);
+}
+
+int FilePcmSink::open(const char *dst, int outputMode) {
+    mode = outputMode;
+    if (mode == FLAC2RAW_OUTPUT_STDIO) {
+        f = fopen(dst, "w");
+        if (NULL == f) {
+            LOGE("Could not write to the phone memory");
+            return errno;
+        }
+        return 0;
+    }
+    if (mode != FLAC2RAW_OUTPUT_MMAP && mode != FLAC2RAW_OUTPUT_PWRITE) return EINVAL;
+    fd = ::open(dst, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        LOGE("Could not write to the phone memory");
+        return errno;
+    }
+    return 0;
+}
+
+int FilePcmSink::begin(const PcmFormat &fmt) {
+    if (fd < 0 || 0 == fmt.totalFrames) return 0;
+    const uint64_t size = fmt.totalFrames * fmt.channels * (fmt.bitsPerSample / 8);
+    if (0 == size) return 0;
+    /* reserves the blocks in one go, the writes then don't have to allocate */
+    bool allocated = fallocate(fd, 0, 0, (off_t) size) == 0;
+    if (!allocated) {
+        if (errno == ENOSPC) {
+            LOGE("Not enough space for %llu bytes of output", (unsigned long long) size);
+            return ENOSPC;
+        }
+        /* filesystems without fallocate get a sparse file */
+        if (ftruncate(fd, (off_t) size)) return errno;
+    }
+    if (mode != FLAC2RAW_OUTPUT_MMAP) return 0;
+    if (!allocated) {
+        /* writing to a hole of a mapping can't report a full disk, just SIGBUS */
+        LOGV("No fallocate, writing the output with pwrite");
+        mode = FLAC2RAW_OUTPUT_PWRITE;
+        return 0;
+    }
+    void *m = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        LOGV("Can't map the output, writing it with pwrite");
+        mode = FLAC2RAW_OUTPUT_PWRITE;
+        return 0;
+    }
+    madvise(m, (size_t) size, MADV_SEQUENTIAL);
+    map = (uint8_t *) m;
+    mapSize = (size_t) size;
+    return 0;
+}
+
+void FilePcmSink::extendTo(uint64_t end) {
+    uint64_t l = length.load(std::memory_order_relaxed);
+    while (l < end && !length.compare_exchange_weak(l, end, std::memory_order_relaxed)) {
+    }
+}
+
+int FilePcmSink::flush() {
+    if (0 == buffered) return 0;
+    int r = pwriteAll(pos - buffered, &block[0], buffered);
+    buffered = 0;
+    return r;
+}
+
+int FilePcmSink::write(const void *data, size_t nbytes) {
+    if (f) {
+        if (fwrite(data, 1, nbytes, f) < nbytes) {
+            LOGE("Error writing to output file");
+            return errno ? errno : EIO;
+        }
+        return 0;
+    }
+    const uint8_t *p = (const uint8_t *) data;
+    if (map) {
+        const size_t n = pos < mapSize ? std::min(nbytes, (size_t) (mapSize - pos)) : 0;
+        memcpy(map + pos, p, n);
+        /* more than estimated in begin() */
+        if (n < nbytes) {
+            int r = pwriteAll(pos + n, p + n, nbytes - n);
+            if (r) return r;
+        }
+        pos += nbytes;
+        extendTo(pos);
+        return 0;
+    }
+    if (block.empty()) block.resize(OUTPUT_BLOCK_BYTES);
+    while (nbytes > 0) {
+        const size_t n = std::min(nbytes, block.size() - buffered);
+        memcpy(&block[buffered], p, n);
+        buffered += n;
+        pos += n;
+        p += n;
+        nbytes -= n;
+        if (buffered == block.size()) {
+            int r = flush();
+            if (r) return r;
+        }
+    }
+    extendTo(pos);
+    return 0;
+}
+
+int FilePcmSink::writeAt(uint64_t offset, const void *data, size_t nbytes) {
+    const uint8_t *p = (const uint8_t *) data;
+    if (map && offset < mapSize) {
+        const size_t n = std::min(nbytes, (size_t) (mapSize - offset));
+        memcpy(map + offset, p, n);
+        p += n;
+        offset += n;
+        nbytes -= n;
+    }
+    int r = pwriteAll(offset, p, nbytes);
+    if (r == 0 && fd >= 0) extendTo(offset + nbytes);
+    return r;
+}
+
+int FilePcmSink::pwriteAll(uint64_t offset, const uint8_t *p, size_t nbytes) {
+    const int fd = f ? fileno(f) : this->fd;
+    while (nbytes > 0) {
+        ssize_t w = pwrite(fd, p, nbytes, (off_t) offset);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Error writing to output file");
+            return errno;
+        }
+        p += w;
+        offset += (uint64_t) w;
+        nbytes -= (size_t) w;
+    }
+    return 0;
+}
+
+int FilePcmSink::end() {
+    if (f) {
+        int r = fclose(f) ? errno : 0;
+        f = NULL;
+        return r;
+    }
+    if (fd < 0) return 0;
+    int r = flush();
+    if (map) {
+        munmap(map, mapSize);
+        map = NULL;
+    }
+    /* the estimate in begin() may have been too long */
+    if (r == 0 && ftruncate(fd, (off_t) length.load()) != 0) r = errno;
+    if (close(fd) && r == 0) r = errno;
+    fd = -1;
+    return r;
+}
+
+//-----------------------------------------------------------------
+int BufferPcmSink::write(const void *data, size_t nbytes) {
+    const size_t end = used;
+    if (nbytes > capacity - end) {
+        LOGE("The buffer is too small for the decoded audio");
+        return ENOBUFS;
+    }
+    /* decoded in place via directBuffer() */
+    if (data != base + end) memcpy(base + end, data, nbytes);
+    used = end + nbytes;
+    return 0;
+}
+
+int BufferPcmSink::writeAt(uint64_t offset, const void *data, size_t nbytes) {
+    if (offset > capacity || nbytes > capacity - offset) {
+        LOGE("The buffer is too small for the decoded audio");
+        return ENOBUFS;
+    }
+    memcpy(base + offset, data, nbytes);
+    const size_t end = (size_t) offset + nbytes;
+    size_t prev = used;
+    while (prev < end && !used.compare_exchange_weak(prev, end)) {}
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_PCM_SINK_H
+#define FLAC2RAW_PCM_SINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <atomic>
+#include <vector>
+
+/* How FilePcmSink writes, same values as Flac2Raw.OUTPUT_* in Java */
+#define FLAC2RAW_OUTPUT_STDIO 0
+#define FLAC2RAW_OUTPUT_MMAP 1
+#define FLAC2RAW_OUTPUT_PWRITE 2
+
+//-----------------------------------------------------------------
+/* Format of the decoded audio handed to a sink */
+typedef struct PcmFormat_ {
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    unsigned bitsPerSample = 16;
+    /* number of sample frames, zero if unknown */
+    uint64_t totalFrames = 0;
+} PcmFormat;
+
+/* Destination of the decoded audio. All methods return zero on success
+ * or an error number which aborts the decoding. */
+class PcmSink {
+public:
+    virtual ~PcmSink() {}
+
+    /* called once before the first write if the format is known */
+    virtual int begin(const PcmFormat &) { return 0; }
+
+    /* interleaved little endian samples */
+    virtual int write(const void *data, size_t nbytes) = 0;
+
+    /* true if writeAt() can be used instead of write(), for example by parallel decoders */
+    virtual bool randomAccess() const { return false; }
+
+    /* writes at the byte offset from the start of the output, has to be thread safe */
+    virtual int writeAt(uint64_t, const void *, size_t) { return ENOSYS; }
+
+    /* memory of the output which a decoder can decode into in place, NULL if there's
+     * none. write() then gets pointers into it at the current end and doesn't copy. */
+    virtual uint8_t *directBuffer(size_t &capacity) {
+        capacity = 0;
+        return NULL;
+    }
+
+    /* called once after the last write */
+    virtual int end() { return 0; }
+};
+
+//-----------------------------------------------------------------
+/* Writes the decoded audio as a headerless raw file. FLAC2RAW_OUTPUT_STDIO
+ * grows the file with buffered writes. The other modes allocate the whole file
+ * in begin() if the length is known, so that it isn't fragmented, and then
+ * copy the audio into a shared mapping of it (MMAP) or write it in large
+ * aligned blocks (PWRITE). The file is cut to the length written in end(). */
+class FilePcmSink : public PcmSink {
+public:
+    FilePcmSink() : f(NULL), fd(-1), mode(FLAC2RAW_OUTPUT_STDIO), map(NULL), mapSize(0),
+                    pos(0), buffered(0), length(0) {}
+
+    ~FilePcmSink();
+
+    int open(const char *dst, int outputMode = FLAC2RAW_OUTPUT_STDIO);
+
+    int begin(const PcmFormat &fmt);
+
+    int write(const void *data, size_t nbytes);
+
+    bool randomAccess() const { return true; }
+
+    int writeAt(uint64_t offset, const void *data, size_t nbytes);
+
+    int end();
+
+private:
+    int pwriteAll(uint64_t offset, const uint8_t *p, size_t nbytes);
+
+    int flush();
+
+    void extendTo(uint64_t end);
+
+    FILE *f;
+    int fd;
+    int mode;
+    /* MMAP: the preallocated file */
+    uint8_t *map;
+    size_t mapSize;
+    /* end of the sequential writes */
+    uint64_t pos;
+    /* PWRITE: the sequential writes in front of pos not yet written */
+    std::vector<uint8_t> block;
+    size_t buffered;
+    /* end of the output, the length of the file in end() */
+    std::atomic<uint64_t> length;
+};
+
+//-----------------------------------------------------------------
+/* Writes the decoded audio into memory of the caller, for example a direct
+ * ByteBuffer. Returns ENOBUFS if the audio doesn't fit. */
+class BufferPcmSink : public PcmSink {
+public:
+    BufferPcmSink(void *buffer, size_t capacity) :
+            base((uint8_t *) buffer), capacity(capacity), used(0) {}
+
+    int write(const void *data, size_t nbytes);
+
+    bool randomAccess() const { return true; }
+
+    int writeAt(uint64_t offset, const void *data, size_t nbytes);
+
+    uint8_t *directBuffer(size_t &cap) {
+        cap = capacity;
+        return base;
+    }
+
+    /* end of the audio written so far */
+    size_t size() const { return used; }
+
+private:
+    uint8_t *base;
+    size_t capacity;
+    std::atomic<size_t> used;
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+#include "probe.h"
+#include "batch-runner.h"
+#include "flac2raw-log.h"
+
+void probeSource(const DecodeSource &src, ProbeResult &result) {
+    std::vector<FlacSeekPoint> seekTable;
+    result.error = NativeFlacBackend::probe(src, result.info, &seekTable);
+    if (result.error) return;
+    result.seekPoints = seekTable.size();
+    if (result.info.sampleRate) {
+        result.durationMs = result.info.totalSamples * 1000 / result.info.sampleRate;
+    }
+}
+
+static bool isFlacName(const char *name) {
+    const size_t len = strlen(name);
+    return len > 5 && !strcasecmp(name + len - 5, ".flac");
+}
+
+int probeDirectory(const char *dir, unsigned maxWorkers, std::vector<ProbeResult> &results) {
+    results.clear();
+    DIR *d = opendir(dir);
+    if (NULL == d) {
+        LOGE("Could not read the directory %s", dir);
+        return errno;
+    }
+    std::vector<std::string> names;
+    for (struct dirent *e = readdir(d); e != NULL; e = readdir(d)) {
+        if (e->d_type == DT_DIR || !isFlacName(e->d_name)) continue;
+        names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    std::string prefix = dir;
+    if (!prefix.empty() && prefix[prefix.size() - 1] != '/') prefix += '/';
+    std::vector<BatchJob> jobs(names.size());
+    results.resize(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        jobs[i].src = prefix + names[i];
+        results[i].path = jobs[i].src;
+    }
+    BatchJob *first = jobs.empty() ? NULL : &jobs[0];
+    runBatch(jobs, maxWorkers, [first, &results](BatchJob &job) {
+        ProbeResult &result = results[&job - first];
+        DecodeSource src;
+        src.type = DecodeSource::URI;
+        src.path = job.src.c_str();
+        probeSource(src, result);
+        return result.error;
+    });
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_PROBE_H
+#define FLAC2RAW_PROBE_H
+
+#include <string>
+#include <vector>
+
+#include "decoder-backend.h"
+
+//-----------------------------------------------------------------
+/* Format of a flac file as read from its metadata, mirrors Flac2Raw.Info in Java */
+typedef struct ProbeResult_ {
+    std::string path;
+    /* zero or the error number, the other fields are only valid if zero */
+    int error = 0;
+    FlacStreamInfo info;
+    /* zero if the length is unknown */
+    uint64_t durationMs = 0;
+    size_t seekPoints = 0;
+} ProbeResult;
+
+/* Probes a single source */
+void probeSource(const DecodeSource &src, ProbeResult &result);
+
+/* Probes all .flac files of a directory (not its subdirectories) on at most
+ * maxWorkers threads, 0 for all cores. The results are sorted by path.
+ * Returns zero or the error number if the directory can't be read. */
+int probeDirectory(const char *dir, unsigned maxWorkers, std::vector<ProbeResult> &results);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "resample-pcm-sink.h"
+#include "flac2raw-log.h"
+
+/* Modified Bessel function of the first kind for the Kaiser window */
+static double besselI0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b) {
+        const uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+uint64_t Resampler::outputFrames(uint64_t inFrames, unsigned inRate, unsigned outRate) {
+    return (inFrames * outRate + inRate - 1) / inRate;
+}
+
+int Resampler::init(unsigned in, unsigned out, unsigned nChannels) {
+    if (!in || !out || !nChannels) return EINVAL;
+    inRate = in;
+    outRate = out;
+    channels = nChannels;
+    const uint64_t g = gcd(in, out);
+    up = out / g;
+    down = in / g;
+    phases = (unsigned) std::min(up, (uint64_t) RESAMPLER_MAX_PHASES);
+
+    /* cutoff in cycles per input sample, below the Nyquist frequency of both rates */
+    const double fc = 0.5 * std::min(1.0, (double) out / in) * RESAMPLER_PASSBAND;
+    const unsigned halfWidth = (unsigned) ceil(RESAMPLER_ZERO_CROSSINGS / (2 * fc));
+    /* a multiple of 8 suits the SIMD kernels */
+    taps = (2 * halfWidth + 7) & ~7u;
+    const double w = taps / 2;
+    const double i0Beta = besselI0(RESAMPLER_KAISER_BETA);
+    coefs.resize((size_t) (phases + 1) * taps);
+    std::vector<double> h(taps);
+    for (unsigned p = 0; p <= phases; p++) {
+        float *row = &coefs[(size_t) p * taps];
+        double sum = 0;
+        for (unsigned j = 0; j < taps; j++) {
+            /* distance from the output position to input tap j */
+            const double t = (double) p / phases + w - 1 - j;
+            const double x = t / w;
+            double v = 0;
+            if (fabs(x) < 1) {
+                const double arg = 2 * fc * t;
+                const double sinc = arg == 0 ? 1 : sin(M_PI * arg) / (M_PI * arg);
+                v = 2 * fc * sinc * besselI0(RESAMPLER_KAISER_BETA * sqrt(1 - x * x)) / i0Beta;
+            }
+            h[j] = v;
+            sum += v;
+        }
+        /* unity gain at DC for every phase */
+        for (unsigned j = 0; j < taps; j++) row[j] = (float) (h[j] / sum);
+    }
+
+    /* the first output is centred on the first input frame */
+    history.assign(channels, std::vector<float>(taps + RESAMPLER_BLOCK_FRAMES));
+    filled = taps / 2 - 1;
+    pos = 0;
+    phase = 0;
+    inFrames = 0;
+    outFrames = 0;
+    LOGV("Resampling %u Hz to %u Hz with %u phases of %u taps", in, out, phases, taps);
+    return 0;
+}
+
+void Resampler::append(const int16_t *in, size_t frames) {
+    for (unsigned ch = 0; ch < channels; ch++) {
+        float *h = &history[ch][filled];
+        const int16_t *p = in + ch;
+        for (size_t i = 0; i < frames; i++, p += channels) h[i] = *p;
+    }
+    filled += frames;
+}
+
+void Resampler::produce(std::vector<int16_t> &out, uint64_t limit) {
+    while (pos + taps <= filled && outFrames < limit) {
+        unsigned row;
+        float frac = 0;
+        if (phases == up) {
+            row = (unsigned) phase;
+        } else {
+            const double x = (double) phase * phases / up;
+            row = (unsigned) x;
+            frac = (float) (x - row);
+        }
+        const float *c0 = &coefs[(size_t) row * taps];
+        for (unsigned ch = 0; ch < channels; ch++) {
+            const float *h = &history[ch][pos];
+            float y = kernels.dot(h, c0, taps);
+            if (frac > 0) y += frac * (kernels.dot(h, c0 + taps, taps) - y);
+            const float r = roundf(y);
+            out.push_back((int16_t) std::max(-32768.0f, std::min(32767.0f, r)));
+        }
+        outFrames++;
+        phase += down;
+        pos += (size_t) (phase / up);
+        phase %= up;
+    }
+    /* keeps the history from the next first tap on */
+    if (pos > 0) {
+        const size_t keep = filled > pos ? filled - pos : 0;
+        for (unsigned ch = 0; ch < channels; ch++) {
+            float *h = &history[ch][0];
+            if (keep) memmove(h, h + pos, keep * sizeof(float));
+        }
+        pos = pos > filled ? pos - filled : 0;
+        filled = keep;
+    }
+}
+
+void Resampler::process(const int16_t *in, size_t frames, std::vector<int16_t> &out) {
+    inFrames += frames;
+    while (frames > 0) {
+        const size_t n = std::min(frames, history[0].size() - filled);
+        append(in, n);
+        produce(out, UINT64_MAX);
+        in += n * channels;
+        frames -= n;
+    }
+}
+
+void Resampler::flush(std::vector<int16_t> &out) {
+    const uint64_t total = outputFrames(inFrames, inRate, outRate);
+    const std::vector<int16_t> silence((size_t) taps * channels, 0);
+    while (outFrames < total) {
+        const size_t n = std::min((size_t) taps, history[0].size() - filled);
+        append(&silence[0], n);
+        produce(out, total);
+    }
+}
+
+//-----------------------------------------------------------------
+int ResamplePcmSink::begin(const PcmFormat &format) {
+    PcmFormat fmt = format;
+    channels = format.channels;
+    passThrough = format.sampleRate == outRate;
+    if (!passThrough) {
+        int r = resampler.init(format.sampleRate, outRate, channels);
+        if (r) {
+            LOGE("Can't resample %u channels of %u Hz", channels, format.sampleRate);
+            return r;
+        }
+        fmt.sampleRate = outRate;
+        fmt.totalFrames = Resampler::outputFrames(format.totalFrames, format.sampleRate, outRate);
+    }
+    return destination.begin(fmt);
+}
+
+int ResamplePcmSink::resample(const int16_t *in, size_t frames) {
+    out.clear();
+    resampler.process(in, frames, out);
+    if (out.empty()) return 0;
+    return destination.write(&out[0], out.size() * sizeof(int16_t));
+}
+
+int ResamplePcmSink::write(const void *data, size_t nbytes) {
+    if (passThrough) return destination.write(data, nbytes);
+    if (!channels) {
+        LOGE("The format of the audio is unknown, can't resample it");
+        return EINVAL;
+    }
+    const size_t frameBytes = channels * sizeof(int16_t);
+    const uint8_t *p = (const uint8_t *) data;
+    if (!partialFrame.empty()) {
+        const size_t n = std::min(frameBytes - partialFrame.size(), nbytes);
+        partialFrame.insert(partialFrame.end(), p, p + n);
+        p += n;
+        nbytes -= n;
+        if (partialFrame.size() < frameBytes) return 0;
+        aligned.resize(channels);
+        memcpy(&aligned[0], &partialFrame[0], frameBytes);
+        partialFrame.clear();
+        int r = resample(&aligned[0], 1);
+        if (r) return r;
+    }
+    const size_t frames = nbytes / frameBytes;
+    if (frames) {
+        const int16_t *in = (const int16_t *) p;
+        if ((uintptr_t) p % sizeof(int16_t)) {
+            aligned.resize(frames * channels);
+            memcpy(&aligned[0], p, frames * frameBytes);
+            in = &aligned[0];
+        }
+        int r = resample(in, frames);
+        if (r) return r;
+    }
+    partialFrame.assign(p + frames * frameBytes, p + nbytes);
+    return 0;
+}
+
+int ResamplePcmSink::end() {
+    if (!passThrough && channels) {
+        if (!partialFrame.empty()) {
+            LOGD("Dropping %zu bytes of an incomplete frame", partialFrame.size());
+            partialFrame.clear();
+        }
+        out.clear();
+        resampler.flush(out);
+        if (!out.empty()) {
+            int r = destination.write(&out[0], out.size() * sizeof(int16_t));
+            if (r) {
+                destination.end();
+                return r;
+            }
+        }
+    }
+    return destination.end();
+}
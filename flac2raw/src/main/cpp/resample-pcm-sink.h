@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_RESAMPLE_PCM_SINK_H
+#define FLAC2RAW_RESAMPLE_PCM_SINK_H
+
+#include <vector>
+
+#include "pcm-sink.h"
+#include "sample-format.h"
+
+/* Zero crossings of the windowed sinc on each side of its centre */
+#define RESAMPLER_ZERO_CROSSINGS 16
+/* Passband as a fraction of the lower of the two Nyquist frequencies */
+#define RESAMPLER_PASSBAND 0.95
+/* Kaiser window for about 90dB stopband attenuation */
+#define RESAMPLER_KAISER_BETA 8.6
+/* Phases of the filter table. Ratios which would need more, for example
+ * between rates with a large prime factor, interpolate between two phases. */
+#define RESAMPLER_MAX_PHASES 1024
+/* Input frames processed at a time, this bounds the state of the resampler */
+#define RESAMPLER_BLOCK_FRAMES 4096
+
+//-----------------------------------------------------------------
+/* Polyphase windowed sinc resampler for interleaved 16 bit audio. It keeps
+ * a filter history of a few dozen frames per channel so it can be fed in
+ * pieces of any size. */
+class Resampler {
+public:
+    Resampler() : kernels(sampleKernels()) {}
+
+    /* returns EINVAL for a rate of zero or no channels */
+    int init(unsigned inRate, unsigned outRate, unsigned channels);
+
+    /* resamples frames of input and appends the output to out */
+    void process(const int16_t *in, size_t frames, std::vector<int16_t> &out);
+
+    /* appends the output of the last input frames */
+    void flush(std::vector<int16_t> &out);
+
+    /* number of output frames for inFrames of input */
+    static uint64_t outputFrames(uint64_t inFrames, unsigned inRate, unsigned outRate);
+
+    /* taps of the filter, the delay in input frames is half of it */
+    unsigned filterTaps() const { return taps; }
+
+private:
+    void append(const int16_t *in, size_t frames);
+
+    /* computes output frames while there's enough input, at most up to limit in total */
+    void produce(std::vector<int16_t> &out, uint64_t limit);
+
+    const SampleKernels &kernels;
+    unsigned channels = 0;
+    unsigned inRate = 0;
+    unsigned outRate = 0;
+    /* output frame n is at input time n * down / up */
+    uint64_t up = 1;
+    uint64_t down = 1;
+    unsigned phases = 1;
+    unsigned taps = 0;
+    /* phases + 1 rows of taps coefficients */
+    std::vector<float> coefs;
+    /* input of each channel, the first tap of the next output is at pos */
+    std::vector<std::vector<float> > history;
+    size_t filled = 0;
+    size_t pos = 0;
+    /* fractional position of the next output in units of 1 / up */
+    uint64_t phase = 0;
+    uint64_t inFrames = 0;
+    uint64_t outFrames = 0;
+};
+
+//-----------------------------------------------------------------
+/* Resamples the audio of a backend to outRate before it goes to the
+ * destination, which gets begin() and end() through this sink. The audio
+ * stays 16 bit so a FormatPcmSink can be the destination. */
+class ResamplePcmSink : public PcmSink {
+public:
+    ResamplePcmSink(PcmSink &destination, unsigned outRate) :
+            destination(destination), outRate(outRate), passThrough(false), channels(0) {}
+
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    int end();
+
+private:
+    int resample(const int16_t *in, size_t frames);
+
+    PcmSink &destination;
+    unsigned outRate;
+    bool passThrough;
+    unsigned channels;
+    Resampler resampler;
+    /* start of a frame split between two writes */
+    std::vector<uint8_t> partialFrame;
+    std::vector<int16_t> aligned;
+    std::vector<int16_t> out;
+};
+
+#endif
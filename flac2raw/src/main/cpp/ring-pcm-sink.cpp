@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "ring-pcm-sink.h"
+#include "flac2raw-log.h"
+
+RingPcmSink::RingPcmSink(PcmSink &destination, size_t ringBytes, size_t chunkBytes) :
+        destination(destination),
+        ring(std::max(ringBytes, (size_t) 1)),
+        chunkBytes(std::max(std::min(chunkBytes, ring.size()), (size_t) 1)),
+        head(0), tail(0), finished(false), error(0),
+        producerWaiting(false), writerWaiting(false) {
+    ringStats.capacityBytes = ring.size();
+    /* not every backend calls begin() so the writer starts right away */
+    writer = std::thread(&RingPcmSink::writerLoop, this);
+}
+
+RingPcmSink::~RingPcmSink() {
+    stopWriter();
+}
+
+int RingPcmSink::begin(const PcmFormat &format) {
+    return destination.begin(format);
+}
+
+/* Dekker style handshake: the sleeping side announces itself before checking
+ * the ring a last time and the other side checks the announcement after
+ * publishing its position, so one of them always sees the other. */
+int RingPcmSink::write(const void *data, size_t nbytes) {
+    const uint8_t *p = (const uint8_t *) data;
+    const size_t size = ring.size();
+    while (nbytes > 0) {
+        if (error) return error;
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        size_t space = size - (size_t) (h - tail.load(std::memory_order_acquire));
+        if (0 == space) {
+            ringStats.producerStalls++;
+            std::unique_lock<std::mutex> guard(lock);
+            producerWaiting = true;
+            wakeup.wait(guard, [this, h, size] {
+                return error || h - tail.load() < size;
+            });
+            producerWaiting = false;
+            continue;
+        }
+        const size_t pos = (size_t) (h % size);
+        const size_t n = std::min(std::min(space, nbytes), size - pos);
+        memcpy(&ring[pos], p, n);
+        head.store(h + n);
+        p += n;
+        nbytes -= n;
+        ringStats.highWaterBytes = std::max(ringStats.highWaterBytes,
+                                            (size_t) (h + n - tail.load()));
+        if (writerWaiting) {
+            std::lock_guard<std::mutex> guard(lock);
+            wakeup.notify_all();
+        }
+    }
+    return 0;
+}
+
+void RingPcmSink::writerLoop() {
+    const size_t size = ring.size();
+    for (;;) {
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        const size_t filled = (size_t) (head.load(std::memory_order_acquire) - t);
+        /* wait for a full chunk unless the decoder has finished */
+        if (filled < chunkBytes && !finished) {
+            std::unique_lock<std::mutex> guard(lock);
+            writerWaiting = true;
+            wakeup.wait(guard, [this, t] {
+                return finished || head.load() - t >= chunkBytes;
+            });
+            writerWaiting = false;
+            continue;
+        }
+        if (0 == filled) return;
+        const size_t pos = (size_t) (t % size);
+        const size_t n = std::min(std::min(filled, chunkBytes), size - pos);
+        int r = destination.write(&ring[pos], n);
+        if (r) {
+            LOGE("Writer thread: error %d writing to the destination", r);
+            std::lock_guard<std::mutex> guard(lock);
+            error = r;
+            wakeup.notify_all();
+            return;
+        }
+        ringStats.writes++;
+        ringStats.bytesWritten += n;
+        tail.store(t + n);
+        if (producerWaiting) {
+            std::lock_guard<std::mutex> guard(lock);
+            wakeup.notify_all();
+        }
+    }
+}
+
+void RingPcmSink::stopWriter() {
+    if (!writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+    }
+    wakeup.notify_all();
+    writer.join();
+}
+
+int RingPcmSink::end() {
+    stopWriter();
+    int r = destination.end();
+    return error ? (int) error : r;
+}
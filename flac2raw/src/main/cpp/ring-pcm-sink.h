@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_RING_PCM_SINK_H
+#define FLAC2RAW_RING_PCM_SINK_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include "pcm-sink.h"
+
+/* Default size of a write of the writer thread */
+#define RING_DEFAULT_CHUNK_BYTES (64 * 1024)
+
+//-----------------------------------------------------------------
+/* Fill statistics of a ring, to size it for the slowest storage */
+typedef struct RingStats_ {
+    size_t capacityBytes = 0;
+    /* largest number of bytes waiting in the ring to be written */
+    size_t highWaterBytes = 0;
+    /* number of times the decoder had to wait because the ring was full */
+    uint64_t producerStalls = 0;
+    /* number of writes to the destination and their total size */
+    uint64_t writes = 0;
+    uint64_t bytesWritten = 0;
+} RingStats;
+
+//-----------------------------------------------------------------
+/* Decouples the decoder from the storage. write() copies the audio into a
+ * single producer / single consumer ring and returns, a writer thread started
+ * by the constructor drains the ring into the destination sink in chunks of
+ * chunkBytes. The data path is lock free, the lock is only taken to sleep when
+ * the ring is full or empty. An error of the destination is returned by the
+ * next write() or end(). */
+class RingPcmSink : public PcmSink {
+public:
+    RingPcmSink(PcmSink &destination, size_t ringBytes,
+                size_t chunkBytes = RING_DEFAULT_CHUNK_BYTES);
+
+    ~RingPcmSink();
+
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    int end();
+
+    const RingStats &stats() const { return ringStats; }
+
+private:
+    void writerLoop();
+
+    void stopWriter();
+
+    PcmSink &destination;
+    std::vector<uint8_t> ring;
+    size_t chunkBytes;
+    /* total bytes written into and read out of the ring, the positions
+     * in the ring are these modulo its size */
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<bool> finished;
+    std::atomic<int> error;
+    std::atomic<bool> producerWaiting;
+    std::atomic<bool> writerWaiting;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::thread writer;
+    RingStats ringStats;
+};
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sample-format.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#include <immintrin.h>
+#define FLAC2RAW_HAVE_AVX2
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FLAC2RAW_HAVE_NEON
+#endif
+
+size_t sampleFormatBytes(int format) {
+    switch (format) {
+        case FLAC2RAW_FORMAT_PCM16:
+            return 2;
+        case FLAC2RAW_FORMAT_FLOAT32:
+            return 4;
+        case FLAC2RAW_FORMAT_INT24:
+            return 3;
+        case FLAC2RAW_FORMAT_INT32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+//-----------------------------------------------------------------
+/* Scalar kernels, also the tails of the SIMD ones */
+
+#define INT16_TO_FLOAT (1.0f / 32768.0f)
+
+static void toFloatScalar(const int16_t *in, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = (float) in[i] * INT16_TO_FLOAT;
+}
+
+static void toInt24Scalar(const int16_t *in, uint8_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const uint16_t v = (uint16_t) in[i];
+        out[3 * i] = 0;
+        out[3 * i + 1] = (uint8_t) v;
+        out[3 * i + 2] = (uint8_t) (v >> 8);
+    }
+}
+
+static void toInt32Scalar(const int16_t *in, int32_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = (int32_t) ((uint32_t) (uint16_t) in[i] << 16);
+}
+
+static void downmixScalar(const int16_t *in, int16_t *out, size_t frames, unsigned channels) {
+    if (channels == 2) {
+        for (size_t i = 0; i < frames; i++) {
+            out[i] = (int16_t) (((int32_t) in[2 * i] + in[2 * i + 1]) >> 1);
+        }
+        return;
+    }
+    const int32_t c = (int32_t) channels;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sum = 0;
+        for (unsigned ch = 0; ch < channels; ch++) sum += *in++;
+        out[i] = (int16_t) (sum >= 0 ? sum / c : -((c - 1 - sum) / c));
+    }
+}
+
+static void deinterleaveScalar(const int16_t *in, int16_t *const *out, size_t frames,
+                               unsigned channels) {
+    for (unsigned ch = 0; ch < channels; ch++) {
+        int16_t *o = out[ch];
+        const int16_t *p = in + ch;
+        for (size_t i = 0; i < frames; i++, p += channels) o[i] = *p;
+    }
+}
+
+static float dotScalar(const float *a, const float *b, size_t n) {
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static const SampleKernels scalarKernels = {
+        "scalar", toFloatScalar, toInt24Scalar, toInt32Scalar, downmixScalar,
+        deinterleaveScalar, dotScalar
+};
+
+#if defined(__SSE2__)
+//-----------------------------------------------------------------
+/* SSE2, which every x86-64 CPU has. Only stereo has SIMD downmixing and
+ * deinterleaving, 24 bit packing needs the byte shuffle of SSSE3. */
+
+static void toFloatSse2(const int16_t *in, float *out, size_t n) {
+    const __m128 scale = _mm_set1_ps(INT16_TO_FLOAT);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    toFloatScalar(in + i, out + i, n - i);
+}
+
+static void toInt32Sse2(const int16_t *in, int32_t *out, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+    toInt32Scalar(in + i, out + i, n - i);
+}
+
+/* left and right channel of 4 stereo frames as 32 bit */
+static inline __m128i leftSse2(__m128i v) {
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static inline __m128i rightSse2(__m128i v) {
+    return _mm_srai_epi32(v, 16);
+}
+
+static void downmixSse2(const int16_t *in, int16_t *out, size_t frames, unsigned channels) {
+    if (channels != 2) {
+        downmixScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+        const __m128i b = _mm_loadu_si128((const __m128i *) (in + 2 * i + 8));
+        const __m128i ma = _mm_srai_epi32(_mm_add_epi32(leftSse2(a), rightSse2(a)), 1);
+        const __m128i mb = _mm_srai_epi32(_mm_add_epi32(leftSse2(b), rightSse2(b)), 1);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(ma, mb));
+    }
+    downmixScalar(in + 2 * i, out + i, frames - i, channels);
+}
+
+static void deinterleaveSse2(const int16_t *in, int16_t *const *out, size_t frames,
+                             unsigned channels) {
+    if (channels != 2) {
+        deinterleaveScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+        const __m128i b = _mm_loadu_si128((const __m128i *) (in + 2 * i + 8));
+        _mm_storeu_si128((__m128i *) (out[0] + i),
+                         _mm_packs_epi32(leftSse2(a), leftSse2(b)));
+        _mm_storeu_si128((__m128i *) (out[1] + i),
+                         _mm_packs_epi32(rightSse2(a), rightSse2(b)));
+    }
+    int16_t *const tail[2] = {out[0] + i, out[1] + i};
+    deinterleaveScalar(in + 2 * i, tail, frames - i, channels);
+}
+
+static float dotSse2(const float *a, const float *b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotScalar(a + i, b + i, n - i);
+}
+
+static const SampleKernels sse2Kernels = {
+        "sse2", toFloatSse2, toInt24Scalar, toInt32Sse2, downmixSse2, deinterleaveSse2, dotSse2
+};
+#endif
+
+#if defined(FLAC2RAW_HAVE_AVX2)
+//-----------------------------------------------------------------
+/* AVX2, compiled for this file only and picked at runtime */
+
+#define AVX2_KERNEL __attribute__((target("avx2")))
+
+AVX2_KERNEL static void toFloatAvx2(const int16_t *in, float *out, size_t n) {
+    const __m256 scale = _mm256_set1_ps(INT16_TO_FLOAT);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (in + i)));
+        const __m256i hi = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *) (in + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    toFloatScalar(in + i, out + i, n - i);
+}
+
+AVX2_KERNEL static void toInt24Avx2(const int16_t *in, uint8_t *out, size_t n) {
+    /* 4 samples into 12 bytes: a zero byte (index 0x80) and the two bytes of the sample */
+    const char z = (char) 0x80;
+    const __m128i lo = _mm_setr_epi8(z, 0, 1, z, 2, 3, z, 4, 5, z, 6, 7, z, z, z, z);
+    const __m128i hi = _mm_setr_epi8(z, 8, 9, z, 10, 11, z, 12, 13, z, 14, 15, z, z, z, z);
+    size_t i = 0;
+    /* the stores are 16 bytes wide, their last 4 bytes are overwritten by the next one */
+    for (; i + 12 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + 3 * i), _mm_shuffle_epi8(v, lo));
+        _mm_storeu_si128((__m128i *) (out + 3 * i + 12), _mm_shuffle_epi8(v, hi));
+    }
+    toInt24Scalar(in + i, out + 3 * i, n - i);
+}
+
+AVX2_KERNEL static void toInt32Avx2(const int16_t *in, int32_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (in + i)));
+        const __m256i hi = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *) (in + i + 8)));
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_slli_epi32(lo, 16));
+        _mm256_storeu_si256((__m256i *) (out + i + 8), _mm256_slli_epi32(hi, 16));
+    }
+    toInt32Scalar(in + i, out + i, n - i);
+}
+
+AVX2_KERNEL static inline __m256i leftAvx2(__m256i v) {
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+AVX2_KERNEL static inline __m256i rightAvx2(__m256i v) {
+    return _mm256_srai_epi32(v, 16);
+}
+
+/* packs within 128 bit lanes, this puts the 64 bit quarters back in order */
+AVX2_KERNEL static inline __m256i packAvx2(__m256i a, __m256i b) {
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+}
+
+AVX2_KERNEL static void downmixAvx2(const int16_t *in, int16_t *out, size_t frames,
+                                    unsigned channels) {
+    if (channels != 2) {
+        downmixScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *) (in + 2 * i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *) (in + 2 * i + 16));
+        const __m256i ma = _mm256_srai_epi32(_mm256_add_epi32(leftAvx2(a), rightAvx2(a)), 1);
+        const __m256i mb = _mm256_srai_epi32(_mm256_add_epi32(leftAvx2(b), rightAvx2(b)), 1);
+        _mm256_storeu_si256((__m256i *) (out + i), packAvx2(ma, mb));
+    }
+    downmixScalar(in + 2 * i, out + i, frames - i, channels);
+}
+
+AVX2_KERNEL static void deinterleaveAvx2(const int16_t *in, int16_t *const *out, size_t frames,
+                                         unsigned channels) {
+    if (channels != 2) {
+        deinterleaveScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *) (in + 2 * i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *) (in + 2 * i + 16));
+        _mm256_storeu_si256((__m256i *) (out[0] + i), packAvx2(leftAvx2(a), leftAvx2(b)));
+        _mm256_storeu_si256((__m256i *) (out[1] + i), packAvx2(rightAvx2(a), rightAvx2(b)));
+    }
+    int16_t *const tail[2] = {out[0] + i, out[1] + i};
+    deinterleaveScalar(in + 2 * i, tail, frames - i, channels);
+}
+
+AVX2_KERNEL static float dotAvx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                                 _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8),
+                                                 _mm256_loadu_ps(b + i + 8)));
+    }
+    const __m256 acc = _mm256_add_ps(acc0, acc1);
+    const __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotScalar(a + i, b + i, n - i);
+}
+
+static const SampleKernels avx2Kernels = {
+        "avx2", toFloatAvx2, toInt24Avx2, toInt32Avx2, downmixAvx2, deinterleaveAvx2, dotAvx2
+};
+#endif
+
+#if defined(FLAC2RAW_HAVE_NEON)
+//-----------------------------------------------------------------
+/* NEON, which every arm64 and current armeabi-v7a device has */
+
+static void toFloatNeon(const int16_t *in, float *out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t v = vld1q_s16(in + i);
+        /* fixed point with 15 fractional bits is the same as dividing by 32768 */
+        vst1q_f32(out + i, vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(v)), 15));
+        vst1q_f32(out + i + 4, vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(v)), 15));
+    }
+    toFloatScalar(in + i, out + i, n - i);
+}
+
+static void toInt24Neon(const int16_t *in, uint8_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        /* splits the little endian samples into low and high bytes */
+        const uint8x8x2_t bytes = vld2_u8((const uint8_t *) (in + i));
+        uint8x8x3_t packed;
+        packed.val[0] = vdup_n_u8(0);
+        packed.val[1] = bytes.val[0];
+        packed.val[2] = bytes.val[1];
+        vst3_u8(out + 3 * i, packed);
+    }
+    toInt24Scalar(in + i, out + 3 * i, n - i);
+}
+
+static void toInt32Neon(const int16_t *in, int32_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t v = vld1q_s16(in + i);
+        vst1q_s32(out + i, vshll_n_s16(vget_low_s16(v), 16));
+        vst1q_s32(out + i + 4, vshll_n_s16(vget_high_s16(v), 16));
+    }
+    toInt32Scalar(in + i, out + i, n - i);
+}
+
+static void downmixNeon(const int16_t *in, int16_t *out, size_t frames, unsigned channels) {
+    if (channels != 2) {
+        downmixScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const int16x8x2_t v = vld2q_s16(in + 2 * i);
+        /* halving add, rounds down like the scalar version */
+        vst1q_s16(out + i, vhaddq_s16(v.val[0], v.val[1]));
+    }
+    downmixScalar(in + 2 * i, out + i, frames - i, channels);
+}
+
+static void deinterleaveNeon(const int16_t *in, int16_t *const *out, size_t frames,
+                             unsigned channels) {
+    if (channels != 2) {
+        deinterleaveScalar(in, out, frames, channels);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const int16x8x2_t v = vld2q_s16(in + 2 * i);
+        vst1q_s16(out[0] + i, v.val[0]);
+        vst1q_s16(out[1] + i, v.val[1]);
+    }
+    int16_t *const tail[2] = {out[0] + i, out[1] + i};
+    deinterleaveScalar(in + 2 * i, tail, frames - i, channels);
+}
+
+static float dotNeon(const float *a, const float *b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    const float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vpadd_f32(sum, sum);
+    return vget_lane_f32(sum, 0) + dotScalar(a + i, b + i, n - i);
+}
+
+static const SampleKernels neonKernels = {
+        "neon", toFloatNeon, toInt24Neon, toInt32Neon, downmixNeon, deinterleaveNeon, dotNeon
+};
+#endif
+
+//-----------------------------------------------------------------
+std::vector<const SampleKernels *> supportedSampleKernels() {
+    std::vector<const SampleKernels *> kernels;
+    kernels.push_back(&scalarKernels);
+#if defined(__SSE2__)
+    kernels.push_back(&sse2Kernels);
+#endif
+#if defined(FLAC2RAW_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(&avx2Kernels);
+#endif
+#if defined(FLAC2RAW_HAVE_NEON)
+    kernels.push_back(&neonKernels);
+#endif
+    return kernels;
+}
+
+const SampleKernels &sampleKernels() {
+    static const SampleKernels *best = supportedSampleKernels().back();
+    return *best;
+}
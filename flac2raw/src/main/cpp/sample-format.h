@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_SAMPLE_FORMAT_H
+#define FLAC2RAW_SAMPLE_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* Output sample formats, same values as Flac2Raw.FORMAT_* in Java */
+#define FLAC2RAW_FORMAT_PCM16 0
+#define FLAC2RAW_FORMAT_FLOAT32 1
+#define FLAC2RAW_FORMAT_INT24 2
+#define FLAC2RAW_FORMAT_INT32 3
+
+/* bytes of a sample in the format, zero for an unknown format */
+size_t sampleFormatBytes(int format);
+
+//-----------------------------------------------------------------
+/* Conversions of 16 bit samples. The SIMD versions give bit for bit the same
+ * results as the scalar ones, except for dot() which adds in a different order. */
+typedef struct SampleKernels_ {
+    const char *name;
+    /* to float in [-1,1) */
+    void (*toFloat)(const int16_t *in, float *out, size_t n);
+    /* to packed little endian 24 bit, the sample in the upper two bytes */
+    void (*toInt24)(const int16_t *in, uint8_t *out, size_t n);
+    /* to 32 bit, the sample in the upper half */
+    void (*toInt32)(const int16_t *in, int32_t *out, size_t n);
+    /* average of the channels of each frame, rounded down */
+    void (*downmix)(const int16_t *in, int16_t *out, size_t frames, unsigned channels);
+    /* interleaved to one buffer per channel */
+    void (*deinterleave)(const int16_t *in, int16_t *const *out, size_t frames,
+                         unsigned channels);
+    /* sum of a[i] * b[i], the inner loop of the resampler */
+    float (*dot)(const float *a, const float *b, size_t n);
+} SampleKernels;
+
+/* the fastest kernels this CPU supports */
+const SampleKernels &sampleKernels();
+
+/* all kernels this CPU supports, the scalar ones first */
+std::vector<const SampleKernels *> supportedSampleKernels();
+
+#endif
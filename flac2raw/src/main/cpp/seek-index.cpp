@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "seek-index.h"
+#include "md5.h"
+#include "flac2raw-log.h"
+
+/* The index file: magic, the stream length in samples and bytes, the number of
+ * points and then the points as three 64 bit values each. It's a cache of the
+ * device it's built on so everything is in native byte order. */
+static const char SEEK_INDEX_MAGIC[8] = {'F', '2', 'R', 'S', 'E', 'E', 'K', '1'};
+/* Bytes from the start and the end of the stream which identify it */
+#define SEEK_INDEX_KEY_BYTES (64 * 1024)
+
+//-----------------------------------------------------------------
+int buildSeekIndex(const FlacDecoder &dec, std::vector<FlacSeekPoint> &points) {
+    points.clear();
+    const FlacStreamInfo &info = dec.streamInfo();
+    const uint8_t *d = dec.data();
+    const size_t begin = dec.audioOffset();
+    const size_t end = dec.size();
+    const uint64_t interval = std::max((uint64_t) 1,
+                                       (uint64_t) info.sampleRate * SEEK_INDEX_INTERVAL_MS / 1000);
+    /* a sync code with a valid header CRC can also appear inside of a frame, but
+     * hardly ever with the sample number which follows the previous frame */
+    uint64_t expected = 0;
+    uint64_t nextPoint = 0;
+    size_t p = begin;
+    while (p + 1 < end) {
+        const uint8_t *sync = (const uint8_t *) memchr(d + p, 0xFF, end - p - 1);
+        if (!sync) break;
+        p = (size_t) (sync - d);
+        FlacFrameHeader header;
+        if ((d[p + 1] & 0xFE) != 0xF8 ||
+            flacParseFrameHeader(d + p, end - p, info, header) ||
+            header.firstSample != expected) {
+            p++;
+            continue;
+        }
+        if (header.firstSample >= nextPoint) {
+            FlacSeekPoint point;
+            point.sampleNumber = header.firstSample;
+            point.streamOffset = p - begin;
+            point.frameSamples = header.blockSize;
+            points.push_back(point);
+            nextPoint = header.firstSample + interval;
+        }
+        expected = header.firstSample + header.blockSize;
+        if (info.totalSamples && expected >= info.totalSamples) break;
+        p += header.headerBytes;
+    }
+    if (points.empty()) return EILSEQ;
+    LOGV("Seek index with %zu points", points.size());
+    return 0;
+}
+
+std::string seekIndexPath(const std::string &dir, const FlacDecoder &dec) {
+    const uint64_t size = dec.size();
+    const uint64_t total = dec.streamInfo().totalSamples;
+    Md5 md5;
+    md5.update(&size, sizeof(size));
+    md5.update(&total, sizeof(total));
+    const size_t n = std::min(dec.size(), (size_t) SEEK_INDEX_KEY_BYTES);
+    md5.update(dec.data(), n);
+    md5.update(dec.data() + dec.size() - n, n);
+    uint8_t digest[16];
+    md5.final(digest);
+    char hex[33];
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    return dir + "/" + hex + ".seek";
+}
+
+int loadSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  std::vector<FlacSeekPoint> &points) {
+    points.clear();
+    const std::string path = seekIndexPath(dir, dec);
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return errno;
+    char magic[8];
+    uint64_t head[3] = {0, 0, 0};
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+              !memcmp(magic, SEEK_INDEX_MAGIC, sizeof(magic)) &&
+              fread(head, sizeof(head), 1, f) == 1 &&
+              head[0] == dec.streamInfo().totalSamples && head[1] == dec.size() &&
+              head[2] > 0 && head[2] <= dec.size();
+    const size_t streamBytes = dec.size() - dec.audioOffset();
+    for (uint64_t i = 0; ok && i < head[2]; i++) {
+        uint64_t v[3];
+        ok = fread(v, sizeof(v), 1, f) == 1 && v[1] < streamBytes &&
+             (points.empty() || v[0] > points.back().sampleNumber);
+        if (!ok) break;
+        FlacSeekPoint point;
+        point.sampleNumber = v[0];
+        point.streamOffset = v[1];
+        point.frameSamples = (unsigned) v[2];
+        points.push_back(point);
+    }
+    fclose(f);
+    if (!ok) {
+        LOGE("Ignoring the invalid seek index %s", path.c_str());
+        points.clear();
+        return EILSEQ;
+    }
+    return 0;
+}
+
+int saveSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  const std::vector<FlacSeekPoint> &points) {
+    if (mkdir(dir.c_str(), 0700) && errno != EEXIST) return errno;
+    const std::string path = seekIndexPath(dir, dec);
+    /* readers only ever see a complete index */
+    const std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return errno;
+    const uint64_t head[3] = {dec.streamInfo().totalSamples, dec.size(), points.size()};
+    bool ok = fwrite(SEEK_INDEX_MAGIC, sizeof(SEEK_INDEX_MAGIC), 1, f) == 1 &&
+              fwrite(head, sizeof(head), 1, f) == 1;
+    for (size_t i = 0; ok && i < points.size(); i++) {
+        const uint64_t v[3] = {points[i].sampleNumber, points[i].streamOffset,
+                               points[i].frameSamples};
+        ok = fwrite(v, sizeof(v), 1, f) == 1;
+    }
+    int e = 0;
+    if (fclose(f) || !ok) {
+        e = errno ? errno : EIO;
+    } else if (rename(tmp.c_str(), path.c_str())) {
+        e = errno;
+    }
+    if (e) unlink(tmp.c_str());
+    return e;
+}
+
+int openSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  std::vector<FlacSeekPoint> &points) {
+    if (!loadSeekIndex(dir, dec, points)) return 0;
+    int r = buildSeekIndex(dec, points);
+    if (r) return r;
+    r = saveSeekIndex(dir, dec, points);
+    /* the index is still good for this decode */
+    if (r) LOGE("Could not save the seek index in %s: %s", dir.c_str(), strerror(r));
+    return 0;
+}
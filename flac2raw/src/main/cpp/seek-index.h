@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_SEEK_INDEX_H
+#define FLAC2RAW_SEEK_INDEX_H
+
+#include <string>
+#include <vector>
+
+#include "flac-decoder.h"
+
+/* Distance of the points of a seek index in milliseconds */
+#define SEEK_INDEX_INTERVAL_MS 100
+
+//-----------------------------------------------------------------
+/* Frame offsets of a flac stream without a SEEKTABLE. Building one scans the
+ * whole stream once, so it's kept in a sidecar file named after a hash of the
+ * stream and later range decodes of the same stream seek straight to a frame.
+ * The points have the same layout as the SEEKTABLE, offsets are relative to
+ * the first frame. All functions return zero or the error number. */
+
+/* Finds the frames of dec by their sync codes and header CRCs, a point about
+ * every SEEK_INDEX_INTERVAL_MS */
+int buildSeekIndex(const FlacDecoder &dec, std::vector<FlacSeekPoint> &points);
+
+/* Path of the index file of dec in dir */
+std::string seekIndexPath(const std::string &dir, const FlacDecoder &dec);
+
+/* Reads the index of dec from dir, ENOENT if there is none and EILSEQ if it
+ * doesn't match the stream */
+int loadSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  std::vector<FlacSeekPoint> &points);
+
+/* Writes the index of dec to dir, replacing any previous one atomically */
+int saveSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  const std::vector<FlacSeekPoint> &points);
+
+/* Loads the index of dec or builds and saves it if there is none */
+int openSeekIndex(const std::string &dir, const FlacDecoder &dec,
+                  std::vector<FlacSeekPoint> &points);
+
+#endif
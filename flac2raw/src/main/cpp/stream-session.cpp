@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+#include "stream-session.h"
+#include "flac2raw-log.h"
+
+StreamSession::StreamSession(size_t bufferBytes) :
+        ring(std::max(bufferBytes, (size_t) 2) & ~(size_t) 1),
+        head(0), filled(0), finished(false), cancelled(false), decodeError(0),
+        formatKnown(false), fd(-1), latencyUs(-1) {}
+
+StreamSession::~StreamSession() {
+    close();
+    if (fd >= 0) ::close(fd);
+}
+
+void StreamSession::start(DecoderBackend &backend, const DecodeSource &src,
+                          const ConvOptions &opts, bool ownFd) {
+    DecodeSource s = src;
+    if (s.type == DecodeSource::URI) {
+        path = s.path;
+        s.path = path.c_str();
+    } else if (ownFd) {
+        fd = s.fd;
+    }
+    startTime = std::chrono::steady_clock::now();
+    DecoderBackend *b = &backend;
+    decoder = std::thread([this, b, s, opts]() {
+        int r = b->decode(s, *this, opts);
+        finish(r);
+    });
+}
+
+void StreamSession::fail(int error) {
+    finish(error);
+}
+
+void StreamSession::finish(int error) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        /* a cancelled decoder reports ECANCELED which isn't an error of the stream */
+        if (!cancelled && !decodeError) decodeError = error;
+        finished = true;
+    }
+    changed.notify_all();
+}
+
+long StreamSession::read(void *dst, size_t maxBytes) {
+    maxBytes &= ~(size_t) 1;
+    if (0 == maxBytes) return 0;
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return filled > 0 || finished || cancelled; });
+    if (cancelled) return 0;
+    if (0 == filled) return decodeError ? -decodeError : 0;
+    const size_t size = ring.size();
+    const size_t tail = (head + size - filled) % size;
+    size_t n = std::min(maxBytes, filled);
+    const size_t first = std::min(n, size - tail);
+    memcpy(dst, &ring[tail], first);
+    memcpy((uint8_t *) dst + first, &ring[0], n - first);
+    filled -= n;
+    guard.unlock();
+    changed.notify_all();
+    return (long) n;
+}
+
+void StreamSession::cancel() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cancelled = true;
+    }
+    changed.notify_all();
+}
+
+void StreamSession::close() {
+    cancel();
+    if (decoder.joinable()) decoder.join();
+}
+
+int64_t StreamSession::startupLatencyUs() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return latencyUs;
+}
+
+int StreamSession::error() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return decodeError;
+}
+
+int StreamSession::format(PcmFormat &format) const {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return formatKnown || finished || cancelled; });
+    if (formatKnown) {
+        format = pcmFormat;
+        return 0;
+    }
+    if (decodeError) return decodeError;
+    return cancelled ? ECANCELED : ENODATA;
+}
+
+void *StreamSession::scratch(size_t nbytes) {
+    if (scratchBuffer.size() < nbytes) scratchBuffer.resize(nbytes);
+    return scratchBuffer.data();
+}
+
+int StreamSession::begin(const PcmFormat &format) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pcmFormat = format;
+        formatKnown = true;
+    }
+    changed.notify_all();
+    return 0;
+}
+
+int StreamSession::write(const void *data, size_t nbytes) {
+    const uint8_t *p = (const uint8_t *) data;
+    const size_t size = ring.size();
+    std::unique_lock<std::mutex> guard(lock);
+    if (latencyUs < 0 && nbytes > 0) {
+        latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - startTime).count();
+        LOGV("First audio of the stream after %lld us", (long long) latencyUs);
+    }
+    while (nbytes > 0) {
+        /* backpressure: the decoder waits here for the reader */
+        changed.wait(guard, [this, size] { return filled < size || cancelled; });
+        if (cancelled) return ECANCELED;
+        const size_t n = std::min(std::min(nbytes, size - filled), size - head);
+        memcpy(&ring[head], p, n);
+        head = (head + n) % size;
+        filled += n;
+        p += n;
+        nbytes -= n;
+        changed.notify_all();
+    }
+    return 0;
+}
+
+int StreamSession::end() {
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_STREAM_SESSION_H
+#define FLAC2RAW_STREAM_SESSION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include "decoder-backend.h"
+
+/* Default amount of decoded audio a stream buffers ahead of the reader */
+#define STREAM_DEFAULT_BUFFER_BYTES (256 * 1024)
+
+//-----------------------------------------------------------------
+/* Pull based decoding with bounded memory. The backend decodes on a thread of
+ * the session into a ring of bufferBytes. When the ring is full the decoder
+ * blocks in write(), for OpenSL ES inside DecPlayCallback, so that a slow
+ * reader throttles the decoding instead of the memory growing. */
+class StreamSession : public PcmSink {
+public:
+    explicit StreamSession(size_t bufferBytes = STREAM_DEFAULT_BUFFER_BYTES);
+
+    /* stops the decoder and waits for it */
+    ~StreamSession();
+
+    /* Starts decoding src on a new thread. path of a URI source is copied, a
+     * file descriptor is closed by the session if ownFd is set. */
+    void start(DecoderBackend &backend, const DecodeSource &src, const ConvOptions &opts,
+               bool ownFd = false);
+
+    /* Fails the session without decoding, for example if the source can't be opened */
+    void fail(int error);
+
+    /* Copies up to maxBytes of audio, rounded down to whole samples. Blocks until
+     * some audio is there. Returns the number of bytes, 0 at the end of the stream
+     * or the negative error number. */
+    long read(void *dst, size_t maxBytes);
+
+    /* stops the decoder and wakes up a blocked read(), further reads return
+     * the end of the stream. Doesn't wait for the decoder. */
+    void cancel();
+
+    /* cancel() and waits for the decoder */
+    void close();
+
+    /* time from start() until the first audio was available, -1 before */
+    int64_t startupLatencyUs() const;
+
+    /* zero or the error number of the decoder */
+    int error() const;
+
+    /* Blocks until the decoder has called begin() and copies the format of the
+     * audio. Returns zero or the error number if the session ended before. */
+    int format(PcmFormat &format) const;
+
+    /* Memory of at least nbytes kept across calls for a reader which can't
+     * read into its destination directly. Not locked, the reads of a session
+     * have to be serialized anyway. */
+    void *scratch(size_t nbytes);
+
+    /* PcmSink for the backend */
+    int begin(const PcmFormat &format);
+
+    int write(const void *data, size_t nbytes);
+
+    int end();
+
+private:
+    void finish(int error);
+
+    std::vector<uint8_t> ring;
+    size_t head;
+    size_t filled;
+    bool finished;
+    bool cancelled;
+    int decodeError;
+    PcmFormat pcmFormat;
+    bool formatKnown;
+    std::vector<uint8_t> scratchBuffer;
+    mutable std::mutex lock;
+    mutable std::condition_variable changed;
+    std::thread decoder;
+    std::string path;
+    int fd;
+    std::chrono::steady_clock::time_point startTime;
+    int64_t latencyUs;
+};
+
+#endif
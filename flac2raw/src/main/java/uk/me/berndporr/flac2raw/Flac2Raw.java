@@ -2,12 +2,739 @@ package uk.me.berndporr.flac2raw;
 
 import android.content.res.AssetManager;
 
-public class Flac2Raw {
+import java.io.Closeable;
+import java.nio.Buffer;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.nio.ShortBuffer;
+
+public class Flac2Raw implements Closeable {
 
     static {
         System.loadLibrary("flac2raw-jni");
     }
 
+    /***
+     * Default maximum number of OpenSL ES audio players decoding at the same time
+     */
+    public static final int DEFAULT_MAX_PLAYERS = 4;
+
+    // native state: the OpenSL ES engine and the pool of player slots
+    private long nativeHandle;
+
+    /***
+     * Creates a converter. The OpenSL ES engine is created on the first conversion
+     * and kept until close() is called.
+     */
+    public Flac2Raw() {
+        this(DEFAULT_MAX_PLAYERS);
+    }
+
+    /***
+     * Creates a converter
+     * @param maxPlayers maximum number of OpenSL ES audio players decoding at the same
+     *                   time. Further conversions block until a player is free.
+     */
+    public Flac2Raw(int maxPlayers) {
+        nativeHandle = nativeCreate(maxPlayers);
+    }
+
+    /***
+     * Releases the OpenSL ES engine. Must not be called while blocking conversions
+     * are running or streams are open. Asynchronous conversions are cancelled and
+     * their listeners get onFinished before it returns. Conversions after close()
+     * return EBADF.
+     */
+    @Override
+    public synchronized void close() {
+        if (nativeHandle != 0) {
+            nativeRelease(nativeHandle);
+            nativeHandle = 0;
+        }
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        try {
+            close();
+        } finally {
+            super.finalize();
+        }
+    }
+
+    /***
+     * Decodes with the platform decoder via OpenSL ES
+     */
+    public static final int BACKEND_OPENSL = 0;
+
+    /***
+     * Decodes with the built-in FLAC decoder (FLAC only)
+     */
+    public static final int BACKEND_NATIVE = 1;
+
+    /***
+     * Buffer size which is a multiple of the block size of the flac file
+     */
+    public static final int BUFFER_SIZE_ADAPTIVE = 0;
+
+    /***
+     * 16 bit signed samples, the format of the decoders
+     */
+    public static final int FORMAT_PCM16 = 0;
+
+    /***
+     * 32 bit float samples between -1 and 1
+     */
+    public static final int FORMAT_FLOAT32 = 1;
+
+    /***
+     * packed 24 bit signed samples (3 bytes each)
+     */
+    public static final int FORMAT_INT24 = 2;
+
+    /***
+     * 32 bit signed samples
+     */
+    public static final int FORMAT_INT32 = 3;
+
+    /***
+     * output files are written with buffered writes and grow as the audio is decoded
+     */
+    public static final int OUTPUT_STDIO = 0;
+
+    /***
+     * output files are allocated in one go and the audio is copied into a mapping of them
+     */
+    public static final int OUTPUT_MMAP = 1;
+
+    /***
+     * output files are allocated in one go and written in blocks of 1MB
+     */
+    public static final int OUTPUT_PWRITE = 2;
+
+    /***
+     * output files are headerless raw audio
+     */
+    public static final int CONTAINER_RAW = 0;
+
+    /***
+     * output files are chunks of raw audio with a CRC each, a header with the format
+     * and an index at the end, see chunked-pcm.h
+     */
+    public static final int CONTAINER_CHUNKED = 1;
+
+    /***
+     * Options of a conversion. The fields are read by the native code.
+     */
+    public static class Options {
+        /***
+         * BACKEND_OPENSL or BACKEND_NATIVE
+         */
+        public int backend = BACKEND_OPENSL;
+
+        /***
+         * sampling rate of the source file
+         */
+        public int samplingRateHz = 48000;
+
+        /***
+         * checks the decoded audio against the MD5 sum of the flac file (native backend only)
+         */
+        public boolean verifyMd5 = false;
+
+        /***
+         * number of threads decoding a single file in parallel, 0 uses all cores
+         * (native backend only, ignored if verifyMd5 is set)
+         */
+        public int numThreads = 1;
+
+        /***
+         * time in ms the platform decoder may take to open the source and
+         * buffer the first data (OpenSL ES backend only)
+         */
+        public int prefetchTimeoutMs = 5000;
+
+        /***
+         * number of buffers in the queue of the platform decoder (OpenSL ES backend only)
+         */
+        public int numBuffers = 4;
+
+        /***
+         * size of each buffer of the queue in 16 bit samples or BUFFER_SIZE_ADAPTIVE.
+         * Larger buffers mean fewer callbacks per second of audio. (OpenSL ES backend only)
+         */
+        public int bufferSizeSamples = 1152;
+
+        /***
+         * size of a ring buffer between the decoder and a separate writer thread so that
+         * storage stalls don't block the decoder. 0 writes directly from the decoder.
+         * The output is then written sequentially so numThreads is ignored.
+         */
+        public int ringBufferBytes = 0;
+
+        /***
+         * size of the writes of the writer thread
+         */
+        public int writeChunkBytes = 64 * 1024;
+
+        /***
+         * decoded audio a Stream buffers ahead of its reader. When it's full the
+         * decoder waits for the reader.
+         */
+        public int streamBufferBytes = 256 * 1024;
+
+        /***
+         * sample format of the output, one of FORMAT_*. Streams are always FORMAT_PCM16.
+         */
+        public int sampleFormat = FORMAT_PCM16;
+
+        /***
+         * averages all channels into a mono output. Streams ignore it.
+         */
+        public boolean downmixToMono = false;
+
+        /***
+         * sampling rate of the output in Hz, for example 16000. The audio is resampled
+         * if the source has a different rate. 0 keeps the rate of the source.
+         * Streams ignore it.
+         */
+        public int resampleToHz = 0;
+
+        /***
+         * start of the time range to decode in milliseconds. The decoder seeks
+         * there instead of decoding everything in front of it.
+         */
+        public long startMs = 0;
+
+        /***
+         * end of the time range to decode in milliseconds, -1 for the end of the file
+         */
+        public long endMs = -1;
+
+        /***
+         * directory where the native backend keeps the seek indexes of flac files
+         * without a SEEKTABLE, for example a subdirectory of getCacheDir(). The first
+         * range of such a file scans it once, later ones seek straight to the range.
+         * null bisects the file every time.
+         */
+        public String seekIndexDir = null;
+
+        /***
+         * directory of a cache of converted files, for example a subdirectory of
+         * getCacheDir(), null for none. Converting a file to a file whose content
+         * and output options have been converted before only copies the cached
+         * output, without starting a decoder.
+         */
+        public String cacheDir = null;
+
+        /***
+         * size of the cache in bytes above which the least recently used files are removed
+         */
+        public long cacheMaxBytes = 256L * 1024 * 1024;
+
+        /***
+         * OUTPUT_STDIO, OUTPUT_MMAP or OUTPUT_PWRITE. The latter two reserve the
+         * whole output file up front, which keeps it in few extents and fails
+         * early with a full disk.
+         */
+        public int outputMode = OUTPUT_STDIO;
+
+        /***
+         * CONTAINER_RAW or CONTAINER_CHUNKED. Chunked files are always written
+         * chunk by chunk and ignore outputMode.
+         */
+        public int container = CONTAINER_RAW;
+
+        /***
+         * bytes of audio per chunk of CONTAINER_CHUNKED, rounded down to whole sample frames
+         */
+        public int chunkBytes = 256 * 1024;
+
+        /***
+         * if a chunked output file of an interrupted or cancelled conversion with the
+         * same format exists, its chunks are kept and only the rest is written
+         */
+        public boolean resume = false;
+
+        /***
+         * if not null it's filled in with the timing of the conversion, see Stats.
+         * Streams and asynchronous conversions aren't timed.
+         */
+        public Stats stats = null;
+
+        /***
+         * milliseconds between two calls of ProgressListener.onProgress of an
+         * asynchronous conversion
+         */
+        public int progressIntervalMs = 250;
+    }
+
+    /***
+     * Timing of a conversion, filled in by the conversions with options whose
+     * stats field is set. Collecting it only reads the clock twice per buffer,
+     * so it can stay switched on. uncompressFiles2Files adds up all its files
+     * but wallUs and realtimeFactor are of the whole batch. Times are in
+     * microseconds.
+     */
+    public static class Stats {
+        /***
+         * number of files converted
+         */
+        public long conversions;
+
+        /***
+         * until the platform decoder had opened the source, -1 for the native
+         * backend or output copied from the cache
+         */
+        public long prefetchUs;
+
+        /***
+         * from starting the decoder until the first decoded buffer, -1 if there was none
+         */
+        public long firstBufferUs;
+
+        /***
+         * whole conversion
+         */
+        public long wallUs;
+
+        /***
+         * decoded buffers, for the platform decoder the number of buffer queue callbacks
+         */
+        public long callbacks;
+
+        /***
+         * time between buffers: element 0 counts the intervals below 64us, element i
+         * those from 32 << i to 64 << i us and the last one all which are longer
+         */
+        public long[] intervalHistogram;
+        public long maxIntervalUs;
+        public double meanIntervalUs;
+
+        /***
+         * standard deviation of the time between buffers
+         */
+        public double intervalJitterUs;
+
+        /***
+         * time the decoder waited for the output to take a buffer. If it's most of
+         * wallUs the storage is the bottleneck, see ringBufferBytes and outputMode.
+         */
+        public long writeBlockedUs;
+
+        /***
+         * decoded 16 bit audio before any format or rate conversion
+         */
+        public long bytesWritten;
+        public double audioSeconds;
+
+        /***
+         * seconds of audio decoded per second
+         */
+        public double realtimeFactor;
+    }
+
+    /***
+     * @param sampleFormat one of FORMAT_*
+     * @return bytes of a sample or 0 for an unknown format
+     */
+    public static int bytesPerSample(int sampleFormat) {
+        switch (sampleFormat) {
+            case FORMAT_PCM16:
+                return 2;
+            case FORMAT_INT24:
+                return 3;
+            case FORMAT_FLOAT32:
+            case FORMAT_INT32:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    /***
+     * Decoded audio pulled by the reader. The decoder runs ahead of the reader
+     * by at most Options.streamBufferBytes.
+     */
+    public static class Stream implements Closeable {
+        // reads can block so close() doesn't take this lock until it has woken them up
+        private final Object readLock = new Object();
+        private long handle;
+        private boolean closing = false;
+
+        private Stream(long handle) {
+            this.handle = handle;
+        }
+
+        /***
+         * Reads interleaved 16 bit samples. Blocks until at least one sample is there.
+         * @param samples destination
+         * @param offset index of the first sample in samples
+         * @param n maximum number of samples
+         * @return the number of samples read or -1 at the end of the stream or on an error
+         */
+        public int read(short[] samples, int offset, int n) {
+            if (offset < 0 || n < 0 || offset + n > samples.length) {
+                throw new IndexOutOfBoundsException();
+            }
+            synchronized (readLock) {
+                if (handle == 0) return -1;
+                return nativeReadShorts(handle, samples, offset, n);
+            }
+        }
+
+        /***
+         * Reads little endian 16 bit samples into a direct ByteBuffer at its position
+         * and advances the position. Blocks until at least one sample is there.
+         * @param buffer direct ByteBuffer
+         * @return the number of bytes read or -1 at the end of the stream or on an error
+         */
+        public int read(ByteBuffer buffer) {
+            if (!buffer.isDirect()) {
+                throw new IllegalArgumentException("Not a direct buffer");
+            }
+            synchronized (readLock) {
+                if (handle == 0) return -1;
+                int r = nativeReadBuffer(handle, buffer, buffer.position(), buffer.remaining());
+                if (r > 0) buffer.position(buffer.position() + r);
+                return r;
+            }
+        }
+
+        /***
+         * @return zero or the error number if read() has returned -1 because of an error
+         */
+        public int error() {
+            synchronized (readLock) {
+                return handle == 0 ? 0 : nativeError(handle);
+            }
+        }
+
+        /***
+         * Blocks until the decoder knows the format of the audio.
+         * @return the sample rate in Hz or -1 if the stream has ended before,
+         * error() tells why
+         */
+        public int sampleRate() {
+            int[] format = format();
+            return format == null ? -1 : format[0];
+        }
+
+        /***
+         * Blocks until the decoder knows the format of the audio.
+         * @return the number of interleaved channels or -1 if the stream has
+         * ended before, error() tells why
+         */
+        public int channels() {
+            int[] format = format();
+            return format == null ? -1 : format[1];
+        }
+
+        private int[] format() {
+            int[] format = new int[2];
+            synchronized (readLock) {
+                if (handle == 0 || nativeFormat(handle, format) != 0) return null;
+            }
+            return format;
+        }
+
+        /***
+         * @return time in microseconds from opening the stream until the first
+         * samples were available, -1 if there weren't any yet
+         */
+        public long startupLatencyUs() {
+            synchronized (readLock) {
+                return handle == 0 ? -1 : nativeStartupLatencyUs(handle);
+            }
+        }
+
+        /***
+         * Stops the decoder and frees the stream. A read() blocked in another
+         * thread returns -1.
+         */
+        @Override
+        public void close() {
+            synchronized (this) {
+                if (handle == 0 || closing) return;
+                closing = true;
+            }
+            // only this thread frees the handle so it's still valid here
+            nativeCancel(handle);
+            synchronized (readLock) {
+                nativeClose(handle);
+                handle = 0;
+            }
+        }
+
+        @Override
+        protected void finalize() throws Throwable {
+            try {
+                close();
+            } finally {
+                super.finalize();
+            }
+        }
+
+        private static native int nativeReadShorts(long handle, short[] samples, int offset, int n);
+
+        private static native int nativeReadBuffer(long handle, ByteBuffer buffer,
+                                                   int offset, int nBytes);
+
+        private static native int nativeError(long handle);
+
+        private static native long nativeStartupLatencyUs(long handle);
+
+        private static native int nativeFormat(long handle, int[] format);
+
+        private static native void nativeCancel(long handle);
+
+        private static native void nativeClose(long handle);
+    }
+
+    /***
+     * Starts decoding a file for reading it piece by piece. Errors, for example
+     * a missing file, are reported by read() and Stream.error().
+     * @param flacFile source flac filename
+     * @param options backend of the decoding and buffering of the stream
+     * @return the stream which has to be closed
+     */
+    public Stream openFile(String flacFile, Options options) {
+        return new Stream(openStreamFile(flacFile, options));
+    }
+
+    /***
+     * Starts decoding an Android asset for reading it piece by piece
+     * @param assetManager
+     * @param flacFile
+     * @param options backend of the decoding and buffering of the stream
+     * @return the stream which has to be closed
+     */
+    public Stream openAsset(AssetManager assetManager, String flacFile, Options options) {
+        return new Stream(openStreamAsset(assetManager, flacFile, options));
+    }
+
+    /***
+     * Starts decoding a byte range of a file descriptor, for example of a
+     * ParcelFileDescriptor. The descriptor is duplicated, the caller can close it.
+     * @param fd file descriptor
+     * @param offset start of the audio file
+     * @param length length of the audio file
+     * @param options backend of the decoding and buffering of the stream
+     * @return the stream which has to be closed
+     */
+    public Stream openFd(int fd, long offset, long length, Options options) {
+        return new Stream(openStreamFd(fd, offset, length, options));
+    }
+
+    /***
+     * Random access to a file written with CONTAINER_CHUNKED. The file is mapped
+     * into memory, so reading a range only touches the chunks of that range. An
+     * interrupted file can be read up to its first damaged chunk.
+     */
+    public static class ChunkedReader implements Closeable {
+        private long handle = 0;
+        private int sampleRate;
+        private int channels;
+        private int bitsPerSample;
+        private int sampleFormat;
+        private int chunkBytes;
+
+        /***
+         * Opens a chunked file, closing the one opened before
+         * @param path the file
+         * @return zero on success or the error number, EINVAL (22) if it isn't a chunked file
+         */
+        public synchronized int open(String path) {
+            close();
+            int[] format = new int[5];
+            long h = nativeOpen(path, format);
+            if (h < 0) return (int) -h;
+            handle = h;
+            sampleRate = format[0];
+            channels = format[1];
+            bitsPerSample = format[2];
+            sampleFormat = format[3];
+            chunkBytes = format[4];
+            return 0;
+        }
+
+        /***
+         * @return true if the conversion had finished, false if it was interrupted
+         */
+        public synchronized boolean isComplete() {
+            return handle != 0 && nativeIsComplete(handle);
+        }
+
+        /***
+         * @return number of sample frames which can be read
+         */
+        public synchronized long frames() {
+            return handle == 0 ? 0 : nativeFrames(handle);
+        }
+
+        /***
+         * @return number of chunks which can be read
+         */
+        public synchronized int chunks() {
+            return handle == 0 ? 0 : nativeChunks(handle);
+        }
+
+        public int sampleRate() {
+            return sampleRate;
+        }
+
+        public int channels() {
+            return channels;
+        }
+
+        /***
+         * @return one of FORMAT_*
+         */
+        public int sampleFormat() {
+            return sampleFormat;
+        }
+
+        public int bytesPerFrame() {
+            return channels * (bitsPerSample / 8);
+        }
+
+        /***
+         * @return bytes of audio of every chunk but the last
+         */
+        public int chunkBytes() {
+            return chunkBytes;
+        }
+
+        /***
+         * Reads 16 bit samples from a frame on
+         * @param frame first sample frame
+         * @param samples destination of the interleaved samples
+         * @param offset index of the first sample in samples
+         * @param n maximum number of frames
+         * @return the number of frames read, 0 past the end
+         */
+        public synchronized int read(long frame, short[] samples, int offset, int n) {
+            if (sampleFormat != FORMAT_PCM16) {
+                throw new IllegalStateException("Not 16 bit audio");
+            }
+            if (frame < 0 || offset < 0 || n < 0 || offset + (long) n * channels > samples.length) {
+                throw new IndexOutOfBoundsException();
+            }
+            if (handle == 0) return 0;
+            return nativeReadShorts(handle, frame, samples, offset, n);
+        }
+
+        /***
+         * Reads whole frames from a frame on into a direct ByteBuffer at its position
+         * and advances the position
+         * @param frame first sample frame
+         * @param buffer direct ByteBuffer
+         * @return the number of frames read, 0 past the end
+         */
+        public synchronized int read(long frame, ByteBuffer buffer) {
+            if (!buffer.isDirect()) {
+                throw new IllegalArgumentException("Not a direct buffer");
+            }
+            if (frame < 0) {
+                throw new IndexOutOfBoundsException();
+            }
+            if (handle == 0) return 0;
+            int r = nativeReadBuffer(handle, frame, buffer, buffer.position(),
+                    buffer.remaining() / bytesPerFrame());
+            if (r > 0) buffer.position(buffer.position() + r * bytesPerFrame());
+            return Math.max(r, 0);
+        }
+
+        /***
+         * Checks the CRC of a chunk
+         * @param chunk index of the chunk
+         * @return zero if it's intact, EILSEQ (84) if it's damaged
+         */
+        public synchronized int verify(int chunk) {
+            if (handle == 0) return EBADF;
+            return nativeVerify(handle, chunk);
+        }
+
+        @Override
+        public synchronized void close() {
+            if (handle != 0) {
+                nativeClose(handle);
+                handle = 0;
+            }
+        }
+
+        @Override
+        protected void finalize() throws Throwable {
+            try {
+                close();
+            } finally {
+                super.finalize();
+            }
+        }
+
+        // returns the handle or the negative error number
+        private static native long nativeOpen(String path, int[] format);
+
+        private static native boolean nativeIsComplete(long handle);
+
+        private static native long nativeFrames(long handle);
+
+        private static native int nativeChunks(long handle);
+
+        private static native int nativeReadShorts(long handle, long frame, short[] samples,
+                                                   int offset, int n);
+
+        private static native int nativeReadBuffer(long handle, long frame, ByteBuffer buffer,
+                                                   int offset, int n);
+
+        private static native int nativeVerify(long handle, int chunk);
+
+        private static native void nativeClose(long handle);
+    }
+
+    /***
+     * Statistics of the writer threads, accumulated over all conversions of this
+     * instance which used a ring buffer
+     */
+    public static class WriterStats {
+        /***
+         * number of conversions through a ring buffer
+         */
+        public long conversions;
+
+        /***
+         * largest ring buffer used
+         */
+        public int capacityBytes;
+
+        /***
+         * most bytes which were waiting in a ring buffer to be written. If it's
+         * close to capacityBytes the ring buffer should be larger.
+         */
+        public int highWaterBytes;
+
+        /***
+         * number of times the decoder had to wait for the writer because the ring was full
+         */
+        public long producerStalls;
+
+        /***
+         * number of writes of the writer threads and the bytes written
+         */
+        public long writes;
+        public long bytesWritten;
+    }
+
+    /***
+     * @return the statistics of the ring buffers so far
+     */
+    public synchronized WriterStats getWriterStats() {
+        WriterStats stats = new WriterStats();
+        fillWriterStats(stats);
+        return stats;
+    }
+
     /***
      * Uncompresses a compressed audio file on the
      * to a raw audio file
@@ -20,6 +747,20 @@ public class Flac2Raw {
                                           String rawFile,
                                           int samplingRateHz);
 
+    /***
+     * Uncompresses a compressed audio file on the
+     * to a raw audio file
+     * @param flacFile source flac filename
+     * @param rawFile destination for the raw filename
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressFile2File(String flacFile,
+                                   String rawFile,
+                                   Options options) {
+        return uncompressFile2FileWithOptions(flacFile, rawFile, options);
+    }
+
     /***
      * Uncompresses an Android asset from the "assets" folder
      * to a raw header-less audio file
@@ -33,4 +774,591 @@ public class Flac2Raw {
                                            String flacFile,
                                            String rawFile,
                                            int samplingRateHz);
+
+    /***
+     * Uncompresses an Android asset from the "assets" folder
+     * to a raw header-less audio file
+     * @param assetManager
+     * @param flacFile
+     * @param rawFile
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressAsset2File(AssetManager assetManager,
+                                    String flacFile,
+                                    String rawFile,
+                                    Options options) {
+        return uncompressAsset2FileWithOptions(assetManager, flacFile, rawFile, options);
+    }
+
+    /***
+     * Receives the progress of an asynchronous conversion. The methods are called
+     * from a background thread which is shared by all conversions of the
+     * converter, so they should return quickly.
+     */
+    public interface ProgressListener {
+        /***
+         * @param conversion the conversion
+         * @param positionMs decoded audio so far
+         * @param durationMs length of the audio or -1 if it isn't known yet
+         */
+        void onProgress(Conversion conversion, long positionMs, long durationMs);
+
+        /***
+         * Called once when the conversion has ended
+         * @param conversion the conversion
+         * @param error zero on success, ECANCELED (125) if it was cancelled or the error number
+         */
+        void onFinished(Conversion conversion, int error);
+    }
+
+    /***
+     * A conversion running in the background, started by uncompressFile2FileAsync
+     * or uncompressAsset2FileAsync. A cancelled conversion leaves an empty raw file,
+     * or with CONTAINER_CHUNKED its complete chunks, which Options.resume carries on.
+     */
+    public static class Conversion implements Closeable {
+        // set by the native start call, freed by close() once no await() uses it
+        private long handle;
+        private int waiters = 0;
+        private boolean closing = false;
+        private int result = EBADF;
+
+        private Conversion() {
+        }
+
+        /***
+         * Asks the decoder to stop. Returns at once, the conversion then ends
+         * with ECANCELED (125) unless it has already finished.
+         */
+        public void cancel() {
+            synchronized (this) {
+                if (handle == 0 || closing) return;
+                nativeCancel(handle);
+            }
+        }
+
+        /***
+         * Blocks until the conversion has ended
+         * @return zero on success, ECANCELED (125) if it was cancelled or the error number
+         */
+        public int await() {
+            long h;
+            synchronized (this) {
+                if (handle == 0 || closing) return result;
+                h = handle;
+                waiters++;
+            }
+            int r = nativeAwait(h);
+            synchronized (this) {
+                result = r;
+                waiters--;
+                notifyAll();
+            }
+            return r;
+        }
+
+        /***
+         * @return true if the conversion has ended
+         */
+        public synchronized boolean isDone() {
+            return handle == 0 || nativeIsDone(handle);
+        }
+
+        /***
+         * Cancels the conversion if it's still running, waits until it has
+         * ended and frees it
+         */
+        @Override
+        public void close() {
+            long h;
+            synchronized (this) {
+                if (handle == 0 || closing) return;
+                closing = true;
+                h = handle;
+            }
+            nativeCancel(h);
+            int r = nativeAwait(h);
+            synchronized (this) {
+                // await() in other threads still use the handle
+                while (waiters > 0) {
+                    try {
+                        wait();
+                    } catch (InterruptedException e) {
+                        Thread.currentThread().interrupt();
+                        break;
+                    }
+                }
+                if (waiters == 0) {
+                    nativeRelease(h);
+                    handle = 0;
+                }
+                result = r;
+            }
+        }
+
+        @Override
+        protected void finalize() throws Throwable {
+            try {
+                close();
+            } finally {
+                super.finalize();
+            }
+        }
+
+        private static native void nativeCancel(long handle);
+
+        private static native int nativeAwait(long handle);
+
+        private static native boolean nativeIsDone(long handle);
+
+        private static native void nativeRelease(long handle);
+    }
+
+    private static final int EBADF = 9;
+
+    /***
+     * Uncompresses a compressed audio file to a raw audio file in the background
+     * @param flacFile source flac filename
+     * @param rawFile destination for the raw filename
+     * @param options backend and format of the conversion
+     * @param listener receives the progress and the result, can be null
+     * @return the conversion which has to be closed
+     */
+    public Conversion uncompressFile2FileAsync(String flacFile,
+                                               String rawFile,
+                                               Options options,
+                                               ProgressListener listener) {
+        Conversion conversion = new Conversion();
+        startFile2FileAsync(flacFile, rawFile, options, conversion, listener);
+        return started(conversion, listener);
+    }
+
+    /***
+     * Uncompresses an Android asset from the "assets" folder to a raw header-less
+     * audio file in the background
+     * @param assetManager
+     * @param flacFile
+     * @param rawFile
+     * @param options backend and format of the conversion
+     * @param listener receives the progress and the result, can be null
+     * @return the conversion which has to be closed
+     */
+    public Conversion uncompressAsset2FileAsync(AssetManager assetManager,
+                                                String flacFile,
+                                                String rawFile,
+                                                Options options,
+                                                ProgressListener listener) {
+        Conversion conversion = new Conversion();
+        startAsset2FileAsync(assetManager, flacFile, rawFile, options, conversion, listener);
+        return started(conversion, listener);
+    }
+
+    // a converter which has been closed doesn't start the conversion
+    private static Conversion started(Conversion conversion, ProgressListener listener) {
+        if (conversion.handle == 0 && listener != null) {
+            listener.onFinished(conversion, EBADF);
+        }
+        return conversion;
+    }
+
+    /***
+     * Uncompresses a list of audio files to raw audio files on a pool of
+     * background threads. Blocks until all files have been converted.
+     * @param flacFiles source filenames
+     * @param rawFiles destination filenames, same length as flacFiles
+     * @param options backend and format of the conversions
+     * @param maxConcurrency maximum number of files decoded at the same time,
+     *                       0 uses all cores. With the OpenSL ES backend it's also
+     *                       limited by maxPlayers.
+     * @return zero or the error number for every file
+     */
+    public int[] uncompressFiles2Files(String[] flacFiles,
+                                       String[] rawFiles,
+                                       Options options,
+                                       int maxConcurrency) {
+        if (flacFiles.length != rawFiles.length) {
+            throw new IllegalArgumentException("flacFiles and rawFiles differ in length");
+        }
+        return uncompressFiles2FilesWithOptions(flacFiles, rawFiles, options, maxConcurrency);
+    }
+
+    /***
+     * Format of a flac file as read from its metadata
+     */
+    public static class Info {
+        /***
+         * the file which was probed
+         */
+        public String path;
+
+        /***
+         * zero or the error number, the other fields are only valid if zero
+         */
+        public int error;
+
+        public int sampleRate;
+        public int channels;
+        public int bitsPerSample;
+
+        /***
+         * number of samples per channel, 0 if unknown
+         */
+        public long totalSamples;
+
+        /***
+         * duration in ms, 0 if unknown
+         */
+        public long durationMs;
+
+        /***
+         * number of points in the SEEKTABLE
+         */
+        public int seekPoints;
+
+        public int minBlockSize;
+        public int maxBlockSize;
+    }
+
+    /***
+     * Reads the format of a flac file from its metadata without decoding it
+     * @param flacFile source flac filename
+     * @return the format, check Info.error
+     */
+    public static native Info probeFile(String flacFile);
+
+    /***
+     * Reads the format of a flac asset from its metadata without decoding it
+     * @param assetManager
+     * @param flacFile
+     * @return the format, check Info.error
+     */
+    public static native Info probeAsset(AssetManager assetManager, String flacFile);
+
+    /***
+     * Reads the format of flac data in memory without decoding it
+     * @param flac the compressed audio
+     * @return the format, check Info.error
+     */
+    public static Info probeMemory(byte[] flac) {
+        return probeMemoryWithOffset(flac, null, 0, flac.length);
+    }
+
+    /***
+     * Reads the format of flac data in memory without decoding it
+     * @param flac the compressed audio from its position to its limit
+     * @return the format, check Info.error
+     */
+    public static Info probeMemory(ByteBuffer flac) {
+        if (!flac.isDirect()) {
+            return probeMemoryWithOffset(flac.array(), null,
+                    flac.arrayOffset() + flac.position(), flac.remaining());
+        }
+        return probeMemoryWithOffset(null, flac, flac.position(), flac.remaining());
+    }
+
+    /***
+     * Probes all .flac files of a directory in parallel
+     * @param dir directory, subdirectories aren't probed
+     * @param maxConcurrency maximum number of threads, 0 uses all cores
+     * @return the formats sorted by path or null if the directory can't be read
+     */
+    public static native Info[] probeDirectory(String dir, int maxConcurrency);
+
+    /***
+     * Size of the decoded audio of a flac file in bytes, to allocate the buffer
+     * for uncompressFile2Buffer
+     * @param flacFile source flac filename
+     * @return the size in bytes or -1 if it's unknown, for example for mp3 files
+     */
+    public static native long decodedSizeOfFile(String flacFile);
+
+    /***
+     * Size of the decoded audio of a flac asset in bytes
+     * @param assetManager
+     * @param flacFile
+     * @return the size in bytes or -1 if it's unknown
+     */
+    public static native long decodedSizeOfAsset(AssetManager assetManager, String flacFile);
+
+    /***
+     * Size of the decoded audio of a flac file in the format of the options
+     * @param flacFile source flac filename
+     * @param options sampleFormat, downmixToMono, resampleToHz and the time range
+     *                of the conversion
+     * @return the size in bytes of all channels or -1 if it's unknown
+     */
+    public static long decodedSizeOfFile(String flacFile, Options options) {
+        return decodedSize(probeFile(flacFile), options);
+    }
+
+    /***
+     * Size of the decoded audio of a probed flac file, asset or memory in the format
+     * of the options
+     * @param info result of one of the probe functions
+     * @param options sampleFormat, downmixToMono, resampleToHz and the time range
+     *                of the conversion
+     * @return the size in bytes of all channels or -1 if it's unknown
+     */
+    public static long decodedSize(Info info, Options options) {
+        if (info == null || info.error != 0 || info.totalSamples == 0) return -1;
+        int channels = options.downmixToMono ? 1 : info.channels;
+        long first = options.startMs * info.sampleRate / 1000;
+        long end = info.totalSamples;
+        if (options.endMs >= 0) end = Math.min(end, options.endMs * info.sampleRate / 1000);
+        if (first < 0 || end <= first) return 0;
+        long frames = end - first;
+        if (options.resampleToHz > 0 && options.resampleToHz != info.sampleRate) {
+            frames = (frames * options.resampleToHz + info.sampleRate - 1) / info.sampleRate;
+        }
+        return frames * channels * bytesPerSample(options.sampleFormat);
+    }
+
+    /***
+     * Uncompresses an audio file into memory, without the detour over a raw file.
+     * The audio is decoded straight into the buffer. Afterwards the buffer is
+     * little endian and its limit is set to the end of the audio.
+     * @param flacFile source flac filename
+     * @param buffer direct ByteBuffer, at least decodedSizeOfFile() bytes
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number, ENOBUFS (105) if the
+     * buffer is too small
+     */
+    public int uncompressFile2Buffer(String flacFile, ByteBuffer buffer, Options options) {
+        buffer.order(ByteOrder.LITTLE_ENDIAN);
+        return setLimit(buffer, 1,
+                uncompressFile2BufferWithOptions(flacFile, buffer, 1, options));
+    }
+
+    /***
+     * Uncompresses an audio file into a direct ShortBuffer, see above
+     * @param flacFile source flac filename
+     * @param buffer direct ShortBuffer in native byte order
+     * @param options backend of the conversion, sampleFormat has to be FORMAT_PCM16
+     * @return returns zero on success or the error number
+     */
+    public int uncompressFile2Buffer(String flacFile, ShortBuffer buffer, Options options) {
+        if (options != null && options.sampleFormat != FORMAT_PCM16) return EINVAL;
+        return setLimit(buffer, 2,
+                uncompressFile2BufferWithOptions(flacFile, buffer, 2, options));
+    }
+
+    /***
+     * Uncompresses an audio file into a direct FloatBuffer, see above
+     * @param flacFile source flac filename
+     * @param buffer direct FloatBuffer in native byte order
+     * @param options backend of the conversion, sampleFormat has to be FORMAT_FLOAT32
+     * @return returns zero on success or the error number, EINVAL (22) for another format
+     */
+    public int uncompressFile2Buffer(String flacFile, FloatBuffer buffer, Options options) {
+        if (options == null || options.sampleFormat != FORMAT_FLOAT32) return EINVAL;
+        return setLimit(buffer, 4,
+                uncompressFile2BufferWithOptions(flacFile, buffer, 4, options));
+    }
+
+    /***
+     * Uncompresses an audio file into one raw file per channel
+     * @param flacFile source flac filename
+     * @param rawFiles destination filenames, one for each channel of the output
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number, EINVAL (22) if the
+     * number of files doesn't match the channels
+     */
+    public int uncompressFile2PlanarFiles(String flacFile, String[] rawFiles, Options options) {
+        return uncompressFile2PlanarFilesWithOptions(flacFile, rawFiles, options);
+    }
+
+    /***
+     * Uncompresses an audio file into one direct ByteBuffer per channel. Afterwards
+     * the buffers are little endian and their limits are set to the end of the audio.
+     * @param flacFile source flac filename
+     * @param buffers direct ByteBuffers, one for each channel of the output
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressFile2PlanarBuffers(String flacFile, ByteBuffer[] buffers,
+                                            Options options) {
+        for (ByteBuffer buffer : buffers) buffer.order(ByteOrder.LITTLE_ENDIAN);
+        long result = uncompressFile2PlanarBuffersWithOptions(flacFile, buffers, options);
+        for (ByteBuffer buffer : buffers) {
+            int r = setLimit(buffer, 1, result);
+            if (r != 0) return r;
+        }
+        return 0;
+    }
+
+    /***
+     * Uncompresses an Android asset into a direct ByteBuffer, see uncompressFile2Buffer
+     * @param assetManager
+     * @param flacFile
+     * @param buffer direct ByteBuffer, at least decodedSizeOfAsset() bytes
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressAsset2Buffer(AssetManager assetManager,
+                                      String flacFile,
+                                      ByteBuffer buffer,
+                                      Options options) {
+        buffer.order(ByteOrder.LITTLE_ENDIAN);
+        return setLimit(buffer, 1,
+                uncompressAsset2BufferWithOptions(assetManager, flacFile, buffer, 1, options));
+    }
+
+    /***
+     * Uncompresses an Android asset into a direct ShortBuffer, see uncompressFile2Buffer
+     * @param assetManager
+     * @param flacFile
+     * @param buffer direct ShortBuffer in native byte order
+     * @param options backend of the conversion, sampleFormat has to be FORMAT_PCM16
+     * @return returns zero on success or the error number
+     */
+    public int uncompressAsset2Buffer(AssetManager assetManager,
+                                      String flacFile,
+                                      ShortBuffer buffer,
+                                      Options options) {
+        if (options != null && options.sampleFormat != FORMAT_PCM16) return EINVAL;
+        return setLimit(buffer, 2,
+                uncompressAsset2BufferWithOptions(assetManager, flacFile, buffer, 2, options));
+    }
+
+    /***
+     * Uncompresses flac data which is already in memory, for example received over
+     * IPC, to a raw file. No temporary flac file is needed.
+     * @param flac the compressed audio
+     * @param rawFile destination raw filename
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressMemory2File(byte[] flac, String rawFile, Options options) {
+        return uncompressMemory2FileWithOptions(flac, null, 0, flac.length, rawFile, options);
+    }
+
+    /***
+     * Uncompresses flac data in a ByteBuffer to a raw file, see above
+     * @param flac the compressed audio from its position to its limit
+     * @param rawFile destination raw filename
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressMemory2File(ByteBuffer flac, String rawFile, Options options) {
+        if (!flac.isDirect()) {
+            return uncompressMemory2FileWithOptions(flac.array(), null,
+                    flac.arrayOffset() + flac.position(), flac.remaining(), rawFile, options);
+        }
+        return uncompressMemory2FileWithOptions(null, flac, flac.position(), flac.remaining(),
+                rawFile, options);
+    }
+
+    /***
+     * Uncompresses flac data in memory into a direct ByteBuffer, see uncompressFile2Buffer
+     * @param flac the compressed audio
+     * @param buffer direct ByteBuffer, at least decodedSize(probeMemory(flac), options) bytes
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressMemory2Buffer(byte[] flac, ByteBuffer buffer, Options options) {
+        buffer.order(ByteOrder.LITTLE_ENDIAN);
+        return setLimit(buffer, 1, uncompressMemory2BufferWithOptions(flac, null, 0,
+                flac.length, buffer, 1, options));
+    }
+
+    /***
+     * Uncompresses flac data in a ByteBuffer into a direct ByteBuffer, see above
+     * @param flac the compressed audio from its position to its limit
+     * @param buffer direct ByteBuffer, at least decodedSize(probeMemory(flac), options) bytes
+     * @param options backend and format of the conversion
+     * @return returns zero on success or the error number
+     */
+    public int uncompressMemory2Buffer(ByteBuffer flac, ByteBuffer buffer, Options options) {
+        buffer.order(ByteOrder.LITTLE_ENDIAN);
+        if (!flac.isDirect()) {
+            return setLimit(buffer, 1, uncompressMemory2BufferWithOptions(flac.array(), null,
+                    flac.arrayOffset() + flac.position(), flac.remaining(), buffer, 1, options));
+        }
+        return setLimit(buffer, 1, uncompressMemory2BufferWithOptions(null, flac,
+                flac.position(), flac.remaining(), buffer, 1, options));
+    }
+
+    // errno for options which don't fit the buffer
+    private static final int EINVAL = 22;
+
+    // the native calls return the decoded bytes or the negative error number
+    private static int setLimit(Buffer buffer, int elementSize, long result) {
+        if (result < 0) return (int) -result;
+        buffer.position(0);
+        buffer.limit((int) (result / elementSize));
+        return 0;
+    }
+
+    private native long uncompressFile2BufferWithOptions(String flacFile,
+                                                         Buffer buffer,
+                                                         int elementSize,
+                                                         Options options);
+
+    private native long uncompressAsset2BufferWithOptions(AssetManager assetManager,
+                                                          String flacFile,
+                                                          Buffer buffer,
+                                                          int elementSize,
+                                                          Options options);
+
+    private native int uncompressFile2PlanarFilesWithOptions(String flacFile,
+                                                             String[] rawFiles,
+                                                             Options options);
+
+    private native long uncompressFile2PlanarBuffersWithOptions(String flacFile,
+                                                                ByteBuffer[] buffers,
+                                                                Options options);
+
+    // the compressed audio is either in the array or in the direct buffer
+    private native int uncompressMemory2FileWithOptions(byte[] array,
+                                                        ByteBuffer flac,
+                                                        int offset,
+                                                        int length,
+                                                        String rawFile,
+                                                        Options options);
+
+    private native long uncompressMemory2BufferWithOptions(byte[] array,
+                                                           ByteBuffer flac,
+                                                           int offset,
+                                                           int length,
+                                                           Buffer buffer,
+                                                           int elementSize,
+                                                           Options options);
+
+    private static native Info probeMemoryWithOffset(byte[] array, ByteBuffer flac,
+                                                     int offset, int length);
+
+    private native int uncompressFile2FileWithOptions(String flacFile,
+                                                      String rawFile,
+                                                      Options options);
+
+    private native int uncompressAsset2FileWithOptions(AssetManager assetManager,
+                                                       String flacFile,
+                                                       String rawFile,
+                                                       Options options);
+
+    private native int[] uncompressFiles2FilesWithOptions(String[] flacFiles,
+                                                          String[] rawFiles,
+                                                          Options options,
+                                                          int maxConcurrency);
+
+    private native void fillWriterStats(WriterStats stats);
+
+    private native void startFile2FileAsync(String flacFile, String rawFile, Options options,
+                                            Conversion conversion, ProgressListener listener);
+
+    private native void startAsset2FileAsync(AssetManager assetManager, String flacFile,
+                                             String rawFile, Options options,
+                                             Conversion conversion, ProgressListener listener);
+
+    private native long openStreamFile(String flacFile, Options options);
+
+    private native long openStreamAsset(AssetManager assetManager, String flacFile,
+                                        Options options);
+
+    private native long openStreamFd(int fd, long offset, long length, Options options);
+
+    private static native long nativeCreate(int maxPlayers);
+
+    private static native void nativeRelease(long handle);
 }
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the native decoder. It decodes the bundled asset and checks it
+ * against its STREAMINFO MD5 and round trips generated streams of various formats.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "batch-runner.h"
+#include "probe.h"
+#include "decoder-backend.h"
+#include "flac-decoder.h"
+#include "flac-test-encoder.h"
+#include "seek-index.h"
+#include "test-util.h"
+
+static int decodeFile(const char *path, MemoryPcmSink &sink, bool verifyMd5,
+                      int numThreads = 1) {
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = path;
+    ConvOptions opts;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    opts.verifyMd5 = verifyMd5;
+    opts.numThreads = numThreads;
+    NativeFlacBackend native;
+    return native.decode(src, sink, opts);
+}
+
+static void testAsset() {
+    MemoryPcmSink sink;
+    CHECK(decodeFile(FLAC2RAW_TEST_ASSET, sink, true) == 0);
+    CHECK(sink.format.sampleRate == 48000);
+    CHECK(sink.format.channels == 1);
+    CHECK(sink.format.totalFrames > 0);
+    CHECK(sink.data.size() == sink.format.totalFrames * 2);
+}
+
+static void testRoundTrip(const TestStreamParams &params, uint64_t frames) {
+    std::vector<int32_t> signal = makeTestSignal(frames, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    const char *path = "roundtrip-test.flac";
+    CHECK(writeTestFile(path, flac) == 0);
+    MemoryPcmSink sink;
+    CHECK(decodeFile(path, sink, true) == 0);
+    CHECK(sink.format.channels == params.channels);
+    CHECK(sink.data.size() == signal.size() * 2);
+    if (sink.data.size() != signal.size() * 2) return;
+    const int16_t *pcm = (const int16_t *) &sink.data[0];
+    size_t mismatches = 0;
+    for (size_t i = 0; i < signal.size(); i++) {
+        int32_t expected = signal[i];
+        if (params.bitsPerSample > 16) expected >>= params.bitsPerSample - 16;
+        if (params.bitsPerSample < 16) expected *= 1 << (16 - params.bitsPerSample);
+        if (pcm[i] != (int16_t) expected) mismatches++;
+    }
+    if (mismatches) {
+        fprintf(stderr, "%zu mismatches for %u channels, %u bits, block size %u\n",
+                mismatches, params.channels, params.bitsPerSample, params.blockSize);
+    }
+    CHECK(mismatches == 0);
+    remove(path);
+}
+
+static void testParallel(unsigned seekInterval) {
+    TestStreamParams params;
+    params.channels = 2;
+    params.blockSize = 1152;
+    params.seekInterval = seekInterval;
+    std::vector<int32_t> signal = makeTestSignal(10 * 48000 + 7, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    const char *path = "parallel-test.flac";
+    CHECK(writeTestFile(path, flac) == 0);
+    MemoryPcmSink sequential;
+    CHECK(decodeFile(path, sequential, true) == 0);
+    for (int threads = 2; threads <= 8; threads *= 2) {
+        RandomAccessPcmSink parallel;
+        CHECK(decodeFile(path, parallel, false, threads) == 0);
+        CHECK(parallel.data == sequential.data);
+    }
+    remove(path);
+}
+
+static int decodeRange(const char *path, MemoryPcmSink &sink, int64_t startMs, int64_t endMs,
+                       const char *indexDir = NULL) {
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = path;
+    ConvOptions opts;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    opts.startMs = startMs;
+    opts.endMs = endMs;
+    if (indexDir) opts.seekIndexDir = indexDir;
+    NativeFlacBackend native;
+    return native.decode(src, sink, opts);
+}
+
+/* Checks that ranges are the same as the slices of the whole decode */
+static void checkRanges(const char *path, const MemoryPcmSink &whole, const char *indexDir) {
+    static const int64_t ranges[][2] = {
+            {0, 500}, {1234, 3456}, {12345, 12346}, {29000, -1}, {15000, 100000}, {7, -1}
+    };
+    const size_t frameBytes = whole.format.channels * sizeof(int16_t);
+    const uint64_t total = whole.data.size() / frameBytes;
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        MemoryPcmSink sink;
+        CHECK(decodeRange(path, sink, ranges[i][0], ranges[i][1], indexDir) == 0);
+        const uint64_t first = ranges[i][0] * 48;
+        const uint64_t end = ranges[i][1] < 0 ? total : std::min(total, (uint64_t) ranges[i][1] * 48);
+        CHECK(sink.format.totalFrames == end - first);
+        CHECK(sink.data.size() == (end - first) * frameBytes);
+        if (sink.data.size() != (end - first) * frameBytes) continue;
+        CHECK(std::equal(sink.data.begin(), sink.data.end(),
+                         whole.data.begin() + first * frameBytes));
+    }
+    MemoryPcmSink empty;
+    CHECK(decodeRange(path, empty, 40000, -1, indexDir) == EINVAL);
+    CHECK(decodeRange(path, empty, 2000, 1000, indexDir) == EINVAL);
+}
+
+static void testRange(unsigned seekInterval) {
+    TestStreamParams params;
+    params.channels = 2;
+    params.blockSize = 1152;
+    params.seekInterval = seekInterval;
+    std::vector<int32_t> signal = makeTestSignal(30 * 48000 + 11, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    const char *path = "range-test.flac";
+    CHECK(writeTestFile(path, flac) == 0);
+    MemoryPcmSink whole;
+    CHECK(decodeFile(path, whole, true) == 0);
+    /* bisection or the SEEKTABLE */
+    checkRanges(path, whole, NULL);
+    if (seekInterval) {
+        remove(path);
+        return;
+    }
+    /* the first range builds the index, the others load it */
+    const char *dir = "range-test-index";
+    FlacDecoder dec;
+    CHECK(dec.open(&flac[0], flac.size()) == 0);
+    const std::string indexPath = seekIndexPath(dir, dec);
+    remove(indexPath.c_str());
+    checkRanges(path, whole, dir);
+    std::vector<FlacSeekPoint> built, loaded;
+    CHECK(buildSeekIndex(dec, built) == 0);
+    CHECK(loadSeekIndex(dir, dec, loaded) == 0);
+    CHECK(built.size() == loaded.size() && built.size() >= 200);
+    for (size_t i = 0; i < built.size() && i < loaded.size(); i++) {
+        CHECK(built[i].sampleNumber == loaded[i].sampleNumber);
+        CHECK(built[i].streamOffset == loaded[i].streamOffset);
+    }
+    /* a damaged index only costs the bisection */
+    std::vector<uint8_t> garbage(100, 0x5A);
+    CHECK(writeTestFile(indexPath.c_str(), garbage) == 0);
+    CHECK(loadSeekIndex(dir, dec, loaded) == EILSEQ);
+    checkRanges(path, whole, NULL);
+    remove(indexPath.c_str());
+    rmdir(dir);
+    remove(path);
+}
+
+/* Decoding from memory gives the same as from the file */
+static void testMemory() {
+    TestStreamParams params;
+    params.channels = 2;
+    std::vector<int32_t> signal = makeTestSignal(50000, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    const char *path = "memory-test.flac";
+    CHECK(writeTestFile(path, flac) == 0);
+    MemoryPcmSink fromFile;
+    CHECK(decodeFile(path, fromFile, true) == 0);
+    remove(path);
+    DecodeSource src;
+    src.type = DecodeSource::MEMORY;
+    src.data = &flac[0];
+    src.size = flac.size();
+    ConvOptions opts;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    opts.verifyMd5 = true;
+    NativeFlacBackend native;
+    MemoryPcmSink fromMemory;
+    CHECK(native.decode(src, fromMemory, opts) == 0);
+    CHECK(fromMemory.data == fromFile.data);
+    src.size = 0;
+    CHECK(native.decode(src, fromMemory, opts) == EILSEQ);
+}
+
+static void testCorruption() {
+    TestStreamParams params;
+    params.channels = 2;
+    std::vector<int32_t> signal = makeTestSignal(20000, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    flac[flac.size() / 2] ^= 0x10;
+    const char *path = "corrupt-test.flac";
+    CHECK(writeTestFile(path, flac) == 0);
+    MemoryPcmSink sink;
+    CHECK(decodeFile(path, sink, false) == EILSEQ);
+    remove(path);
+    MemoryPcmSink missing;
+    CHECK(decodeFile("does-not-exist.flac", missing, false) == ENOENT);
+
+    /* single bit errors in the audio of a real file are caught by the CRC even
+     * if the predictors overflow before it is checked */
+    std::vector<uint8_t> asset;
+    FILE *f = fopen(FLAC2RAW_TEST_ASSET, "rb");
+    CHECK(f != NULL);
+    if (NULL == f) return;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) asset.insert(asset.end(), buf, buf + n);
+    fclose(f);
+    uint32_t lcg = 1;
+    for (int i = 0; i < 40; i++) {
+        lcg = lcg * 1664525u + 1013904223u;
+        std::vector<uint8_t> flipped = asset;
+        flipped[asset.size() / 2 + (lcg >> 8) % (asset.size() / 2)] ^= (uint8_t) (1u << (lcg & 7));
+        DecodeSource src;
+        src.type = DecodeSource::MEMORY;
+        src.data = &flipped[0];
+        src.size = flipped.size();
+        ConvOptions opts;
+        opts.backend = FLAC2RAW_BACKEND_NATIVE;
+        MemoryPcmSink out;
+        NativeFlacBackend native;
+        CHECK(native.decode(src, out, opts) == EILSEQ);
+    }
+}
+
+static void testBatch() {
+    TestStreamParams params;
+    std::vector<BatchJob> jobs;
+    for (int i = 0; i < 6; i++) {
+        std::vector<int32_t> signal = makeTestSignal((i + 1) * 10000, params, i + 1);
+        BatchJob job;
+        job.src = "batch-test-" + std::to_string(i) + ".flac";
+        job.dst = "batch-test-" + std::to_string(i) + ".raw";
+        CHECK(writeTestFile(job.src.c_str(), encodeTestFlac(signal, params)) == 0);
+        jobs.push_back(job);
+    }
+    BatchJob missing;
+    missing.src = "does-not-exist.flac";
+    missing.dst = "batch-test-missing.raw";
+    jobs.push_back(missing);
+
+    std::mutex lock;
+    int running = 0;
+    int maxRunning = 0;
+    runBatch(jobs, 3, [&](BatchJob &job) {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            maxRunning = std::max(maxRunning, ++running);
+        }
+        DecodeSource src;
+        src.path = job.src.c_str();
+        ConvOptions opts;
+        opts.backend = FLAC2RAW_BACKEND_NATIVE;
+        FilePcmSink sink;
+        int r = sink.open(job.dst.c_str());
+        if (!r) r = NativeFlacBackend().decode(src, sink, opts);
+        std::lock_guard<std::mutex> l(lock);
+        running--;
+        return r;
+    });
+    CHECK(maxRunning <= 3);
+    for (size_t i = 0; i + 1 < jobs.size(); i++) {
+        CHECK(jobs[i].result == 0);
+        FILE *f = fopen(jobs[i].dst.c_str(), "r");
+        CHECK(f != NULL);
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            CHECK(ftell(f) == (long) (i + 1) * 10000 * 2);
+            fclose(f);
+        }
+        remove(jobs[i].src.c_str());
+        remove(jobs[i].dst.c_str());
+    }
+    CHECK(jobs.back().result == ENOENT);
+    remove(jobs.back().dst.c_str());
+}
+
+static void testProbe() {
+    TestStreamParams params;
+    params.channels = 2;
+    params.bitsPerSample = 24;
+    params.seekInterval = 48000;
+    std::vector<int32_t> signal = makeTestSignal(3 * 48000 + 5, params);
+    std::vector<uint8_t> flac = encodeTestFlac(signal, params);
+    mkdir("probe-test", 0755);
+    CHECK(writeTestFile("probe-test/b.flac", flac) == 0);
+    /* a padding block in front which doesn't fit into the first read */
+    const size_t padding = 100 * 1000;
+    std::vector<uint8_t> padded(flac.size() + 4 + padding, 0);
+    memcpy(&padded[0], &flac[0], 4);
+    padded[4] = 1;
+    padded[5] = (uint8_t) (padding >> 16);
+    padded[6] = (uint8_t) (padding >> 8);
+    padded[7] = (uint8_t) padding;
+    memcpy(&padded[8 + padding], &flac[4], flac.size() - 4);
+    CHECK(writeTestFile("probe-test/a.FLAC", padded) == 0);
+    CHECK(writeTestFile("probe-test/c.flac", std::vector<uint8_t>(10, 0)) == 0);
+    CHECK(writeTestFile("probe-test/notes.txt", flac) == 0);
+
+    std::vector<ProbeResult> results;
+    CHECK(probeDirectory("probe-test", 2, results) == 0);
+    CHECK(results.size() == 3);
+    if (results.size() == 3) {
+        CHECK(results[0].path == "probe-test/a.FLAC");
+        CHECK(results[2].error == EILSEQ);
+        for (int i = 0; i < 2; i++) {
+            CHECK(results[i].error == 0);
+            CHECK(results[i].info.sampleRate == 48000);
+            CHECK(results[i].info.channels == 2);
+            CHECK(results[i].info.bitsPerSample == 24);
+            CHECK(results[i].info.totalSamples == 3 * 48000 + 5);
+            CHECK(results[i].durationMs == 3000);
+            CHECK(results[i].seekPoints == 4);
+        }
+    }
+    CHECK(probeDirectory("does-not-exist", 2, results) == ENOENT);
+
+    /* the same without a file */
+    DecodeSource mem;
+    mem.type = DecodeSource::MEMORY;
+    mem.data = &padded[0];
+    mem.size = padded.size();
+    ProbeResult memResult;
+    probeSource(mem, memResult);
+    CHECK(memResult.error == 0 && memResult.info.totalSamples == 3 * 48000 + 5);
+    CHECK(memResult.seekPoints == 4);
+    remove("probe-test/a.FLAC");
+    remove("probe-test/b.flac");
+    remove("probe-test/c.flac");
+    remove("probe-test/notes.txt");
+    rmdir("probe-test");
+}
+
+int main() {
+    testAsset();
+    static const unsigned formats[][3] = {
+            // channels, bits, block size
+            {1, 16, 4096},
+            {2, 16, 4096},
+            {2, 16, 1152},
+            {2, 24, 4608},
+            {1, 8, 192},
+            {6, 16, 1000},
+            {2, 12, 256},
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        TestStreamParams params;
+        params.channels = formats[i][0];
+        params.bitsPerSample = formats[i][1];
+        params.blockSize = formats[i][2];
+        testRoundTrip(params, 48000 + 123);
+    }
+    testParallel(0);
+    testParallel(48000);
+    testRange(0);
+    testRange(48000);
+    testMemory();
+    testCorruption();
+    testBatch();
+    testProbe();
+    return testResult();
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "flac-test-encoder.h"
+#include "flac-decoder.h"
+#include "md5.h"
+
+//-----------------------------------------------------------------
+class BitWriter {
+public:
+    std::vector<uint8_t> out;
+
+    BitWriter() : acc(0), nbits(0) {}
+
+    void write(uint32_t v, unsigned n) {
+        for (unsigned i = n; i > 0; i--) {
+            acc = (acc << 1) | ((v >> (i - 1)) & 1);
+            if (++nbits == 8) {
+                out.push_back((uint8_t) acc);
+                acc = 0;
+                nbits = 0;
+            }
+        }
+    }
+
+    void writeSigned(int32_t v, unsigned n) {
+        write((uint32_t) v & (n == 32 ? 0xFFFFFFFFu : ((1u << n) - 1)), n);
+    }
+
+    void writeUnary(uint32_t q) {
+        for (uint32_t i = 0; i < q; i++) write(0, 1);
+        write(1, 1);
+    }
+
+    void align() {
+        while (nbits) write(0, 1);
+    }
+
+private:
+    uint32_t acc;
+    unsigned nbits;
+};
+
+static void put24(std::vector<uint8_t> &v, uint32_t x) {
+    v.push_back((uint8_t) (x >> 16));
+    v.push_back((uint8_t) (x >> 8));
+    v.push_back((uint8_t) x);
+}
+
+static void put64(uint8_t *p, uint64_t x) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t) x;
+        x >>= 8;
+    }
+}
+
+//-----------------------------------------------------------------
+static uint64_t riceBits(const int32_t *res, unsigned n, unsigned param) {
+    uint64_t bits = 0;
+    for (unsigned i = 0; i < n; i++) {
+        const uint32_t u = ((uint32_t) res[i] << 1) ^ (uint32_t) (res[i] >> 31);
+        bits += (u >> param) + 1 + param;
+    }
+    return bits;
+}
+
+static void writeResidual(BitWriter &bw, const int32_t *res, unsigned blockSize,
+                          unsigned order) {
+    /* method 0 with partition order 2 if possible, escape coded partitions for noise */
+    unsigned partOrder = 0;
+    while (partOrder < 2 && (blockSize >> (partOrder + 1)) >= order &&
+           ((blockSize >> (partOrder + 1)) << (partOrder + 1)) == blockSize) {
+        partOrder++;
+    }
+    bw.write(0, 2);
+    bw.write(partOrder, 4);
+    const unsigned psize = blockSize >> partOrder;
+    unsigned i = 0;
+    for (unsigned p = 0; p < (1u << partOrder); p++) {
+        const unsigned n = p == 0 ? psize - order : psize;
+        const int32_t *r = res + i;
+        unsigned best = 0;
+        uint64_t bestBits = riceBits(r, n, 0);
+        for (unsigned k = 1; k < 15; k++) {
+            const uint64_t b = riceBits(r, n, k);
+            if (b < bestBits) {
+                best = k;
+                bestBits = b;
+            }
+        }
+        int32_t maxAbs = 0;
+        for (unsigned j = 0; j < n; j++) {
+            const int32_t a = r[j] < 0 ? -r[j] : r[j];
+            if (a > maxAbs) maxAbs = a;
+        }
+        unsigned rawBits = 1;
+        while (rawBits < 31 && (1 << (rawBits - 1)) <= maxAbs) rawBits++;
+        if ((uint64_t) rawBits * n + 5 < bestBits) {
+            bw.write(15, 4);
+            bw.write(rawBits, 5);
+            for (unsigned j = 0; j < n; j++) bw.writeSigned(r[j], rawBits);
+        } else {
+            bw.write(best, 4);
+            for (unsigned j = 0; j < n; j++) {
+                const uint32_t u = ((uint32_t) r[j] << 1) ^ (uint32_t) (r[j] >> 31);
+                bw.writeUnary(u >> best);
+                bw.write(u & ((1u << best) - 1), best);
+            }
+        }
+        i += n;
+    }
+}
+
+static void writeSubframe(BitWriter &bw, const int32_t *x, unsigned n, unsigned bps,
+                          bool verbatim) {
+    /* wasted bits */
+    uint32_t ored = 0;
+    for (unsigned i = 0; i < n; i++) ored |= (uint32_t) x[i];
+    unsigned wasted = 0;
+    if (ored) {
+        while (!(ored & 1) && wasted < bps - 1) {
+            ored >>= 1;
+            wasted++;
+        }
+    }
+    std::vector<int32_t> s(x, x + n);
+    for (unsigned i = 0; i < n; i++) s[i] >>= wasted;
+    const unsigned sbps = bps - wasted;
+    bool constant = true;
+    for (unsigned i = 1; i < n && constant; i++) constant = s[i] == s[0];
+
+    bw.write(0, 1);
+    if (constant) {
+        bw.write(0, 6);
+        bw.write(0, 1);
+        bw.writeSigned(x[0], bps);
+        return;
+    }
+    unsigned type;
+    unsigned order = 0;
+    std::vector<int32_t> res(n);
+    if (verbatim) {
+        type = 1;
+    } else {
+        /* pick the fixed predictor with the smallest residual */
+        uint64_t bestSum = ~0ULL;
+        for (unsigned o = 0; o <= 4 && o < n; o++) {
+            uint64_t sum = 0;
+            for (unsigned i = o; i < n; i++) {
+                int64_t p = 0;
+                switch (o) {
+                    case 1: p = s[i - 1]; break;
+                    case 2: p = 2 * (int64_t) s[i - 1] - s[i - 2]; break;
+                    case 3: p = 3 * ((int64_t) s[i - 1] - s[i - 2]) + s[i - 3]; break;
+                    case 4: p = 4 * ((int64_t) s[i - 1] + s[i - 3]) - 6 * (int64_t) s[i - 2] -
+                                s[i - 4]; break;
+                    default: break;
+                }
+                const int64_t r = s[i] - p;
+                sum += (uint64_t) (r < 0 ? -r : r);
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                order = o;
+            }
+        }
+        for (unsigned i = order; i < n; i++) {
+            int64_t p = 0;
+            switch (order) {
+                case 1: p = s[i - 1]; break;
+                case 2: p = 2 * (int64_t) s[i - 1] - s[i - 2]; break;
+                case 3: p = 3 * ((int64_t) s[i - 1] - s[i - 2]) + s[i - 3]; break;
+                case 4: p = 4 * ((int64_t) s[i - 1] + s[i - 3]) - 6 * (int64_t) s[i - 2] -
+                            s[i - 4]; break;
+                default: break;
+            }
+            res[i - order] = (int32_t) (s[i] - p);
+        }
+        type = 8 + order;
+    }
+    bw.write(type, 6);
+    if (wasted) {
+        bw.write(1, 1);
+        bw.writeUnary(wasted - 1);
+    } else {
+        bw.write(0, 1);
+    }
+    if (verbatim) {
+        for (unsigned i = 0; i < n; i++) bw.writeSigned(s[i], sbps);
+        return;
+    }
+    for (unsigned i = 0; i < order; i++) bw.writeSigned(s[i], sbps);
+    writeResidual(bw, &res[0], n, order);
+}
+
+static void writeUtf8(std::vector<uint8_t> &v, uint64_t x) {
+    if (x < 0x80) {
+        v.push_back((uint8_t) x);
+        return;
+    }
+    unsigned extra = 1;
+    while (extra < 6 && x >= (1ULL << (6 * extra + 6 - extra))) extra++;
+    v.push_back((uint8_t) ((0xFF00 >> (extra + 1)) | (x >> (6 * extra))));
+    for (int i = (int) extra - 1; i >= 0; i--) {
+        v.push_back((uint8_t) (0x80 | ((x >> (6 * i)) & 0x3F)));
+    }
+}
+
+static void encodeFrame(std::vector<uint8_t> &out, const int32_t *interleaved, unsigned n,
+                        uint64_t frameNumber, const TestStreamParams &params) {
+    const unsigned nch = params.channels;
+    const unsigned bps = params.bitsPerSample;
+    std::vector<std::vector<int32_t> > ch(nch, std::vector<int32_t>(n));
+    for (unsigned i = 0; i < n; i++) {
+        for (unsigned c = 0; c < nch; c++) ch[c][i] = interleaved[(size_t) i * nch + c];
+    }
+    /* cycle through the stereo modes */
+    unsigned assignment = nch - 1;
+    if (nch == 2) {
+        static const unsigned modes[4] = {1, 8, 9, 10};
+        assignment = modes[frameNumber % 4];
+    }
+    std::vector<int32_t> a = nch > 0 ? ch[0] : std::vector<int32_t>();
+    std::vector<int32_t> b = nch > 1 ? ch[1] : std::vector<int32_t>();
+    unsigned bpsA = bps, bpsB = bps;
+    if (assignment == 8) {
+        for (unsigned i = 0; i < n; i++) b[i] = ch[0][i] - ch[1][i];
+        bpsB++;
+    } else if (assignment == 9) {
+        for (unsigned i = 0; i < n; i++) a[i] = ch[0][i] - ch[1][i];
+        bpsA++;
+    } else if (assignment == 10) {
+        for (unsigned i = 0; i < n; i++) {
+            a[i] = (ch[0][i] + ch[1][i]) >> 1;
+            b[i] = ch[0][i] - ch[1][i];
+        }
+        bpsB++;
+    }
+
+    const size_t start = out.size();
+    std::vector<uint8_t> hdr;
+    hdr.push_back(0xFF);
+    hdr.push_back(0xF8);
+    unsigned bsCode = 7;
+    for (unsigned c = 8; c < 16; c++) {
+        if (n == (256u << (c - 8))) bsCode = c;
+    }
+    hdr.push_back((uint8_t) (bsCode << 4));
+    unsigned ssCode = 0;
+    if (bps == 8) ssCode = 1;
+    if (bps == 12) ssCode = 2;
+    if (bps == 16) ssCode = 4;
+    if (bps == 20) ssCode = 5;
+    if (bps == 24) ssCode = 6;
+    hdr.push_back((uint8_t) (assignment << 4 | ssCode << 1));
+    writeUtf8(hdr, frameNumber);
+    if (bsCode == 7) {
+        hdr.push_back((uint8_t) ((n - 1) >> 8));
+        hdr.push_back((uint8_t) (n - 1));
+    }
+    hdr.push_back(flacCrc8(&hdr[0], hdr.size()));
+    out.insert(out.end(), hdr.begin(), hdr.end());
+
+    BitWriter bw;
+    const bool verbatim = (frameNumber % 7) == 3;
+    for (unsigned c = 0; c < nch; c++) {
+        if (c == 0) {
+            writeSubframe(bw, &a[0], n, bpsA, verbatim);
+        } else if (c == 1) {
+            writeSubframe(bw, &b[0], n, bpsB, verbatim);
+        } else {
+            writeSubframe(bw, &ch[c][0], n, bps, verbatim);
+        }
+    }
+    bw.align();
+    out.insert(out.end(), bw.out.begin(), bw.out.end());
+    const uint16_t crc = flacCrc16(&out[start], out.size() - start);
+    out.push_back((uint8_t) (crc >> 8));
+    out.push_back((uint8_t) crc);
+}
+
+//-----------------------------------------------------------------
+std::vector<uint8_t> encodeTestFlac(const std::vector<int32_t> &interleaved,
+                                    const TestStreamParams &params) {
+    const unsigned nch = params.channels;
+    const uint64_t total = interleaved.size() / nch;
+    std::vector<uint8_t> out;
+    out.push_back('f');
+    out.push_back('L');
+    out.push_back('a');
+    out.push_back('C');
+
+    /* MD5 of the source in the STREAMINFO layout */
+    const unsigned bytes = (params.bitsPerSample + 7) / 8;
+    Md5 md5;
+    for (size_t i = 0; i < interleaved.size(); i++) {
+        uint8_t b[4];
+        for (unsigned k = 0; k < bytes; k++) b[k] = (uint8_t) (interleaved[i] >> (8 * k));
+        md5.update(b, bytes);
+    }
+    uint8_t digest[16];
+    md5.final(digest);
+
+    std::vector<uint64_t> seekSamples;
+    if (params.seekInterval) {
+        for (uint64_t s = 0; s < total; s += params.seekInterval) {
+            /* seek points have to be at frame starts */
+            seekSamples.push_back(s - s % params.blockSize);
+        }
+    }
+    /* STREAMINFO */
+    out.push_back(seekSamples.empty() ? 0x80 : 0x00);
+    put24(out, 34);
+    const size_t siPos = out.size();
+    out.resize(out.size() + 34);
+    size_t stPos = 0;
+    if (!seekSamples.empty()) {
+        out.push_back(0x80 | 3);
+        put24(out, (uint32_t) (seekSamples.size() * 18));
+        stPos = out.size();
+        out.resize(out.size() + seekSamples.size() * 18);
+    }
+    const size_t audioStart = out.size();
+    unsigned minFrame = ~0u, maxFrame = 0;
+    std::vector<uint64_t> frameOffsets;
+    for (uint64_t s = 0, f = 0; s < total; s += params.blockSize, f++) {
+        const unsigned n = (unsigned) (total - s < params.blockSize ? total - s
+                                                                    : params.blockSize);
+        const size_t before = out.size();
+        frameOffsets.push_back(before - audioStart);
+        encodeFrame(out, &interleaved[(size_t) s * nch], n, f, params);
+        const unsigned len = (unsigned) (out.size() - before);
+        if (len < minFrame) minFrame = len;
+        if (len > maxFrame) maxFrame = len;
+    }
+    uint8_t *si = &out[siPos];
+    si[0] = (uint8_t) (params.blockSize >> 8);
+    si[1] = (uint8_t) params.blockSize;
+    si[2] = (uint8_t) (params.blockSize >> 8);
+    si[3] = (uint8_t) params.blockSize;
+    si[4] = (uint8_t) (minFrame >> 16);
+    si[5] = (uint8_t) (minFrame >> 8);
+    si[6] = (uint8_t) minFrame;
+    si[7] = (uint8_t) (maxFrame >> 16);
+    si[8] = (uint8_t) (maxFrame >> 8);
+    si[9] = (uint8_t) maxFrame;
+    si[10] = (uint8_t) (params.sampleRate >> 12);
+    si[11] = (uint8_t) (params.sampleRate >> 4);
+    si[12] = (uint8_t) ((params.sampleRate & 0x0F) << 4 | (nch - 1) << 1 |
+                        ((params.bitsPerSample - 1) >> 4));
+    si[13] = (uint8_t) (((params.bitsPerSample - 1) & 0x0F) << 4 | (total >> 32));
+    si[14] = (uint8_t) (total >> 24);
+    si[15] = (uint8_t) (total >> 16);
+    si[16] = (uint8_t) (total >> 8);
+    si[17] = (uint8_t) total;
+    memcpy(si + 18, digest, 16);
+    for (size_t i = 0; i < seekSamples.size(); i++) {
+        uint8_t *p = &out[stPos + i * 18];
+        const uint64_t frame = seekSamples[i] / params.blockSize;
+        put64(p, seekSamples[i]);
+        put64(p + 8, frameOffsets[frame]);
+        const uint64_t left = total - seekSamples[i];
+        const unsigned fs = (unsigned) (left < params.blockSize ? left : params.blockSize);
+        p[16] = (uint8_t) (fs >> 8);
+        p[17] = (uint8_t) fs;
+    }
+    return out;
+}
+
+std::vector<int32_t> makeTestSignal(uint64_t frames, const TestStreamParams &params,
+                                    unsigned seed) {
+    const unsigned nch = params.channels;
+    std::vector<int32_t> v((size_t) frames * nch);
+    const double full = (double) (1 << (params.bitsPerSample - 1));
+    uint32_t lcg = seed * 2654435761u + 1;
+    for (uint64_t i = 0; i < frames; i++) {
+        const uint64_t block = i / params.blockSize;
+        for (unsigned c = 0; c < nch; c++) {
+            int32_t x;
+            if (block % 7 == 4) {
+                /* silence gives constant subframes */
+                x = 0;
+            } else {
+                const double t = (double) i / params.sampleRate;
+                double y = 0.3 * sin(2 * M_PI * (220.0 + 110.0 * c) * t) +
+                           0.2 * sin(2 * M_PI * (1250.0 + 17.0 * c) * t);
+                lcg = lcg * 1664525u + 1013904223u;
+                y += 0.05 * ((double) (lcg >> 8) / (double) (1 << 24) - 0.5);
+                x = (int32_t) floor(y * full);
+                if (block % 5 == 2) {
+                    /* low bits cleared give wasted bits */
+                    x &= ~3;
+                }
+            }
+            v[(size_t) i * nch + c] = x;
+        }
+    }
+    return v;
+}
+
+int writeTestFile(const char *path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return errno;
+    const size_t w = fwrite(&data[0], 1, data.size(), f);
+    fclose(f);
+    return w == data.size() ? 0 : EIO;
+}
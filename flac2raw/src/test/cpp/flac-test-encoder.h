@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAC2RAW_FLAC_TEST_ENCODER_H
+#define FLAC2RAW_FLAC_TEST_ENCODER_H
+
+#include <stdint.h>
+#include <vector>
+
+/* Parameters of a generated test stream */
+typedef struct TestStreamParams_ {
+    unsigned sampleRate = 48000;
+    unsigned channels = 1;
+    unsigned bitsPerSample = 16;
+    unsigned blockSize = 4096;
+    /* write a SEEKTABLE with a point every seekInterval samples, 0 for none */
+    unsigned seekInterval = 0;
+} TestStreamParams;
+
+/* Minimal FLAC encoder for tests and benchmarks: fixed predictors, verbatim and
+ * constant subframes, all stereo decorrelation modes and wasted bits. */
+std::vector<uint8_t> encodeTestFlac(const std::vector<int32_t> &interleaved,
+                                    const TestStreamParams &params);
+
+/* Generates a deterministic test signal: a few sines plus noise */
+std::vector<int32_t> makeTestSignal(uint64_t frames, const TestStreamParams &params,
+                                    unsigned seed = 1);
+
+/* Writes data into a file, returns zero on success */
+int writeTestFile(const char *path, const std::vector<uint8_t> &data);
+
+#endif
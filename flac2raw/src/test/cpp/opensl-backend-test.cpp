@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the OpenSL ES backend against the OpenSL ES stub. Checks that
+ * one engine serves all conversions and that the player pool is bounded.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <vector>
+
+#include "async-conversion.h"
+#include "decoder-backend.h"
+#include "opensl-backend.h"
+#include "format-pcm-sink.h"
+#include "opensl-stub.h"
+#include "pcm-cache.h"
+#include "test-util.h"
+
+static DecodeSource assetSource() {
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = FLAC2RAW_TEST_ASSET;
+    return src;
+}
+
+/* the platform decoder hands out whole buffers so the output may be
+ * longer than the native one, but only by trailing silence */
+static bool samePcm(const MemoryPcmSink &reference, const MemoryPcmSink &sink) {
+    if (sink.data.size() < reference.data.size()) return false;
+    if (memcmp(&reference.data[0], &sink.data[0], reference.data.size())) return false;
+    for (size_t i = reference.data.size(); i < sink.data.size(); i++) {
+        if (sink.data[i]) return false;
+    }
+    return true;
+}
+
+static void testReuse(const MemoryPcmSink &reference) {
+    slStubResetStats();
+    {
+        OpenSLBackend backend(2);
+        ConvOptions opts;
+        for (int i = 0; i < 5; i++) {
+            MemoryPcmSink sink;
+            CHECK(backend.decode(assetSource(), sink, opts) == 0);
+            CHECK(samePcm(reference, sink));
+        }
+        CHECK(slStubStats().enginesCreated == 1);
+        CHECK(slStubStats().playersCreated == 5);
+        CHECK(slStubStats().playersAlive == 0);
+    }
+    CHECK(slStubStats().enginesAlive == 0);
+}
+
+static void testConcurrent(const MemoryPcmSink &reference) {
+    slStubResetStats();
+    OpenSLBackend backend(2);
+    const int nThreads = 6;
+    const int perThread = 3;
+    std::vector<int> errors(nThreads, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            ConvOptions opts;
+            for (int i = 0; i < perThread; i++) {
+                MemoryPcmSink sink;
+                if (backend.decode(assetSource(), sink, opts) != 0 ||
+                    !samePcm(reference, sink)) {
+                    errors[t]++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    for (int t = 0; t < nThreads; t++) CHECK(errors[t] == 0);
+    CHECK(slStubStats().enginesCreated == 1);
+    CHECK(slStubStats().playersCreated == nThreads * perThread);
+    CHECK(slStubStats().maxPlayersAlive <= 2);
+}
+
+/* counts the buffers delivered by the decoder */
+class CountingPcmSink : public MemoryPcmSink {
+public:
+    int write(const void *p, size_t nbytes) {
+        writes++;
+        return MemoryPcmSink::write(p, nbytes);
+    }
+
+    int writes = 0;
+};
+
+static void testBufferConfig(const MemoryPcmSink &reference) {
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    CountingPcmSink fixed;
+    CHECK(backend.decode(assetSource(), fixed, opts) == 0);
+    CHECK(samePcm(reference, fixed));
+
+    opts.numBuffers = 2;
+    opts.bufferSizeSamples = 10000;
+    CountingPcmSink large;
+    CHECK(backend.decode(assetSource(), large, opts) == 0);
+    CHECK(samePcm(reference, large));
+    CHECK(large.data.size() % 20000 == 0);
+
+    opts.numBuffers = 8;
+    opts.bufferSizeSamples = BUFFER_SIZE_ADAPTIVE;
+    CountingPcmSink adaptive;
+    CHECK(backend.decode(assetSource(), adaptive, opts) == 0);
+    CHECK(samePcm(reference, adaptive));
+    CHECK(adaptive.writes * 4 < fixed.writes);
+}
+
+static void testDirectBuffer(const MemoryPcmSink &reference) {
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    opts.bufferSizeSamples = 1000;
+    std::vector<uint8_t> mem(reference.data.size());
+    BufferPcmSink exact(&mem[0], mem.size());
+    CHECK(backend.decode(assetSource(), exact, opts) == 0);
+    CHECK(exact.size() == reference.data.size());
+    CHECK(mem == reference.data);
+
+    std::vector<uint8_t> small(reference.data.size() / 2);
+    BufferPcmSink tooSmall(&small[0], small.size());
+    CHECK(backend.decode(assetSource(), tooSmall, opts) == ENOBUFS);
+
+    NativeFlacBackend native;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        opts.numThreads = threads;
+        std::vector<uint8_t> out(reference.data.size() + 100);
+        BufferPcmSink sink(&out[0], out.size());
+        CHECK(native.decode(assetSource(), sink, opts) == 0);
+        CHECK(sink.size() == reference.data.size());
+        CHECK(memcmp(&out[0], &reference.data[0], reference.data.size()) == 0);
+    }
+}
+
+/* The backend tells the sink the format so that it can be converted */
+static void testFormat(const MemoryPcmSink &reference) {
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    MemoryPcmSink pcm;
+    CHECK(backend.decode(assetSource(), pcm, opts) == 0);
+    CHECK(pcm.format.channels == 1 && pcm.format.sampleRate == 48000);
+    CHECK(pcm.format.totalFrames * 2 == reference.data.size());
+
+    MemoryPcmSink floats;
+    FormatPcmSink format(floats, FLAC2RAW_FORMAT_FLOAT32, false);
+    CHECK(backend.decode(assetSource(), format, opts) == 0);
+    CHECK(floats.ended && floats.format.bitsPerSample == 32);
+    CHECK(floats.data.size() >= reference.data.size() * 2);
+    const int16_t *in = (const int16_t *) &reference.data[0];
+    const float *out = (const float *) &floats.data[0];
+    size_t mismatches = 0;
+    for (size_t i = 0; i < reference.data.size() / 2; i++) {
+        if (out[i] != in[i] / 32768.0f) mismatches++;
+    }
+    CHECK(mismatches == 0);
+}
+
+/* A time range comes out exactly, with and without a player which can seek */
+static void testRange(const MemoryPcmSink &reference) {
+    OpenSLBackend backend(1);
+    const uint64_t total = reference.data.size() / 2;
+    const uint64_t durationMs = total * 1000 / 48000;
+    const int64_t ranges[][2] = {
+            {0, 100}, {250, 750}, {(int64_t) durationMs / 2, -1}, {900, 5000}
+    };
+    for (int seek = 0; seek < 2; seek++) {
+        slStubSetSeekSupported(seek != 0);
+        for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+            ConvOptions opts;
+            opts.startMs = ranges[i][0];
+            opts.endMs = ranges[i][1];
+            MemoryPcmSink sink;
+            CHECK(backend.decode(assetSource(), sink, opts) == 0);
+            const uint64_t first = (uint64_t) ranges[i][0] * 48;
+            const uint64_t end = ranges[i][1] < 0 ? total :
+                                 std::min(total, (uint64_t) ranges[i][1] * 48);
+            CHECK(sink.format.totalFrames == end - first);
+            CHECK(sink.data.size() >= (end - first) * 2);
+            if (sink.data.size() < (end - first) * 2) continue;
+            /* only the last buffer of an open range may have trailing silence */
+            CHECK(end == total || sink.data.size() == (end - first) * 2);
+            CHECK(!memcmp(&sink.data[0], &reference.data[first * 2], (end - first) * 2));
+        }
+    }
+    slStubSetSeekSupported(true);
+}
+
+/* Every buffer is counted and timed without changing the output */
+static void testStats(const MemoryPcmSink &reference) {
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    opts.bufferSizeSamples = 1000;
+    ConvStats stats;
+    opts.stats = &stats;
+    std::vector<uint8_t> mem(reference.data.size());
+    BufferPcmSink direct(&mem[0], mem.size());
+    StatsPcmSink timed(direct, stats);
+    CHECK(backend.decode(assetSource(), timed, opts) == 0);
+    timed.finish();
+    CHECK(mem == reference.data);
+    CHECK(stats.prefetchUs >= 0);
+    CHECK(stats.firstBufferUs >= 0);
+    CHECK(stats.bytesWritten == reference.data.size());
+    CHECK(stats.callbacks == (reference.data.size() + 1999) / 2000);
+    uint64_t intervals = 0;
+    for (int i = 0; i < CONV_STATS_BUCKETS; i++) intervals += stats.intervalHistogram[i];
+    CHECK(intervals == stats.callbacks - 1);
+    CHECK(stats.maxIntervalUs >= (int64_t) meanIntervalUs(stats));
+    CHECK(stats.audioSeconds > 0.99 && stats.audioSeconds < 1.01);
+
+    NativeFlacBackend native;
+    ConvStats parallel;
+    opts.stats = &parallel;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    opts.numThreads = 4;
+    RandomAccessPcmSink sink;
+    StatsPcmSink timedParallel(sink, parallel);
+    CHECK(native.decode(assetSource(), timedParallel, opts) == 0);
+    timedParallel.finish();
+    CHECK(sink.data == reference.data);
+    CHECK(parallel.prefetchUs == -1);
+    CHECK(parallel.callbacks > 0);
+    CHECK(parallel.bytesWritten == reference.data.size());
+    mergeStats(stats, parallel);
+    CHECK(stats.bytesWritten == 2 * reference.data.size());
+}
+
+static std::vector<uint8_t> readFile(const char *path) {
+    std::vector<uint8_t> data;
+    FILE *f = fopen(path, "rb");
+    if (!f) return data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+/* Converts the asset to dst through the cache with a new backend each time */
+static int cachedFile(const char *dst, const ConvOptions &opts) {
+    OpenSLBackend backend(1);
+    return cachedConvert(assetSource(), dst, opts, [&]() {
+        FilePcmSink sink;
+        int r = sink.open(dst);
+        if (r) return r;
+        FormatPcmSink format(sink, opts.sampleFormat, opts.downmix);
+        return backend.decode(assetSource(), format, opts);
+    });
+}
+
+/* The second conversion comes from the cache without an OpenSL ES engine, the
+ * budget evicts the least recently used entries */
+static void testCache() {
+    const char *dir = "pcm-cache-test";
+    ConvOptions opts;
+    opts.cacheDir = dir;
+    slStubResetStats();
+    CHECK(cachedFile("cache-test-1.raw", opts) == 0);
+    CHECK(slStubStats().enginesCreated == 1);
+    CHECK(cachedFile("cache-test-2.raw", opts) == 0);
+    CHECK(slStubStats().enginesCreated == 1);
+    const std::vector<uint8_t> first = readFile("cache-test-1.raw");
+    CHECK(!first.empty() && readFile("cache-test-2.raw") == first);
+
+    /* other output options are another entry */
+    ConvOptions floats = opts;
+    floats.sampleFormat = FLAC2RAW_FORMAT_FLOAT32;
+    std::string pcmKey, floatKey;
+    CHECK(PcmCache::key(assetSource(), opts, pcmKey) == 0);
+    CHECK(PcmCache::key(assetSource(), floats, floatKey) == 0);
+    CHECK(pcmKey != floatKey);
+    CHECK(cachedFile("cache-test-3.raw", floats) == 0);
+    CHECK(slStubStats().enginesCreated == 2);
+    CHECK(readFile("cache-test-3.raw").size() == 2 * first.size());
+
+    /* the new entry only fits after evicting both older ones */
+    floats.cacheMaxBytes = (int64_t) (2 * first.size() + first.size() / 2);
+    floats.downmix = true;
+    CHECK(cachedFile("cache-test-4.raw", floats) == 0);
+    PcmCache cache(dir, 0);
+    CHECK(access(cache.entryPath(pcmKey).c_str(), F_OK) != 0);
+    CHECK(access(cache.entryPath(floatKey).c_str(), F_OK) != 0);
+    CHECK(cachedFile("cache-test-2.raw", opts) == 0);
+    CHECK(slStubStats().enginesCreated == 4);
+
+    /* a hit replaces a longer file as a whole, a failed one leaves nothing */
+    FILE *f = fopen("cache-test-1.raw", "wb");
+    if (f) {
+        std::vector<uint8_t> junk(3 * first.size(), 0x55);
+        fwrite(&junk[0], 1, junk.size(), f);
+        fclose(f);
+    }
+    CHECK(cache.fetch(pcmKey, "cache-test-1.raw") == 0);
+    CHECK(readFile("cache-test-1.raw") == first);
+    CHECK(cache.fetch(pcmKey, "no-such-dir/cache-test.raw") == ENOENT);
+    CHECK(access("no-such-dir", F_OK) != 0);
+
+    for (int i = 1; i <= 4; i++) remove(("cache-test-" + std::to_string(i) + ".raw").c_str());
+    remove(cache.entryPath(pcmKey).c_str());
+    std::string monoKey;
+    CHECK(PcmCache::key(assetSource(), floats, monoKey) == 0);
+    remove(cache.entryPath(monoKey).c_str());
+    rmdir(dir);
+}
+
+/* The platform decoder gets compressed audio in memory as an in-memory file */
+static void testMemory(const MemoryPcmSink &reference) {
+    std::vector<uint8_t> flac = readFile(FLAC2RAW_TEST_ASSET);
+    DecodeSource src;
+    src.type = DecodeSource::MEMORY;
+    src.data = &flac[0];
+    src.size = flac.size();
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    MemoryPcmSink sink;
+    CHECK(backend.decode(src, sink, opts) == 0);
+    CHECK(samePcm(reference, sink));
+    CHECK(sink.format.totalFrames * 2 == reference.data.size());
+}
+
+static long fileSize(const char *path) {
+    struct stat st;
+    return stat(path, &st) ? -1 : (long) st.st_size;
+}
+
+/* converts the asset into dst, through a MonitorPcmSink for the native backend */
+static int convertTo(DecoderBackend &backend, const char *dst, const ConvOptions &opts) {
+    FilePcmSink file;
+    int r = file.open(dst, opts.outputMode);
+    if (r) return r;
+    if (opts.backend == FLAC2RAW_BACKEND_OPENSL) return backend.decode(assetSource(), file, opts);
+    MonitorPcmSink monitor(file, *opts.monitor, true);
+    return backend.decode(assetSource(), monitor, opts);
+}
+
+static void testAsync(const MemoryPcmSink &reference) {
+    const std::string dst = "async-test.raw";
+    OpenSLBackend backend(1);
+    ConvOptions opts;
+    opts.progressIntervalMs = 20;
+    std::function<int(const ConvOptions &)> convert = [&](const ConvOptions &o) {
+        return convertTo(backend, dst.c_str(), o);
+    };
+
+    /* finishes and reports the whole file */
+    {
+        AsyncConversion c;
+        c.start(convert, opts, dst);
+        CHECK(c.wait() == 0);
+        CHECK(c.finished());
+        CHECK(fileSize(dst.c_str()) >= (long) reference.data.size());
+    }
+
+    /* a decoder at real time is stopped within a progress interval */
+    slStubSetPacing(1.0, 0);
+    {
+        AsyncConversion c;
+        c.start(convert, opts, dst);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        CHECK(!c.finished());
+        int64_t position, duration;
+        c.position(position, duration);
+        CHECK(position > 0);
+        CHECK(duration > position);
+        const auto cancelled = std::chrono::steady_clock::now();
+        c.cancel();
+        CHECK(c.wait() == ECANCELED);
+        CHECK(std::chrono::steady_clock::now() - cancelled < std::chrono::milliseconds(200));
+        CHECK(fileSize(dst.c_str()) == 0);
+    }
+
+    /* a listener restarting its conversion from onFinished while the converter
+     * is closed doesn't get a new one */
+    {
+        AsyncConversions conversions;
+        std::shared_ptr<AsyncConversion> first, second;
+        CHECK(conversions.start(convert, opts, dst, first) == 0);
+        int restarted = 0;
+        std::thread listener([&] {
+            first->wait();
+            restarted = conversions.start(convert, opts, dst, second);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        conversions.close();
+        listener.join();
+        CHECK(first->wait() == ECANCELED);
+        CHECK(restarted == EBADF);
+        CHECK(!second);
+    }
+    CHECK(slStubStats().playersAlive == 0);
+
+    /* a cancelled chunked container keeps its complete chunks for a resume */
+    ConvOptions chunkedOpts = opts;
+    chunkedOpts.container = FLAC2RAW_CONTAINER_CHUNKED;
+    chunkedOpts.chunkBytes = 4096;
+    uint64_t resumed = 0;
+    std::function<int(const ConvOptions &)> convertChunked = [&](const ConvOptions &o) {
+        ChunkedPcmSink sink(o.sampleFormat, (size_t) o.chunkBytes);
+        int r = sink.open(dst.c_str(), o.resume);
+        if (!r) r = backend.decode(assetSource(), sink, o);
+        resumed = sink.resumedFrames();
+        return r ? r : sink.finish();
+    };
+    {
+        AsyncConversion c;
+        c.start(convertChunked, chunkedOpts, dst);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        c.cancel();
+        CHECK(c.wait() == ECANCELED);
+    }
+    uint64_t kept = 0;
+    {
+        ChunkedPcmReader reader;
+        CHECK(reader.open(dst.c_str()) == 0);
+        CHECK(!reader.complete());
+        kept = reader.frames();
+        CHECK(kept > 0 && kept < reference.data.size() / 2);
+    }
+    slStubSetPacing(0, 0);
+    const std::string fresh = "async-test-fresh.raw";
+    {
+        ChunkedPcmSink sink(FLAC2RAW_FORMAT_PCM16, 4096);
+        CHECK(sink.open(fresh.c_str()) == 0);
+        CHECK(backend.decode(assetSource(), sink, opts) == 0);
+        CHECK(sink.finish() == 0);
+    }
+    chunkedOpts.resume = true;
+    {
+        AsyncConversion c;
+        c.start(convertChunked, chunkedOpts, dst);
+        CHECK(c.wait() == 0);
+    }
+    CHECK(resumed == kept);
+    CHECK(readFile(dst.c_str()) == readFile(fresh.c_str()));
+    unlink(fresh.c_str());
+
+    /* the native backend stops at its next write */
+    NativeFlacBackend native;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    {
+        AsyncConversion c;
+        c.cancel();
+        c.start([&](const ConvOptions &o) { return convertTo(native, dst.c_str(), o); },
+                opts, dst);
+        CHECK(c.wait() == ECANCELED);
+        CHECK(fileSize(dst.c_str()) == 0);
+    }
+    {
+        AsyncConversion c;
+        c.start([&](const ConvOptions &o) { return convertTo(native, dst.c_str(), o); },
+                opts, dst);
+        CHECK(c.wait() == 0);
+        int64_t position, duration;
+        c.position(position, duration);
+        CHECK(position > 0 && position == duration);
+    }
+    unlink(dst.c_str());
+}
+
+int main() {
+    MemoryPcmSink reference;
+    ConvOptions opts;
+    opts.backend = FLAC2RAW_BACKEND_NATIVE;
+    NativeFlacBackend native;
+    CHECK(native.decode(assetSource(), reference, opts) == 0);
+    CHECK(!reference.data.empty());
+    if (reference.data.empty()) return testResult();
+    testReuse(reference);
+    testConcurrent(reference);
+    testBufferConfig(reference);
+    testDirectBuffer(reference);
+    testFormat(reference);
+    testRange(reference);
+    testCache();
+    testMemory(reference);
+    testStats(reference);
+    testAsync(reference);
+    return testResult();
+}
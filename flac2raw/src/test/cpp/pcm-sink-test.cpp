@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the PCM sinks
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include "chunked-pcm.h"
+#include "ring-pcm-sink.h"
+#include "format-pcm-sink.h"
+#include "resample-pcm-sink.h"
+#include "test-util.h"
+
+/* Destination which stalls now and then like a busy SD card */
+class SlowPcmSink : public MemoryPcmSink {
+public:
+    int write(const void *p, size_t nbytes) {
+        if (++nWrites % 8 == 0) usleep(2000);
+        if (failAfter && data.size() + nbytes > failAfter) return EIO;
+        maxWrite = std::max(maxWrite, nbytes);
+        return MemoryPcmSink::write(p, nbytes);
+    }
+
+    int nWrites = 0;
+    size_t maxWrite = 0;
+    size_t failAfter = 0;
+};
+
+static std::vector<uint8_t> testData(size_t n) {
+    std::vector<uint8_t> d(n);
+    uint32_t x = 1;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        d[i] = (uint8_t) (x >> 16);
+    }
+    return d;
+}
+
+static void testRing(size_t ringBytes, size_t chunkBytes) {
+    const std::vector<uint8_t> input = testData(3 * 1000 * 1000 + 17);
+    SlowPcmSink slow;
+    RingPcmSink ring(slow, ringBytes, chunkBytes);
+    PcmFormat fmt;
+    CHECK(ring.begin(fmt) == 0);
+    size_t pos = 0;
+    /* buffer sizes of the platform decoder and of odd sizes */
+    for (size_t n = 2304; pos < input.size(); n = n == 2304 ? 777 : 2304) {
+        n = std::min(n, input.size() - pos);
+        CHECK(ring.write(&input[pos], n) == 0);
+        pos += n;
+    }
+    CHECK(ring.end() == 0);
+    CHECK(slow.ended);
+    CHECK(slow.data == input);
+    const RingStats &stats = ring.stats();
+    CHECK(stats.capacityBytes == ringBytes);
+    CHECK(stats.highWaterBytes <= ringBytes);
+    CHECK(stats.bytesWritten == input.size());
+    CHECK(slow.maxWrite <= chunkBytes);
+    /* all but the last write are whole chunks unless they hit the end of the ring */
+    CHECK(stats.writes <= input.size() / chunkBytes + input.size() / ringBytes + 2);
+}
+
+static void testRingError() {
+    const std::vector<uint8_t> input = testData(1000 * 1000);
+    SlowPcmSink slow;
+    slow.failAfter = 100 * 1000;
+    RingPcmSink ring(slow, 64 * 1024, 4096);
+    int r = 0;
+    for (size_t pos = 0; pos < input.size() && !r; pos += 1000) {
+        r = ring.write(&input[pos], 1000);
+    }
+    CHECK(r == EIO);
+    CHECK(ring.end() == EIO);
+}
+
+static std::vector<uint8_t> readFile(const char *path) {
+    std::vector<uint8_t> d;
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) return d;
+    uint8_t buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) d.insert(d.end(), buf, buf + n);
+    fclose(f);
+    return d;
+}
+
+/* Every output mode writes the same file, whether begin() guessed the length
+ * too short or too long, sequentially or from several threads */
+static void testFileModes() {
+    char dir[] = "/tmp/flac2raw-file-XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    const std::string path = std::string(dir) + "/out.raw";
+    const std::vector<uint8_t> input = testData(3 * 1000 * 1000 + 4);
+    for (int mode = FLAC2RAW_OUTPUT_STDIO; mode <= FLAC2RAW_OUTPUT_PWRITE; mode++) {
+        for (uint64_t frames = input.size() / 4 - 1000; frames <= input.size() / 4 + 1000;
+             frames += 1000) {
+            FilePcmSink sink;
+            CHECK(sink.open(path.c_str(), mode) == 0);
+            PcmFormat fmt;
+            fmt.channels = 2;
+            fmt.totalFrames = frames;
+            CHECK(sink.begin(fmt) == 0);
+            size_t pos = 0;
+            for (size_t n = 4608; pos < input.size(); n = n == 4608 ? 777 : 4608) {
+                n = std::min(n, input.size() - pos);
+                CHECK(sink.write(&input[pos], n) == 0);
+                pos += n;
+            }
+            CHECK(sink.end() == 0);
+            CHECK(readFile(path.c_str()) == input);
+        }
+        FilePcmSink sink;
+        CHECK(sink.open(path.c_str(), mode) == 0);
+        PcmFormat fmt;
+        fmt.channels = 2;
+        fmt.totalFrames = input.size() / 4;
+        CHECK(sink.begin(fmt) == 0);
+        std::vector<std::thread> threads;
+        const size_t part = input.size() / 4;
+        for (size_t t = 0; t < 4; t++) {
+            threads.push_back(std::thread([&, t] {
+                const size_t first = t * part;
+                const size_t last = t == 3 ? input.size() : first + part;
+                for (size_t p = first; p < last; p += 10000) {
+                    const size_t n = std::min((size_t) 10000, last - p);
+                    CHECK(sink.writeAt(p, &input[p], n) == 0);
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+        CHECK(sink.end() == 0);
+        CHECK(readFile(path.c_str()) == input);
+    }
+    FilePcmSink bad;
+    CHECK(bad.open(path.c_str(), 42) == EINVAL);
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+static void writeChunked(ChunkedPcmSink &sink, const std::vector<uint8_t> &input, size_t nbytes) {
+    for (size_t pos = 0, n = 4608; pos < nbytes; pos += n, n = n == 4608 ? 777 : 4608) {
+        n = std::min(n, nbytes - pos);
+        CHECK(sink.write(&input[pos], n) == 0);
+    }
+}
+
+/* A finished container is read from its index, an interrupted one up to its
+ * first damaged chunk, and a resumed conversion gives the same file */
+static void testChunked() {
+    char dir[] = "/tmp/flac2raw-chunked-XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    const std::string path = std::string(dir) + "/out.f2rc";
+    const std::vector<uint8_t> input = testData(4 * 250001);
+    PcmFormat fmt;
+    fmt.sampleRate = 48000;
+    fmt.channels = 2;
+    fmt.totalFrames = input.size() / 4;
+    {
+        ChunkedPcmSink sink(FLAC2RAW_FORMAT_PCM16, 65537);
+        CHECK(sink.open(path.c_str()) == 0);
+        CHECK(sink.begin(fmt) == 0);
+        writeChunked(sink, input, input.size());
+        CHECK(sink.finish() == 0);
+    }
+    const std::vector<uint8_t> finished = readFile(path.c_str());
+    {
+        ChunkedPcmReader reader;
+        CHECK(reader.open(path.c_str()) == 0);
+        CHECK(reader.complete());
+        CHECK(reader.format().chunkBytes == 65536);
+        CHECK(reader.format().sampleRate == 48000 && reader.format().channels == 2);
+        CHECK(reader.frames() == input.size() / 4);
+        CHECK(reader.chunks() == (input.size() + 65535) / 65536);
+        for (size_t i = 0; i < reader.chunks(); i++) CHECK(reader.verify(i) == 0);
+        uint64_t count;
+        const uint8_t *p = reader.framesAt(16384 + 10, count);
+        CHECK(p && count == 16384 - 10 && !memcmp(p, &input[4 * (16384 + 10)], 4));
+        CHECK(reader.framesAt(reader.frames(), count) == NULL && count == 0);
+        std::vector<uint8_t> range(4 * 40000);
+        CHECK(reader.read(16000, &range[0], 40000) == 40000);
+        CHECK(!memcmp(&range[0], &input[4 * 16000], range.size()));
+        CHECK(reader.read(reader.frames() - 5, &range[0], 40000) == 5);
+    }
+
+    /* a footer whose index would wrap around the end of the file is ignored and
+     * the chunks are scanned instead */
+    {
+        std::vector<uint8_t> bad = finished;
+        ChunkedPcmFooter footer;
+        memcpy(&footer, &bad[bad.size() - sizeof(footer)], sizeof(footer));
+        footer.chunks = UINT32_MAX;
+        footer.indexOffset = (uint64_t) (bad.size() - sizeof(footer)) -
+                             (uint64_t) footer.chunks * sizeof(ChunkedPcmIndexEntry);
+        memcpy(&bad[bad.size() - sizeof(footer)], &footer, sizeof(footer));
+        FILE *f = fopen(path.c_str(), "wb");
+        CHECK(f != NULL);
+        if (f) {
+            fwrite(&bad[0], 1, bad.size(), f);
+            fclose(f);
+        }
+        ChunkedPcmReader reader;
+        CHECK(reader.open(path.c_str()) == 0);
+        CHECK(!reader.complete());
+        CHECK(reader.frames() == input.size() / 4);
+    }
+
+    /* interrupted after 3.5 chunks with the fourth chunk damaged */
+    {
+        ChunkedPcmSink sink(FLAC2RAW_FORMAT_PCM16, 65536);
+        CHECK(sink.open(path.c_str()) == 0);
+        CHECK(sink.begin(fmt) == 0);
+        writeChunked(sink, input, 65536 * 7 / 2);
+    }
+    {
+        FILE *f = fopen(path.c_str(), "r+b");
+        CHECK(f != NULL);
+        if (f) {
+            fseek(f, (long) (sizeof(ChunkedPcmHeader) + 2 * (16 + 65536) + 16 + 100), SEEK_SET);
+            fputc(input[2 * 65536 + 100] ^ 1, f);
+            fclose(f);
+        }
+        ChunkedPcmReader reader;
+        CHECK(reader.open(path.c_str()) == 0);
+        CHECK(!reader.complete());
+        CHECK(reader.chunks() == 2);
+        CHECK(reader.frames() == 2 * 16384);
+    }
+    {
+        ChunkedPcmSink sink(FLAC2RAW_FORMAT_PCM16, 65536);
+        CHECK(sink.open(path.c_str(), true) == 0);
+        CHECK(sink.begin(fmt) == 0);
+        CHECK(sink.resumedFrames() == 2 * 16384);
+        writeChunked(sink, input, input.size());
+        CHECK(sink.finish() == 0);
+    }
+    CHECK(readFile(path.c_str()) == finished);
+
+    /* another format starts over */
+    PcmFormat mono = fmt;
+    mono.channels = 1;
+    {
+        ChunkedPcmSink sink(FLAC2RAW_FORMAT_PCM16, 65536);
+        CHECK(sink.open(path.c_str(), true) == 0);
+        CHECK(sink.begin(mono) == 0);
+        CHECK(sink.resumedFrames() == 0);
+        writeChunked(sink, input, 1000);
+        CHECK(sink.finish() == 0);
+        ChunkedPcmReader reader;
+        CHECK(reader.open(path.c_str()) == 0);
+        CHECK(reader.complete() && reader.frames() == 500);
+    }
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f) {
+        fwrite(&input[0], 1, 1000, f);
+        fclose(f);
+    }
+    ChunkedPcmReader raw;
+    CHECK(raw.open(path.c_str()) == EINVAL);
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+/* Every kernel this CPU supports gives the same result as the scalar one */
+static void testSampleKernels() {
+    const std::vector<const SampleKernels *> kernels = supportedSampleKernels();
+    const SampleKernels &ref = *kernels[0];
+    CHECK(&sampleKernels() == kernels.back());
+    std::vector<uint8_t> bytes = testData(2 * 6 * 1000);
+    std::vector<int16_t> in(bytes.size() / 2);
+    memcpy(&in[0], &bytes[0], bytes.size());
+    in[0] = -32768;
+    in[1] = -32768;
+    in[2] = 32767;
+    in[3] = 32767;
+    in[5] = -1;
+    for (size_t k = 1; k < kernels.size(); k++) {
+        const SampleKernels &kern = *kernels[k];
+        /* odd sizes exercise the scalar tails */
+        for (size_t n = 0; n < 70; n += 1 + n / 8) {
+            const size_t len = n * 13 + n % 7;
+            std::vector<float> f0(len), f1(len);
+            ref.toFloat(&in[0], f0.data(), len);
+            kern.toFloat(&in[0], f1.data(), len);
+            CHECK(f0 == f1);
+            std::vector<uint8_t> b0(3 * len), b1(3 * len);
+            ref.toInt24(&in[0], b0.data(), len);
+            kern.toInt24(&in[0], b1.data(), len);
+            CHECK(b0 == b1);
+            std::vector<int32_t> i0(len), i1(len);
+            ref.toInt32(&in[0], i0.data(), len);
+            kern.toInt32(&in[0], i1.data(), len);
+            CHECK(i0 == i1);
+            for (unsigned channels = 1; channels <= 6; channels++) {
+                const size_t frames = len / 6;
+                std::vector<int16_t> m0(frames), m1(frames);
+                ref.downmix(&in[0], m0.data(), frames, channels);
+                kern.downmix(&in[0], m1.data(), frames, channels);
+                CHECK(m0 == m1);
+                std::vector<int16_t> p0(frames * channels), p1(frames * channels);
+                std::vector<int16_t *> q0, q1;
+                for (unsigned ch = 0; ch < channels; ch++) {
+                    q0.push_back(p0.data() + ch * frames);
+                    q1.push_back(p1.data() + ch * frames);
+                }
+                ref.deinterleave(&in[0], q0.data(), frames, channels);
+                kern.deinterleave(&in[0], q1.data(), frames, channels);
+                CHECK(p0 == p1);
+            }
+            std::vector<float> a(len), b(len);
+            for (size_t j = 0; j < len; j++) {
+                a[j] = in[j] / 32768.0f;
+                b[j] = in[len - 1 - j] / 32768.0f;
+            }
+            const float d0 = ref.dot(a.data(), b.data(), len);
+            const float d1 = kern.dot(a.data(), b.data(), len);
+            CHECK(fabsf(d0 - d1) <= 1e-5f * (1 + fabsf(d0)));
+        }
+    }
+    float f;
+    ref.toFloat(&in[0], &f, 1);
+    CHECK(f == -1.0f);
+    int32_t i;
+    ref.toInt32(&in[2], &i, 1);
+    CHECK(i == 32767 * 65536);
+    int16_t m;
+    ref.downmix(&in[4], &m, 1, 2);
+    CHECK(m == (in[4] + in[5]) >> 1);
+}
+
+static void testFormatSink() {
+    const size_t frames = 5000;
+    std::vector<int16_t> stereo(2 * frames);
+    for (size_t i = 0; i < frames; i++) {
+        stereo[2 * i] = (int16_t) (i * 7);
+        stereo[2 * i + 1] = (int16_t) -(int) (i * 3);
+    }
+    PcmFormat fmt;
+    fmt.sampleRate = 48000;
+    fmt.channels = 2;
+    fmt.totalFrames = frames;
+
+    /* downmixed to float, fed in pieces which split samples and frames */
+    MemoryPcmSink mono;
+    FormatPcmSink mix(mono, FLAC2RAW_FORMAT_FLOAT32, true);
+    CHECK(mix.begin(fmt) == 0);
+    CHECK(mono.format.channels == 1 && mono.format.bitsPerSample == 32);
+    const uint8_t *p = (const uint8_t *) &stereo[0];
+    for (size_t pos = 0, n = 1; pos < stereo.size() * 2; pos += n, n = n * 3 % 1001 + 1) {
+        CHECK(mix.write(p + pos, std::min(n, stereo.size() * 2 - pos)) == 0);
+    }
+    CHECK(mix.end() == 0);
+    CHECK(mono.ended);
+    CHECK(mono.data.size() == frames * sizeof(float));
+    const float *fl = (const float *) &mono.data[0];
+    CHECK(fl[1000] == (float) ((7000 - 3000) >> 1) / 32768.0f);
+
+    /* planar 32 bit, written out of order like the parallel decoder */
+    RandomAccessPcmSink left, right;
+    std::vector<PcmSink *> planes;
+    planes.push_back(&left);
+    planes.push_back(&right);
+    FormatPcmSink split(planes, FLAC2RAW_FORMAT_INT32, false);
+    CHECK(split.begin(fmt) == 0);
+    CHECK(split.randomAccess());
+    CHECK(split.writeAt(4 * 3000, p + 4 * 3000, 4 * (frames - 3000)) == 0);
+    CHECK(split.writeAt(0, p, 4 * 3000) == 0);
+    CHECK(split.writeAt(2, p, 4) == EINVAL);
+    CHECK(split.end() == 0);
+    CHECK(left.data.size() == frames * 4 && right.data.size() == frames * 4);
+    const int32_t *l = (const int32_t *) &left.data[0];
+    const int32_t *r = (const int32_t *) &right.data[0];
+    CHECK(l[2000] == 2000 * 7 * 65536 && r[4000] == -4000 * 3 * 65536);
+
+    /* one output for two channels */
+    RandomAccessPcmSink extra;
+    planes.push_back(&extra);
+    FormatPcmSink mismatch(planes, FLAC2RAW_FORMAT_PCM16, false);
+    CHECK(mismatch.begin(fmt) == EINVAL);
+}
+
+/* Stereo sine, the second channel inverted */
+static std::vector<int16_t> sine(double freq, unsigned rate, size_t frames, double amplitude) {
+    std::vector<int16_t> s(2 * frames);
+    for (size_t i = 0; i < frames; i++) {
+        s[2 * i] = (int16_t) lrint(amplitude * sin(2 * M_PI * freq * i / rate));
+        s[2 * i + 1] = (int16_t) -s[2 * i];
+    }
+    return s;
+}
+
+static std::vector<int16_t> resample(const std::vector<int16_t> &in, unsigned inRate,
+                                     unsigned outRate, size_t piece) {
+    MemoryPcmSink out;
+    ResamplePcmSink resampler(out, outRate);
+    PcmFormat fmt;
+    fmt.sampleRate = inRate;
+    fmt.channels = 2;
+    fmt.totalFrames = in.size() / 2;
+    CHECK(resampler.begin(fmt) == 0);
+    CHECK(out.format.sampleRate == outRate);
+    CHECK(out.format.totalFrames == Resampler::outputFrames(fmt.totalFrames, inRate, outRate));
+    const uint8_t *p = (const uint8_t *) &in[0];
+    const size_t nbytes = in.size() * 2;
+    for (size_t pos = 0; pos < nbytes; pos += piece) {
+        CHECK(resampler.write(p + pos, std::min(piece, nbytes - pos)) == 0);
+    }
+    CHECK(resampler.end() == 0);
+    CHECK(out.ended);
+    CHECK(out.data.size() == out.format.totalFrames * 4);
+    std::vector<int16_t> s(out.data.size() / 2);
+    memcpy(&s[0], &out.data[0], out.data.size());
+    return s;
+}
+
+static void testResampler() {
+    const unsigned rates[][2] = {{44100, 16000}, {48000, 22050}, {16000, 48000},
+                                 {48000, 44100}, {44100, 44101}};
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        const unsigned in = rates[r][0], out = rates[r][1];
+        const std::vector<int16_t> s = resample(sine(1000, in, in / 2, 16000), in, out, 4096);
+        /* away from the edges the output is the same sine at the new rate */
+        double maxError = 0;
+        for (size_t i = out / 20; i < out / 2 - out / 20; i++) {
+            const double expected = 16000 * sin(2 * M_PI * 1000 * i / out);
+            maxError = std::max(maxError, fabs(s[2 * i] - expected));
+            CHECK(s[2 * i + 1] == -s[2 * i]);
+        }
+        CHECK(maxError < 8);
+        if (maxError >= 8) fprintf(stderr, "%u -> %u Hz: error %f\n", in, out, maxError);
+    }
+
+    /* 12kHz is above the Nyquist frequency of 16kHz and has to be filtered out */
+    const std::vector<int16_t> alias = resample(sine(12000, 48000, 24000, 16000), 48000,
+                                                16000, 1 << 20);
+    double power = 0;
+    for (size_t i = 800; i < 7200; i++) power += (double) alias[2 * i] * alias[2 * i];
+    CHECK(sqrt(power / 6400) < 16);
+
+    /* the output doesn't depend on how the input is split, even within frames */
+    const std::vector<int16_t> noise = sine(3000, 44100, 10000, 20000);
+    const std::vector<int16_t> whole = resample(noise, 44100, 16000, 1 << 20);
+    CHECK(resample(noise, 44100, 16000, 777) == whole);
+    CHECK(resample(noise, 44100, 16000, 3) == whole);
+}
+
+int main() {
+    testSampleKernels();
+    testFormatSink();
+    testResampler();
+    testRing(1024 * 1024, 64 * 1024);
+    /* small ring so that the decoder has to wait */
+    testRing(10000, 4096);
+    testRingError();
+    testFileModes();
+    testChunked();
+    return testResult();
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Subset of the Khronos OpenSL ES 1.0.1 API which is used by flac2raw, so that
+ * the OpenSL ES code can be built and tested on a Linux host against the stub
+ * in opensl-stub.cpp. Names, values and signatures follow the real header but
+ * interfaces only declare the methods flac2raw calls.
+ */
+
+#ifndef OPENSL_ES_H_
+#define OPENSL_ES_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SL_API
+#define SLAPIENTRY
+
+typedef int8_t SLint8;
+typedef uint8_t SLuint8;
+typedef int16_t SLint16;
+typedef uint16_t SLuint16;
+typedef int32_t SLint32;
+typedef uint32_t SLuint32;
+typedef int64_t SLAint64;
+typedef SLuint32 SLboolean;
+typedef SLuint8 SLchar;
+typedef SLint16 SLmillibel;
+typedef SLuint32 SLmillisecond;
+typedef SLuint32 SLmilliHertz;
+typedef SLint16 SLpermille;
+typedef SLuint32 SLresult;
+
+#define SL_BOOLEAN_FALSE ((SLboolean) 0x00000000)
+#define SL_BOOLEAN_TRUE ((SLboolean) 0x00000001)
+
+#define SL_RESULT_SUCCESS ((SLuint32) 0x00000000)
+#define SL_RESULT_PRECONDITIONS_VIOLATED ((SLuint32) 0x00000001)
+#define SL_RESULT_PARAMETER_INVALID ((SLuint32) 0x00000002)
+#define SL_RESULT_MEMORY_FAILURE ((SLuint32) 0x00000003)
+#define SL_RESULT_RESOURCE_ERROR ((SLuint32) 0x00000004)
+#define SL_RESULT_RESOURCE_LOST ((SLuint32) 0x00000005)
+#define SL_RESULT_IO_ERROR ((SLuint32) 0x00000006)
+#define SL_RESULT_BUFFER_INSUFFICIENT ((SLuint32) 0x00000007)
+#define SL_RESULT_CONTENT_CORRUPTED ((SLuint32) 0x00000008)
+#define SL_RESULT_CONTENT_UNSUPPORTED ((SLuint32) 0x00000009)
+#define SL_RESULT_CONTENT_NOT_FOUND ((SLuint32) 0x0000000A)
+#define SL_RESULT_PERMISSION_DENIED ((SLuint32) 0x0000000B)
+#define SL_RESULT_FEATURE_UNSUPPORTED ((SLuint32) 0x0000000C)
+#define SL_RESULT_INTERNAL_ERROR ((SLuint32) 0x0000000D)
+#define SL_RESULT_UNKNOWN_ERROR ((SLuint32) 0x0000000E)
+#define SL_RESULT_OPERATION_ABORTED ((SLuint32) 0x0000000F)
+#define SL_RESULT_CONTROL_LOST ((SLuint32) 0x00000010)
+
+#define SL_TIME_UNKNOWN ((SLuint32) 0xFFFFFFFF)
+
+/* Interface IDs */
+struct SLInterfaceID_ {
+    SLuint32 time_low;
+    SLuint16 time_mid;
+    SLuint16 time_hi_and_version;
+    SLuint16 clock_seq;
+    SLuint8 node[6];
+};
+typedef const struct SLInterfaceID_ *SLInterfaceID;
+
+extern SL_API const SLInterfaceID SL_IID_NULL;
+extern SL_API const SLInterfaceID SL_IID_OBJECT;
+extern SL_API const SLInterfaceID SL_IID_ENGINE;
+extern SL_API const SLInterfaceID SL_IID_PLAY;
+extern SL_API const SLInterfaceID SL_IID_PREFETCHSTATUS;
+extern SL_API const SLInterfaceID SL_IID_METADATAEXTRACTION;
+extern SL_API const SLInterfaceID SL_IID_SEEK;
+
+/* Data sources and sinks */
+#define SL_DATAFORMAT_MIME ((SLuint32) 0x00000001)
+#define SL_DATAFORMAT_PCM ((SLuint32) 0x00000002)
+
+#define SL_DATALOCATOR_URI ((SLuint32) 0x00000001)
+#define SL_DATALOCATOR_ADDRESS ((SLuint32) 0x00000002)
+
+#define SL_CONTAINERTYPE_UNSPECIFIED ((SLuint32) 0x00000001)
+
+#define SL_SAMPLINGRATE_8 ((SLuint32) 8000000)
+#define SL_SAMPLINGRATE_11_025 ((SLuint32) 11025000)
+#define SL_SAMPLINGRATE_12 ((SLuint32) 12000000)
+#define SL_SAMPLINGRATE_16 ((SLuint32) 16000000)
+#define SL_SAMPLINGRATE_22_05 ((SLuint32) 22050000)
+#define SL_SAMPLINGRATE_24 ((SLuint32) 24000000)
+#define SL_SAMPLINGRATE_32 ((SLuint32) 32000000)
+#define SL_SAMPLINGRATE_44_1 ((SLuint32) 44100000)
+#define SL_SAMPLINGRATE_48 ((SLuint32) 48000000)
+#define SL_SAMPLINGRATE_64 ((SLuint32) 64000000)
+#define SL_SAMPLINGRATE_88_2 ((SLuint32) 88200000)
+#define SL_SAMPLINGRATE_96 ((SLuint32) 96000000)
+#define SL_SAMPLINGRATE_192 ((SLuint32) 192000000)
+
+#define SL_PCMSAMPLEFORMAT_FIXED_8 ((SLuint16) 0x0008)
+#define SL_PCMSAMPLEFORMAT_FIXED_16 ((SLuint16) 0x0010)
+#define SL_PCMSAMPLEFORMAT_FIXED_20 ((SLuint16) 0x0014)
+#define SL_PCMSAMPLEFORMAT_FIXED_24 ((SLuint16) 0x0018)
+#define SL_PCMSAMPLEFORMAT_FIXED_28 ((SLuint16) 0x001C)
+#define SL_PCMSAMPLEFORMAT_FIXED_32 ((SLuint16) 0x0020)
+
+#define SL_SPEAKER_FRONT_LEFT ((SLuint32) 0x00000001)
+#define SL_SPEAKER_FRONT_RIGHT ((SLuint32) 0x00000002)
+#define SL_SPEAKER_FRONT_CENTER ((SLuint32) 0x00000004)
+
+#define SL_BYTEORDER_BIGENDIAN ((SLuint32) 0x00000001)
+#define SL_BYTEORDER_LITTLEENDIAN ((SLuint32) 0x00000002)
+
+typedef struct SLDataSource_ {
+    void *pLocator;
+    void *pFormat;
+} SLDataSource;
+
+typedef struct SLDataSink_ {
+    void *pLocator;
+    void *pFormat;
+} SLDataSink;
+
+typedef struct SLDataLocator_URI_ {
+    SLuint32 locatorType;
+    SLchar *URI;
+} SLDataLocator_URI;
+
+typedef struct SLDataFormat_MIME_ {
+    SLuint32 formatType;
+    SLchar *mimeType;
+    SLuint32 containerType;
+} SLDataFormat_MIME;
+
+typedef struct SLDataFormat_PCM_ {
+    SLuint32 formatType;
+    SLuint32 numChannels;
+    SLuint32 samplesPerSec;
+    SLuint32 bitsPerSample;
+    SLuint32 containerSize;
+    SLuint32 channelMask;
+    SLuint32 endianness;
+} SLDataFormat_PCM;
+
+/* Object */
+#define SL_OBJECT_STATE_UNREALIZED ((SLuint32) 0x00000001)
+#define SL_OBJECT_STATE_REALIZED ((SLuint32) 0x00000002)
+#define SL_OBJECT_STATE_SUSPENDED ((SLuint32) 0x00000003)
+
+struct SLObjectItf_;
+typedef const struct SLObjectItf_ *const *SLObjectItf;
+
+struct SLObjectItf_ {
+    SLresult (*Realize)(SLObjectItf self, SLboolean async);
+    SLresult (*Resume)(SLObjectItf self, SLboolean async);
+    SLresult (*GetState)(SLObjectItf self, SLuint32 *pState);
+    SLresult (*GetInterface)(SLObjectItf self, const SLInterfaceID iid, void *pInterface);
+    void (*Destroy)(SLObjectItf self);
+};
+
+/* Engine */
+#define SL_ENGINEOPTION_THREADSAFE ((SLuint32) 0x00000001)
+#define SL_ENGINEOPTION_LOSSOFCONTROL ((SLuint32) 0x00000002)
+
+typedef struct SLEngineOption_ {
+    SLuint32 feature;
+    SLuint32 data;
+} SLEngineOption;
+
+struct SLEngineItf_;
+typedef const struct SLEngineItf_ *const *SLEngineItf;
+
+struct SLEngineItf_ {
+    SLresult (*CreateAudioPlayer)(SLEngineItf self, SLObjectItf *pPlayer,
+                                  SLDataSource *pAudioSrc, SLDataSink *pAudioSnk,
+                                  SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+                                  const SLboolean *pInterfaceRequired);
+};
+
+SL_API SLresult SLAPIENTRY slCreateEngine(SLObjectItf *pEngine,
+                                          SLuint32 numOptions,
+                                          const SLEngineOption *pEngineOptions,
+                                          SLuint32 numInterfaces,
+                                          const SLInterfaceID *pInterfaceIds,
+                                          const SLboolean *pInterfaceRequired);
+
+/* Play */
+#define SL_PLAYSTATE_STOPPED ((SLuint32) 0x00000001)
+#define SL_PLAYSTATE_PAUSED ((SLuint32) 0x00000002)
+#define SL_PLAYSTATE_PLAYING ((SLuint32) 0x00000003)
+
+#define SL_PLAYEVENT_HEADATEND ((SLuint32) 0x00000001)
+#define SL_PLAYEVENT_HEADATMARKER ((SLuint32) 0x00000002)
+#define SL_PLAYEVENT_HEADATNEWPOS ((SLuint32) 0x00000004)
+#define SL_PLAYEVENT_HEADMOVING ((SLuint32) 0x00000008)
+#define SL_PLAYEVENT_HEADSTALLED ((SLuint32) 0x00000010)
+
+struct SLPlayItf_;
+typedef const struct SLPlayItf_ *const *SLPlayItf;
+
+typedef void (SLAPIENTRY *slPlayCallback)(SLPlayItf caller, void *pContext, SLuint32 event);
+
+struct SLPlayItf_ {
+    SLresult (*SetPlayState)(SLPlayItf self, SLuint32 state);
+    SLresult (*GetPlayState)(SLPlayItf self, SLuint32 *pState);
+    SLresult (*GetDuration)(SLPlayItf self, SLmillisecond *pMsec);
+    SLresult (*GetPosition)(SLPlayItf self, SLmillisecond *pMsec);
+    SLresult (*RegisterCallback)(SLPlayItf self, slPlayCallback callback, void *pContext);
+    SLresult (*SetCallbackEventsMask)(SLPlayItf self, SLuint32 eventFlags);
+    SLresult (*GetCallbackEventsMask)(SLPlayItf self, SLuint32 *pEventFlags);
+    SLresult (*SetMarkerPosition)(SLPlayItf self, SLmillisecond mSec);
+    SLresult (*ClearMarkerPosition)(SLPlayItf self);
+    SLresult (*GetMarkerPosition)(SLPlayItf self, SLmillisecond *pMsec);
+    SLresult (*SetPositionUpdatePeriod)(SLPlayItf self, SLmillisecond mSec);
+    SLresult (*GetPositionUpdatePeriod)(SLPlayItf self, SLmillisecond *pMsec);
+};
+
+/* Prefetch status */
+#define SL_PREFETCHSTATUS_UNDERFLOW ((SLuint32) 0x00000001)
+#define SL_PREFETCHSTATUS_SUFFICIENTDATA ((SLuint32) 0x00000002)
+#define SL_PREFETCHSTATUS_OVERFLOW ((SLuint32) 0x00000003)
+
+#define SL_PREFETCHEVENT_STATUSCHANGE ((SLuint32) 0x00000001)
+#define SL_PREFETCHEVENT_FILLLEVELCHANGE ((SLuint32) 0x00000002)
+
+struct SLPrefetchStatusItf_;
+typedef const struct SLPrefetchStatusItf_ *const *SLPrefetchStatusItf;
+
+typedef void (SLAPIENTRY *slPrefetchCallback)(SLPrefetchStatusItf caller, void *pContext,
+                                              SLuint32 event);
+
+struct SLPrefetchStatusItf_ {
+    SLresult (*GetPrefetchStatus)(SLPrefetchStatusItf self, SLuint32 *pStatus);
+    SLresult (*GetFillLevel)(SLPrefetchStatusItf self, SLpermille *pLevel);
+    SLresult (*RegisterCallback)(SLPrefetchStatusItf self, slPrefetchCallback callback,
+                                 void *pContext);
+    SLresult (*SetCallbackEventsMask)(SLPrefetchStatusItf self, SLuint32 eventFlags);
+    SLresult (*GetCallbackEventsMask)(SLPrefetchStatusItf self, SLuint32 *pEventFlags);
+    SLresult (*SetFillUpdatePeriod)(SLPrefetchStatusItf self, SLpermille period);
+    SLresult (*GetFillUpdatePeriod)(SLPrefetchStatusItf self, SLpermille *pPeriod);
+};
+
+/* Seek */
+#define SL_SEEKMODE_FAST ((SLuint32) 0x0001)
+#define SL_SEEKMODE_ACCURATE ((SLuint32) 0x0002)
+
+struct SLSeekItf_;
+typedef const struct SLSeekItf_ *const *SLSeekItf;
+
+struct SLSeekItf_ {
+    SLresult (*SetPosition)(SLSeekItf self, SLmillisecond pos, SLuint32 seekMode);
+    SLresult (*SetLoop)(SLSeekItf self, SLboolean loopEnable, SLmillisecond startPos,
+                        SLmillisecond endPos);
+    SLresult (*GetLoop)(SLSeekItf self, SLboolean *pLoopEnabled, SLmillisecond *pStartPos,
+                        SLmillisecond *pEndPos);
+};
+
+/* Metadata extraction */
+#define SL_CHARACTERENCODING_UNKNOWN ((SLuint32) 0x00000000)
+#define SL_CHARACTERENCODING_BINARY ((SLuint32) 0x00000001)
+#define SL_CHARACTERENCODING_ASCII ((SLuint32) 0x00000002)
+
+typedef struct SLMetadataInfo_ {
+    SLuint32 size;
+    SLuint32 encoding;
+    SLchar langCountry[16];
+    SLuint8 data[1];
+} SLMetadataInfo;
+
+struct SLMetadataExtractionItf_;
+typedef const struct SLMetadataExtractionItf_ *const *SLMetadataExtractionItf;
+
+struct SLMetadataExtractionItf_ {
+    SLresult (*GetItemCount)(SLMetadataExtractionItf self, SLuint32 *pItemCount);
+    SLresult (*GetKeySize)(SLMetadataExtractionItf self, SLuint32 index, SLuint32 *pKeySize);
+    SLresult (*GetKey)(SLMetadataExtractionItf self, SLuint32 index, SLuint32 keySize,
+                       SLMetadataInfo *pKey);
+    SLresult (*GetValueSize)(SLMetadataExtractionItf self, SLuint32 index,
+                             SLuint32 *pValueSize);
+    SLresult (*GetValue)(SLMetadataExtractionItf self, SLuint32 index, SLuint32 valueSize,
+                         SLMetadataInfo *pValue);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
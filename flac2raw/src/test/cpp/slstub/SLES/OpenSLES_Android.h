@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Subset of the Android extensions of OpenSL ES used by flac2raw, see OpenSLES.h.
+ */
+
+#ifndef OPENSL_ES_ANDROID_H_
+#define OPENSL_ES_ANDROID_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "OpenSLES.h"
+
+#define SL_DATALOCATOR_ANDROIDFD ((SLuint32) 0x800007BC)
+#define SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE ((SLuint32) 0x800007BD)
+#define SL_DATALOCATOR_ANDROIDBUFFERQUEUE ((SLuint32) 0x800007BE)
+
+#define SL_DATALOCATOR_ANDROIDFD_USE_FILE_SIZE ((SLAint64) 0xFFFFFFFFFFFFFFFFll)
+
+typedef struct SLDataLocator_AndroidFD_ {
+    SLuint32 locatorType;
+    SLint32 fd;
+    SLAint64 offset;
+    SLAint64 length;
+} SLDataLocator_AndroidFD;
+
+typedef struct SLDataLocator_AndroidSimpleBufferQueue {
+    SLuint32 locatorType;
+    SLuint32 numBuffers;
+} SLDataLocator_AndroidSimpleBufferQueue;
+
+/* keys of the decoded PCM format in the metadata extraction interface */
+#define ANDROID_KEY_PCMFORMAT_NUMCHANNELS "AndroidPcmFormatNumChannels"
+#define ANDROID_KEY_PCMFORMAT_SAMPLERATE "AndroidPcmFormatSampleRate"
+#define ANDROID_KEY_PCMFORMAT_BITSPERSAMPLE "AndroidPcmFormatBitsPerSample"
+#define ANDROID_KEY_PCMFORMAT_CONTAINERSIZE "AndroidPcmFormatContainerSize"
+#define ANDROID_KEY_PCMFORMAT_CHANNELMASK "AndroidPcmFormatChannelMask"
+#define ANDROID_KEY_PCMFORMAT_ENDIANNESS "AndroidPcmFormatEndianness"
+
+/* Android simple buffer queue */
+extern SL_API const SLInterfaceID SL_IID_ANDROIDSIMPLEBUFFERQUEUE;
+
+typedef struct SLAndroidSimpleBufferQueueState_ {
+    SLuint32 count;
+    SLuint32 index;
+} SLAndroidSimpleBufferQueueState;
+
+struct SLAndroidSimpleBufferQueueItf_;
+typedef const struct SLAndroidSimpleBufferQueueItf_ *const *SLAndroidSimpleBufferQueueItf;
+
+typedef void (SLAPIENTRY *slAndroidSimpleBufferQueueCallback)(
+        SLAndroidSimpleBufferQueueItf caller, void *pContext);
+
+struct SLAndroidSimpleBufferQueueItf_ {
+    SLresult (*Enqueue)(SLAndroidSimpleBufferQueueItf self, const void *pBuffer,
+                        SLuint32 size);
+    SLresult (*Clear)(SLAndroidSimpleBufferQueueItf self);
+    SLresult (*GetState)(SLAndroidSimpleBufferQueueItf self,
+                         SLAndroidSimpleBufferQueueState *pState);
+    SLresult (*RegisterCallback)(SLAndroidSimpleBufferQueueItf self,
+                                 slAndroidSimpleBufferQueueCallback callback, void *pContext);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+#include "opensl-stub.h"
+#include "decoder-backend.h"
+#include "flac-decoder.h"
+
+//-----------------------------------------------------------------
+/* Interface IDs, only their addresses matter */
+static const struct SLInterfaceID_ iids[] = {
+        {0x1}, {0x2}, {0x3}, {0x4}, {0x5}, {0x6}, {0x7}, {0x8}
+};
+const SLInterfaceID SL_IID_NULL = &iids[0];
+const SLInterfaceID SL_IID_OBJECT = &iids[1];
+const SLInterfaceID SL_IID_ENGINE = &iids[2];
+const SLInterfaceID SL_IID_PLAY = &iids[3];
+const SLInterfaceID SL_IID_PREFETCHSTATUS = &iids[4];
+const SLInterfaceID SL_IID_METADATAEXTRACTION = &iids[5];
+const SLInterfaceID SL_IID_SEEK = &iids[6];
+const SLInterfaceID SL_IID_ANDROIDSIMPLEBUFFERQUEUE = &iids[7];
+
+static SlStubStats stats;
+static std::atomic<bool> seekSupported(true);
+static std::atomic<double> pacingSpeed(0);
+static std::atomic<unsigned> pacingJitterUs(0);
+static std::atomic<unsigned> playerSeed(1);
+
+SlStubStats &slStubStats() {
+    return stats;
+}
+
+void slStubSetSeekSupported(bool supported) {
+    seekSupported = supported;
+}
+
+void slStubSetPacing(double speed, unsigned jitterUs) {
+    pacingSpeed = speed;
+    pacingJitterUs = jitterUs;
+}
+
+void slStubResetStats() {
+    stats.enginesCreated = 0;
+    stats.enginesAlive = 0;
+    stats.playersCreated = 0;
+    stats.playersAlive = 0;
+    stats.maxPlayersAlive = 0;
+}
+
+/* An interface: the handle points to vtbl, owner leads back to the object */
+template<class V, class O>
+struct StubItf {
+    const V *vtbl;
+    O *owner;
+};
+
+template<class V, class O, class H>
+static O *ownerOf(H self) {
+    return ((const StubItf<V, O> *) self)->owner;
+}
+
+//-----------------------------------------------------------------
+/* Audio player decoding into an Android simple buffer queue */
+struct StubPlayer {
+    StubItf<SLObjectItf_, StubPlayer> object;
+    StubItf<SLPlayItf_, StubPlayer> play;
+    StubItf<SLPrefetchStatusItf_, StubPlayer> prefetch;
+    StubItf<SLMetadataExtractionItf_, StubPlayer> meta;
+    StubItf<SLAndroidSimpleBufferQueueItf_, StubPlayer> bq;
+    StubItf<SLSeekItf_, StubPlayer> seek;
+
+    MappedSource in;
+    FlacDecoder dec;
+    bool sourceOk = false;
+    size_t decodePos = 0;
+    uint64_t decodedFrames = 0;
+    std::vector<int16_t> pending;
+    size_t pendingPos = 0;
+
+    slPlayCallback playCb = NULL;
+    void *playCtx = NULL;
+    SLuint32 playMask = 0;
+    slPrefetchCallback prefetchCb = NULL;
+    void *prefetchCtx = NULL;
+    SLuint32 prefetchMask = 0;
+    slAndroidSimpleBufferQueueCallback bqCb = NULL;
+    void *bqCtx = NULL;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::pair<void *, SLuint32> > queue;
+    SLuint32 playState = SL_PLAYSTATE_STOPPED;
+    SLuint32 prefetchStatus = SL_PREFETCHSTATUS_UNDERFLOW;
+    bool stop = false;
+    std::atomic<uint64_t> deliveredFrames;
+    std::thread thread;
+
+    StubPlayer() : deliveredFrames(0) {}
+
+    void run();
+
+    /* fills buf from the decoder, returns the number of bytes filled */
+    size_t fill(uint8_t *buf, size_t size);
+
+    /* continues decoding with sample frame target */
+    void seekTo(uint64_t target);
+};
+
+void StubPlayer::seekTo(uint64_t target) {
+    /* decodes from the start, that is slow but exact */
+    decodePos = dec.audioOffset();
+    decodedFrames = 0;
+    pending.clear();
+    pendingPos = 0;
+    const unsigned channels = dec.streamInfo().channels;
+    while (decodePos < in.size) {
+        FlacFrameHeader header;
+        if (dec.decodeFrame(decodePos, header)) {
+            decodePos = in.size;
+            break;
+        }
+        decodedFrames += header.blockSize;
+        if (header.firstSample + header.blockSize > target) {
+            pending.resize((size_t) header.blockSize * channels);
+            dec.toInt16Interleaved(header, &pending[0]);
+            pendingPos = (size_t) (target - header.firstSample) * channels;
+            break;
+        }
+    }
+    deliveredFrames = target;
+}
+
+size_t StubPlayer::fill(uint8_t *buf, size_t size) {
+    size_t filled = 0;
+    const FlacStreamInfo &info = dec.streamInfo();
+    while (filled < size) {
+        if (pendingPos == pending.size()) {
+            if (decodePos >= in.size ||
+                (info.totalSamples && decodedFrames >= info.totalSamples)) {
+                break;
+            }
+            FlacFrameHeader header;
+            if (dec.decodeFrame(decodePos, header)) {
+                /* the platform decoder just ends the stream on errors */
+                decodePos = in.size;
+                break;
+            }
+            pending.resize((size_t) header.blockSize * header.channels);
+            dec.toInt16Interleaved(header, &pending[0]);
+            pendingPos = 0;
+            decodedFrames += header.blockSize;
+        }
+        size_t n = (pending.size() - pendingPos) * sizeof(int16_t);
+        if (n > size - filled) n = size - filled;
+        memcpy(buf + filled, (const uint8_t *) &pending[0] + pendingPos * sizeof(int16_t), n);
+        filled += n;
+        pendingPos += n / sizeof(int16_t);
+    }
+    return filled;
+}
+
+void StubPlayer::run() {
+    const size_t frameBytes = dec.streamInfo().channels * sizeof(int16_t);
+    const double speed = pacingSpeed;
+    const unsigned jitterUs = pacingJitterUs;
+    const double rate = dec.streamInfo().sampleRate ? dec.streamInfo().sampleRate : 48000;
+    std::minstd_rand rng(playerSeed++);
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t playedFrames = 0;
+    for (;;) {
+        std::pair<void *, SLuint32> buf;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this] {
+                return stop || (playState == SL_PLAYSTATE_PLAYING && !queue.empty());
+            });
+            if (stop) return;
+            buf = queue.front();
+            queue.pop_front();
+        }
+        const size_t filled = fill((uint8_t *) buf.first, buf.second);
+        const bool eos = filled < buf.second;
+        if (filled) {
+            memset((uint8_t *) buf.first + filled, 0, buf.second - filled);
+            deliveredFrames += filled / frameBytes;
+            playedFrames += filled / frameBytes;
+            /* a real decoder is paced by its source and scheduling, not by memcpy */
+            if (speed > 0 || jitterUs) {
+                auto due = speed > 0 ? start + std::chrono::microseconds(
+                        (int64_t) (playedFrames * 1e6 / rate / speed)) :
+                           std::chrono::steady_clock::now();
+                if (jitterUs) due += std::chrono::microseconds(rng() % (jitterUs + 1));
+                std::this_thread::sleep_until(due);
+            }
+            if (bqCb) bqCb((SLAndroidSimpleBufferQueueItf) &bq.vtbl, bqCtx);
+        }
+        if (eos) {
+            if (playCb && (playMask & SL_PLAYEVENT_HEADATEND)) {
+                playCb((SLPlayItf) &play.vtbl, playCtx, SL_PLAYEVENT_HEADATEND);
+            }
+            return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------
+static SLresult playerRealize(SLObjectItf, SLboolean) {
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult playerResume(SLObjectItf, SLboolean) {
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult playerGetState(SLObjectItf, SLuint32 *pState) {
+    *pState = SL_OBJECT_STATE_REALIZED;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult playerGetInterface(SLObjectItf self, const SLInterfaceID iid, void *pInterface) {
+    StubPlayer *p = ownerOf<SLObjectItf_, StubPlayer>(self);
+    const void *itf = NULL;
+    if (iid == SL_IID_OBJECT) itf = &p->object.vtbl;
+    if (iid == SL_IID_PLAY) itf = &p->play.vtbl;
+    if (iid == SL_IID_PREFETCHSTATUS) itf = &p->prefetch.vtbl;
+    if (iid == SL_IID_METADATAEXTRACTION) itf = &p->meta.vtbl;
+    if (iid == SL_IID_ANDROIDSIMPLEBUFFERQUEUE) itf = &p->bq.vtbl;
+    if (iid == SL_IID_SEEK && seekSupported) itf = &p->seek.vtbl;
+    if (!itf) return SL_RESULT_FEATURE_UNSUPPORTED;
+    *(const void **) pInterface = itf;
+    return SL_RESULT_SUCCESS;
+}
+
+static void playerDestroy(SLObjectItf self) {
+    StubPlayer *p = ownerOf<SLObjectItf_, StubPlayer>(self);
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->stop = true;
+    }
+    p->cond.notify_all();
+    if (p->thread.joinable()) {
+        if (p->thread.get_id() == std::this_thread::get_id()) {
+            p->thread.detach();
+        } else {
+            p->thread.join();
+        }
+    }
+    delete p;
+    stats.playersAlive--;
+}
+
+static const SLObjectItf_ playerObjectVtbl = {
+        playerRealize, playerResume, playerGetState, playerGetInterface, playerDestroy
+};
+
+//-----------------------------------------------------------------
+static SLresult setPlayState(SLPlayItf self, SLuint32 state) {
+    StubPlayer *p = ownerOf<SLPlayItf_, StubPlayer>(self);
+    if (state == SL_PLAYSTATE_PAUSED && p->prefetchStatus != SL_PREFETCHSTATUS_SUFFICIENTDATA) {
+        /* prefetching: the platform reports a source it can't open as an underflow
+         * at fill level 0 */
+        if (p->sourceOk) {
+            p->prefetchStatus = SL_PREFETCHSTATUS_SUFFICIENTDATA;
+            if (p->prefetchCb && (p->prefetchMask & SL_PREFETCHEVENT_STATUSCHANGE)) {
+                p->prefetchCb((SLPrefetchStatusItf) &p->prefetch.vtbl, p->prefetchCtx,
+                              SL_PREFETCHEVENT_STATUSCHANGE);
+            }
+        } else if (p->prefetchCb) {
+            p->prefetchCb((SLPrefetchStatusItf) &p->prefetch.vtbl, p->prefetchCtx,
+                          SL_PREFETCHEVENT_STATUSCHANGE | SL_PREFETCHEVENT_FILLLEVELCHANGE);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        if (state == SL_PLAYSTATE_PLAYING && !p->thread.joinable() && p->sourceOk) {
+            p->thread = std::thread(&StubPlayer::run, p);
+        }
+        p->playState = state;
+    }
+    p->cond.notify_all();
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getPlayState(SLPlayItf self, SLuint32 *pState) {
+    StubPlayer *p = ownerOf<SLPlayItf_, StubPlayer>(self);
+    std::lock_guard<std::mutex> guard(p->lock);
+    *pState = p->playState;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getDuration(SLPlayItf self, SLmillisecond *pMsec) {
+    StubPlayer *p = ownerOf<SLPlayItf_, StubPlayer>(self);
+    const FlacStreamInfo &info = p->dec.streamInfo();
+    if (!p->sourceOk || !info.totalSamples) {
+        *pMsec = SL_TIME_UNKNOWN;
+    } else {
+        *pMsec = (SLmillisecond) (info.totalSamples * 1000 / info.sampleRate);
+    }
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getPosition(SLPlayItf self, SLmillisecond *pMsec) {
+    StubPlayer *p = ownerOf<SLPlayItf_, StubPlayer>(self);
+    const unsigned rate = p->sourceOk ? p->dec.streamInfo().sampleRate : 0;
+    *pMsec = rate ? (SLmillisecond) (p->deliveredFrames * 1000 / rate) : 0;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult playRegisterCallback(SLPlayItf self, slPlayCallback callback, void *pContext) {
+    StubPlayer *p = ownerOf<SLPlayItf_, StubPlayer>(self);
+    p->playCb = callback;
+    p->playCtx = pContext;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult setCallbackEventsMask(SLPlayItf self, SLuint32 eventFlags) {
+    ownerOf<SLPlayItf_, StubPlayer>(self)->playMask = eventFlags;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getCallbackEventsMask(SLPlayItf self, SLuint32 *pEventFlags) {
+    *pEventFlags = ownerOf<SLPlayItf_, StubPlayer>(self)->playMask;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult playUnsupported(SLPlayItf, SLmillisecond) {
+    return SL_RESULT_FEATURE_UNSUPPORTED;
+}
+
+static SLresult playUnsupportedGet(SLPlayItf, SLmillisecond *) {
+    return SL_RESULT_FEATURE_UNSUPPORTED;
+}
+
+static SLresult clearMarkerPosition(SLPlayItf) {
+    return SL_RESULT_FEATURE_UNSUPPORTED;
+}
+
+static const SLPlayItf_ playVtbl = {
+        setPlayState, getPlayState, getDuration, getPosition, playRegisterCallback,
+        setCallbackEventsMask, getCallbackEventsMask, playUnsupported, clearMarkerPosition,
+        playUnsupportedGet, playUnsupported, playUnsupportedGet
+};
+
+//-----------------------------------------------------------------
+static SLresult getPrefetchStatus(SLPrefetchStatusItf self, SLuint32 *pStatus) {
+    *pStatus = ownerOf<SLPrefetchStatusItf_, StubPlayer>(self)->prefetchStatus;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getFillLevel(SLPrefetchStatusItf self, SLpermille *pLevel) {
+    StubPlayer *p = ownerOf<SLPrefetchStatusItf_, StubPlayer>(self);
+    *pLevel = p->prefetchStatus == SL_PREFETCHSTATUS_SUFFICIENTDATA ? 1000 : 0;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult prefetchRegisterCallback(SLPrefetchStatusItf self, slPrefetchCallback callback,
+                                         void *pContext) {
+    StubPlayer *p = ownerOf<SLPrefetchStatusItf_, StubPlayer>(self);
+    p->prefetchCb = callback;
+    p->prefetchCtx = pContext;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult prefetchSetMask(SLPrefetchStatusItf self, SLuint32 eventFlags) {
+    ownerOf<SLPrefetchStatusItf_, StubPlayer>(self)->prefetchMask = eventFlags;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult prefetchGetMask(SLPrefetchStatusItf self, SLuint32 *pEventFlags) {
+    *pEventFlags = ownerOf<SLPrefetchStatusItf_, StubPlayer>(self)->prefetchMask;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult setFillUpdatePeriod(SLPrefetchStatusItf, SLpermille) {
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getFillUpdatePeriod(SLPrefetchStatusItf, SLpermille *pPeriod) {
+    *pPeriod = 100;
+    return SL_RESULT_SUCCESS;
+}
+
+static const SLPrefetchStatusItf_ prefetchVtbl = {
+        getPrefetchStatus, getFillLevel, prefetchRegisterCallback, prefetchSetMask,
+        prefetchGetMask, setFillUpdatePeriod, getFillUpdatePeriod
+};
+
+//-----------------------------------------------------------------
+/* The decoded PCM format is all the platform decoder reports as metadata */
+static const char *const metaKeys[] = {
+        ANDROID_KEY_PCMFORMAT_NUMCHANNELS,
+        ANDROID_KEY_PCMFORMAT_SAMPLERATE
+};
+#define NUM_META_KEYS 2
+
+static SLresult getItemCount(SLMetadataExtractionItf, SLuint32 *pItemCount) {
+    *pItemCount = NUM_META_KEYS;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getKeySize(SLMetadataExtractionItf, SLuint32 index, SLuint32 *pKeySize) {
+    if (index >= NUM_META_KEYS) return SL_RESULT_PARAMETER_INVALID;
+    *pKeySize = (SLuint32) (sizeof(SLMetadataInfo) + strlen(metaKeys[index]));
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getKey(SLMetadataExtractionItf, SLuint32 index, SLuint32 keySize,
+                       SLMetadataInfo *pKey) {
+    if (index >= NUM_META_KEYS) return SL_RESULT_PARAMETER_INVALID;
+    const size_t len = strlen(metaKeys[index]) + 1;
+    if (keySize < sizeof(SLMetadataInfo) - 1 + len) return SL_RESULT_BUFFER_INSUFFICIENT;
+    pKey->size = (SLuint32) len;
+    pKey->encoding = SL_CHARACTERENCODING_ASCII;
+    memcpy(pKey->data, metaKeys[index], len);
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getValueSize(SLMetadataExtractionItf, SLuint32 index, SLuint32 *pValueSize) {
+    if (index >= NUM_META_KEYS) return SL_RESULT_PARAMETER_INVALID;
+    *pValueSize = (SLuint32) (sizeof(SLMetadataInfo) - 1 + sizeof(SLuint32));
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult getValue(SLMetadataExtractionItf self, SLuint32 index, SLuint32 valueSize,
+                         SLMetadataInfo *pValue) {
+    StubPlayer *p = ownerOf<SLMetadataExtractionItf_, StubPlayer>(self);
+    if (index >= NUM_META_KEYS) return SL_RESULT_PARAMETER_INVALID;
+    if (valueSize < sizeof(SLMetadataInfo) - 1 + sizeof(SLuint32)) {
+        return SL_RESULT_BUFFER_INSUFFICIENT;
+    }
+    const FlacStreamInfo &info = p->dec.streamInfo();
+    const SLuint32 v = index == 0 ? info.channels : info.sampleRate;
+    pValue->size = sizeof(SLuint32);
+    pValue->encoding = SL_CHARACTERENCODING_BINARY;
+    memcpy(pValue->data, &v, sizeof(v));
+    return SL_RESULT_SUCCESS;
+}
+
+static const SLMetadataExtractionItf_ metaVtbl = {
+        getItemCount, getKeySize, getKey, getValueSize, getValue
+};
+
+//-----------------------------------------------------------------
+static SLresult setPosition(SLSeekItf self, SLmillisecond pos, SLuint32) {
+    StubPlayer *p = ownerOf<SLSeekItf_, StubPlayer>(self);
+    if (!p->sourceOk) return SL_RESULT_PRECONDITIONS_VIOLATED;
+    std::lock_guard<std::mutex> guard(p->lock);
+    /* only before decoding starts, that's all the backend needs */
+    if (p->thread.joinable()) return SL_RESULT_FEATURE_UNSUPPORTED;
+    p->seekTo((uint64_t) pos * p->dec.streamInfo().sampleRate / 1000);
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult setLoop(SLSeekItf, SLboolean, SLmillisecond, SLmillisecond) {
+    return SL_RESULT_FEATURE_UNSUPPORTED;
+}
+
+static SLresult getLoop(SLSeekItf, SLboolean *pLoopEnabled, SLmillisecond *, SLmillisecond *) {
+    *pLoopEnabled = SL_BOOLEAN_FALSE;
+    return SL_RESULT_SUCCESS;
+}
+
+static const SLSeekItf_ seekVtbl = {
+        setPosition, setLoop, getLoop
+};
+
+//-----------------------------------------------------------------
+static SLresult enqueue(SLAndroidSimpleBufferQueueItf self, const void *pBuffer, SLuint32 size) {
+    StubPlayer *p = ownerOf<SLAndroidSimpleBufferQueueItf_, StubPlayer>(self);
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->queue.push_back(std::make_pair((void *) pBuffer, size));
+    }
+    p->cond.notify_all();
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult clear(SLAndroidSimpleBufferQueueItf self) {
+    StubPlayer *p = ownerOf<SLAndroidSimpleBufferQueueItf_, StubPlayer>(self);
+    std::lock_guard<std::mutex> guard(p->lock);
+    p->queue.clear();
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult bqGetState(SLAndroidSimpleBufferQueueItf self,
+                           SLAndroidSimpleBufferQueueState *pState) {
+    StubPlayer *p = ownerOf<SLAndroidSimpleBufferQueueItf_, StubPlayer>(self);
+    std::lock_guard<std::mutex> guard(p->lock);
+    pState->count = (SLuint32) p->queue.size();
+    pState->index = 0;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult bqRegisterCallback(SLAndroidSimpleBufferQueueItf self,
+                                   slAndroidSimpleBufferQueueCallback callback,
+                                   void *pContext) {
+    StubPlayer *p = ownerOf<SLAndroidSimpleBufferQueueItf_, StubPlayer>(self);
+    p->bqCb = callback;
+    p->bqCtx = pContext;
+    return SL_RESULT_SUCCESS;
+}
+
+static const SLAndroidSimpleBufferQueueItf_ bqVtbl = {
+        enqueue, clear, bqGetState, bqRegisterCallback
+};
+
+//-----------------------------------------------------------------
+static SLresult createAudioPlayer(SLEngineItf, SLObjectItf *pPlayer,
+                                  SLDataSource *pAudioSrc, SLDataSink *pAudioSnk,
+                                  SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+                                  const SLboolean *pInterfaceRequired) {
+    for (SLuint32 i = 0; i < numInterfaces; i++) {
+        const SLInterfaceID iid = pInterfaceIds[i];
+        if (pInterfaceRequired[i] && iid != SL_IID_NULL && iid != SL_IID_PREFETCHSTATUS &&
+            iid != SL_IID_METADATAEXTRACTION && iid != SL_IID_ANDROIDSIMPLEBUFFERQUEUE) {
+            return SL_RESULT_FEATURE_UNSUPPORTED;
+        }
+    }
+    const SLuint32 sinkType = *(const SLuint32 *) pAudioSnk->pLocator;
+    if (sinkType != SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE) {
+        return SL_RESULT_CONTENT_UNSUPPORTED;
+    }
+    DecodeSource src;
+    const SLuint32 srcType = *(const SLuint32 *) pAudioSrc->pLocator;
+    if (srcType == SL_DATALOCATOR_URI) {
+        src.type = DecodeSource::URI;
+        src.path = (const char *) ((SLDataLocator_URI *) pAudioSrc->pLocator)->URI;
+    } else if (srcType == SL_DATALOCATOR_ANDROIDFD) {
+        const SLDataLocator_AndroidFD *loc = (SLDataLocator_AndroidFD *) pAudioSrc->pLocator;
+        src.type = DecodeSource::FD;
+        src.fd = loc->fd;
+        src.start = (off_t) loc->offset;
+        src.length = (off_t) loc->length;
+    } else {
+        return SL_RESULT_CONTENT_UNSUPPORTED;
+    }
+    StubPlayer *p = new StubPlayer;
+    p->object = {&playerObjectVtbl, p};
+    p->play = {&playVtbl, p};
+    p->prefetch = {&prefetchVtbl, p};
+    p->meta = {&metaVtbl, p};
+    p->bq = {&bqVtbl, p};
+    p->seek = {&seekVtbl, p};
+    /* like the platform, failing to open the source only shows when prefetching */
+    p->dec.setQuiet(true);
+    p->sourceOk = !p->in.map(src) && !p->dec.open(p->in.data, p->in.size);
+    p->decodePos = p->dec.audioOffset();
+    *pPlayer = (SLObjectItf) &p->object.vtbl;
+    stats.playersCreated++;
+    const int alive = ++stats.playersAlive;
+    int max = stats.maxPlayersAlive;
+    while (alive > max && !stats.maxPlayersAlive.compare_exchange_weak(max, alive)) {}
+    return SL_RESULT_SUCCESS;
+}
+
+static const SLEngineItf_ engineVtbl = {
+        createAudioPlayer
+};
+
+/* The engine object */
+struct StubEngine {
+    StubItf<SLObjectItf_, StubEngine> object;
+    StubItf<SLEngineItf_, StubEngine> engine;
+};
+
+static SLresult engineRealize(SLObjectItf, SLboolean) {
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult engineResume(SLObjectItf, SLboolean) {
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult engineGetState(SLObjectItf, SLuint32 *pState) {
+    *pState = SL_OBJECT_STATE_REALIZED;
+    return SL_RESULT_SUCCESS;
+}
+
+static SLresult engineGetInterface(SLObjectItf self, const SLInterfaceID iid, void *pInterface) {
+    StubEngine *e = ownerOf<SLObjectItf_, StubEngine>(self);
+    if (iid == SL_IID_ENGINE) {
+        *(const void **) pInterface = &e->engine.vtbl;
+        return SL_RESULT_SUCCESS;
+    }
+    if (iid == SL_IID_OBJECT) {
+        *(const void **) pInterface = &e->object.vtbl;
+        return SL_RESULT_SUCCESS;
+    }
+    return SL_RESULT_FEATURE_UNSUPPORTED;
+}
+
+static void engineDestroy(SLObjectItf self) {
+    delete ownerOf<SLObjectItf_, StubEngine>(self);
+    stats.enginesAlive--;
+}
+
+static const SLObjectItf_ engineObjectVtbl = {
+        engineRealize, engineResume, engineGetState, engineGetInterface, engineDestroy
+};
+
+SLresult slCreateEngine(SLObjectItf *pEngine, SLuint32, const SLEngineOption *,
+                        SLuint32, const SLInterfaceID *, const SLboolean *) {
+    StubEngine *e = new StubEngine;
+    e->object = {&engineObjectVtbl, e};
+    e->engine = {&engineVtbl, e};
+    *pEngine = (SLObjectItf) &e->object.vtbl;
+    stats.enginesCreated++;
+    stats.enginesAlive++;
+    return SL_RESULT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for OpenSL ES. Audio players decode FLAC sources with the
+ * native decoder on their own thread and hand the PCM out through the
+ * Android simple buffer queue callbacks, just like the platform decoder does.
+ */
+
+#ifndef FLAC2RAW_OPENSL_STUB_H
+#define FLAC2RAW_OPENSL_STUB_H
+
+#include <atomic>
+
+/* Counters of the stub objects, for example to check that engines are reused */
+typedef struct SlStubStats_ {
+    std::atomic<int> enginesCreated;
+    std::atomic<int> enginesAlive;
+    std::atomic<int> playersCreated;
+    std::atomic<int> playersAlive;
+    std::atomic<int> maxPlayersAlive;
+} SlStubStats;
+
+SlStubStats &slStubStats();
+
+/* Sets all counters to zero */
+void slStubResetStats();
+
+/* Whether audio players have the Seek interface, like most platform decoders do */
+void slStubSetSeekSupported(bool supported);
+
+/* Paces the buffer queue callbacks like a platform decoder of speed times real
+ * time, 0 hands out the buffers as fast as they are decoded. Every callback is
+ * additionally delayed by a random time of up to jitterUs. */
+void slStubSetPacing(double speed, unsigned jitterUs);
+
+#endif
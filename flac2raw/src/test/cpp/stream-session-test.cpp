@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the streaming sessions with both backends
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+
+#include "decoder-backend.h"
+#include "opensl-backend.h"
+#include "stream-session.h"
+#include "test-util.h"
+
+static DecodeSource assetSource() {
+    DecodeSource src;
+    src.type = DecodeSource::URI;
+    src.path = FLAC2RAW_TEST_ASSET;
+    return src;
+}
+
+/* reads the whole stream in small pieces, slower than it's decoded */
+static int readAll(StreamSession &session, std::vector<uint8_t> &out) {
+    uint8_t buf[2000];
+    for (int i = 0;; i++) {
+        long r = session.read(buf, sizeof(buf) - 1);
+        if (r < 0) return (int) -r;
+        if (r == 0) return 0;
+        CHECK(r % 2 == 0);
+        out.insert(out.end(), buf, buf + r);
+        if (i % 10 == 0) usleep(1000);
+    }
+}
+
+static void testStream(DecoderBackend &backend, const MemoryPcmSink &reference) {
+    ConvOptions opts;
+    StreamSession session(4096);
+    session.start(backend, assetSource(), opts);
+    /* known before the first read */
+    PcmFormat format;
+    CHECK(session.format(format) == 0);
+    CHECK(format.sampleRate == reference.format.sampleRate);
+    CHECK(format.channels == reference.format.channels);
+    std::vector<uint8_t> out;
+    CHECK(readAll(session, out) == 0);
+    CHECK(session.error() == 0);
+    CHECK(session.startupLatencyUs() >= 0);
+    /* the platform decoder may pad the last buffer */
+    CHECK(out.size() >= reference.data.size());
+    CHECK(out.size() - reference.data.size() < 4096);
+    CHECK(memcmp(&out[0], &reference.data[0],
+                 std::min(out.size(), reference.data.size())) == 0);
+}
+
+static void testClose(DecoderBackend &backend) {
+    ConvOptions opts;
+    StreamSession session(4096);
+    session.start(backend, assetSource(), opts);
+    uint8_t buf[1000];
+    CHECK(session.read(buf, sizeof(buf)) > 0);
+    /* the decoder is blocked on the full buffer and has to give up */
+    session.close();
+    CHECK(session.read(buf, sizeof(buf)) == 0);
+    CHECK(session.error() == 0);
+}
+
+static void testMissing() {
+    NativeFlacBackend native;
+    DecodeSource src;
+    src.path = "does-not-exist.flac";
+    ConvOptions opts;
+    StreamSession session;
+    session.start(native, src, opts);
+    uint8_t buf[100];
+    CHECK(session.read(buf, sizeof(buf)) == -ENOENT);
+    CHECK(session.error() == ENOENT);
+    /* doesn't block without a format */
+    PcmFormat format;
+    CHECK(session.format(format) == ENOENT);
+}
+
+int main() {
+    NativeFlacBackend native;
+    MemoryPcmSink reference;
+    ConvOptions opts;
+    CHECK(native.decode(assetSource(), reference, opts) == 0);
+    if (reference.data.empty()) return testResult();
+    OpenSLBackend openSL;
+    testStream(native, reference);
+    testStream(openSL, reference);
+    testClose(native);
+    testClose(openSL);
+    testMissing();
+    return testResult();
+}
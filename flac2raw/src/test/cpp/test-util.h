@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 Bernd Porr, mail@berndporr.me.uk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Helpers shared by the host tests
+ */
+
+#ifndef FLAC2RAW_TEST_UTIL_H
+#define FLAC2RAW_TEST_UTIL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <mutex>
+
+#include "pcm-sink.h"
+
+static int failures = 0;
+
+#define CHECK(x) do { if (!(x)) { \
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #x); \
+    failures++; } } while (0)
+
+/* Collects the decoded audio in memory */
+class MemoryPcmSink : public PcmSink {
+public:
+    PcmFormat format;
+    std::vector<uint8_t> data;
+    bool ended = false;
+
+    int begin(const PcmFormat &fmt) {
+        format = fmt;
+        return 0;
+    }
+
+    int write(const void *p, size_t nbytes) {
+        data.insert(data.end(), (const uint8_t *) p, (const uint8_t *) p + nbytes);
+        return 0;
+    }
+
+    int end() {
+        ended = true;
+        return 0;
+    }
+};
+
+/* Memory sink which also accepts positional writes from parallel decoding */
+class RandomAccessPcmSink : public MemoryPcmSink {
+public:
+    std::mutex lock;
+
+    int begin(const PcmFormat &fmt) {
+        format = fmt;
+        data.resize(fmt.totalFrames * fmt.channels * (fmt.bitsPerSample / 8));
+        return 0;
+    }
+
+    bool randomAccess() const { return true; }
+
+    int writeAt(uint64_t offset, const void *p, size_t nbytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (offset + nbytes > data.size()) return EINVAL;
+        memcpy(&data[offset], p, nbytes);
+        return 0;
+    }
+};
+
+/* Prints the summary, returns the exit code of the test */
+static int testResult() {
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
+
+#endif